@@ -18,9 +18,12 @@
 
 #include "voip_patrol.hh"
 #include "action.hh"
+#include "mod_voip_patrol.hh"
 #include "util.hh"
 #include "string.h"
 #include <pjsua2/presence.hpp>
+#include <algorithm>
+#include <cmath>
 
 void filter_accountname(std::string *str) {
 	size_t index = 0;
@@ -44,18 +47,40 @@ Action::Action(Config *cfg) : config{cfg} {
 	std::cout<<"Prepared for Action!\n";
 }
 
-vector<ActionParam> Action::get_params(string name) {
-	if (name.compare("call") == 0) return do_call_params;
-	else if (name.compare("register") == 0) return do_register_params;
-	else if (name.compare("wait") == 0) return do_wait_params;
-	else if (name.compare("accept") == 0) return do_accept_params;
-	else if (name.compare("alert") == 0) return do_alert_params;
-	else if (name.compare("codec") == 0) return do_codec_params;
-	else if (name.compare("turn") == 0) return do_turn_params;
-	else if (name.compare("message") == 0) return do_message_params;
-	else if (name.compare("accept_message") == 0) return do_accept_message_params;
-	vector<ActionParam> empty_params;
-	return empty_params;
+ActionType get_action_type_from_string(const string& type) {
+	if (type.compare("call") == 0) return ActionType::call;
+	else if (type.compare("register") == 0) return ActionType::reg;
+	else if (type.compare("wait") == 0) return ActionType::wait;
+	else if (type.compare("accept") == 0) return ActionType::accept;
+	else if (type.compare("alert") == 0) return ActionType::alert;
+	else if (type.compare("codec") == 0) return ActionType::codec;
+	else if (type.compare("turn") == 0) return ActionType::turn;
+	else if (type.compare("message") == 0) return ActionType::message;
+	else if (type.compare("accept_message") == 0) return ActionType::accept_message;
+	else if (type.compare("rewrite") == 0) return ActionType::rewrite;
+	else if (type.compare("replay") == 0) return ActionType::replay;
+	else if (type.compare("capacity") == 0) return ActionType::capacity;
+	else if (type.compare("trace") == 0) return ActionType::trace;
+	return ActionType::none;
+}
+
+const vector<ActionParam>& Action::get_params(ActionType type) const {
+	static const vector<ActionParam> empty_params;
+	switch (type) {
+		case ActionType::call: return do_call_params;
+		case ActionType::reg: return do_register_params;
+		case ActionType::wait: return do_wait_params;
+		case ActionType::accept: return do_accept_params;
+		case ActionType::alert: return do_alert_params;
+		case ActionType::codec: return do_codec_params;
+		case ActionType::turn: return do_turn_params;
+		case ActionType::message: return do_message_params;
+		case ActionType::accept_message: return do_accept_message_params;
+		case ActionType::rewrite: return do_rewrite_params;
+		case ActionType::capacity: return do_capacity_params;
+		case ActionType::trace: return do_trace_params;
+		default: return empty_params;
+	}
 }
 
 string Action::get_env(string env) {
@@ -103,9 +128,9 @@ bool Action::set_param_by_name(vector<ActionParam> *params, const string& name,
 void Action::init_actions_params() {
 	// do_call
 	do_call_params.push_back(ActionParam("caller", true, APType::apt_string));
-	do_call_params.push_back(ActionParam("from", true, APType::apt_string));
+	do_call_params.push_back(ActionParam("from", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("callee", true, APType::apt_string));
-	do_call_params.push_back(ActionParam("to_uri", true, APType::apt_string));
+	do_call_params.push_back(ActionParam("to_uri", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("label", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("username", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("auth_username", false, APType::apt_string));
@@ -120,8 +145,14 @@ void Action::init_actions_params() {
 	do_call_params.push_back(ActionParam("expected_duration", false, APType::apt_integer));
 	do_call_params.push_back(ActionParam("expected_setup_duration", false, APType::apt_integer));
 	do_call_params.push_back(ActionParam("min_mos", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("reference", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("rtp_stats", false, APType::apt_bool));
+	do_call_params.push_back(ActionParam("quality_interval", false, APType::apt_integer));
+	do_call_params.push_back(ActionParam("analyze", false, APType::apt_string));
+	do_call_params.push_back(ActionParam("watermark", false, APType::apt_bool));
+	do_call_params.push_back(ActionParam("latency", false, APType::apt_bool));
 	do_call_params.push_back(ActionParam("late_start", false, APType::apt_bool));
+	do_call_params.push_back(ActionParam("media", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("srtp", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("force_contact", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("hangup", false, APType::apt_integer));
@@ -135,27 +166,70 @@ void Action::init_actions_params() {
 	do_call_params.push_back(ActionParam("proxy", false, APType::apt_string));
 	do_call_params.push_back(ActionParam("disable_turn", false, APType::apt_bool));
 	do_call_params.push_back(ActionParam("contact_uri_params", false, APType::apt_string));
+	do_call_params.push_back(ActionParam("injection_file", false, APType::apt_string));
+	do_call_params.push_back(ActionParam("injection_mode", false, APType::apt_string));
+	do_call_params.push_back(ActionParam("injection_worker", false, APType::apt_integer));
+	do_call_params.push_back(ActionParam("injection_workers", false, APType::apt_integer));
+	do_call_params.push_back(ActionParam("concurrency", false, APType::apt_integer));
+	do_call_params.push_back(ActionParam("concurrency_duration", false, APType::apt_integer));
+	do_call_params.push_back(ActionParam("concurrency_ramp", false, APType::apt_integer));
+	do_call_params.push_back(ActionParam("rate", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("arrival", false, APType::apt_string));
+	do_call_params.push_back(ActionParam("hold", false, APType::apt_string));
+	do_call_params.push_back(ActionParam("hold_mean", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("hold_sigma", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("hold_min", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("hold_max", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("backpressure", false, APType::apt_bool));
+	do_call_params.push_back(ActionParam("rate_min", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("rate_max", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("rate_increase", false, APType::apt_float));
+	do_call_params.push_back(ActionParam("rate_decrease", false, APType::apt_float));
+	// do_capacity, the probe calls take the call parameters
+	do_capacity_params = do_call_params;
+	do_capacity_params.push_back(ActionParam("mode", false, APType::apt_string, "cps"));
+	do_capacity_params.push_back(ActionParam("min", false, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("max", true, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("step_duration", false, APType::apt_integer));
+	do_capacity_params.push_back(ActionParam("drain", false, APType::apt_integer));
+	do_capacity_params.push_back(ActionParam("resolution", false, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("slo_asr", false, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("slo_5xx", false, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("slo_503", false, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("slo_retransmissions", false, APType::apt_float));
+	do_capacity_params.push_back(ActionParam("slo_pdd_p99", false, APType::apt_integer));
+	do_capacity_params.push_back(ActionParam("slo_mos", false, APType::apt_float));
+	// do_trace, the caller, callee and duration of every call come from the trace
+	do_trace_params = do_call_params;
+	for (auto &param : do_trace_params) {
+		if (param.name.compare("caller") == 0 || param.name.compare("callee") == 0) {
+			param.required = false;
+		}
+	}
+	do_trace_params.push_back(ActionParam("file", true, APType::apt_string));
+	do_trace_params.push_back(ActionParam("time_scale", false, APType::apt_float));
+	do_trace_params.push_back(ActionParam("volume", false, APType::apt_float));
 	// do_register
 	do_register_params.push_back(ActionParam("transport", false, APType::apt_string));
 	do_register_params.push_back(ActionParam("label", false, APType::apt_string));
-	do_register_params.push_back(ActionParam("registrar", false, APType::apt_string));
+	do_register_params.push_back(ActionParam("registrar", true, APType::apt_string));
 	do_register_params.push_back(ActionParam("proxy", false, APType::apt_string));
 	do_register_params.push_back(ActionParam("realm", false, APType::apt_string));
-	do_register_params.push_back(ActionParam("username", false, APType::apt_string));
+	do_register_params.push_back(ActionParam("username", true, APType::apt_string));
 	do_register_params.push_back(ActionParam("auth_username", false, APType::apt_string));
 	do_register_params.push_back(ActionParam("account", false, APType::apt_string));
 	do_register_params.push_back(ActionParam("aor", false, APType::apt_string));
-	do_register_params.push_back(ActionParam("password", false, APType::apt_string));
+	do_register_params.push_back(ActionParam("password", true, APType::apt_string));
 	do_register_params.push_back(ActionParam("unregister", false, APType::apt_bool));
 	do_register_params.push_back(ActionParam("expected_cause_code", false, APType::apt_integer));
 	do_register_params.push_back(ActionParam("reg_id", false, APType::apt_string));
 	do_register_params.push_back(ActionParam("instance_id", false, APType::apt_string));
 	do_register_params.push_back(ActionParam("srtp", false, APType::apt_string));
-	do_register_params.push_back(ActionParam("rewrite_contact", true, APType::apt_bool));
+	do_register_params.push_back(ActionParam("rewrite_contact", false, APType::apt_bool));
 	do_register_params.push_back(ActionParam("disable_turn", false, APType::apt_bool));
 	do_register_params.push_back(ActionParam("contact_uri_params", false, APType::apt_string));
 	// do_accept
-	do_accept_params.push_back(ActionParam("match_account", false, APType::apt_string));
+	do_accept_params.push_back(ActionParam("match_account", true, APType::apt_string));
 	do_accept_params.push_back(ActionParam("transport", false, APType::apt_string));
 	do_accept_params.push_back(ActionParam("label", false, APType::apt_string));
 	do_accept_params.push_back(ActionParam("cancel", false, APType::apt_string));
@@ -170,7 +244,12 @@ void Action::init_actions_params() {
 	do_accept_params.push_back(ActionParam("re_invite_interval", false, APType::apt_integer));
 	//do_accept_params.push_back(ActionParam("min_mos", false, APType::apt_float));
 	do_accept_params.push_back(ActionParam("rtp_stats", false, APType::apt_bool));
+	do_accept_params.push_back(ActionParam("quality_interval", false, APType::apt_integer));
+	do_accept_params.push_back(ActionParam("analyze", false, APType::apt_string));
+	do_accept_params.push_back(ActionParam("watermark", false, APType::apt_bool));
+	do_accept_params.push_back(ActionParam("latency", false, APType::apt_bool));
 	do_accept_params.push_back(ActionParam("late_start", false, APType::apt_bool));
+	do_accept_params.push_back(ActionParam("media", false, APType::apt_string));
 	do_accept_params.push_back(ActionParam("srtp", false, APType::apt_string));
 	do_accept_params.push_back(ActionParam("force_contact", false, APType::apt_string));
 	do_accept_params.push_back(ActionParam("play", false, APType::apt_string));
@@ -210,16 +289,22 @@ void Action::init_actions_params() {
 	do_message_params.push_back(ActionParam("from", true, APType::apt_string));
 	do_message_params.push_back(ActionParam("to_uri", true, APType::apt_string));
 	do_message_params.push_back(ActionParam("text", true, APType::apt_string));
-	do_message_params.push_back(ActionParam("username", true, APType::apt_string));
-	do_message_params.push_back(ActionParam("password", true, APType::apt_string));
+	do_message_params.push_back(ActionParam("username", false, APType::apt_string));
+	do_message_params.push_back(ActionParam("password", false, APType::apt_string));
 	do_message_params.push_back(ActionParam("realm", false, APType::apt_string));
-	do_message_params.push_back(ActionParam("label", true, APType::apt_string));
+	do_message_params.push_back(ActionParam("label", false, APType::apt_string));
 	do_message_params.push_back(ActionParam("expected_cause_code", false, APType::apt_integer));
 	// do_accept_message
-	do_accept_message_params.push_back(ActionParam("account", false, APType::apt_string));
+	do_accept_message_params.push_back(ActionParam("account", true, APType::apt_string));
 	do_accept_message_params.push_back(ActionParam("transport", false, APType::apt_string));
 	do_accept_message_params.push_back(ActionParam("label", false, APType::apt_string));
 	do_accept_message_params.push_back(ActionParam("message_count", false, APType::apt_integer));
+	// do_rewrite
+	do_rewrite_params.push_back(ActionParam("method", false, APType::apt_string));
+	do_rewrite_params.push_back(ActionParam("code", false, APType::apt_integer));
+	do_rewrite_params.push_back(ActionParam("header", false, APType::apt_string));
+	do_rewrite_params.push_back(ActionParam("match", true, APType::apt_string));
+	do_rewrite_params.push_back(ActionParam("replace", false, APType::apt_string));
 }
 
 void setTurnConfigAccount(AccountConfig &acc_cfg, Config *cfg, bool disable_turn) {
@@ -376,6 +461,7 @@ void Action::do_register(const vector<ActionParam> &params, const vector<ActionC
 	// This should be just internal identifier for program
 	account_full_name = account_name + "@" + registrar;
 
+	std::unique_lock<std::mutex> setup(config->setup_lock);
 	TestAccount *acc = config->findAccount(account_full_name);
 
 	if (unregister) {
@@ -395,6 +481,7 @@ void Action::do_register(const vector<ActionParam> &params, const vector<ActionC
 			} else {
 				LOG(logINFO) << __FUNCTION__ << " register is not active";
 			}
+			setup.unlock();
 			int max_wait_ms = 2000;
 			while (acc->unregistering && max_wait_ms >= 0) {
 				pj_thread_sleep(10);
@@ -499,6 +586,15 @@ void Action::do_register(const vector<ActionParam> &params, const vector<ActionC
 	acc_cfg.sipConfig.authCreds.push_back(AuthCredInfo("digest", realm, auth_username, 0, password));
 	acc_cfg.natConfig.contactRewriteUse = rewrite_contact;
 
+	test->source = config->source_pool.select(account_full_name);
+	pjsua_transport_id source_tp = config->source_pool.transport_id(test->source, transport);
+	if (source_tp != -1) {
+		acc_cfg.sipConfig.transportId = source_tp;
+		config->source_pool.count(test->source, true);
+	} else {
+		test->source = -1;
+	}
+
 	acc_cfg.sipConfig.contactUriParams = ";vp_acc=" + account_name;
 	if (!contact_params.empty()) {
 		acc_cfg.sipConfig.contactUriParams += ";" + contact_params;
@@ -551,9 +647,14 @@ void Action::do_accept(const vector<ActionParam> &params, const vector<ActionChe
 	int expected_duration {0};
 	int expected_setup_duration {0};
 	int re_invite_interval {0};
+	int quality_interval {0};
+	string analyze;
+	bool watermark {false};
+	bool latency {false};
 	call_state_t wait_until {INV_STATE_NULL};
 	bool rtp_stats {false};
 	bool late_start {false};
+	bool no_media {false};
 	bool fail_on_accept {false};
 	bool disable_turn {false};
 	string srtp {"none"};
@@ -587,9 +688,14 @@ void Action::do_accept(const vector<ActionParam> &params, const vector<ActionChe
 		else if (param.name.compare("disable_turn") == 0) disable_turn = param.b_val;
 		//else if (param.name.compare("min_mos") == 0) min_mos = param.f_val;
 		else if (param.name.compare("rtp_stats") == 0) rtp_stats = param.b_val;
+		else if (param.name.compare("quality_interval") == 0) quality_interval = param.i_val;
+		else if (param.name.compare("analyze") == 0) analyze = param.s_val;
+		else if (param.name.compare("watermark") == 0) watermark = param.b_val;
+		else if (param.name.compare("latency") == 0) latency = param.b_val;
 		else if (param.name.compare("srtp") == 0 && param.s_val.length() > 0) srtp = param.s_val;
 		else if (param.name.compare("force_contact") == 0) force_contact = param.s_val;
 		else if (param.name.compare("late_start") == 0) late_start = param.b_val;
+		else if (param.name.compare("media") == 0) no_media = (param.s_val.compare("none") == 0 || param.s_val.compare("nosdp") == 0);
 		else if (param.name.compare("wait_until") == 0) wait_until = get_call_state_from_string(param.s_val);
 		else if (param.name.compare("hangup") == 0) hangup_duration = param.i_val;
 		else if (param.name.compare("cancel") == 0) cancel_behavoir = param.s_val;
@@ -608,6 +714,8 @@ void Action::do_accept(const vector<ActionParam> &params, const vector<ActionChe
 
 	vp::tolower(transport);
 
+	// <parallel> streams can configure the same account at the same time
+	std::lock_guard<std::mutex> setup(config->setup_lock);
 	TestAccount *acc = config->findAccount(account_name);
 	if (!acc || !force_contact.empty()) {
 		AccountConfig acc_cfg;
@@ -700,7 +808,12 @@ void Action::do_accept(const vector<ActionParam> &params, const vector<ActionChe
 	acc->ring_duration = ring_duration;
 	acc->accept_label = label;
 	acc->rtp_stats = rtp_stats;
+	acc->quality_interval = quality_interval;
+	acc->analyze = analyze;
+	acc->watermark = watermark;
+	acc->latency = latency;
 	acc->late_start = late_start;
+	acc->no_media = no_media;
 	acc->play = play;
 	acc->recording = recording;
 	acc->record_early = record_early;
@@ -725,93 +838,124 @@ void Action::do_accept(const vector<ActionParam> &params, const vector<ActionChe
 }
 
 
-void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck> &checks, const SipHeaderVector &x_headers) {
-	string type {"call"};
-	string play {default_playback_file};
-	string play_dtmf {};
-	string timer {};
-	string caller {};
-	string from {};
-	string callee {};
-	string to_uri {};
-	string transport {"udp"};
-	string username {};
-	string auth_username {};
-	string password {};
-	string realm {"*"};
-	string label {};
-	string proxy {};
-	string srtp {"none"};
-	int expected_cause_code {200};
-	call_state_t wait_until {INV_STATE_NULL};
-	float min_mos {0.0};
-	int max_duration {0};
-	int max_ring_duration {60};
-	int expected_duration {0};
-	int expected_setup_duration {0};
-	int hangup_duration {0};
-	int early_cancel {0};
-	int re_invite_interval {0};
-	int repeat {0};
-	string recording {};
-	bool record_early {false};
-	bool rtp_stats {false};
-	bool late_start {false};
-	bool disable_turn {false};
-	string force_contact {};
+CallAction Action::get_call_action(const vector<ActionParam> &params) const {
+	CallAction c;
+	c.play = default_playback_file;
+
+	for (auto &param : params) {
+		if (param.name.compare("callee") == 0) c.callee = param.s_val;
+		else if (param.name.compare("caller") == 0) c.caller = param.s_val;
+		else if (param.name.compare("from") == 0) c.from = param.s_val;
+		else if (param.name.compare("to_uri") == 0) c.to_uri = param.s_val;
+		else if (param.name.compare("transport") == 0) c.transport = param.s_val;
+		else if (param.name.compare("play") == 0 && param.s_val.length() > 0) c.play = param.s_val;
+		else if (param.name.compare("record") == 0) c.recording = param.s_val;
+		else if (param.name.compare("record_early") == 0) c.record_early = param.b_val;
+		else if (param.name.compare("play_dtmf") == 0 && param.s_val.length() > 0) c.play_dtmf = param.s_val;
+		else if (param.name.compare("timer") == 0 && param.s_val.length() > 0) c.timer = param.s_val;
+		else if (param.name.compare("username") == 0) c.username = param.s_val;
+		else if (param.name.compare("auth_username") == 0) c.auth_username = param.s_val;
+		else if (param.name.compare("password") == 0) c.password = param.s_val;
+		else if (param.name.compare("realm") == 0 && param.s_val != "") c.realm = param.s_val;
+		else if (param.name.compare("label") == 0) c.label = param.s_val;
+		else if (param.name.compare("proxy") == 0) c.proxy = param.s_val;
+		else if (param.name.compare("expected_cause_code") == 0) c.expected_cause_code = param.i_val;
+		else if (param.name.compare("wait_until") == 0) c.wait_until = get_call_state_from_string(param.s_val);
+		else if (param.name.compare("min_mos") == 0) c.min_mos = param.f_val;
+		else if (param.name.compare("reference") == 0) c.reference = param.s_val;
+		else if (param.name.compare("rtp_stats") == 0) c.rtp_stats = param.b_val;
+		else if (param.name.compare("quality_interval") == 0) c.quality_interval = param.i_val;
+		else if (param.name.compare("analyze") == 0) c.analyze = param.s_val;
+		else if (param.name.compare("watermark") == 0) c.watermark = param.b_val;
+		else if (param.name.compare("latency") == 0) c.latency = param.b_val;
+		else if (param.name.compare("late_start") == 0) c.late_start = param.b_val;
+		else if (param.name.compare("media") == 0 && param.s_val.length() > 0) c.media = param.s_val;
+		else if (param.name.compare("disable_turn") == 0) c.disable_turn = param.b_val;
+		else if (param.name.compare("srtp") == 0 && param.s_val.length() > 0) c.srtp = param.s_val;
+		else if (param.name.compare("force_contact") == 0) c.force_contact = param.s_val;
+		else if (param.name.compare("max_duration") == 0) c.max_duration = param.i_val;
+		else if (param.name.compare("max_ring_duration") == 0 && param.i_val != 0) c.max_ring_duration = param.i_val;
+		else if (param.name.compare("expected_duration") == 0) c.expected_duration = param.i_val;
+		else if (param.name.compare("expected_setup_duration") == 0) c.expected_setup_duration = param.i_val;
+		else if (param.name.compare("hangup") == 0) c.hangup_duration = param.i_val;
+		else if (param.name.compare("re_invite_interval") == 0) c.re_invite_interval = param.i_val;
+		else if (param.name.compare("early_cancel") == 0) c.early_cancel = param.i_val;
+		else if (param.name.compare("repeat") == 0) c.repeat = param.i_val;
+		else if (param.name.compare("injection_file") == 0) c.injection_file = param.s_val;
+		else if (param.name.compare("injection_mode") == 0) c.injection_mode = param.s_val;
+		else if (param.name.compare("injection_worker") == 0) c.injection_worker = param.i_val;
+		else if (param.name.compare("injection_workers") == 0 && param.i_val > 0) c.injection_workers = param.i_val;
+		else if (param.name.compare("concurrency") == 0) c.concurrency = param.i_val;
+		else if (param.name.compare("concurrency_duration") == 0) c.concurrency_duration = param.i_val;
+		else if (param.name.compare("concurrency_ramp") == 0) c.concurrency_ramp = param.i_val;
+		else if (param.name.compare("rate") == 0) c.rate = param.f_val;
+		else if (param.name.compare("arrival") == 0) c.poisson = (param.s_val.compare("poisson") == 0);
+		else if (param.name.compare("hold") == 0) c.hold.type = get_distribution_from_string(param.s_val);
+		else if (param.name.compare("hold_mean") == 0) c.hold.mean = param.f_val;
+		else if (param.name.compare("hold_sigma") == 0 && param.f_val > 0) c.hold.sigma = param.f_val;
+		else if (param.name.compare("hold_min") == 0) c.hold.min = param.f_val;
+		else if (param.name.compare("hold_max") == 0) c.hold.max = param.f_val;
+		else if (param.name.compare("backpressure") == 0) c.backpressure = param.b_val;
+		else if (param.name.compare("rate_min") == 0) c.rate_min = param.f_val;
+		else if (param.name.compare("rate_max") == 0) c.rate_max = param.f_val;
+		else if (param.name.compare("rate_increase") == 0 && param.f_val > 0) c.rate_increase = param.f_val;
+		else if (param.name.compare("rate_decrease") == 0 && param.f_val > 0 && param.f_val < 1) c.rate_decrease = param.f_val;
+	}
+	vp::tolower(c.transport);
+	return c;
+}
 
-	for (auto param : params) {
-		if (param.name.compare("callee") == 0) callee = param.s_val;
-		else if (param.name.compare("caller") == 0) caller = param.s_val;
-		else if (param.name.compare("from") == 0) from = param.s_val;
-		else if (param.name.compare("to_uri") == 0) to_uri = param.s_val;
-		else if (param.name.compare("transport") == 0) transport = param.s_val;
-		else if (param.name.compare("play") == 0 && param.s_val.length() > 0) play = param.s_val;
-		else if (param.name.compare("record") == 0) recording = param.s_val;
-		else if (param.name.compare("record_early") == 0) record_early = param.b_val;
-		else if (param.name.compare("play_dtmf") == 0 && param.s_val.length() > 0) play_dtmf = param.s_val;
-		else if (param.name.compare("timer") == 0 && param.s_val.length() > 0) timer = param.s_val;
-		else if (param.name.compare("username") == 0) username = param.s_val;
-		else if (param.name.compare("auth_username") == 0) auth_username = param.s_val;
-		else if (param.name.compare("password") == 0) password = param.s_val;
-		else if (param.name.compare("realm") == 0 && param.s_val != "") realm = param.s_val;
-		else if (param.name.compare("label") == 0) label = param.s_val;
-		else if (param.name.compare("proxy") == 0) proxy = param.s_val;
-		else if (param.name.compare("expected_cause_code") == 0) expected_cause_code = param.i_val;
-		else if (param.name.compare("wait_until") == 0) wait_until = get_call_state_from_string(param.s_val);
-		else if (param.name.compare("min_mos") == 0) min_mos = param.f_val;
-		else if (param.name.compare("rtp_stats") == 0) rtp_stats = param.b_val;
-		else if (param.name.compare("late_start") == 0) late_start = param.b_val;
-		else if (param.name.compare("disable_turn") == 0) disable_turn = param.b_val;
-		else if (param.name.compare("srtp") == 0 && param.s_val.length() > 0) srtp = param.s_val;
-		else if (param.name.compare("force_contact") == 0) force_contact = param.s_val;
-		else if (param.name.compare("max_duration") == 0) max_duration = param.i_val;
-		else if (param.name.compare("max_ring_duration") == 0 && param.i_val != 0) max_ring_duration = param.i_val;
-		else if (param.name.compare("expected_duration") == 0) expected_duration = param.i_val;
-		else if (param.name.compare("expected_setup_duration") == 0) expected_setup_duration = param.i_val;
-		else if (param.name.compare("hangup") == 0) hangup_duration = param.i_val;
-		else if (param.name.compare("re_invite_interval") == 0) re_invite_interval = param.i_val;
-		else if (param.name.compare("early_cancel") == 0) early_cancel = param.i_val;
-		else if (param.name.compare("repeat") == 0) repeat = param.i_val;
+bool Action::do_call(const CallAction &action, const vector<ActionCheck> &checks, const SipHeaderVector &x_headers,
+                     std::shared_ptr<CallGroup> group) {
+	string type {"call"};
+	const string &play = action.play;
+	const string &play_dtmf = action.play_dtmf;
+	const string &timer = action.timer;
+	const string &caller = action.caller;
+	string from = action.from;
+	const string &callee = action.callee;
+	string to_uri = action.to_uri;
+	const string &transport = action.transport;
+	const string &username = action.username;
+	string auth_username = action.auth_username;
+	const string &password = action.password;
+	const string &realm = action.realm;
+	const string &label = action.label;
+	const string &proxy = action.proxy;
+	const string &srtp = action.srtp;
+	const string &recording = action.recording;
+	const string &force_contact = action.force_contact;
+	call_state_t wait_until = (call_state_t)action.wait_until;
+	int repeat = action.repeat;
+
+	if (!action.injection_file.empty()) {
+		InjectionFile *injection = config->getInjectionFile(action.injection_file);
+		if (!injection) {
+			LOG(logERROR) << __FUNCTION__ << ": can not load injection file: " << action.injection_file;
+			config->total_tasks_count += 100;
+			return false;
+		}
+		do_call_injection(action, checks, x_headers, injection, group);
+		return true;
 	}
 
 	if (caller.empty() || callee.empty()) {
 		LOG(logERROR) << __FUNCTION__ << ": missing action parameters <callee>/<caller>" ;
 
 		config->total_tasks_count += 100;
-		return;
+		return false;
 	}
-	vp::tolower(transport);
 
 	string account_uri {caller};
 	if (transport != "udp") {
 		account_uri = caller + ";transport=" + transport;
 	}
-	TestAccount* acc = config->findAccount(account_uri);
+	std::unique_lock<std::mutex> setup(config->setup_lock);
+	TestAccount* acc = config->findCallerAccount(account_uri);
+	AccountConfig acc_cfg;
 	if (!acc) {
-		AccountConfig acc_cfg;
 
-		setTurnConfigAccount(acc_cfg, config, disable_turn);
+		setTurnConfigAccount(acc_cfg, config, action.disable_turn);
 
 		if (force_contact != "") {
 			LOG(logINFO) << __FUNCTION__ << ":do_call:force_contact:" << force_contact << "\n";
@@ -845,7 +989,7 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			if (config->transport_id_tls == -1) {
 				LOG(logERROR) << __FUNCTION__ << ": TLS transport not supported" ;
 
-				return;
+				return false;
 			}
 			acc_cfg.idUri = "sip:" + account_uri;
 
@@ -860,7 +1004,7 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			if (config->transport_id_tls == -1) {
 				LOG(logERROR) << __FUNCTION__ << ": sips(TLS) transport not supported" ;
 
-				return;
+				return false;
 			}
 			acc_cfg.idUri = "sips:" + account_uri;
 
@@ -901,7 +1045,7 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			if (password.empty()) {
 				LOG(logERROR) << __FUNCTION__ << ": realm specified missing password";
 
-				return;
+				return false;
 			}
 			if (auth_username.empty()) {
 				auth_username = username;
@@ -928,10 +1072,20 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			LOG(logINFO) << __FUNCTION__ << " Forcing encryption";
 		}
 
-		acc = config->createAccount(acc_cfg);
+		if (config->source_pool.empty()) {
+			acc = config->createAccount(acc_cfg);
+			config->accounts_lock.lock();
+			config->caller_accounts[account_uri] = acc;
+			config->accounts_lock.unlock();
+		}
 
 		LOG(logINFO) << __FUNCTION__ << ": session timer["<<timer<<"] :"<< acc_cfg.callConfig.timerUse << " TURN: "<< acc_cfg.natConfig.turnEnabled;
 	}
+	setup.unlock();
+
+	if (action.backpressure && repeat > 0) {
+		group = rate_control_group(action, group);
+	}
 
 	do {
 		Test *test = new Test(config, type);
@@ -942,24 +1096,38 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			test->state = VPT_RUN_WAIT;
 		}
 
-		test->expected_duration = expected_duration;
-		test->expected_setup_duration = expected_setup_duration;
+		test->expected_duration = action.expected_duration;
+		test->expected_setup_duration = action.expected_setup_duration;
 		test->label = label;
 		test->play = play;
 		test->play_dtmf = play_dtmf;
-		test->min_mos = min_mos;
-		test->max_duration = max_duration;
-		test->max_ring_duration = max_ring_duration;
-		test->hangup_duration = hangup_duration;
-		test->re_invite_interval = re_invite_interval;
-		test->re_invite_next = re_invite_interval;
+		test->min_mos = action.min_mos;
+		test->reference = action.reference;
+		test->max_duration = action.max_duration;
+		test->max_ring_duration = action.max_ring_duration;
+		test->hangup_duration = action.hangup_duration;
+		if (action.hold.type != DIST_FIXED) {
+			// the hangup is checked every second
+			test->hangup_duration = std::max(1, (int)std::lround(TrafficRandom::current(config->random).sample(action.hold)));
+			config->traffic_summary.add((label.empty() ? "call" : label) + "/hold", get_distribution_string(action.hold.type),
+			                            test->hangup_duration);
+		}
+		test->re_invite_interval = action.re_invite_interval;
+		test->re_invite_next = action.re_invite_interval;
 		test->recording = recording;
-		test->record_early = record_early;
-		test->rtp_stats = rtp_stats;
-		test->late_start = late_start;
+		test->record_early = action.record_early;
+		test->rtp_stats = action.rtp_stats;
+		test->quality_interval = action.quality_interval;
+		test->quality_next = action.quality_interval;
+		test->analyze = action.analyze;
+		test->late_start = action.late_start;
+		if (action.media.compare("none") == 0 || action.media.compare("nosdp") == 0) {
+			test->disable_media();
+			test->late_start = action.late_start || action.media.compare("nosdp") == 0;
+		}
 		test->force_contact = force_contact;
 		test->srtp = srtp;
-		test->early_cancel = early_cancel;
+		test->early_cancel = action.early_cancel;
 		std::size_t pos = caller.find("@");
 
 		if (pos!=std::string::npos) {
@@ -972,22 +1140,59 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			test->remote_user = callee.substr(0, pos);
 		}
 
-		TestCall *call = new TestCall(acc);
+		// with source addresses every source has its own account, the transport of the dialog is the one of its account
+		TestAccount *call_acc = acc;
+		test->source = -1;
+		if (!acc) {
+			test->source = config->source_pool.select(caller);
+			call_acc = source_account(account_uri, acc_cfg, &test->source, transport);
+		}
+
+		TestCall *call = new TestCall(call_acc);
+		config->checking_calls.lock();
 		config->calls.push_back(call);
+		config->checking_calls.unlock();
 
 		call->test = test;
-		test->expected_cause_code = expected_cause_code;
+		if (group) {
+			// before the INVITE, the call can end in another thread
+			group->started();
+			test->group = group;
+		}
+		test->expected_cause_code = action.expected_cause_code;
 		test->from = caller;
 		test->to = callee;
 		test->type = type;
-		acc->calls.push_back(call);
+		// also updated by the incoming calls of the SIP worker threads
+		config->new_calls_lock.lock();
+		call_acc->calls.push_back(call);
+		config->new_calls_lock.unlock();
 		CallOpParam prm(true);
 
 		for (auto x_hdr : x_headers) {
 			prm.txOption.headers.push_back(x_hdr);
 		}
+		if (action.watermark && !test->no_media) {
+			// the peer tags its audio with the same id
+			test->watermark = true;
+			test->watermark_id = config->watermark_next++ % 0xffff + 1;
+			SipHeader wm_hdr;
+			wm_hdr.hName = WATERMARK_HEADER;
+			wm_hdr.hValue = std::to_string(test->watermark_id);
+			prm.txOption.headers.push_back(wm_hdr);
+		}
+		if (action.latency && !test->no_media) {
+			// an accept of this process reflecting the markers shares their times
+			test->latency = true;
+			test->latency_key = config->latency_marks.new_key();
+			test->latency_marks = config->latency_marks.create(test->latency_key);
+			SipHeader lat_hdr;
+			lat_hdr.hName = LATENCY_HEADER;
+			lat_hdr.hValue = test->latency_key;
+			prm.txOption.headers.push_back(lat_hdr);
+		}
 
-		prm.opt.audioCount = 1;
+		prm.opt.audioCount = test->no_media ? 0 : 1;
 		prm.opt.videoCount = 0;
 
 		LOG(logINFO) << "call->test:" << test << " " << call->test->type;
@@ -1032,8 +1237,242 @@ void Action::do_call(const vector<ActionParam> &params, const vector<ActionCheck
 			}
 		}
 		pj_gettimeofday(&test->sip_latency.inviteSentTs);
+		if (call->getId() == PJSUA_INVALID_ID && !test->latency_key.empty()) {
+			// no media will end the taps of the call
+			config->latency_marks.remove(test->latency_key);
+			test->latency_key.clear();
+		}
+		if (group && call->getId() == PJSUA_INVALID_ID) {
+			// no INVITE was sent, the call will not be disconnected
+			group->completed(0, 0, 0.0, 0);
+			group->ended();
+			test->group.reset();
+		}
+		repeat -= 1;
+		if (repeat >= 0) {
+			pace_arrival(action, group ? group->controller.get() : nullptr);
+		}
+	} while (repeat >= 0);
+	if (action.backpressure && action.repeat > 0) {
+		rate_control_report(action, group);
+	}
+	return true;
+}
+
+// the account of a caller bound to a source address, created once, the calls in progress never see its transport change
+TestAccount* Action::source_account(const string &account_uri, const AccountConfig &acc_cfg, int *source, const string &transport) {
+	pjsua_transport_id source_tp = config->source_pool.transport_id(*source, transport);
+	string key = account_uri;
+	if (source_tp != -1) {
+		key += " " + config->source_pool.name(*source);
+	} else {
+		*source = -1;
+	}
+	// parallel streams can use the same caller, the lock is not taken by the pjsua callbacks
+	std::lock_guard<std::mutex> setup(config->setup_lock);
+	config->accounts_lock.lock();
+	auto it = config->caller_accounts.find(key);
+	TestAccount *acc = it != config->caller_accounts.end() ? it->second : nullptr;
+	config->accounts_lock.unlock();
+	if (!acc) {
+		AccountConfig source_cfg = acc_cfg;
+		if (source_tp != -1) {
+			source_cfg.sipConfig.transportId = source_tp;
+		}
+		acc = config->createAccount(source_cfg);
+		config->accounts_lock.lock();
+		config->caller_accounts[key] = acc;
+		config->accounts_lock.unlock();
+		LOG(logINFO) << __FUNCTION__ << ": " << key << " transport:" << source_tp;
+	}
+	if (source_tp != -1) {
+		config->source_pool.count(*source, false);
+	}
+	return acc;
+}
+
+// the calls of the action give the outcome of their INVITE to the controller through their group
+std::shared_ptr<CallGroup> Action::rate_control_group(const CallAction &action, std::shared_ptr<CallGroup> group) {
+	if (action.rate <= 0) {
+		return group;
+	}
+	if (!group) {
+		group = std::make_shared<CallGroup>();
+	}
+	if (!group->controller) {
+		float rate_min = action.rate_min > 0 ? action.rate_min : action.rate / 10;
+		float rate_max = action.rate_max > 0 ? action.rate_max : action.rate;
+		group->controller = std::make_shared<RateController>(std::min(action.rate, rate_max), rate_min, rate_max,
+		                                                     action.rate_increase, action.rate_decrease);
+		LOG(logINFO) << __FUNCTION__ << ": rate:" << action.rate << " min:" << rate_min << " max:" << rate_max
+		             << " increase:" << action.rate_increase << " decrease:" << action.rate_decrease;
+	}
+	return group;
+}
+
+void Action::rate_control_report(const CallAction &action, const std::shared_ptr<CallGroup> &group) {
+	if (!group || !group->controller) {
+		return;
+	}
+	std::string res = "{\"backpressure\": {\"label\": \"" + action.label + "\", \"controller\": " + group->controller->json() + "}}";
+	LOG(logINFO) << __FUNCTION__ << ": " << res;
+	config->result_file.write(res);
+	config->result_file.flush();
+}
+
+void Action::pace_arrival(const CallAction &action, RateController *controller) {
+	if (action.rate <= 0) {
+		return;
+	}
+	std::string label = action.label.empty() ? "call" : action.label;
+	float rate = action.rate;
+	if (controller) {
+		rate = controller->rate();
+		config->traffic_summary.add(label + "/rate", "aimd", rate);
+	}
+	double interval = TrafficRandom::current(config->random).interval(rate, action.poisson);
+	config->traffic_summary.add(label + "/interarrival", action.poisson ? "poisson" : "fixed", interval);
+
+	// arrivals follow a schedule, the wait loop granularity is 10ms so shorter intervals add up
+	pj_time_val now;
+	pj_gettimeofday(&now);
+	double now_ms = PJ_TIME_VAL_MSEC(now);
+	if (pace_next_ms < now_ms - 1000) {
+		pace_next_ms = now_ms;
+	}
+	if (controller && controller->pause_ms() > 0) {
+		// Retry-After, no new call before it expires
+		pace_next_ms = std::max(pace_next_ms, now_ms + controller->pause_ms());
+	}
+	pace_next_ms += interval * 1000;
+	int wait_ms = pace_next_ms - now_ms;
+	if (wait_ms < 10) {
+		return;
+	}
+	// calls progress while waiting for the next arrival
+	vector<ActionParam> wait_params = get_params(ActionType::wait);
+	set_param_by_name(&wait_params, "ms", std::to_string(wait_ms).c_str());
+	do_wait(wait_params);
+}
+
+void Action::do_call_concurrency(const CallAction &action, const vector<ActionCheck> &checks, const SipHeaderVector &x_headers,
+                                 std::shared_ptr<CallGroup> group) {
+	// every call counts as active from its INVITE to its disconnection
+	if (!group) {
+		group = std::make_shared<CallGroup>();
+	}
+	CallAction call_action = action;
+	call_action.repeat = 0;
+	call_action.concurrency = 0;
+	int duration_ms = action.concurrency_duration * 1000;
+	int ramp_ms = action.concurrency_ramp * 1000;
+	int launched = 0;
+	int peak = 0;
+	long long active_sum = 0;
+	int samples = 0;
+
+	if (duration_ms <= 0) {
+		LOG(logERROR) << __FUNCTION__ << ": missing action parameter <concurrency_duration>";
+		config->total_tasks_count += 100;
+		return;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": target:" << action.concurrency << " duration:" << action.concurrency_duration
+	             << "s ramp:" << action.concurrency_ramp << "s";
+
+	// calls progress between two checks of the target
+	vector<ActionParam> wait_params = get_params(ActionType::wait);
+	set_param_by_name(&wait_params, "ms", "100");
+
+	pj_time_val start, now;
+	pj_gettimeofday(&start);
+	int elapsed_ms = 0;
+	while (elapsed_ms < duration_ms) {
+		int target = action.concurrency;
+		if (ramp_ms > 0 && elapsed_ms < ramp_ms) {
+			target = std::max(1, (int)((long long)action.concurrency * elapsed_ms / ramp_ms));
+		}
+		int active = group->active();
+		for (; active < target; active++) {
+			config->total_tasks_count += 1;
+			if (!do_call(call_action, checks, x_headers, group)) {
+				// the action can not make a call, topping up would only repeat the error
+				break;
+			}
+			launched++;
+		}
+		if (active < target) {
+			break;
+		}
+		active = group->active();
+		peak = std::max(peak, active);
+		active_sum += active;
+		samples++;
+
+		do_wait(wait_params);
+		pj_gettimeofday(&now);
+		PJ_TIME_VAL_SUB(now, start);
+		elapsed_ms = PJ_TIME_VAL_MSEC(now);
+	}
+	LOG(logINFO) << __FUNCTION__ << ": target:" << action.concurrency << " calls:" << launched << " peak:" << peak
+	             << " average:" << (samples ? active_sum / samples : 0) << " still active:" << group->active();
+}
+
+void Action::do_call_injection(const CallAction &action, const vector<ActionCheck> &checks, const SipHeaderVector &x_headers,
+                               InjectionFile *injection, std::shared_ptr<CallGroup> group) {
+	static string CallAction::* const string_fields[] = {
+		&CallAction::play, &CallAction::play_dtmf, &CallAction::timer, &CallAction::caller, &CallAction::from,
+		&CallAction::callee, &CallAction::to_uri, &CallAction::transport, &CallAction::username, &CallAction::auth_username,
+		&CallAction::password, &CallAction::realm, &CallAction::label, &CallAction::proxy, &CallAction::srtp,
+		&CallAction::recording, &CallAction::force_contact
+	};
+	// Split the values referencing injection fields once, every iteration only renders the selected row.
+	vector<pair<string CallAction::*, InjectionTemplate>> field_templates;
+	vector<pair<size_t, InjectionTemplate>> header_templates;
+
+	for (auto field : string_fields) {
+		if (InjectionTemplate::has_fields(action.*field)) {
+			field_templates.push_back(make_pair(field, InjectionTemplate(action.*field)));
+		}
+	}
+	for (size_t i = 0; i < x_headers.size(); i++) {
+		if (InjectionTemplate::has_fields(x_headers[i].hValue)) {
+			header_templates.push_back(make_pair(i, InjectionTemplate(x_headers[i].hValue)));
+		}
+	}
+
+	CallAction call_action = action;
+	SipHeaderVector call_x_headers = x_headers;
+	call_action.injection_file.clear();
+	call_action.repeat = 0;
+	injection_mode_t mode = get_injection_mode_from_string(action.injection_mode);
+	int repeat = action.repeat;
+
+	LOG(logINFO) << __FUNCTION__ << ": " << injection->name << " rows:" << injection->rows() << " calls:" << repeat + 1
+	             << " templates:" << field_templates.size() << " x-header templates:" << header_templates.size();
+
+	if (action.backpressure && repeat > 0) {
+		group = rate_control_group(action, group);
+	}
+
+	size_t cursor = action.injection_worker;
+	do {
+		size_t row = injection->next_row(mode, &cursor, action.injection_workers);
+		for (auto &t : field_templates) {
+			call_action.*(t.first) = t.second.render(injection, row);
+		}
+		for (auto &t : header_templates) {
+			call_x_headers[t.first].hValue = t.second.render(injection, row);
+		}
+		vp::tolower(call_action.transport);
+		do_call(call_action, checks, call_x_headers, group);
 		repeat -= 1;
+		if (repeat >= 0) {
+			pace_arrival(action, group ? group->controller.get() : nullptr);
+		}
 	} while (repeat >= 0);
+	if (action.backpressure && action.repeat > 0) {
+		rate_control_report(action, group);
+	}
 }
 
 void Action::do_turn(const vector<ActionParam> &params) {
@@ -1104,6 +1543,7 @@ void Action::do_message(const vector<ActionParam> &params, const vector<ActionCh
     bCfg.uri = buddy_uri;
 	bCfg.subscribe = false;
 
+	std::unique_lock<std::mutex> setup(config->setup_lock);
 	TestAccount *acc = config->findAccount(from);
 	string account_uri = from;
 	vp::tolower(transport);
@@ -1121,6 +1561,7 @@ void Action::do_message(const vector<ActionParam> &params, const vector<ActionCh
 
 		acc = config->createAccount(acc_cfg);
 	}
+	setup.unlock();
 
 	Buddy buddy;
 	Account& account = *acc;
@@ -1175,6 +1616,7 @@ void Action::do_accept_message(const vector<ActionParam> &params, const vector<A
 	}
 	vp::tolower(transport);
 
+	std::lock_guard<std::mutex> setup(config->setup_lock);
 	TestAccount *acc = config->findAccount(account_name);
 	AccountConfig acc_cfg;
 	if (!acc) {
@@ -1237,6 +1679,36 @@ void Action::do_codec(const vector<ActionParam> &params) {
 		config->ep->setCodecs(enable, priority);
 }
 
+void Action::do_rewrite(const vector<ActionParam> &params) {
+	string method {};
+	int code {0};
+	string header {};
+	string match {};
+	string replace {};
+	for (auto param : params) {
+		if (param.name.compare("method") == 0) method = param.s_val;
+		else if (param.name.compare("code") == 0) code = param.i_val;
+		else if (param.name.compare("header") == 0) header = param.s_val;
+		else if (param.name.compare("match") == 0) match = param.s_val;
+		else if (param.name.compare("replace") == 0) replace = param.s_val;
+	}
+	if (match.empty()) {
+		LOG(logERROR) << __FUNCTION__ << ": missing action parameter <match>";
+		return;
+	}
+	if (code != 0 && (code < 100 || code > 699)) {
+		LOG(logERROR) << __FUNCTION__ << ": invalid response code: " << code;
+		return;
+	}
+	if (!vp_rewrite_add_rule(method, code, header, match, replace)) {
+		return;
+	}
+	pj_status_t status = vp_rewrite_register(pjsua_get_pjsip_endpt());
+	if (status != PJ_SUCCESS) {
+		LOG(logERROR) << __FUNCTION__ << ": can not register module: " << status;
+	}
+}
+
 void Action::do_alert(const vector<ActionParam> &params) {
 	string email {};
 	string email_from {};
@@ -1274,15 +1746,20 @@ void Action::do_wait(const vector<ActionParam> &params) {
 	while (!completed) {
 
 		// insert any incomming call received in another thread.
+		config->checking_calls.lock();
 		config->new_calls_lock.lock();
-		for (auto it = config->new_calls.begin(); it != config->new_calls.end(); ++it) {
-			config->calls.push_back(*it);
-			config->new_calls.erase(it);
-			break;
-		}
+		config->calls.insert(config->calls.end(), config->new_calls.begin(), config->new_calls.end());
+		config->new_calls.clear();
 		config->new_calls_lock.unlock();
+		config->checking_calls.unlock();
+
+		config->release_expired();
 
-		for (auto & account : config->accounts) {
+		// <parallel> streams can add accounts while waiting
+		config->accounts_lock.lock();
+		std::vector<TestAccount *> accounts = config->accounts;
+		config->accounts_lock.unlock();
+		for (auto & account : accounts) {
 			AccountInfo acc_inf = account->getInfo();
 
 			if (account->test && account->test->state == VPT_DONE) {
@@ -1301,139 +1778,153 @@ void Action::do_wait(const vector<ActionParam> &params) {
 			}
 		}
 
-		// prevent calls destruction while parsing looking at them
+		// the calls are never deleted while a scenario runs, pjsua is called without the lock
+		std::vector<TestCall *> calls;
 		config->checking_calls.lock();
-
 		for (auto & call : config->calls) {
-			if (call->test && call->test->state == VPT_DONE) {
-				//CallInfo ci = call->getInfo();
-				//if (ci.state == PJSIP_INV_STATE_DISCONNECTED)
-				//LOG(logINFO) << "delete call test["<<call->test<<"] = " << config->removeCall(call);
-				continue;
-			} else if (call->test) {
-				CallInfo ci = call->getInfo();
-				if (status_update) {
-					LOG(logDEBUG) << __FUNCTION__ << ": [call][" << call->getId() << "][test][" << (ci.role==0?"CALLER":"CALLEE") << "]["
-						     << ci.callIdString << "][" << ci.remoteUri << "][" << ci.stateText << "|" << ci.state << "]duration["
-						     << ci.connectDuration.sec << ">=" << call->test->hangup_duration<< "]";
-				}
-				if (ci.state == PJSIP_INV_STATE_CALLING || ci.state == PJSIP_INV_STATE_EARLY || ci.state == PJSIP_INV_STATE_INCOMING)  {
-					Test *test = call->test;
-					if (test->response_delay > 0 && ci.totalDuration.sec >= test->response_delay && ci.state == PJSIP_INV_STATE_INCOMING) {
-						CallOpParam prm;
-						// Explicitly answer with 100
-						CallOpParam prm_100;
+			if (call->test && call->test->state != VPT_DONE) {
+				calls.push_back(call);
+			}
+		}
+		config->checking_calls.unlock();
 
-						prm_100.statusCode = PJSIP_SC_TRYING;
-						call->answer(prm_100);
+		for (auto & call : calls) {
+			CallInfo ci = call->getInfo();
+			if (status_update) {
+				LOG(logDEBUG) << __FUNCTION__ << ": [call][" << call->getId() << "][test][" << (ci.role==0?"CALLER":"CALLEE") << "]["
+					     << ci.callIdString << "][" << ci.remoteUri << "][" << ci.stateText << "|" << ci.state << "]duration["
+					     << ci.connectDuration.sec << ">=" << call->test->hangup_duration<< "]";
+			}
+			if (ci.state == PJSIP_INV_STATE_CALLING || ci.state == PJSIP_INV_STATE_EARLY || ci.state == PJSIP_INV_STATE_INCOMING)  {
+				Test *test = call->test;
+				if (test->response_delay > 0 && ci.totalDuration.sec >= test->response_delay && ci.state == PJSIP_INV_STATE_INCOMING) {
+					CallOpParam prm;
+					// Explicitly answer with 100
+					CallOpParam prm_100;
 
-						if (test->ring_duration > 0) {
+					prm_100.statusCode = PJSIP_SC_TRYING;
+					call->answer(prm_100);
 
-							prm.statusCode = PJSIP_SC_RINGING;
-							if (test->early_media) {
-								prm.statusCode = PJSIP_SC_PROGRESS;
-							}
+					if (test->ring_duration > 0) {
 
-							call->answer(prm);
-						} else {
-							prm.reason = "OK";
-							if (test->code) {
-								prm.statusCode = test->code;
-							} else {
-								prm.statusCode = PJSIP_SC_OK;
-							}
-							call->answer(prm);
+						prm.statusCode = PJSIP_SC_RINGING;
+						if (test->early_media) {
+							prm.statusCode = PJSIP_SC_PROGRESS;
 						}
-						LOG(logINFO) << " Answering call[" << call->getId() << "] with " << prm.statusCode << " on call time: " << ci.totalDuration.sec;
 
-					} else if (test->ring_duration > 0 && ci.totalDuration.sec >= (test->ring_duration + test->response_delay)) {
-						CallOpParam prm;
+						call->media_setting(prm.opt);
+						call->answer(prm);
+					} else {
 						prm.reason = "OK";
-
 						if (test->code) {
 							prm.statusCode = test->code;
 						} else {
 							prm.statusCode = PJSIP_SC_OK;
 						}
+						test->add_latency_reflect(prm);
+						call->media_setting(prm.opt);
+						call->answer(prm);
+					}
+					LOG(logINFO) << " Answering call[" << call->getId() << "] with " << prm.statusCode << " on call time: " << ci.totalDuration.sec;
 
-						LOG(logINFO) << " Answering call[" << call->getId() << "] with " << test->code << " on call time: " << ci.totalDuration.sec;
+				} else if (test->ring_duration > 0 && ci.totalDuration.sec >= (test->ring_duration + test->response_delay)) {
+					CallOpParam prm;
+					prm.reason = "OK";
 
-						call->answer(prm);
-					} else if (test->max_ring_duration && (test->max_ring_duration + test->response_delay) <= ci.totalDuration.sec) {
-						LOG(logINFO) << __FUNCTION__ << "[cancelling:call][" << call->getId() << "][test][" << (ci.role==0?"CALLER":"CALLEE") << "]["
-						     << ci.callIdString << "][" << ci.remoteUri << "][" << ci.stateText << "|" << ci.state << "]duration["
-						     << ci.totalDuration.sec << ">=(" << test->max_ring_duration << " + " << test->response_delay << ")]";
+					if (test->code) {
+						prm.statusCode = test->code;
+					} else {
+						prm.statusCode = PJSIP_SC_OK;
+					}
+
+					LOG(logINFO) << " Answering call[" << call->getId() << "] with " << test->code << " on call time: " << ci.totalDuration.sec;
+
+					test->add_latency_reflect(prm);
+					call->media_setting(prm.opt);
+					call->answer(prm);
+				} else if (test->max_ring_duration && (test->max_ring_duration + test->response_delay) <= ci.totalDuration.sec) {
+					LOG(logINFO) << __FUNCTION__ << "[cancelling:call][" << call->getId() << "][test][" << (ci.role==0?"CALLER":"CALLEE") << "]["
+					     << ci.callIdString << "][" << ci.remoteUri << "][" << ci.stateText << "|" << ci.state << "]duration["
+					     << ci.totalDuration.sec << ">=(" << test->max_ring_duration << " + " << test->response_delay << ")]";
+					CallOpParam prm(true);
+					try {
+						pj_gettimeofday(&test->sip_latency.byeSentTs);
+						call->hangup(prm);
+					} catch (pj::Error& e)  {
+						if (e.status != 171140) {
+							LOG(logERROR) << __FUNCTION__ << " error :" << e.status;
+						}
+					}
+				}
+			} else if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
+				std::string res = "call[" + std::to_string(ci.lastStatusCode) + "] reason[" + ci.lastReason + "]";
+				call->test->connect_duration = ci.connectDuration.sec;
+				call->test->setup_duration = ci.totalDuration.sec - ci.connectDuration.sec;
+				call->test->result_cause_code = (int)ci.lastStatusCode;
+				call->test->reason = ci.lastReason;
+				// check re-invite
+				if (call->test->re_invite_interval && ci.connectDuration.sec >= call->test->re_invite_next){
+					if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
 						CallOpParam prm(true);
+						prm.opt.audioCount = call->test->no_media ? 0 : 1;
+						prm.opt.videoCount = 0;
+						LOG(logINFO) << __FUNCTION__ << " re-invite : call in PJSIP_INV_STATE_CONFIRMED" ;
 						try {
-							pj_gettimeofday(&test->sip_latency.byeSentTs);
-							call->hangup(prm);
+							call->reinvite(prm);
+							call->test->re_invite_next = call->test->re_invite_next + call->test->re_invite_interval;
 						} catch (pj::Error& e)  {
 							if (e.status != 171140) {
-								LOG(logERROR) << __FUNCTION__ << " error :" << e.status;
+								LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): [" << e.srcFile << "] " << e.reason << std::endl;
 							}
 						}
 					}
-				} else if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
-					std::string res = "call[" + std::to_string(ci.lastStatusCode) + "] reason[" + ci.lastReason + "]";
-					call->test->connect_duration = ci.connectDuration.sec;
-					call->test->setup_duration = ci.totalDuration.sec - ci.connectDuration.sec;
-					call->test->result_cause_code = (int)ci.lastStatusCode;
-					call->test->reason = ci.lastReason;
-					// check re-invite
-					if (call->test->re_invite_interval && ci.connectDuration.sec >= call->test->re_invite_next){
-						if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
-							CallOpParam prm(true);
-							prm.opt.audioCount = 1;
-							prm.opt.videoCount = 0;
-							LOG(logINFO) << __FUNCTION__ << " re-invite : call in PJSIP_INV_STATE_CONFIRMED" ;
-							try {
-								call->reinvite(prm);
-								call->test->re_invite_next = call->test->re_invite_next + call->test->re_invite_interval;
-							} catch (pj::Error& e)  {
-								if (e.status != 171140) {
-									LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): [" << e.srcFile << "] " << e.reason << std::endl;
-								}
-							}
-						}
-					}
-					// check hangup
-					if (call->test->hangup_duration && ci.connectDuration.sec >= call->test->hangup_duration){
-						if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
-							CallOpParam prm(true);
-							LOG(logINFO) << "hangup : call in PJSIP_INV_STATE_CONFIRMED" ;
-							try {
-								pj_gettimeofday(&call->test->sip_latency.byeSentTs);
-								call->hangup(prm);
-							} catch (pj::Error& e)  {
-								if (e.status != 171140) {
-									LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): [" << e.srcFile << "] " << e.reason << std::endl;
-								}
+				}
+				// sample the quality
+				if (call->test->quality_interval && ci.connectDuration.sec >= call->test->quality_next) {
+					call->sample_quality(ci);
+					call->test->quality_next = ci.connectDuration.sec + call->test->quality_interval;
+				}
+				// check hangup
+				if (call->test->hangup_duration && ci.connectDuration.sec >= call->test->hangup_duration){
+					if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
+						CallOpParam prm(true);
+						LOG(logINFO) << "hangup : call in PJSIP_INV_STATE_CONFIRMED" ;
+						try {
+							pj_gettimeofday(&call->test->sip_latency.byeSentTs);
+							call->hangup(prm);
+						} catch (pj::Error& e)  {
+							if (e.status != 171140) {
+								LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): [" << e.srcFile << "] " << e.reason << std::endl;
 							}
 						}
-						call->test->update_result();
 					}
+					call->test->update_result();
 				}
-				if (complete_all || call->test->state == VPT_RUN_WAIT) {
-					tests_running += 1;
-				}
+			}
+			if (complete_all || call->test->state == VPT_RUN_WAIT) {
+				tests_running += 1;
 			}
 		}
 
-		int pos = 0;
-
-		for (auto test : config->tests_with_rtp_stats) {
-			if (test->rtp_stats_ready) {
-				test->update_result();
-				config->tests_with_rtp_stats.erase(config->tests_with_rtp_stats.begin() + pos);
-
-				LOG(logINFO) << __FUNCTION__ << " erase pos:" << pos;
+		std::vector<Test *> rtp_stats_ready;
+		config->rtp_stats_lock.lock();
+		for (auto it = config->tests_with_rtp_stats.begin(); it != config->tests_with_rtp_stats.end();) {
+			if ((*it)->rtp_stats_ready) {
+				rtp_stats_ready.push_back(*it);
+				it = config->tests_with_rtp_stats.erase(it);
 			} else {
 				tests_running += 1;
-				pos += 1;
- 			}
+				++it;
+			}
 		}
-		// calls, can now be destroyed
-		config->checking_calls.unlock();
+		config->rtp_stats_lock.unlock();
+		for (auto test : rtp_stats_ready) {
+			test->update_result();
+		}
+		for (auto test : config->scoring.completed()) {
+			test->update_result();
+		}
+		tests_running += config->scoring.pending();
 
 		if (tests_running == 0 && complete_all) {
 			LOG(logINFO) << __FUNCTION__ << LOG_COLOR_ERROR << ": action[wait] no more tests are running, exiting... " << LOG_COLOR_END;
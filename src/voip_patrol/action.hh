@@ -21,15 +21,25 @@
 
 #include "voip_patrol.hh"
 #include "check.hh"
+#include "injection.hh"
+#include "traffic_model.hh"
+#include "call_group.hh"
 #include <pjsua2.hpp>
+#include <memory>
+#include <atomic>
 
 class Config;
 class ActionCheck;
+class TrafficGroup;
 
 using namespace std;
 
 enum class APType { apt_integer, apt_string, apt_float, apt_bool };
 
+enum class ActionType { none, call, accept, wait, reg, alert, codec, turn, message, accept_message, rewrite, replay, parallel, capacity, trace };
+
+ActionType get_action_type_from_string(const string& type);
+
 struct ActionParam {
 	ActionParam(const string& name, bool required, APType type, const string& s_val="", int i_val=0, float f_val=0.0, bool b_val=false)
                  : type(type), required(required), name(name), i_val(i_val), s_val(s_val), f_val(f_val) , b_val(b_val) {}
@@ -43,13 +53,89 @@ struct ActionParam {
 };
 
 
+/*
+ * Call action parameters, resolved once when the scenario is compiled,
+ * every call made from the plan only reads these fields.
+ */
+struct CallAction {
+	string play;
+	string play_dtmf;
+	string timer;
+	string caller;
+	string from;
+	string callee;
+	string to_uri;
+	string transport {"udp"};
+	string username;
+	string auth_username;
+	string password;
+	string realm {"*"};
+	string label;
+	string proxy;
+	string srtp {"none"};
+	string recording;
+	string force_contact;
+	int expected_cause_code {200};
+	int wait_until {0}; // call_state_t
+	float min_mos {0.0};
+	string reference;             // scored against the received audio for min_mos, default play
+	int max_duration {0};
+	int max_ring_duration {60};
+	int expected_duration {0};
+	int expected_setup_duration {0};
+	int hangup_duration {0};
+	int early_cancel {0};
+	int re_invite_interval {0};
+	int repeat {0};
+	bool record_early {false};
+	bool rtp_stats {false};
+	int quality_interval {0};     // seconds between two samples of the quality time series
+	string analyze;               // "report" or "check" the received audio as it arrives
+	bool watermark {false};       // call id sent in band and expected back
+	bool latency {false};         // audio markers sent and timed when reflected
+	bool late_start {false};
+	string media {"audio"};       // "none" disabled audio in the SDP, "nosdp" no SDP in the INVITE, no media resources
+	bool disable_turn {false};
+	string injection_file;
+	string injection_mode;
+	int injection_worker {0};
+	int injection_workers {1};
+	int concurrency {0};          // simultaneous calls maintained by the action, 0 plain calls
+	int concurrency_duration {0}; // seconds
+	int concurrency_ramp {0};     // seconds to reach the target
+	float rate {0.0};             // calls per second between the repeated calls, 0 all at once
+	bool poisson {false};
+	Distribution hold;            // hangup duration, fixed uses hangup
+	bool backpressure {false};    // AIMD on the rate, lowered on 503, 408 and Retry-After
+	float rate_min {0.0};         // default rate / 10
+	float rate_max {0.0};         // default rate
+	float rate_increase {1.0};    // calls per second added every second of answered calls
+	float rate_decrease {0.5};    // rate factor on overload
+};
+
+/* one action of the compiled scenario */
+struct ScenarioAction {
+	ActionType type {ActionType::none};
+	string name;
+	vector<ActionParam> params;
+	vector<ActionCheck> checks;
+	pj::SipHeaderVector x_headers;
+	CallAction call;
+	std::shared_ptr<TrafficGroup> group; // <parallel>
+};
+
 class Action {
 	public:
 			Action(Config *cfg);
-			vector<ActionParam> get_params(string);
+			const vector<ActionParam>& get_params(ActionType type) const;
+			CallAction get_call_action(const vector<ActionParam> &params) const;
 			bool set_param(ActionParam&, const char *val);
 			bool set_param_by_name(vector<ActionParam> *params, const string& name, const char *val=nullptr);
-			void do_call(const vector<ActionParam> &params, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers);
+			bool do_call(const CallAction &action, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers,
+			             std::shared_ptr<CallGroup> group = nullptr);
+			void pace_arrival(const CallAction &action, RateController *controller = nullptr);
+			void do_call_concurrency(const CallAction &action, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers,
+			                         std::shared_ptr<CallGroup> group = nullptr);
 			void do_accept(const vector<ActionParam> &params, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers);
 			void do_wait(const vector<ActionParam> &params);
 			void do_register(const vector<ActionParam> &params, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers);
@@ -58,10 +144,16 @@ class Action {
 			void do_turn(const vector<ActionParam> &params);
 			void do_message(const vector<ActionParam> &params, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers);
 			void do_accept_message(const vector<ActionParam> &params, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers);
+			void do_rewrite(const vector<ActionParam> &params);
 			void set_config(Config *);
 			Config* get_config();
 	private:
 			string get_env(string);
+			void do_call_injection(const CallAction &action, const vector<ActionCheck> &checks, const pj::SipHeaderVector &x_headers,
+			                       InjectionFile *injection, std::shared_ptr<CallGroup> group);
+			std::shared_ptr<CallGroup> rate_control_group(const CallAction &action, std::shared_ptr<CallGroup> group);
+			void rate_control_report(const CallAction &action, const std::shared_ptr<CallGroup> &group);
+			TestAccount* source_account(const string &account_uri, const pj::AccountConfig &acc_cfg, int *source, const string &transport);
 			void init_actions_params();
 			vector<ActionParam> do_call_params;
 			vector<ActionParam> do_register_params;
@@ -72,6 +164,10 @@ class Action {
 			vector<ActionParam> do_turn_params;
 			vector<ActionParam> do_message_params;
 			vector<ActionParam> do_accept_message_params;
+			vector<ActionParam> do_rewrite_params;
+			vector<ActionParam> do_capacity_params;
+			vector<ActionParam> do_trace_params;
+			double pace_next_ms {0.0}; // next arrival of the calls paced by rate
 			Config* config;
 };
 
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "audio_analysis.hh"
+#include <math.h>
+
+#define ANALYSIS_BLOCK_MS 10
+#define ANALYSIS_SILENCE_DBFS -65.0
+#define ANALYSIS_SPEECH_DBFS -55.0
+#define ANALYSIS_SPEECH_MARGIN_DB 9.0
+#define ANALYSIS_NOISE_RISE 1.002      // per block, about 0.9dB per second
+#define ANALYSIS_CLIP_LEVEL 32000
+#define ANALYSIS_CLIPPING_RATIO 0.001
+#define ANALYSIS_NO_SPEECH_RATIO 0.01
+#define ANALYSIS_LOW_LEVEL_DBFS -40.0
+
+static double dbfs_to_energy(double dbfs) {
+	return pow(10.0, dbfs / 10.0) * 32768.0 * 32768.0;
+}
+
+static float energy_to_dbfs(double energy) {
+	if (energy < 1.0)
+		return -96.0;
+	return 10.0 * log10(energy / (32768.0 * 32768.0));
+}
+
+AudioAnalyzer::AudioAnalyzer(unsigned clock_rate) : AudioSink(clock_rate) {
+	block_samples = clock_rate * ANALYSIS_BLOCK_MS / 1000;
+}
+
+void AudioAnalyzer::put(const pj_int16_t *in, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (unsigned i = 0; i < count; i++) {
+		int s = in[i];
+		unsigned a = s < 0 ? -s : s;
+		if (a > peak)
+			peak = a;
+		if (a >= ANALYSIS_CLIP_LEVEL)
+			clipped++;
+		block_energy += (double)s * s;
+		if (++block_pos == block_samples)
+			end_block();
+	}
+	samples += count;
+}
+
+void AudioAnalyzer::end_block() {
+	double energy = block_energy / block_samples;
+	block_energy = 0.0;
+	block_pos = 0;
+	blocks++;
+
+	if (blocks == 1 || energy < noise_floor)
+		noise_floor = energy;
+	else
+		noise_floor *= ANALYSIS_NOISE_RISE;
+	noise_floor = fmax(noise_floor, 1.0);
+
+	if (energy < dbfs_to_energy(ANALYSIS_SILENCE_DBFS)) {
+		silent_blocks++;
+		if (++silence_run > longest_silence_run)
+			longest_silence_run = silence_run;
+		return;
+	}
+	silence_run = 0;
+	if (energy > dbfs_to_energy(ANALYSIS_SPEECH_DBFS) &&
+	    energy > noise_floor * pow(10.0, ANALYSIS_SPEECH_MARGIN_DB / 10.0)) {
+		speech_blocks++;
+		speech_energy += energy;
+	}
+}
+
+AudioAnalysis AudioAnalyzer::result() const {
+	std::lock_guard<std::mutex> guard(lock);
+	AudioAnalysis r;
+	r.valid = true;
+	r.duration_ms = blocks * ANALYSIS_BLOCK_MS;
+	r.longest_silence_ms = longest_silence_run * ANALYSIS_BLOCK_MS;
+	r.peak_dbfs = energy_to_dbfs((double)peak * peak);
+	if (speech_blocks)
+		r.rms_dbfs = energy_to_dbfs(speech_energy / speech_blocks);
+	if (blocks) {
+		r.speech_ratio = (float)speech_blocks / blocks;
+		r.silence_ratio = (float)silent_blocks / blocks;
+	}
+	if (samples)
+		r.clipped_ratio = (float)clipped / samples;
+
+	if (blocks == silent_blocks)
+		r.verdict = "one_way";
+	else if (r.speech_ratio < ANALYSIS_NO_SPEECH_RATIO)
+		r.verdict = "no_speech";
+	else if (r.clipped_ratio > ANALYSIS_CLIPPING_RATIO)
+		r.verdict = "clipping";
+	else if (r.rms_dbfs < ANALYSIS_LOW_LEVEL_DBFS)
+		r.verdict = "low_level";
+	else
+		r.verdict = "ok";
+	return r;
+}
+
+std::string AudioAnalysis::json() const {
+	return "{\"verdict\": \"" + verdict + "\"" +
+	       ", \"duration_ms\": " + std::to_string(duration_ms) +
+	       ", \"rms_dbfs\": " + std::to_string(rms_dbfs) +
+	       ", \"peak_dbfs\": " + std::to_string(peak_dbfs) +
+	       ", \"speech_ratio\": " + std::to_string(speech_ratio) +
+	       ", \"silence_ratio\": " + std::to_string(silence_ratio) +
+	       ", \"clipped_ratio\": " + std::to_string(clipped_ratio) +
+	       ", \"longest_silence_ms\": " + std::to_string(longest_silence_ms) + "}";
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_AUDIO_ANALYSIS_H
+#define VOIP_PATROL_AUDIO_ANALYSIS_H
+
+#include "audio_sink.hh"
+#include <mutex>
+#include <string>
+
+#define AUDIO_ANALYSIS_RATE 8000 // the bridge gives the audio at this rate, the direct media at the stream rate
+
+/* verdict and measures of the received audio of a call */
+struct AudioAnalysis {
+	bool valid {false};
+	std::string verdict;      // ok, one_way, no_speech, clipping, low_level
+	unsigned duration_ms {0};
+	float rms_dbfs {-96.0};   // level of the speech
+	float peak_dbfs {-96.0};
+	float speech_ratio {0.0};
+	float silence_ratio {0.0};
+	float clipped_ratio {0.0};
+	unsigned longest_silence_ms {0};
+	std::string json() const;
+};
+
+/*
+ * Streaming analysis of the received audio, in blocks of 10ms with a constant
+ * state whatever the duration of the call: nothing is recorded.
+ * A block is speech above an absolute level and above the noise floor, that
+ * rises slowly and follows the quieter blocks at once.
+ */
+class AudioAnalyzer : public AudioSink {
+	public:
+		AudioAnalyzer(unsigned clock_rate);
+		void put(const pj_int16_t *samples, unsigned count) override;
+		AudioAnalysis result() const;
+	private:
+		void end_block();
+		unsigned block_samples;
+		unsigned block_pos {0};
+		double block_energy {0.0};
+		double noise_floor {0.0};
+		double speech_energy {0.0};
+		unsigned peak {0};
+		unsigned long samples {0};
+		unsigned long clipped {0};
+		unsigned long blocks {0};
+		unsigned long silent_blocks {0};
+		unsigned long speech_blocks {0};
+		unsigned long silence_run {0};
+		unsigned long longest_silence_run {0};
+		mutable std::mutex lock; // put() runs in the media clock thread, result() in a SIP thread
+};
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "audio_kernels.hh"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+static audio_isa_t detect_isa() {
+#ifdef AUDIO_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return AUDIO_ISA_AVX2;
+	if (__builtin_cpu_supports("sse4.1")) return AUDIO_ISA_SSE41;
+#endif
+	return AUDIO_ISA_SCALAR;
+}
+
+static audio_isa_t cpu_isa = detect_isa();
+static audio_isa_t isa = cpu_isa;
+
+audio_isa_t audio_kernels_isa() {
+	return isa;
+}
+
+const char* audio_kernels_isa_name(audio_isa_t isa) {
+	switch (isa) {
+		case AUDIO_ISA_AVX2: return "avx2";
+		case AUDIO_ISA_SSE41: return "sse4.1";
+		default: return "scalar";
+	}
+}
+
+void audio_kernels_set_isa(audio_isa_t requested) {
+	isa = std::min(requested, cpu_isa);
+}
+
+/*
+ * scalar G.711, the reference algorithms (Sun Microsystems) used by pjmedia
+ */
+
+static inline uint8_t ulaw_encode_sample(int pcm) {
+	static const int seg_end[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+	int mask;
+	pcm >>= 2;
+	if (pcm < 0) {
+		pcm = -pcm;
+		mask = 0x7F;
+	} else {
+		mask = 0xFF;
+	}
+	pcm = std::min(pcm, 8159) + 33;
+	int seg = 0;
+	while (seg < 8 && pcm > seg_end[seg]) seg++;
+	if (seg >= 8) {
+		return (uint8_t)(0x7F ^ mask);
+	}
+	return (uint8_t)(((seg << 4) | ((pcm >> (seg + 1)) & 0xF)) ^ mask);
+}
+
+static inline uint8_t alaw_encode_sample(int pcm) {
+	static const int seg_end[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+	int mask;
+	pcm >>= 3;
+	if (pcm >= 0) {
+		mask = 0xD5;
+	} else {
+		mask = 0x55;
+		pcm = -pcm - 1;
+	}
+	int seg = 0;
+	while (seg < 8 && pcm > seg_end[seg]) seg++;
+	if (seg >= 8) {
+		return (uint8_t)(0x7F ^ mask);
+	}
+	int aval = seg << 4;
+	aval |= (seg < 2) ? (pcm >> 1) & 0xF : (pcm >> seg) & 0xF;
+	return (uint8_t)(aval ^ mask);
+}
+
+static inline int16_t ulaw_decode_sample(uint8_t u) {
+	u = ~u;
+	int t = ((u & 0xF) << 3) + 0x84;
+	t <<= (u & 0x70) >> 4;
+	return (int16_t)((u & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static inline int16_t alaw_decode_sample(uint8_t a) {
+	a ^= 0x55;
+	int t = (a & 0xF) << 4;
+	int seg = (a & 0x70) >> 4;
+	if (seg == 0) {
+		t += 8;
+	} else {
+		t = (t + 0x108) << (seg - 1);
+	}
+	return (int16_t)((a & 0x80) ? t : -t);
+}
+
+#ifdef AUDIO_KERNELS_X86
+
+/*
+ * The segment and the 4 bits of mantissa following the leading bit are read
+ * from the float representation of the magnitude: (bits >> 19) is exponent << 4 | mantissa.
+ */
+
+__attribute__((target("sse4.1")))
+static inline __m128i ulaw_encode_sse41(__m128i x) {
+	__m128i s = _mm_srai_epi32(x, 2);
+	__m128i neg = _mm_cmplt_epi32(s, _mm_setzero_si128());
+	__m128i mag = _mm_add_epi32(_mm_min_epi32(_mm_abs_epi32(s), _mm_set1_epi32(8159)), _mm_set1_epi32(33));
+	__m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(mag));
+	__m128i u = _mm_sub_epi32(_mm_srli_epi32(bits, 19), _mm_set1_epi32((127 + 5) << 4));
+	u = _mm_min_epi32(u, _mm_set1_epi32(0x7F));
+	return _mm_xor_si128(_mm_xor_si128(u, _mm_set1_epi32(0xFF)), _mm_and_si128(neg, _mm_set1_epi32(0x80)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i alaw_encode_sse41(__m128i x) {
+	__m128i s = _mm_srai_epi32(x, 3);
+	__m128i neg = _mm_cmplt_epi32(s, _mm_setzero_si128());
+	__m128i mag = _mm_xor_si128(s, neg); // -s - 1 when negative
+	__m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(mag));
+	__m128i big = _mm_sub_epi32(_mm_srli_epi32(bits, 19), _mm_set1_epi32((127 + 4) << 4));
+	__m128i small = _mm_srli_epi32(mag, 1);
+	__m128i a = _mm_blendv_epi8(big, small, _mm_cmplt_epi32(mag, _mm_set1_epi32(32)));
+	return _mm_xor_si128(_mm_xor_si128(a, _mm_set1_epi32(0xD5)), _mm_and_si128(neg, _mm_set1_epi32(0x80)));
+}
+
+__attribute__((target("sse4.1")))
+static size_t g711_encode_sse41(const int16_t *in, uint8_t *out, size_t count, bool ulaw) {
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i lo = _mm_cvtepi16_epi32(x);
+		__m128i hi = _mm_cvtepi16_epi32(_mm_srli_si128(x, 8));
+		lo = ulaw ? ulaw_encode_sse41(lo) : alaw_encode_sse41(lo);
+		hi = ulaw ? ulaw_encode_sse41(hi) : alaw_encode_sse41(hi);
+		__m128i packed = _mm_packus_epi16(_mm_packus_epi32(lo, hi), _mm_setzero_si128());
+		_mm_storel_epi64((__m128i *)(out + i), packed);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ulaw_encode_avx2(__m256i x) {
+	__m256i s = _mm256_srai_epi32(x, 2);
+	__m256i neg = _mm256_cmpgt_epi32(_mm256_setzero_si256(), s);
+	__m256i mag = _mm256_add_epi32(_mm256_min_epi32(_mm256_abs_epi32(s), _mm256_set1_epi32(8159)), _mm256_set1_epi32(33));
+	__m256i bits = _mm256_castps_si256(_mm256_cvtepi32_ps(mag));
+	__m256i u = _mm256_sub_epi32(_mm256_srli_epi32(bits, 19), _mm256_set1_epi32((127 + 5) << 4));
+	u = _mm256_min_epi32(u, _mm256_set1_epi32(0x7F));
+	return _mm256_xor_si256(_mm256_xor_si256(u, _mm256_set1_epi32(0xFF)), _mm256_and_si256(neg, _mm256_set1_epi32(0x80)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i alaw_encode_avx2(__m256i x) {
+	__m256i s = _mm256_srai_epi32(x, 3);
+	__m256i neg = _mm256_cmpgt_epi32(_mm256_setzero_si256(), s);
+	__m256i mag = _mm256_xor_si256(s, neg);
+	__m256i bits = _mm256_castps_si256(_mm256_cvtepi32_ps(mag));
+	__m256i big = _mm256_sub_epi32(_mm256_srli_epi32(bits, 19), _mm256_set1_epi32((127 + 4) << 4));
+	__m256i small = _mm256_srli_epi32(mag, 1);
+	__m256i a = _mm256_blendv_epi8(big, small, _mm256_cmpgt_epi32(_mm256_set1_epi32(32), mag));
+	return _mm256_xor_si256(_mm256_xor_si256(a, _mm256_set1_epi32(0xD5)), _mm256_and_si256(neg, _mm256_set1_epi32(0x80)));
+}
+
+__attribute__((target("avx2")))
+static size_t g711_encode_avx2(const int16_t *in, uint8_t *out, size_t count, bool ulaw) {
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i + 8)));
+		lo = ulaw ? ulaw_encode_avx2(lo) : alaw_encode_avx2(lo);
+		hi = ulaw ? ulaw_encode_avx2(hi) : alaw_encode_avx2(hi);
+		// the packs work within 128 bit lanes
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+		__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+		_mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(bytes));
+	}
+	return i;
+}
+
+/* the segment shift is a multiplication by a power of two read with a byte shuffle */
+
+__attribute__((target("sse4.1")))
+static size_t g711_decode_sse41(const uint8_t *in, int16_t *out, size_t count, bool ulaw) {
+	const __m128i pow2 = ulaw ? _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0)
+	                          : _mm_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i high_zero = _mm_set1_epi16((short)0x8000);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i v = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(in + i)));
+		__m128i res;
+		if (ulaw) {
+			v = _mm_xor_si128(v, _mm_set1_epi16(0xFF));
+			__m128i seg = _mm_srli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x70)), 4);
+			__m128i t = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xF)), 3), _mm_set1_epi16(0x84));
+			t = _mm_mullo_epi16(t, _mm_shuffle_epi8(pow2, _mm_or_si128(seg, high_zero)));
+			__m128i d = _mm_sub_epi16(t, _mm_set1_epi16(0x84));
+			__m128i neg = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x80)), _mm_set1_epi16(0x80));
+			res = _mm_sub_epi16(_mm_xor_si128(d, neg), neg);
+		} else {
+			v = _mm_xor_si128(v, _mm_set1_epi16(0x55));
+			__m128i seg = _mm_srli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x70)), 4);
+			__m128i seg0 = _mm_cmpeq_epi16(seg, _mm_setzero_si128());
+			__m128i bias = _mm_blendv_epi8(_mm_set1_epi16(0x108), _mm_set1_epi16(8), seg0);
+			__m128i t = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xF)), 4), bias);
+			t = _mm_mullo_epi16(t, _mm_shuffle_epi8(pow2, _mm_or_si128(seg, high_zero)));
+			__m128i neg = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(0x80)), _mm_setzero_si128());
+			res = _mm_sub_epi16(_mm_xor_si128(t, neg), neg);
+		}
+		_mm_storeu_si128((__m128i *)(out + i), res);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t g711_decode_avx2(const uint8_t *in, int16_t *out, size_t count, bool ulaw) {
+	const __m256i pow2 = ulaw ? _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+	                                             1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0)
+	                          : _mm256_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0,
+	                                             1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i high_zero = _mm256_set1_epi16((short)0x8000);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(in + i)));
+		__m256i res;
+		if (ulaw) {
+			v = _mm256_xor_si256(v, _mm256_set1_epi16(0xFF));
+			__m256i seg = _mm256_srli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x70)), 4);
+			__m256i t = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xF)), 3), _mm256_set1_epi16(0x84));
+			t = _mm256_mullo_epi16(t, _mm256_shuffle_epi8(pow2, _mm256_or_si256(seg, high_zero)));
+			__m256i d = _mm256_sub_epi16(t, _mm256_set1_epi16(0x84));
+			__m256i neg = _mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x80)), _mm256_set1_epi16(0x80));
+			res = _mm256_sub_epi16(_mm256_xor_si256(d, neg), neg);
+		} else {
+			v = _mm256_xor_si256(v, _mm256_set1_epi16(0x55));
+			__m256i seg = _mm256_srli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x70)), 4);
+			__m256i seg0 = _mm256_cmpeq_epi16(seg, _mm256_setzero_si256());
+			__m256i bias = _mm256_blendv_epi8(_mm256_set1_epi16(0x108), _mm256_set1_epi16(8), seg0);
+			__m256i t = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xF)), 4), bias);
+			t = _mm256_mullo_epi16(t, _mm256_shuffle_epi8(pow2, _mm256_or_si256(seg, high_zero)));
+			__m256i neg = _mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x80)), _mm256_setzero_si256());
+			res = _mm256_sub_epi16(_mm256_xor_si256(t, neg), neg);
+		}
+		_mm256_storeu_si256((__m256i *)(out + i), res);
+	}
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static int32_t dot_sse41(const int16_t *a, const int16_t *b, unsigned n) {
+	__m128i acc = _mm_setzero_si128();
+	for (unsigned i = 0; i < n; i += 8) {
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+	}
+	acc = _mm_hadd_epi32(acc, acc);
+	acc = _mm_hadd_epi32(acc, acc);
+	return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_avx2(const int16_t *a, const int16_t *b, unsigned n) {
+	__m256i acc = _mm256_setzero_si256();
+	for (unsigned i = 0; i < n; i += 16) {
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i))));
+	}
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	sum = _mm_hadd_epi32(sum, sum);
+	sum = _mm_hadd_epi32(sum, sum);
+	return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("sse4.1")))
+static float dot_float_sse41(const float *a, const float *b, size_t count, size_t *done) {
+	__m128 acc = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+	acc = _mm_hadd_ps(acc, acc);
+	acc = _mm_hadd_ps(acc, acc);
+	*done = i;
+	return _mm_cvtss_f32(acc);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_float_avx2(const float *a, const float *b, size_t count, size_t *done) {
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+	}
+	acc0 = _mm256_add_ps(acc0, acc1);
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+	sum = _mm_hadd_ps(sum, sum);
+	sum = _mm_hadd_ps(sum, sum);
+	*done = i;
+	return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("sse4.1")))
+static unsigned goertzel_sse41(const int16_t *in, size_t n, const float *coefs, unsigned count, float *power) {
+	unsigned k = 0;
+	for (; k + 4 <= count; k += 4) {
+		__m128 c = _mm_loadu_ps(coefs + k);
+		__m128 s1 = _mm_setzero_ps();
+		__m128 s2 = _mm_setzero_ps();
+		for (size_t i = 0; i < n; i++) {
+			__m128 s0 = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(in[i]), _mm_mul_ps(c, s1)), s2);
+			s2 = s1;
+			s1 = s0;
+		}
+		__m128 p = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(s1, s1), _mm_mul_ps(s2, s2)), _mm_mul_ps(_mm_mul_ps(c, s1), s2));
+		_mm_storeu_ps(power + k, p);
+	}
+	return k;
+}
+
+__attribute__((target("avx2,fma")))
+static unsigned goertzel_avx2(const int16_t *in, size_t n, const float *coefs, unsigned count, float *power) {
+	unsigned k = 0;
+	for (; k + 8 <= count; k += 8) {
+		__m256 c = _mm256_loadu_ps(coefs + k);
+		__m256 s1 = _mm256_setzero_ps();
+		__m256 s2 = _mm256_setzero_ps();
+		for (size_t i = 0; i < n; i++) {
+			__m256 s0 = _mm256_sub_ps(_mm256_fmadd_ps(c, s1, _mm256_set1_ps(in[i])), s2);
+			s2 = s1;
+			s1 = s0;
+		}
+		__m256 p = _mm256_fmsub_ps(s1, s1, _mm256_fmsub_ps(_mm256_mul_ps(c, s1), s2, _mm256_mul_ps(s2, s2)));
+		_mm256_storeu_ps(power + k, p);
+	}
+	return k;
+}
+
+#endif
+
+static int32_t dot_scalar(const int16_t *a, const int16_t *b, unsigned n) {
+	int32_t acc = 0;
+	for (unsigned i = 0; i < n; i++) {
+		acc += (int32_t)a[i] * b[i];
+	}
+	return acc;
+}
+
+static size_t g711_encode_simd(const int16_t *in, uint8_t *out, size_t count, bool ulaw) {
+#ifdef AUDIO_KERNELS_X86
+	if (isa == AUDIO_ISA_AVX2) return g711_encode_avx2(in, out, count, ulaw);
+	if (isa == AUDIO_ISA_SSE41) return g711_encode_sse41(in, out, count, ulaw);
+#endif
+	return 0;
+}
+
+static size_t g711_decode_simd(const uint8_t *in, int16_t *out, size_t count, bool ulaw) {
+#ifdef AUDIO_KERNELS_X86
+	if (isa == AUDIO_ISA_AVX2) return g711_decode_avx2(in, out, count, ulaw);
+	if (isa == AUDIO_ISA_SSE41) return g711_decode_sse41(in, out, count, ulaw);
+#endif
+	return 0;
+}
+
+void g711_ulaw_encode(const int16_t *in, uint8_t *out, size_t count) {
+	for (size_t i = g711_encode_simd(in, out, count, true); i < count; i++) {
+		out[i] = ulaw_encode_sample(in[i]);
+	}
+}
+
+void g711_alaw_encode(const int16_t *in, uint8_t *out, size_t count) {
+	for (size_t i = g711_encode_simd(in, out, count, false); i < count; i++) {
+		out[i] = alaw_encode_sample(in[i]);
+	}
+}
+
+void g711_ulaw_decode(const uint8_t *in, int16_t *out, size_t count) {
+	for (size_t i = g711_decode_simd(in, out, count, true); i < count; i++) {
+		out[i] = ulaw_decode_sample(in[i]);
+	}
+}
+
+void g711_alaw_decode(const uint8_t *in, int16_t *out, size_t count) {
+	for (size_t i = g711_decode_simd(in, out, count, false); i < count; i++) {
+		out[i] = alaw_decode_sample(in[i]);
+	}
+}
+
+static unsigned gcd(unsigned a, unsigned b) {
+	while (b) {
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+bool Resampler::supported(unsigned in_rate, unsigned out_rate) {
+	if (!in_rate || !out_rate) {
+		return false;
+	}
+	unsigned g = gcd(in_rate, out_rate);
+	// integer ratios only, 8, 16 and 48kHz between themselves
+	return (in_rate / g == 1 || out_rate / g == 1) && std::max(in_rate, out_rate) / g <= 6;
+}
+
+Resampler::Resampler(unsigned in_rate, unsigned out_rate) : in_rate(in_rate), out_rate(out_rate) {
+	unsigned g = gcd(in_rate, out_rate);
+	up = out_rate / g;
+	down = in_rate / g;
+	// the same transition band relative to the lowest rate whatever the ratio
+	taps = 16 * ((std::max(up, down) + up - 1) / up);
+	unsigned length = taps * up;
+	double cutoff = 0.92 * 0.5 / std::max(up, down); // cycles per upsampled sample
+	double center = (length - 1) / 2.0;
+	coefs.resize(length);
+	for (unsigned p = 0; p < up; p++) {
+		for (unsigned k = 0; k < taps; k++) {
+			// coefs[p][k] multiplies the input k samples after the oldest one of the window
+			unsigned n = p + (taps - 1 - k) * up;
+			double x = n - center;
+			double sinc = (x == 0.0) ? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+			double window = 0.42 - 0.5 * cos(2 * M_PI * (n + 0.5) / length) + 0.08 * cos(4 * M_PI * (n + 0.5) / length);
+			double h = up * 2 * cutoff * sinc * window;
+			coefs[p * taps + k] = (int16_t)std::max(-32768.0, std::min(32767.0, std::round(h * 32768)));
+		}
+	}
+	reset();
+}
+
+void Resampler::reset() {
+	buffer.assign(taps - 1, 0);
+	position = 0;
+}
+
+size_t Resampler::process(const int16_t *in, size_t count, int16_t *out) {
+	buffer.resize(taps - 1);
+	buffer.insert(buffer.end(), in, in + count);
+	int32_t (*dot)(const int16_t *, const int16_t *, unsigned) = &dot_scalar;
+#ifdef AUDIO_KERNELS_X86
+	if (isa == AUDIO_ISA_AVX2) dot = &dot_avx2;
+	else if (isa == AUDIO_ISA_SSE41) dot = &dot_sse41;
+#endif
+	size_t produced = 0;
+	uint64_t end = (uint64_t)count * up;
+	for (; position < end; position += down) {
+		size_t i = position / up;
+		unsigned phase = position % up;
+		int32_t acc = dot(&coefs[phase * taps], &buffer[i], taps) + (1 << 14);
+		out[produced++] = (int16_t)std::max(-32768, std::min(32767, acc >> 15));
+	}
+	position -= end;
+	// the window of the next block starts with the last taps - 1 samples
+	std::copy(buffer.end() - (taps - 1), buffer.end(), buffer.begin());
+	return produced;
+}
+
+void goertzel_power(const int16_t *in, size_t n, const float *coefs, unsigned count, float *power) {
+	unsigned k = 0;
+#ifdef AUDIO_KERNELS_X86
+	if (isa == AUDIO_ISA_AVX2 && __builtin_cpu_supports("fma")) k = goertzel_avx2(in, n, coefs, count, power);
+	if (isa >= AUDIO_ISA_SSE41) k += goertzel_sse41(in, n, coefs + k, count - k, power + k);
+#endif
+	for (; k < count; k++) {
+		float c = coefs[k];
+		float s1 = 0.0;
+		float s2 = 0.0;
+		for (size_t i = 0; i < n; i++) {
+			float s0 = in[i] + c * s1 - s2;
+			s2 = s1;
+			s1 = s0;
+		}
+		power[k] = s1 * s1 + s2 * s2 - c * s1 * s2;
+	}
+}
+
+float audio_dot(const float *a, const float *b, size_t count) {
+	float acc = 0.0;
+	size_t i = 0;
+#ifdef AUDIO_KERNELS_X86
+	if (isa == AUDIO_ISA_AVX2 && __builtin_cpu_supports("fma")) acc = dot_float_avx2(a, b, count, &i);
+	else if (isa >= AUDIO_ISA_SSE41) acc = dot_float_sse41(a, b, count, &i);
+#endif
+	for (; i < count; i++) {
+		acc += a[i] * b[i];
+	}
+	return acc;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_AUDIO_KERNELS_H
+#define VOIP_PATROL_AUDIO_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Audio kernels of the media path, vectorized with AVX2 or SSE4.1 when the CPU
+ * has them, the scalar versions are used otherwise and for the remaining samples.
+ * The G.711 conversions are bit exact with pjmedia.
+ */
+typedef enum audio_isa {
+	AUDIO_ISA_SCALAR,
+	AUDIO_ISA_SSE41,
+	AUDIO_ISA_AVX2
+} audio_isa_t;
+
+audio_isa_t audio_kernels_isa();
+const char* audio_kernels_isa_name(audio_isa_t isa);
+// limited to what the CPU supports, used to compare the implementations
+void audio_kernels_set_isa(audio_isa_t isa);
+
+void g711_ulaw_encode(const int16_t *in, uint8_t *out, size_t count);
+void g711_alaw_encode(const int16_t *in, uint8_t *out, size_t count);
+void g711_ulaw_decode(const uint8_t *in, int16_t *out, size_t count);
+void g711_alaw_decode(const uint8_t *in, int16_t *out, size_t count);
+
+// sum of a[i] * b[i], the cross-correlations of the audio scoring
+float audio_dot(const float *a, const float *b, size_t count);
+
+// Goertzel power of count frequencies over the same n samples, coefs[k] = 2cos(2pi f_k / rate),
+// the filters run side by side, 8 at a time with AVX2
+void goertzel_power(const int16_t *in, size_t n, const float *coefs, unsigned count, float *power);
+
+/*
+ * Streaming polyphase FIR resampler between 8, 16 and 48kHz (any integer ratio),
+ * Q15 coefficients, windowed sinc cut at 92% of the lowest Nyquist frequency.
+ */
+class Resampler {
+	public:
+		Resampler(unsigned in_rate, unsigned out_rate);
+		static bool supported(unsigned in_rate, unsigned out_rate);
+		// returns the number of samples written, count * out_rate / in_rate over time
+		size_t process(const int16_t *in, size_t count, int16_t *out);
+		void reset();
+		unsigned in_rate;
+		unsigned out_rate;
+	private:
+		unsigned up;
+		unsigned down;
+		unsigned taps;                // per phase, multiple of 16
+		std::vector<int16_t> coefs;   // phase after phase, in input order
+		std::vector<int16_t> buffer;  // taps - 1 previous samples followed by the block
+		uint64_t position {0};        // next output in the upsampled domain, from the block start
+};
+
+#endif
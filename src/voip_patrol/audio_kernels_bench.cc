@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+/*
+ * audio_kernels_bench: checks the G.711 kernels against pjmedia on every input
+ * and measures the samples per second of each implementation, then the resampler
+ * against pjmedia_resample on 20ms frames, and the Goertzel filters of the
+ * watermark on 20ms blocks.
+ */
+
+#include "audio_kernels.hh"
+#include <pjlib.h>
+#include <pjmedia.h>
+#include <pjmedia/alaw_ulaw.h>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#define BENCH_SAMPLES (1 << 20)
+#define BENCH_ROUNDS 64
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double msps(bench_clock::time_point start, size_t samples) {
+	double s = std::chrono::duration<double>(bench_clock::now() - start).count();
+	return samples / s / 1e6;
+}
+
+static bool check_g711() {
+	std::vector<int16_t> pcm(65536);
+	std::vector<uint8_t> codes(256);
+	std::vector<uint8_t> u(pcm.size()), a(pcm.size());
+	std::vector<int16_t> du(codes.size()), da(codes.size());
+	for (size_t i = 0; i < pcm.size(); i++) pcm[i] = (int16_t)(i - 32768);
+	for (size_t i = 0; i < codes.size(); i++) codes[i] = (uint8_t)i;
+	g711_ulaw_encode(pcm.data(), u.data(), pcm.size());
+	g711_alaw_encode(pcm.data(), a.data(), pcm.size());
+	g711_ulaw_decode(codes.data(), du.data(), codes.size());
+	g711_alaw_decode(codes.data(), da.data(), codes.size());
+	for (size_t i = 0; i < pcm.size(); i++) {
+		if (u[i] != pjmedia_linear2ulaw(pcm[i]) || a[i] != pjmedia_linear2alaw(pcm[i])) {
+			std::cout << "encode mismatch on " << pcm[i] << "\n";
+			return false;
+		}
+	}
+	for (size_t i = 0; i < codes.size(); i++) {
+		if (du[i] != pjmedia_ulaw2linear(codes[i]) || da[i] != pjmedia_alaw2linear(codes[i])) {
+			std::cout << "decode mismatch on " << i << "\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+static void bench_g711() {
+	std::vector<int16_t> pcm(BENCH_SAMPLES);
+	std::vector<uint8_t> law(BENCH_SAMPLES);
+	for (size_t i = 0; i < pcm.size(); i++) pcm[i] = (int16_t)(20000 * sin(i * 0.01) + (i * 7919) % 2000);
+
+	bench_clock::time_point start = bench_clock::now();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (size_t i = 0; i < pcm.size(); i++) law[i] = pjmedia_linear2ulaw(pcm[i]);
+	std::cout << "ulaw encode pjmedia: " << msps(start, (size_t)BENCH_SAMPLES * BENCH_ROUNDS) << " Msamples/s\n";
+	start = bench_clock::now();
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+		for (size_t i = 0; i < pcm.size(); i++) pcm[i] = pjmedia_ulaw2linear(law[i]);
+	std::cout << "ulaw decode pjmedia: " << msps(start, (size_t)BENCH_SAMPLES * BENCH_ROUNDS) << " Msamples/s\n";
+
+	audio_isa_t cpu = audio_kernels_isa();
+	for (int isa = AUDIO_ISA_SCALAR; isa <= cpu; isa++) {
+		audio_kernels_set_isa((audio_isa_t)isa);
+		if (!check_g711()) {
+			std::cout << audio_kernels_isa_name((audio_isa_t)isa) << " is not bit exact\n";
+			continue;
+		}
+		start = bench_clock::now();
+		for (int r = 0; r < BENCH_ROUNDS; r++) g711_ulaw_encode(pcm.data(), law.data(), pcm.size());
+		std::cout << "ulaw encode " << audio_kernels_isa_name((audio_isa_t)isa) << ": " << msps(start, (size_t)BENCH_SAMPLES * BENCH_ROUNDS) << " Msamples/s\n";
+		start = bench_clock::now();
+		for (int r = 0; r < BENCH_ROUNDS; r++) g711_alaw_encode(pcm.data(), law.data(), pcm.size());
+		std::cout << "alaw encode " << audio_kernels_isa_name((audio_isa_t)isa) << ": " << msps(start, (size_t)BENCH_SAMPLES * BENCH_ROUNDS) << " Msamples/s\n";
+		start = bench_clock::now();
+		for (int r = 0; r < BENCH_ROUNDS; r++) g711_ulaw_decode(law.data(), pcm.data(), pcm.size());
+		std::cout << "ulaw decode " << audio_kernels_isa_name((audio_isa_t)isa) << ": " << msps(start, (size_t)BENCH_SAMPLES * BENCH_ROUNDS) << " Msamples/s\n";
+	}
+	audio_kernels_set_isa(cpu);
+}
+
+static void bench_resample(pj_pool_t *pool, unsigned in_rate, unsigned out_rate) {
+	unsigned in_spf = in_rate / 50;
+	unsigned out_spf = out_rate / 50;
+	unsigned frames = BENCH_SAMPLES / in_spf;
+	std::vector<int16_t> in(frames * in_spf);
+	std::vector<int16_t> out(out_spf);
+	for (size_t i = 0; i < in.size(); i++) in[i] = (int16_t)(10000 * sin(2 * M_PI * 440 * i / in_rate));
+
+	pjmedia_resample *resample;
+	if (pjmedia_resample_create(pool, PJ_TRUE, PJ_FALSE, 1, in_rate, out_rate, in_spf, &resample) != PJ_SUCCESS) {
+		return;
+	}
+	bench_clock::time_point start = bench_clock::now();
+	for (unsigned f = 0; f < frames; f++) pjmedia_resample_run(resample, &in[f * in_spf], out.data());
+	std::cout << in_rate << "Hz to " << out_rate << "Hz pjmedia: " << msps(start, in.size()) << " Msamples/s\n";
+	pjmedia_resample_destroy(resample);
+
+	Resampler resampler(in_rate, out_rate);
+	start = bench_clock::now();
+	for (unsigned f = 0; f < frames; f++) resampler.process(&in[f * in_spf], in_spf, out.data());
+	std::cout << in_rate << "Hz to " << out_rate << "Hz " << audio_kernels_isa_name(audio_kernels_isa()) << ": " << msps(start, in.size()) << " Msamples/s\n";
+}
+
+static void bench_goertzel() {
+	std::vector<int16_t> in(BENCH_SAMPLES);
+	for (size_t i = 0; i < in.size(); i++) in[i] = (int16_t)(10000 * sin(2 * M_PI * 1300 * i / 8000));
+	float coefs[17];
+	float power[17];
+	for (int k = 0; k < 17; k++) coefs[k] = 2 * cos(2 * M_PI * (700 + 150 * k) / 8000);
+
+	audio_isa_t cpu = audio_kernels_isa();
+	for (int isa = AUDIO_ISA_SCALAR; isa <= cpu; isa++) {
+		audio_kernels_set_isa((audio_isa_t)isa);
+		bench_clock::time_point start = bench_clock::now();
+		for (size_t i = 0; i + 160 <= in.size(); i += 160) goertzel_power(&in[i], 160, coefs, 17, power);
+		std::cout << "goertzel 17 tones " << audio_kernels_isa_name((audio_isa_t)isa) << ": " << msps(start, in.size()) << " Msamples/s\n";
+	}
+	audio_kernels_set_isa(cpu);
+}
+
+int main() {
+	pj_caching_pool cp;
+	pj_init();
+	pj_log_set_level(1);
+	pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+	pj_pool_t *pool = pj_pool_create(&cp.factory, "bench", 4000, 4000, NULL);
+
+	std::cout << "cpu: " << audio_kernels_isa_name(audio_kernels_isa()) << "\n";
+	bench_g711();
+	unsigned rates[][2] = {{8000, 16000}, {16000, 8000}, {8000, 48000}, {48000, 8000}, {16000, 48000}, {48000, 16000}};
+	for (auto &r : rates) {
+		bench_resample(pool, r[0], r[1]);
+	}
+	bench_goertzel();
+
+	pj_pool_release(pool);
+	pj_caching_pool_destroy(&cp);
+	pj_shutdown();
+	return 0;
+}
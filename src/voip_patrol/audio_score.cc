@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "audio_score.hh"
+#include "audio_kernels.hh"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#define SCORE_FRAME 256         // 32ms
+#define SCORE_HOP 128
+#define SCORE_BLOCK 32          // 4ms envelope blocks of the coarse alignment
+#define SCORE_MAX_DELAY_MS 2000
+#define SCORE_FINE_SAMPLES 64
+#define SCORE_LEVEL 200.0       // RMS of the active speech once normalized
+#define SCORE_ASYM_FLOOR 5e5    // band power under which added components are not heard, about 20dB under the speech
+#define SCORE_AGGREGATE 20      // frames of a block of the disturbance aggregation
+#define SCORE_SILENCE_DB 35.0   // frames this far below the loudest reference frame are not scored
+
+static std::vector<float> envelope(const std::vector<float> &x) {
+	std::vector<float> env(x.size() / SCORE_BLOCK);
+	for (size_t b = 0; b < env.size(); b++) {
+		env[b] = sqrt(audio_dot(&x[b * SCORE_BLOCK], &x[b * SCORE_BLOCK], SCORE_BLOCK) / SCORE_BLOCK);
+	}
+	float mean = 0;
+	for (float v : env) mean += v;
+	mean = env.empty() ? 0 : mean / env.size();
+	for (float &v : env) v -= mean;
+	return env;
+}
+
+// correlation of ref[i] with deg[i + lag], normalized by the overlap
+static float correlation(const std::vector<float> &ref, const std::vector<float> &deg, long lag) {
+	long start = std::max(0L, -lag);
+	long end = std::min((long)ref.size(), (long)deg.size() - lag);
+	if (end - start < 1) {
+		return -INFINITY;
+	}
+	return audio_dot(&ref[start], &deg[start + lag], end - start) / sqrt((float)(end - start));
+}
+
+static long align(const std::vector<float> &ref, const std::vector<float> &deg) {
+	std::vector<float> env_ref = envelope(ref);
+	std::vector<float> env_deg = envelope(deg);
+	long max_lag = SCORE_MAX_DELAY_MS * AUDIO_SCORE_RATE / 1000 / SCORE_BLOCK;
+	long coarse = 0;
+	float best = -INFINITY;
+	for (long lag = -max_lag; lag <= max_lag; lag++) {
+		float c = correlation(env_ref, env_deg, lag);
+		if (c > best) {
+			best = c;
+			coarse = lag;
+		}
+	}
+	long delay = coarse * SCORE_BLOCK;
+	best = -INFINITY;
+	for (long lag = coarse * SCORE_BLOCK - SCORE_FINE_SAMPLES; lag <= coarse * SCORE_BLOCK + SCORE_FINE_SAMPLES; lag++) {
+		float c = correlation(ref, deg, lag);
+		if (c > best) {
+			best = c;
+			delay = lag;
+		}
+	}
+	return delay;
+}
+
+static void fft(std::vector<std::complex<float>> &a) {
+	size_t n = a.size();
+	for (size_t i = 1, j = 0; i < n; i++) {
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) std::swap(a[i], a[j]);
+	}
+	for (size_t len = 2; len <= n; len <<= 1) {
+		std::complex<float> w(cos(-2 * M_PI / len), sin(-2 * M_PI / len));
+		for (size_t i = 0; i < n; i += len) {
+			std::complex<float> wn(1);
+			for (size_t k = 0; k < len / 2; k++) {
+				std::complex<float> u = a[i + k];
+				std::complex<float> v = a[i + k + len / 2] * wn;
+				a[i + k] = u + v;
+				a[i + k + len / 2] = u - v;
+				wn *= w;
+			}
+		}
+	}
+}
+
+static float bark(float hz) {
+	return 13 * atan(0.00076 * hz) + 3.5 * atan((hz / 7500) * (hz / 7500));
+}
+
+// band of every FFT bin, one Bark wide, the DC bin is left out
+static std::vector<int> bark_bands(int *count) {
+	std::vector<int> band(SCORE_FRAME / 2 + 1, -1);
+	for (int k = 1; k <= SCORE_FRAME / 2; k++) {
+		band[k] = (int)bark(k * (float)AUDIO_SCORE_RATE / SCORE_FRAME);
+	}
+	*count = band[SCORE_FRAME / 2] + 1;
+	return band;
+}
+
+// Zwicker loudness of the Bark bands of one frame
+static void loudness(const float *x, const std::vector<float> &window, const std::vector<int> &band, int bands,
+                     std::vector<float> &power, std::vector<float> &loud) {
+	std::vector<std::complex<float>> spectrum(SCORE_FRAME);
+	for (int i = 0; i < SCORE_FRAME; i++) {
+		spectrum[i] = x[i] * window[i];
+	}
+	fft(spectrum);
+	power.assign(bands, 0.0);
+	for (int k = 1; k <= SCORE_FRAME / 2; k++) {
+		power[band[k]] += std::norm(spectrum[k]);
+	}
+	loud.resize(bands);
+	for (int b = 0; b < bands; b++) {
+		loud[b] = pow(power[b] + 1.0f, 0.23f);
+	}
+}
+
+AudioScore audio_score(const std::vector<float> &reference, const std::vector<float> &degraded) {
+	AudioScore score;
+	if (reference.size() < SCORE_FRAME * 4 || degraded.size() < SCORE_FRAME * 4) {
+		return score;
+	}
+	long delay = align(reference, degraded);
+	score.delay_ms = delay * 1000.0 / AUDIO_SCORE_RATE;
+	long start = std::max(0L, -delay);
+	long end = std::min((long)reference.size(), (long)degraded.size() - delay);
+	long frames = (end - start - SCORE_FRAME) / SCORE_HOP;
+	if (frames < 4) {
+		return score;
+	}
+
+	// active speech frames of the reference
+	std::vector<float> energy(frames);
+	float loudest = 0;
+	for (long f = 0; f < frames; f++) {
+		const float *r = &reference[start + f * SCORE_HOP];
+		energy[f] = audio_dot(r, r, SCORE_FRAME);
+		loudest = std::max(loudest, energy[f]);
+	}
+	float threshold = loudest * pow(10.0, -SCORE_SILENCE_DB / 10);
+
+	// level normalization on the active frames, both at the reference speech level
+	double ref_energy = 0, deg_energy = 0;
+	for (long f = 0; f < frames; f++) {
+		if (energy[f] < threshold) continue;
+		const float *d = &degraded[start + delay + f * SCORE_HOP];
+		ref_energy += energy[f];
+		deg_energy += audio_dot(d, d, SCORE_FRAME);
+	}
+	if (ref_energy <= 0) {
+		return score;
+	}
+	float ref_gain = SCORE_LEVEL / sqrt(ref_energy / frames / SCORE_FRAME);
+	float deg_gain = deg_energy > 0 ? ref_gain * sqrt(ref_energy / deg_energy) : 0.0;
+	score.gain_db = deg_energy > 0 ? 10 * log10(ref_energy / deg_energy) : 0.0;
+
+	int bands;
+	std::vector<int> band = bark_bands(&bands);
+	std::vector<float> window(SCORE_FRAME);
+	for (int i = 0; i < SCORE_FRAME; i++) {
+		window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / SCORE_FRAME);
+	}
+	std::vector<float> r(SCORE_FRAME), d(SCORE_FRAME);
+	std::vector<float> ref_power, deg_power, ref_loud, deg_loud;
+	std::vector<float> frame_sym, frame_asym;
+	for (long f = 0; f < frames; f++) {
+		if (energy[f] < threshold) continue;
+		for (int i = 0; i < SCORE_FRAME; i++) {
+			r[i] = reference[start + f * SCORE_HOP + i] * ref_gain;
+			d[i] = degraded[start + delay + f * SCORE_HOP + i] * deg_gain;
+		}
+		loudness(r.data(), window, band, bands, ref_power, ref_loud);
+		loudness(d.data(), window, band, bands, deg_power, deg_loud);
+		float sym = 0, asym = 0;
+		for (int b = 0; b < bands; b++) {
+			// small differences are masked
+			float diff = std::fabs(deg_loud[b] - ref_loud[b]) - 0.25f * std::min(ref_loud[b], deg_loud[b]);
+			diff = std::max(0.0f, diff);
+			sym += diff * diff;
+			// added components (noise, distortion) are more annoying than missing ones
+			float ratio = pow((deg_power[b] + SCORE_ASYM_FLOOR) / (ref_power[b] + SCORE_ASYM_FLOOR), 1.2f);
+			asym += diff * (ratio < 3 ? 0.0f : std::min(ratio, 12.0f));
+		}
+		frame_sym.push_back(sqrt(sym / bands));
+		frame_asym.push_back(asym / bands);
+	}
+	score.frames = frame_sym.size();
+	if (score.frames == 0) {
+		return score;
+	}
+	// L6 within blocks of 20 frames then L2 over the blocks, a short bad burst weighs more than with a mean
+	double sym = 0, asym = 0;
+	int blocks = 0;
+	for (size_t b = 0; b < frame_sym.size(); b += SCORE_AGGREGATE) {
+		size_t n = std::min((size_t)SCORE_AGGREGATE, frame_sym.size() - b);
+		double block_sym = 0, block_asym = 0;
+		for (size_t f = b; f < b + n; f++) {
+			block_sym += pow(frame_sym[f], 6.0);
+			block_asym += pow(frame_asym[f], 6.0);
+		}
+		block_sym = pow(block_sym / n, 1.0 / 6);
+		block_asym = pow(block_asym / n, 1.0 / 6);
+		sym += block_sym * block_sym;
+		asym += block_asym * block_asym;
+		blocks++;
+	}
+	score.disturbance = sqrt(sym / blocks);
+	score.asymmetric = sqrt(asym / blocks);
+	float raw = 4.5 - 0.1 * score.disturbance - 0.0309 * score.asymmetric;
+	// P.862.1 mapping to the MOS-LQO scale
+	score.mos = 0.999 + 4.0 / (1 + exp(-1.4945 * raw + 4.6607));
+	score.mos = std::max(1.0f, std::min(4.5f, score.mos));
+	score.valid = true;
+	return score;
+}
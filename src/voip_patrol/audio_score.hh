@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_AUDIO_SCORE_H
+#define VOIP_PATROL_AUDIO_SCORE_H
+
+#include <vector>
+
+#define AUDIO_SCORE_RATE 8000
+
+struct AudioScore {
+	bool valid {false};
+	float mos {0.0};          // 1 to 4.5, MOS-LQO scale
+	float delay_ms {0.0};     // of the degraded signal against the reference
+	float gain_db {0.0};      // applied to the degraded signal by the level normalization
+	float disturbance {0.0};  // symmetric
+	float asymmetric {0.0};   // added distortion
+	int frames {0};           // active speech frames scored
+};
+
+/*
+ * Perceptual comparison of a degraded signal with its reference, both 8kHz:
+ * time alignment by envelope then sample cross-correlation, level normalization
+ * on the active speech, then Bark band loudness disturbance mapped to MOS like P.862.
+ * It is not a certified PESQ implementation, scores are comparable between runs.
+ */
+AudioScore audio_score(const std::vector<float> &reference, const std::vector<float> &degraded);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "audio_sink.hh"
+#include "direct_media.hh"
+#include <string.h>
+
+#define AUDIO_SINK_SIGNATURE PJMEDIA_SIGNATURE('V', 'P', 'A', 'S')
+#define AUDIO_SOURCE_SIGNATURE PJMEDIA_SIGNATURE('V', 'P', 'A', 'O')
+#define AUDIO_SINK_PTIME 20
+
+AudioSink::AudioSink(unsigned clock_rate) : clock_rate(clock_rate) {
+	memset(&bridge_port, 0, sizeof(bridge_port));
+}
+
+AudioSink::~AudioSink() {
+	if (pool) {
+		pj_pool_release(pool);
+	}
+}
+
+// a port added to the conference bridge, it only listens
+pjmedia_port* AudioSink::port() {
+	if (!pool) {
+		pool = pjsua_pool_create("audio_sink", 512, 512);
+		pj_str_t name = pj_str((char *)"audio_sink");
+		pjmedia_port_info_init(&bridge_port.info, &name, AUDIO_SINK_SIGNATURE, clock_rate, 1, 16, clock_rate * AUDIO_SINK_PTIME / 1000);
+		bridge_port.put_frame = &port_put_frame;
+		bridge_port.get_frame = &port_get_frame;
+		bridge_port.port_data.pdata = this;
+	}
+	return &bridge_port;
+}
+
+pj_status_t AudioSink::port_put_frame(pjmedia_port *port, pjmedia_frame *frame) {
+	AudioSink *sink = (AudioSink *)port->port_data.pdata;
+	if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+		sink->put((const pj_int16_t *)frame->buf, frame->size / sizeof(pj_int16_t));
+	}
+	return PJ_SUCCESS;
+}
+
+pj_status_t AudioSink::port_get_frame(pjmedia_port *port, pjmedia_frame *frame) {
+	PJ_UNUSED_ARG(port);
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	frame->size = 0;
+	return PJ_SUCCESS;
+}
+
+AudioSource::AudioSource(unsigned clock_rate) : clock_rate(clock_rate) {
+	memset(&bridge_port, 0, sizeof(bridge_port));
+}
+
+AudioSource::~AudioSource() {
+	if (pool) {
+		pj_pool_release(pool);
+	}
+}
+
+// a port added to the conference bridge, it only speaks
+pjmedia_port* AudioSource::port() {
+	if (!pool) {
+		pool = pjsua_pool_create("audio_source", 512, 512);
+		pj_str_t name = pj_str((char *)"audio_source");
+		pjmedia_port_info_init(&bridge_port.info, &name, AUDIO_SOURCE_SIGNATURE, clock_rate, 1, 16, clock_rate * AUDIO_SINK_PTIME / 1000);
+		bridge_port.put_frame = &port_put_frame;
+		bridge_port.get_frame = &port_get_frame;
+		bridge_port.port_data.pdata = this;
+	}
+	return &bridge_port;
+}
+
+pj_status_t AudioSource::port_put_frame(pjmedia_port *port, pjmedia_frame *frame) {
+	PJ_UNUSED_ARG(port);
+	PJ_UNUSED_ARG(frame);
+	return PJ_SUCCESS;
+}
+
+pj_status_t AudioSource::port_get_frame(pjmedia_port *port, pjmedia_frame *frame) {
+	AudioSource *source = (AudioSource *)port->port_data.pdata;
+	unsigned count = source->clock_rate * AUDIO_SINK_PTIME / 1000;
+	memset(frame->buf, 0, count * sizeof(pj_int16_t));
+	source->mix((pj_int16_t *)frame->buf, count);
+	frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame->size = count * sizeof(pj_int16_t);
+	return PJ_SUCCESS;
+}
+
+bool MediaTaps::add_sink(std::shared_ptr<AudioSink> sink, DirectMedia *direct_media, int call_port) {
+	taps.push_back(Tap{sink, sink.get(), nullptr, direct_media, PJSUA_INVALID_ID});
+	if (direct_media) {
+		direct_media->add_sink(sink.get());
+		return true;
+	}
+	return pjsua_conf_add_port(sink->get_pool(), sink->port(), &taps.back().slot) == PJ_SUCCESS &&
+	       pjsua_conf_connect(call_port, taps.back().slot) == PJ_SUCCESS;
+}
+
+bool MediaTaps::add_source(std::shared_ptr<AudioSource> source, DirectMedia *direct_media, int call_port) {
+	taps.push_back(Tap{source, nullptr, source.get(), direct_media, PJSUA_INVALID_ID});
+	if (direct_media) {
+		return direct_media->add_source(source.get());
+	}
+	return pjsua_conf_add_port(source->get_pool(), source->port(), &taps.back().slot) == PJ_SUCCESS &&
+	       pjsua_conf_connect(taps.back().slot, call_port) == PJ_SUCCESS;
+}
+
+// the direct media path lets go at once, the bridge on its next tick
+void MediaTaps::detach(std::vector<std::shared_ptr<void>> &owners) {
+	for (auto &tap : taps) {
+		if (tap.direct_media && tap.sink) {
+			tap.direct_media->remove_sink(tap.sink);
+		}
+		if (tap.direct_media && tap.source) {
+			tap.direct_media->remove_source(tap.source);
+		}
+		if (tap.slot != PJSUA_INVALID_ID) {
+			pjsua_conf_remove_port(tap.slot);
+		}
+		owners.push_back(tap.owner);
+	}
+	taps.clear();
+}
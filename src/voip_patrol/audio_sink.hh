@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_AUDIO_SINK_H
+#define VOIP_PATROL_AUDIO_SINK_H
+
+#include <pjmedia.h>
+#include <pjsua-lib/pjsua.h>
+#include <memory>
+#include <vector>
+
+class DirectMedia;
+
+/*
+ * Receiver of the audio of a call, fed by the direct media tap or, through its
+ * port, by the conference bridge. put() runs in the media clock thread.
+ */
+class AudioSink {
+	public:
+		AudioSink(unsigned clock_rate);
+		virtual ~AudioSink();
+		virtual void put(const pj_int16_t *samples, unsigned count) = 0;
+		pjmedia_port* port();
+		pj_pool_t* get_pool() { return pool; }
+		unsigned clock_rate;
+	private:
+		static pj_status_t port_put_frame(pjmedia_port *port, pjmedia_frame *frame);
+		static pj_status_t port_get_frame(pjmedia_port *port, pjmedia_frame *frame);
+		pj_pool_t *pool {nullptr};
+		pjmedia_port bridge_port;
+};
+
+/*
+ * Audio added to the sent audio of a call, mixed by the direct media tap or,
+ * through its port, by the conference bridge. mix() runs in the media clock thread.
+ */
+class AudioSource {
+	public:
+		AudioSource(unsigned clock_rate);
+		virtual ~AudioSource();
+		virtual void mix(pj_int16_t *samples, unsigned count) = 0; // adds to the samples, saturated
+		pjmedia_port* port();
+		pj_pool_t* get_pool() { return pool; }
+		unsigned clock_rate;
+	private:
+		static pj_status_t port_put_frame(pjmedia_port *port, pjmedia_frame *frame);
+		static pj_status_t port_get_frame(pjmedia_port *port, pjmedia_frame *frame);
+		pj_pool_t *pool {nullptr};
+		pjmedia_port bridge_port;
+};
+
+/*
+ * The sinks and sources tapping the audio of a call, attached to its direct media
+ * path or, through their ports, to its port of the conference bridge.
+ * They are detached together, the bridge removes a port on its next tick: the
+ * owners are handed back to be freed later.
+ */
+class MediaTaps {
+	public:
+		bool add_sink(std::shared_ptr<AudioSink> sink, DirectMedia *direct_media, int call_port);
+		bool add_source(std::shared_ptr<AudioSource> source, DirectMedia *direct_media, int call_port);
+		void detach(std::vector<std::shared_ptr<void>> &owners);
+		bool empty() const { return taps.empty(); }
+	private:
+		struct Tap {
+			std::shared_ptr<void> owner;
+			AudioSink *sink;
+			AudioSource *source;
+			DirectMedia *direct_media;
+			pjsua_conf_port_id slot;
+		};
+		std::vector<Tap> taps;
+};
+
+#endif
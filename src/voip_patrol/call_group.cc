@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "call_group.hh"
+#include <algorithm>
+#include <stdio.h>
+
+std::string CallGroupStats::json() const {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "\"calls\": %d, \"completed\": %d, \"asr\": %.2f, \"5xx\": %.2f, \"503\": %.2f, "
+		"\"retransmissions\": %.2f, \"pdd_p99_ms\": %d, \"mos\": %.2f",
+		calls, completed, percent(answered), percent(failed_5xx), percent(failed_503),
+		percent(retransmitted), pdd_p99_ms, mos);
+	return buf;
+}
+
+void CallGroup::started() {
+	active_calls++;
+	std::lock_guard<std::mutex> guard(lock);
+	totals.calls++;
+}
+
+void CallGroup::ended() {
+	active_calls--;
+}
+
+void CallGroup::completed(int code, int pdd, float mos, int retransmissions) {
+	std::lock_guard<std::mutex> guard(lock);
+	totals.completed++;
+	if (code >= 200 && code < 300) {
+		totals.answered++;
+	} else if (code >= 500 && code < 600) {
+		totals.failed_5xx++;
+		if (code == 503) {
+			totals.failed_503++;
+		}
+	}
+	if (retransmissions > 0) {
+		totals.retransmitted++;
+	}
+	if (pdd > 0) {
+		pdd_ms.push_back(pdd);
+	}
+	if (mos > 0) {
+		mos_sum += mos;
+		mos_count++;
+	}
+}
+
+CallGroupStats CallGroup::stats() {
+	std::lock_guard<std::mutex> guard(lock);
+	CallGroupStats res = totals;
+	if (!pdd_ms.empty()) {
+		std::vector<int> sorted = pdd_ms;
+		size_t idx = std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.99));
+		std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+		res.pdd_p99_ms = sorted[idx];
+	}
+	res.mos = mos_count ? mos_sum / mos_count : 0.0;
+	return res;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_CALL_GROUP_H
+#define VOIP_PATROL_CALL_GROUP_H
+
+#include "rate_controller.hh"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct CallGroupStats {
+	int calls {0};          // INVITE sent
+	int completed {0};      // result known
+	int answered {0};
+	int failed_5xx {0};
+	int failed_503 {0};
+	int retransmitted {0};  // INVITE sent more than once
+	int pdd_p99_ms {0};     // INVITE to first ringing or answer
+	float mos {0.0};        // average, 0 without rtp_stats
+	float percent(int n) const { return completed ? 100.0 * n / completed : 0.0; }
+	std::string json() const;
+};
+
+/*
+ * Calls made together by one action (concurrency target, capacity probe),
+ * shared with their Test, the calls up and their outcome are accounted as they end.
+ */
+class CallGroup {
+	public:
+		void started();
+		void ended();
+		void completed(int code, int pdd_ms, float mos, int retransmissions);
+		int active() const { return active_calls; }
+		CallGroupStats stats();
+		std::shared_ptr<RateController> controller; // backpressure of the paced calls, null without
+	private:
+		std::atomic<int> active_calls {0};
+		std::mutex lock;
+		CallGroupStats totals;
+		std::vector<int> pdd_ms;
+		double mos_sum {0.0};
+		int mos_count {0};
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "capacity.hh"
+#include <algorithm>
+#include <stdio.h>
+
+CapacitySearch::CapacitySearch(Config *config, const CallAction &call, const vector<ActionCheck> &checks,
+                               const pj::SipHeaderVector &x_headers, const vector<ActionParam> &params)
+	: config(config), call(call), checks(checks), x_headers(x_headers) {
+	for (auto &param : params) {
+		if (param.name.compare("mode") == 0) concurrency = (param.s_val.compare("concurrency") == 0);
+		else if (param.name.compare("min") == 0 && param.f_val > 0) min = param.f_val;
+		else if (param.name.compare("max") == 0) max = param.f_val;
+		else if (param.name.compare("resolution") == 0 && param.f_val > 0) resolution = param.f_val;
+		else if (param.name.compare("step_duration") == 0 && param.i_val > 0) step_duration = param.i_val;
+		else if (param.name.compare("drain") == 0 && param.i_val > 0) drain = param.i_val;
+		else if (param.name.compare("slo_asr") == 0) slo.asr = param.f_val;
+		else if (param.name.compare("slo_5xx") == 0) slo.failed_5xx = param.f_val;
+		else if (param.name.compare("slo_503") == 0) slo.failed_503 = param.f_val;
+		else if (param.name.compare("slo_retransmissions") == 0) slo.retransmissions = param.f_val;
+		else if (param.name.compare("slo_pdd_p99") == 0) slo.pdd_p99_ms = param.i_val;
+		else if (param.name.compare("slo_mos") == 0) slo.mos = param.f_val;
+	}
+	this->call.repeat = 0;
+	this->call.concurrency = 0;
+	// the probes offer a fixed load
+	this->call.backpressure = false;
+}
+
+bool CapacitySearch::check_slo(const CallGroupStats &stats, std::string &reason) const {
+	char buf[128];
+	if (stats.completed == 0) {
+		reason = "no call completed";
+		return false;
+	}
+	if (slo.asr > 0 && stats.percent(stats.answered) < slo.asr) {
+		snprintf(buf, sizeof(buf), "asr %.2f < %.2f", stats.percent(stats.answered), slo.asr);
+	} else if (slo.failed_5xx > 0 && stats.percent(stats.failed_5xx) > slo.failed_5xx) {
+		snprintf(buf, sizeof(buf), "5xx %.2f > %.2f", stats.percent(stats.failed_5xx), slo.failed_5xx);
+	} else if (slo.failed_503 > 0 && stats.percent(stats.failed_503) > slo.failed_503) {
+		snprintf(buf, sizeof(buf), "503 %.2f > %.2f", stats.percent(stats.failed_503), slo.failed_503);
+	} else if (slo.retransmissions > 0 && stats.percent(stats.retransmitted) > slo.retransmissions) {
+		snprintf(buf, sizeof(buf), "retransmissions %.2f > %.2f", stats.percent(stats.retransmitted), slo.retransmissions);
+	} else if (slo.pdd_p99_ms > 0 && stats.pdd_p99_ms > slo.pdd_p99_ms) {
+		snprintf(buf, sizeof(buf), "pdd_p99_ms %d > %d", stats.pdd_p99_ms, slo.pdd_p99_ms);
+	} else if (slo.mos > 0 && stats.mos < slo.mos) {
+		snprintf(buf, sizeof(buf), "mos %.2f < %.2f", stats.mos, slo.mos);
+	} else {
+		reason = "";
+		return true;
+	}
+	reason = buf;
+	return false;
+}
+
+CapacityStep CapacitySearch::probe(float load) {
+	std::shared_ptr<CallGroup> group = std::make_shared<CallGroup>();
+	CallAction probe_call = call;
+
+	LOG(logINFO) << __FUNCTION__ << ": " << (concurrency ? "concurrency:" : "cps:") << load << " for " << step_duration << "s";
+	if (concurrency) {
+		probe_call.concurrency = std::max(1, (int)load);
+		probe_call.concurrency_duration = step_duration;
+		probe_call.concurrency_ramp = 0;
+		config->action.do_call_concurrency(probe_call, checks, x_headers, group);
+	} else {
+		probe_call.rate = load;
+		pj_time_val start, now;
+		pj_gettimeofday(&start);
+		int elapsed_ms = 0;
+		while (elapsed_ms < step_duration * 1000) {
+			config->total_tasks_count += 1;
+			if (!config->action.do_call(probe_call, checks, x_headers, group)) {
+				break;
+			}
+			config->action.pace_arrival(probe_call);
+			pj_gettimeofday(&now);
+			PJ_TIME_VAL_SUB(now, start);
+			elapsed_ms = PJ_TIME_VAL_MSEC(now);
+		}
+	}
+
+	// the outcome of a step is known when its calls ended
+	vector<ActionParam> wait_params = config->action.get_params(ActionType::wait);
+	config->action.set_param_by_name(&wait_params, "ms", "100");
+	for (int waited_ms = 0; group->active() > 0 && waited_ms < drain * 1000; waited_ms += 100) {
+		config->action.do_wait(wait_params);
+	}
+
+	CapacityStep step;
+	step.load = load;
+	step.stats = group->stats();
+	step.pass = check_slo(step.stats, step.reason);
+	LOG(logINFO) << __FUNCTION__ << ": load:" << load << (step.pass ? " PASS " : " FAIL ") << step.reason << " {" << step.stats.json() << "}";
+	return step;
+}
+
+std::string CapacitySearch::json(float knee) const {
+	char buf[64];
+	std::string res = "{\"capacity\": {\"mode\": \"";
+	res += concurrency ? "concurrency" : "cps";
+	snprintf(buf, sizeof(buf), "%.2f", knee);
+	res += "\", \"knee\": " + std::string(buf) + ", \"curve\": [";
+	for (size_t i = 0; i < curve.size(); i++) {
+		if (i > 0) {
+			res += ", ";
+		}
+		snprintf(buf, sizeof(buf), "%.2f", curve[i].load);
+		res += "{\"load\": " + std::string(buf) + ", \"pass\": " + (curve[i].pass ? "true" : "false")
+			+ ", \"reason\": \"" + curve[i].reason + "\", " + curve[i].stats.json() + "}";
+	}
+	res += "]}}";
+	return res;
+}
+
+void CapacitySearch::run() {
+	if (max < min) {
+		LOG(logERROR) << __FUNCTION__ << ": invalid load range " << min << "-" << max;
+		config->total_tasks_count += 100;
+		return;
+	}
+	float pass = 0.0;  // highest load meeting the SLO
+	float fail = 0.0;  // lowest load missing it
+	float load = min;
+
+	while (true) {
+		CapacityStep step = probe(load);
+		curve.push_back(step);
+		if (step.pass) {
+			pass = load;
+		} else {
+			fail = load;
+			if (pass == 0.0) {
+				// even the lowest load fails
+				break;
+			}
+		}
+		if (fail == 0.0) {
+			if (load >= max) {
+				break;
+			}
+			load = std::min(max, load * 2);
+		} else {
+			if (fail - pass <= resolution) {
+				break;
+			}
+			load = (pass + fail) / 2;
+			if (concurrency) {
+				load = (int)load;
+				if (load <= pass) {
+					break;
+				}
+			}
+		}
+	}
+
+	std::string res = json(pass);
+	config->result_file.write(res);
+	config->result_file.flush();
+	LOG(logINFO) << __FUNCTION__ << ": " << res;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_CAPACITY_H
+#define VOIP_PATROL_CAPACITY_H
+
+#include "voip_patrol.hh"
+#include <string>
+#include <vector>
+
+/* thresholds a load step must meet, a zero value is not checked */
+struct CapacitySlo {
+	float asr {0.0};             // minimum % of answered calls
+	float failed_5xx {0.0};      // maximum % of 5xx
+	float failed_503 {0.0};      // maximum % of 503
+	float retransmissions {0.0}; // maximum % of retransmitted INVITE
+	int pdd_p99_ms {0};          // maximum
+	float mos {0.0};             // minimum average
+};
+
+struct CapacityStep {
+	float load;
+	bool pass;
+	std::string reason;
+	CallGroupStats stats;
+};
+
+/*
+ * Capacity search, the load (calls per second or simultaneous calls) doubles
+ * from min until a step misses the SLO or max is reached, then the highest
+ * passing load is bisected down to the resolution.
+ */
+class CapacitySearch {
+	public:
+		CapacitySearch(Config *config, const CallAction &call, const vector<ActionCheck> &checks,
+		               const pj::SipHeaderVector &x_headers, const vector<ActionParam> &params);
+		void run();
+	private:
+		CapacityStep probe(float load);
+		bool check_slo(const CallGroupStats &stats, std::string &reason) const;
+		std::string json(float knee) const;
+		Config *config;
+		CallAction call;
+		const vector<ActionCheck> &checks;
+		const pj::SipHeaderVector &x_headers;
+		bool concurrency {false};
+		float min {1.0};
+		float max {0.0};
+		float resolution {1.0};
+		int step_duration {30};
+		int drain {60};
+		CapacitySlo slo;
+		std::vector<CapacityStep> curve;
+};
+
+#endif
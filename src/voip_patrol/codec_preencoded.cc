@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "codec_preencoded.hh"
+#include "audio_kernels.hh"
+#include "log.h"
+#include <pjmedia-codec.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#define THIS_FILE "codec_preencoded.cc"
+#define PREENCODED_CLOCK_RATE 8000
+#define PREENCODED_FRAME_PTIME 10
+#define PREENCODED_FRAMES_PER_PACKET 2
+#define PREENCODED_SAMPLES_PER_FRAME (PREENCODED_CLOCK_RATE * PREENCODED_FRAME_PTIME / 1000)
+
+void preencode_play_file(const std::string& file_name) {
+	preencoded_payload(file_name, PJMEDIA_RTP_PT_PCMU);
+	preencoded_payload(file_name, PJMEDIA_RTP_PT_PCMA);
+}
+
+static pj_status_t factory_test_alloc(pjmedia_codec_factory *factory, const pjmedia_codec_info *info);
+static pj_status_t factory_default_attr(pjmedia_codec_factory *factory, const pjmedia_codec_info *info, pjmedia_codec_param *attr);
+static pj_status_t factory_enum_info(pjmedia_codec_factory *factory, unsigned *count, pjmedia_codec_info codecs[]);
+static pj_status_t factory_alloc_codec(pjmedia_codec_factory *factory, const pjmedia_codec_info *info, pjmedia_codec **p_codec);
+static pj_status_t factory_dealloc_codec(pjmedia_codec_factory *factory, pjmedia_codec *codec);
+static pj_status_t factory_destroy(void);
+
+static pj_status_t codec_init(pjmedia_codec *codec, pj_pool_t *pool);
+static pj_status_t codec_open(pjmedia_codec *codec, pjmedia_codec_param *attr);
+static pj_status_t codec_close(pjmedia_codec *codec);
+static pj_status_t codec_modify(pjmedia_codec *codec, const pjmedia_codec_param *attr);
+static pj_status_t codec_parse(pjmedia_codec *codec, void *pkt, pj_size_t pkt_size, const pj_timestamp *ts,
+                               unsigned *frame_cnt, pjmedia_frame frames[]);
+static pj_status_t codec_encode(pjmedia_codec *codec, const pjmedia_frame *input, unsigned output_buf_len, pjmedia_frame *output);
+static pj_status_t codec_decode(pjmedia_codec *codec, const pjmedia_frame *input, unsigned output_buf_len, pjmedia_frame *output);
+static pj_status_t codec_recover(pjmedia_codec *codec, unsigned output_buf_len, pjmedia_frame *output);
+
+static pjmedia_codec_factory_op factory_op = {
+	&factory_test_alloc,
+	&factory_default_attr,
+	&factory_enum_info,
+	&factory_alloc_codec,
+	&factory_dealloc_codec,
+	&factory_destroy
+};
+
+static pjmedia_codec_op codec_op = {
+	&codec_init,
+	&codec_open,
+	&codec_close,
+	&codec_modify,
+	&codec_parse,
+	&codec_encode,
+	&codec_decode,
+	&codec_recover
+};
+
+static struct preencoded_factory {
+	pjmedia_codec_factory base;
+	pjmedia_endpt *endpt;
+	pj_pool_t *pool;
+} factory;
+
+/* the codec only needs its payload type */
+struct preencoded_codec {
+	pjmedia_codec base;
+	unsigned pt;
+};
+
+static std::mutex payload_lock;
+static std::map<std::pair<std::string, unsigned>, std::unique_ptr<std::vector<uint8_t>>> payloads;
+
+pj_status_t preencoded_g711_register(pjmedia_endpt *endpt) {
+	pjmedia_codec_mgr *mgr = pjmedia_endpt_get_codec_mgr(endpt);
+	// a codec id is allocated by the first factory listing it
+	pjmedia_codec_g711_deinit();
+
+	factory.base.op = &factory_op;
+	factory.base.factory_data = NULL;
+	factory.endpt = endpt;
+	factory.pool = pjmedia_endpt_create_pool(endpt, "preencoded_g711", 4000, 4000);
+	pj_status_t status = pjmedia_codec_mgr_register_factory(mgr, &factory.base);
+	if (status != PJ_SUCCESS) {
+		LOG(logERROR) << __FUNCTION__ << ": can not register the pre-encoded G.711 codecs: " << status;
+		return status;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": PCMU and PCMA play pre-encoded files";
+	return PJ_SUCCESS;
+}
+
+static bool decode_play_file(const std::string& file_name, std::vector<pj_int16_t> &samples) {
+	pj_pool_t *pool = pjmedia_endpt_create_pool(factory.endpt, "preencoded_file", 4000, 4000);
+	pjmedia_port *player;
+	pj_status_t status = pjmedia_wav_player_port_create(pool, file_name.c_str(), 20, PJMEDIA_FILE_NO_LOOP, 0, &player);
+	if (status != PJ_SUCCESS) {
+		pj_pool_release(pool);
+		return false;
+	}
+	unsigned rate = PJMEDIA_PIA_SRATE(&player->info);
+	bool usable = PJMEDIA_PIA_CCNT(&player->info) == 1 && Resampler::supported(rate, PREENCODED_CLOCK_RATE);
+	if (usable) {
+		std::vector<pj_int16_t> frame(PJMEDIA_PIA_SPF(&player->info));
+		// 16kHz and 48kHz files are resampled once too
+		std::unique_ptr<Resampler> resampler;
+		std::vector<pj_int16_t> resampled;
+		if (rate != PREENCODED_CLOCK_RATE) {
+			resampler.reset(new Resampler(rate, PREENCODED_CLOCK_RATE));
+			resampled.resize(frame.size());
+		}
+		pjmedia_frame f;
+		while (true) {
+			f.buf = frame.data();
+			f.size = frame.size() * sizeof(pj_int16_t);
+			f.type = PJMEDIA_FRAME_TYPE_AUDIO;
+			if (pjmedia_port_get_frame(player, &f) != PJ_SUCCESS || f.type != PJMEDIA_FRAME_TYPE_AUDIO) {
+				break;
+			}
+			if (resampler) {
+				size_t count = resampler->process(frame.data(), frame.size(), resampled.data());
+				samples.insert(samples.end(), resampled.begin(), resampled.begin() + count);
+			} else {
+				samples.insert(samples.end(), frame.begin(), frame.end());
+			}
+		}
+	}
+	pjmedia_port_destroy(player);
+	pj_pool_release(pool);
+	return usable && !samples.empty();
+}
+
+const std::vector<uint8_t>* preencoded_payload(const std::string& file_name, unsigned pt) {
+	if (pt != PJMEDIA_RTP_PT_PCMU && pt != PJMEDIA_RTP_PT_PCMA) {
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> guard(payload_lock);
+	auto it = payloads.find(std::make_pair(file_name, pt));
+	if (it != payloads.end()) {
+		return it->second.get();
+	}
+	// encoded once per file and codec, an unusable file is remembered too
+	std::vector<pj_int16_t> samples;
+	std::unique_ptr<std::vector<uint8_t>> &payload = payloads[std::make_pair(file_name, pt)];
+	if (!decode_play_file(file_name, samples)) {
+		LOG(logINFO) << __FUNCTION__ << ": " << file_name << " is not 8, 16 or 48kHz mono, it is encoded by every call";
+		return nullptr;
+	}
+	payload.reset(new std::vector<uint8_t>(samples.size()));
+	if (pt == PJMEDIA_RTP_PT_PCMU) {
+		g711_ulaw_encode(samples.data(), payload->data(), samples.size());
+	} else {
+		g711_alaw_encode(samples.data(), payload->data(), samples.size());
+	}
+	LOG(logINFO) << __FUNCTION__ << ": " << file_name << " pt:" << pt << " " << payload->size() << " bytes";
+	return payload.get();
+}
+
+static pj_status_t factory_test_alloc(pjmedia_codec_factory *factory, const pjmedia_codec_info *info) {
+	PJ_UNUSED_ARG(factory);
+	if (info->type != PJMEDIA_TYPE_AUDIO || info->clock_rate != PREENCODED_CLOCK_RATE || info->channel_cnt != 1 ||
+	    (info->pt != PJMEDIA_RTP_PT_PCMU && info->pt != PJMEDIA_RTP_PT_PCMA)) {
+		return PJMEDIA_CODEC_EUNSUP;
+	}
+	return PJ_SUCCESS;
+}
+
+static pj_status_t factory_default_attr(pjmedia_codec_factory *factory, const pjmedia_codec_info *info, pjmedia_codec_param *attr) {
+	PJ_UNUSED_ARG(factory);
+	pj_bzero(attr, sizeof(pjmedia_codec_param));
+	attr->info.clock_rate = PREENCODED_CLOCK_RATE;
+	attr->info.channel_cnt = 1;
+	attr->info.avg_bps = 64000;
+	attr->info.max_bps = 64000;
+	attr->info.pcm_bits_per_sample = 16;
+	attr->info.frm_ptime = PREENCODED_FRAME_PTIME;
+	attr->info.pt = (pj_uint8_t)info->pt;
+	attr->setting.frm_per_pkt = PREENCODED_FRAMES_PER_PACKET;
+	// the silence detector would read the payload of pre-encoded frames as samples
+	attr->setting.vad = 0;
+	attr->setting.plc = 1;
+	return PJ_SUCCESS;
+}
+
+static pj_status_t factory_enum_info(pjmedia_codec_factory *factory, unsigned *count, pjmedia_codec_info codecs[]) {
+	PJ_UNUSED_ARG(factory);
+	unsigned max = *count;
+	*count = 0;
+	const struct { unsigned pt; const char *name; } laws[] = {{PJMEDIA_RTP_PT_PCMU, "PCMU"}, {PJMEDIA_RTP_PT_PCMA, "PCMA"}};
+	for (auto &law : laws) {
+		if (*count >= max) {
+			break;
+		}
+		pjmedia_codec_info *info = &codecs[(*count)++];
+		pj_bzero(info, sizeof(*info));
+		info->type = PJMEDIA_TYPE_AUDIO;
+		info->pt = law.pt;
+		info->encoding_name = pj_str((char *)law.name);
+		info->clock_rate = PREENCODED_CLOCK_RATE;
+		info->channel_cnt = 1;
+	}
+	return PJ_SUCCESS;
+}
+
+static pj_status_t factory_alloc_codec(pjmedia_codec_factory *factory, const pjmedia_codec_info *info, pjmedia_codec **p_codec) {
+	PJ_UNUSED_ARG(factory);
+	// codecs are allocated by the media threads
+	pj_pool_t *pool = pjmedia_endpt_create_pool(::factory.endpt, "preencoded_codec", 512, 512);
+	preencoded_codec *codec = PJ_POOL_ZALLOC_T(pool, preencoded_codec);
+	codec->base.op = &codec_op;
+	codec->base.factory = &::factory.base;
+	codec->base.codec_data = pool;
+	codec->pt = info->pt;
+	*p_codec = &codec->base;
+	return PJ_SUCCESS;
+}
+
+static pj_status_t factory_dealloc_codec(pjmedia_codec_factory *factory, pjmedia_codec *codec) {
+	PJ_UNUSED_ARG(factory);
+	pj_pool_release((pj_pool_t *)codec->codec_data);
+	return PJ_SUCCESS;
+}
+
+static pj_status_t factory_destroy(void) {
+	if (::factory.pool) {
+		pj_pool_release(::factory.pool);
+		::factory.pool = NULL;
+	}
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_init(pjmedia_codec *codec, pj_pool_t *pool) {
+	PJ_UNUSED_ARG(codec);
+	PJ_UNUSED_ARG(pool);
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_open(pjmedia_codec *codec, pjmedia_codec_param *attr) {
+	PJ_UNUSED_ARG(codec);
+	attr->setting.vad = 0;
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_close(pjmedia_codec *codec) {
+	PJ_UNUSED_ARG(codec);
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_modify(pjmedia_codec *codec, const pjmedia_codec_param *attr) {
+	PJ_UNUSED_ARG(codec);
+	PJ_UNUSED_ARG(attr);
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_parse(pjmedia_codec *codec, void *pkt, pj_size_t pkt_size, const pj_timestamp *ts,
+                               unsigned *frame_cnt, pjmedia_frame frames[]) {
+	PJ_UNUSED_ARG(codec);
+	unsigned count = 0;
+	pj_size_t frame_size = PREENCODED_SAMPLES_PER_FRAME;
+	while (pkt_size >= frame_size && count < *frame_cnt) {
+		frames[count].type = PJMEDIA_FRAME_TYPE_AUDIO;
+		frames[count].buf = pkt;
+		frames[count].size = frame_size;
+		frames[count].timestamp.u64 = ts->u64 + PREENCODED_SAMPLES_PER_FRAME * count;
+		pkt = ((char *)pkt) + frame_size;
+		pkt_size -= frame_size;
+		count++;
+	}
+	*frame_cnt = count;
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_encode(pjmedia_codec *codec, const pjmedia_frame *input, unsigned output_buf_len, pjmedia_frame *output) {
+	preencoded_codec *c = (preencoded_codec *)codec;
+	unsigned samples = input->size / sizeof(pj_int16_t);
+	if (output_buf_len < samples) {
+		return PJMEDIA_CODEC_EFRMTOOSHORT;
+	}
+	if (input->type != PJMEDIA_FRAME_TYPE_AUDIO) {
+		output->type = PJMEDIA_FRAME_TYPE_NONE;
+		output->size = 0;
+		return PJ_SUCCESS;
+	}
+	if (input->bit_info == PREENCODED_FRAME) {
+		pj_memcpy(output->buf, input->buf, samples);
+	} else {
+		const pj_int16_t *in = (const pj_int16_t *)input->buf;
+		pj_uint8_t *out = (pj_uint8_t *)output->buf;
+		if (c->pt == PJMEDIA_RTP_PT_PCMU) {
+			g711_ulaw_encode(in, out, samples);
+		} else {
+			g711_alaw_encode(in, out, samples);
+		}
+	}
+	output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	output->size = samples;
+	output->timestamp = input->timestamp;
+	return PJ_SUCCESS;
+}
+
+static pj_status_t codec_decode(pjmedia_codec *codec, const pjmedia_frame *input, unsigned output_buf_len, pjmedia_frame *output) {
+	preencoded_codec *c = (preencoded_codec *)codec;
+	if (output_buf_len < input->size * sizeof(pj_int16_t)) {
+		return PJMEDIA_CODEC_EPCMTOOSHORT;
+	}
+	const pj_uint8_t *in = (const pj_uint8_t *)input->buf;
+	pj_int16_t *out = (pj_int16_t *)output->buf;
+	if (c->pt == PJMEDIA_RTP_PT_PCMU) {
+		g711_ulaw_decode(in, out, input->size);
+	} else {
+		g711_alaw_decode(in, out, input->size);
+	}
+	output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	output->size = input->size * sizeof(pj_int16_t);
+	output->timestamp = input->timestamp;
+	return PJ_SUCCESS;
+}
+
+// a lost frame is played as silence
+static pj_status_t codec_recover(pjmedia_codec *codec, unsigned output_buf_len, pjmedia_frame *output) {
+	PJ_UNUSED_ARG(codec);
+	unsigned size = PREENCODED_SAMPLES_PER_FRAME * sizeof(pj_int16_t);
+	if (output_buf_len < size) {
+		return PJMEDIA_CODEC_EPCMTOOSHORT;
+	}
+	pj_bzero(output->buf, size);
+	output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+	output->size = size;
+	return PJ_SUCCESS;
+}
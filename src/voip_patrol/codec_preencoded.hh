@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_CODEC_PREENCODED_H
+#define VOIP_PATROL_CODEC_PREENCODED_H
+
+#include <pjmedia.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * G.711 codec accepting pre-encoded frames, it replaces the pjmedia G.711 factory.
+ * A frame with bit_info PREENCODED_FRAME carries the payload of its samples in
+ * the first bytes of its buffer, it is sent as is, other frames are encoded.
+ */
+#define PREENCODED_FRAME 0x56505045
+
+pj_status_t preencoded_g711_register(pjmedia_endpt *endpt);
+
+/*
+ * Payload of a whole mono play file (8, 16 or 48kHz resampled to 8kHz), encoded once per payload type
+ * (0 PCMU, 8 PCMA) and shared by every call, G.711 has no state, any packetization reads consecutive bytes.
+ * Null when the file can not be used.
+ */
+const std::vector<uint8_t>* preencoded_payload(const std::string& file_name, unsigned pt);
+// both payloads of a play file, when the scenario is compiled, the calls do not encode in their media callbacks
+void preencode_play_file(const std::string& file_name);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "daemon.hh"
+#include "voip_patrol.hh"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#define DAEMON_READ_SIZE 4096
+#define DAEMON_MAX_LINE 4096
+
+ScenarioDaemon::ScenarioDaemon(Config *config, const std::string& socket_path, bool stream)
+	: config(config), socket_path(socket_path), stream(stream) {
+}
+
+ScenarioDaemon::~ScenarioDaemon() {
+	for (auto &client : clients) {
+		close(client.first);
+	}
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(socket_path.c_str());
+	}
+}
+
+bool ScenarioDaemon::start() {
+	struct sockaddr_un addr;
+	if (socket_path.size() >= sizeof(addr.sun_path)) {
+		LOG(logERROR) << __FUNCTION__ << ": socket path too long: " << socket_path;
+		return false;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		LOG(logERROR) << __FUNCTION__ << ": socket: " << strerror(errno);
+		return false;
+	}
+	// a socket left by a previous daemon
+	unlink(socket_path.c_str());
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+		LOG(logERROR) << __FUNCTION__ << ": " << socket_path << ": " << strerror(errno);
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": waiting for scenarios on " << socket_path;
+	return true;
+}
+
+void ScenarioDaemon::accept_client() {
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0) {
+		LOG(logERROR) << __FUNCTION__ << ": accept: " << strerror(errno);
+		return;
+	}
+	clients[fd] = "";
+	LOG(logINFO) << __FUNCTION__ << ": client connected fd:" << fd;
+}
+
+void ScenarioDaemon::close_client(int fd) {
+	// scenarios not started yet are dropped with their submitter
+	for (auto it = queue.begin(); it != queue.end();) {
+		if (it->fd == fd) {
+			it = queue.erase(it);
+		} else {
+			++it;
+		}
+	}
+	clients.erase(fd);
+	close(fd);
+	LOG(logINFO) << __FUNCTION__ << ": client disconnected fd:" << fd;
+}
+
+void ScenarioDaemon::submit(int fd, const std::string& line) {
+	std::string file_name = line;
+	bool stream_file = stream;
+	if (file_name.compare(0, 7, "stream ") == 0) {
+		file_name = file_name.substr(7);
+		stream_file = true;
+	}
+	if (file_name.empty()) {
+		return;
+	}
+	if (file_name == "shutdown") {
+		LOG(logINFO) << __FUNCTION__ << ": shutdown requested fd:" << fd;
+		running = false;
+		return;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": queued scenario:" << file_name << " fd:" << fd << " pending:" << queue.size();
+	queue.push_back({fd, file_name, stream_file});
+}
+
+bool ScenarioDaemon::read_client(int fd) {
+	char buf[DAEMON_READ_SIZE];
+	ssize_t n = recv(fd, buf, sizeof(buf), 0);
+	if (n <= 0) {
+		return false;
+	}
+	std::string &pending = clients[fd];
+	pending.append(buf, n);
+	size_t eol;
+	while ((eol = pending.find('\n')) != std::string::npos) {
+		std::string line = pending.substr(0, eol);
+		pending.erase(0, eol + 1);
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		submit(fd, line);
+	}
+	if (pending.size() > DAEMON_MAX_LINE) {
+		LOG(logERROR) << __FUNCTION__ << ": line too long fd:" << fd;
+		return false;
+	}
+	return true;
+}
+
+void ScenarioDaemon::run_submission(const ScenarioSubmission& submission) {
+	config->reset();
+	config->result_file.mirror(submission.fd);
+
+	std::string status = config->scenario_start_json(submission.file_name);
+	config->result_file.write(status);
+	config->result_file.flush();
+	LOG(logINFO) << __FUNCTION__ << status;
+
+	config->run_scenario(submission.file_name, submission.stream);
+	config->hangup_all();
+
+	status = config->scenario_end_json(submission.file_name);
+	config->result_file.write(status);
+	config->result_file.flush();
+	LOG(logINFO) << __FUNCTION__ << status;
+	config->result_file.mirror(-1);
+}
+
+void ScenarioDaemon::run() {
+	std::vector<struct pollfd> fds;
+	while (running) {
+		fds.clear();
+		fds.push_back({listen_fd, POLLIN, 0});
+		for (auto &client : clients) {
+			fds.push_back({client.first, POLLIN, 0});
+		}
+		// submissions are only read between two scenarios, the next one starts right away
+		int timeout = queue.empty() ? -1 : 0;
+		if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+			LOG(logERROR) << __FUNCTION__ << ": poll: " << strerror(errno);
+			break;
+		}
+		for (auto &pfd : fds) {
+			if (!pfd.revents) {
+				continue;
+			}
+			if (pfd.fd == listen_fd) {
+				accept_client();
+			} else if (!read_client(pfd.fd)) {
+				close_client(pfd.fd);
+			}
+		}
+		if (running && !queue.empty()) {
+			ScenarioSubmission submission = queue.front();
+			queue.pop_front();
+			run_submission(submission);
+		}
+	}
+	LOG(logINFO) << __FUNCTION__ << ": daemon stopped";
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_DAEMON_H
+#define VOIP_PATROL_DAEMON_H
+
+#include <deque>
+#include <map>
+#include <string>
+
+class Config;
+
+struct ScenarioSubmission {
+	int fd;
+	std::string file_name;
+	bool stream;
+};
+
+/*
+ * Daemon mode, the endpoint and the transports are created once and the
+ * scenario files submitted on a UNIX socket are executed one after another.
+ * A client writes one line per scenario, "<file>" or "stream <file>", and
+ * reads back the JSON result lines of its scenarios, "shutdown" stops the daemon.
+ */
+class ScenarioDaemon {
+	public:
+		ScenarioDaemon(Config *config, const std::string& socket_path, bool stream);
+		~ScenarioDaemon();
+		bool start();
+		void run();
+	private:
+		void accept_client();
+		bool read_client(int fd);
+		void close_client(int fd);
+		void submit(int fd, const std::string& line);
+		void run_submission(const ScenarioSubmission& submission);
+		Config *config;
+		std::string socket_path;
+		bool stream;
+		int listen_fd {-1};
+		bool running {true};
+		std::map<int, std::string> clients; // partial line received from each client
+		std::deque<ScenarioSubmission> queue;
+};
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "direct_media.hh"
+#include "codec_preencoded.hh"
+#include "media_engine.hh"
+#include "audio_sink.hh"
+#include "log.h"
+#include <pjsua-lib/pjsua.h>
+#include <string.h>
+#include <algorithm>
+
+#define DIRECT_MEDIA_SIGNATURE PJMEDIA_SIGNATURE('V', 'P', 'D', 'M')
+
+DirectMedia::DirectMedia() {
+	memset(&tap, 0, sizeof(tap));
+}
+
+DirectMedia::~DirectMedia() {
+	close();
+	if (null_port) {
+		pjmedia_port_destroy(null_port);
+	}
+	if (pool) {
+		pj_pool_release(pool);
+	}
+}
+
+pj_status_t DirectMedia::start(pjmedia_port *stream_port, const std::string& play_file, int pre_encoded_pt,
+                               MediaEngine *media_engine) {
+	pj_status_t status;
+	const pjmedia_audio_format_detail *afd = pjmedia_format_get_audio_format_detail(&stream_port->info.fmt, PJ_TRUE);
+	unsigned spf = PJMEDIA_PIA_SPF(&stream_port->info);
+
+	if (!pool) {
+		pool = pjsua_pool_create("direct_media", 1024, 1024);
+	}
+	if (master || worker >= 0) {
+		stop();
+	}
+	// a re-INVITE can change the codec, the player is kept only when it still matches the stream
+	if (samples_per_frame && (clock_rate != afd->clock_rate || channel_count != afd->channel_count || samples_per_frame != spf)) {
+		LOG(logERROR) << __FUNCTION__ << ": stream format changed " << clock_rate << "Hz to " << afd->clock_rate << "Hz";
+		return PJMEDIA_ENCCLOCKRATE;
+	}
+	clock_rate = afd->clock_rate;
+	channel_count = afd->channel_count;
+	samples_per_frame = spf;
+
+	if (!player && !payload && !play_file.empty() && pre_encoded_pt >= 0) {
+		payload = preencoded_payload(play_file, pre_encoded_pt);
+	}
+	if (!player && !payload && !play_file.empty()) {
+		status = pjmedia_wav_player_port_create(pool, play_file.c_str(), PJMEDIA_PIA_PTIME(&stream_port->info), 0, 0, &player);
+		if (status != PJ_SUCCESS) {
+			LOG(logERROR) << __FUNCTION__ << ": [error] creating player: " << status << " " << play_file;
+			player = nullptr;
+			return status;
+		}
+		unsigned player_rate = PJMEDIA_PIA_SRATE(&player->info);
+		if (player_rate != clock_rate && channel_count == 1 && PJMEDIA_PIA_CCNT(&player->info) == 1 &&
+		    Resampler::supported(player_rate, clock_rate)) {
+			// same ptime, one player frame gives one stream frame
+			resampler.reset(new Resampler(player_rate, clock_rate));
+			player_frame.resize(PJMEDIA_PIA_SPF(&player->info));
+		} else if (player_rate != clock_rate || PJMEDIA_PIA_CCNT(&player->info) != channel_count ||
+		           PJMEDIA_PIA_SPF(&player->info) != samples_per_frame) {
+			LOG(logINFO) << __FUNCTION__ << ": " << play_file << " " << player_rate << "Hz does not match the stream "
+			             << clock_rate << "Hz";
+			pjmedia_port_destroy(player);
+			player = nullptr;
+			return PJMEDIA_ENCCLOCKRATE;
+		}
+	}
+
+	// the previous stream, if any, is already removed from the bridge
+	if (null_port) {
+		pjmedia_port_destroy(null_port);
+		null_port = nullptr;
+	}
+	status = pjmedia_null_port_create(pool, clock_rate, channel_count, samples_per_frame, 16, &null_port);
+	if (status != PJ_SUCCESS) {
+		return status;
+	}
+
+	pj_str_t name = pj_str((char *)"direct_media");
+	pjmedia_port_info_init(&tap.info, &name, DIRECT_MEDIA_SIGNATURE, clock_rate, channel_count, 16, samples_per_frame);
+	tap.get_frame = &tap_get_frame;
+	tap.put_frame = &tap_put_frame;
+	tap.port_data.pdata = this;
+
+	if (media_engine && media_engine->running()) {
+		stream = stream_port;
+		engine = media_engine;
+		frame_buf.assign(samples_per_frame, 0);
+		worker = engine->add(this, PJMEDIA_PIA_PTIME(&stream_port->info));
+		return PJ_SUCCESS;
+	}
+	// upstream: the frames received on the stream go to the tap, the tap frames are sent
+	status = pjmedia_master_port_create(pool, stream_port, &tap, 0, &master);
+	if (status != PJ_SUCCESS) {
+		master = nullptr;
+		return status;
+	}
+	status = pjmedia_master_port_start(master);
+	if (status != PJ_SUCCESS) {
+		pjmedia_master_port_destroy(master, PJ_FALSE);
+		master = nullptr;
+	}
+	return status;
+}
+
+void DirectMedia::play() {
+	std::lock_guard<std::mutex> guard(lock);
+	playing = true;
+}
+
+bool DirectMedia::recording() {
+	std::lock_guard<std::mutex> guard(lock);
+	return recorder != nullptr;
+}
+
+pj_status_t DirectMedia::record(const std::string& file_name) {
+	if (recording()) {
+		return PJ_SUCCESS;
+	}
+	if (!samples_per_frame) {
+		return PJ_EINVALIDOP;
+	}
+	pjmedia_port *port;
+	// the stream format, the recording does not need the bridge resampling either
+	pj_status_t status = pjmedia_wav_writer_port_create(pool, file_name.c_str(), clock_rate, channel_count, samples_per_frame, 16, 0, 0, &port);
+	if (status != PJ_SUCCESS) {
+		LOG(logERROR) << __FUNCTION__ << ": [error] creating recorder: " << status << " " << file_name;
+		return status;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	recorder = port;
+	return PJ_SUCCESS;
+}
+
+void DirectMedia::add_sink(AudioSink *sink) {
+	std::lock_guard<std::mutex> guard(lock);
+	sinks.push_back(sink);
+}
+
+void DirectMedia::remove_sink(AudioSink *sink) {
+	std::lock_guard<std::mutex> guard(lock);
+	sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+}
+
+bool DirectMedia::add_source(AudioSource *source) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (payload) {
+		return false;
+	}
+	sources.push_back(source);
+	return true;
+}
+
+void DirectMedia::remove_source(AudioSource *source) {
+	std::lock_guard<std::mutex> guard(lock);
+	sources.erase(std::remove(sources.begin(), sources.end(), source), sources.end());
+}
+
+// the stream is being destroyed
+void DirectMedia::stop() {
+	if (worker >= 0) {
+		engine->remove(this, worker);
+		worker = -1;
+		stream = nullptr;
+	}
+	if (master) {
+		pjmedia_master_port_stop(master);
+		pjmedia_master_port_destroy(master, PJ_FALSE);
+		master = nullptr;
+	}
+}
+
+void DirectMedia::close() {
+	stop();
+	std::lock_guard<std::mutex> guard(lock);
+	if (player) {
+		pjmedia_port_destroy(player);
+		player = nullptr;
+	}
+	resampler.reset();
+	payload = nullptr;
+	if (recorder) {
+		// completes the WAV header
+		pjmedia_port_destroy(recorder);
+		recorder = nullptr;
+	}
+	playing = false;
+}
+
+// the same exchange as the master port clock
+void DirectMedia::tick() {
+	pjmedia_frame frame;
+	frame.buf = frame_buf.data();
+	frame.size = frame_buf.size() * sizeof(pj_int16_t);
+	frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame.timestamp.u64 = timestamp;
+	frame.bit_info = 0;
+	if (pjmedia_port_get_frame(stream, &frame) == PJ_SUCCESS) {
+		tap_put_frame(&tap, &frame);
+	}
+
+	frame.buf = frame_buf.data();
+	frame.size = frame_buf.size() * sizeof(pj_int16_t);
+	frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+	frame.timestamp.u64 = timestamp;
+	frame.bit_info = 0;
+	if (tap_get_frame(&tap, &frame) != PJ_SUCCESS) {
+		frame.type = PJMEDIA_FRAME_TYPE_NONE;
+		frame.size = 0;
+	}
+	pjmedia_port_put_frame(stream, &frame);
+	timestamp += samples_per_frame / channel_count;
+}
+
+pj_status_t DirectMedia::tap_get_frame(pjmedia_port *port, pjmedia_frame *frame) {
+	DirectMedia *media = (DirectMedia *)port->port_data.pdata;
+	std::lock_guard<std::mutex> guard(media->lock);
+	if (media->playing && media->payload) {
+		// the file loops like the player, the codec sends the bytes as they are
+		const std::vector<uint8_t> &payload = *media->payload;
+		uint8_t *buf = (uint8_t *)frame->buf;
+		for (unsigned i = 0; i < media->samples_per_frame; i++) {
+			buf[i] = payload[media->payload_pos];
+			media->payload_pos = (media->payload_pos + 1) % payload.size();
+		}
+		frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+		frame->size = media->samples_per_frame * sizeof(pj_int16_t);
+		frame->bit_info = PREENCODED_FRAME;
+		return PJ_SUCCESS;
+	}
+	frame->bit_info = 0;
+	pj_status_t status = PJ_SUCCESS;
+	if (media->playing && media->player && media->resampler) {
+		pjmedia_frame in = *frame;
+		in.buf = media->player_frame.data();
+		in.size = media->player_frame.size() * sizeof(pj_int16_t);
+		status = pjmedia_port_get_frame(media->player, &in);
+		if (status != PJ_SUCCESS || in.type != PJMEDIA_FRAME_TYPE_AUDIO) {
+			frame->type = PJMEDIA_FRAME_TYPE_NONE;
+			frame->size = 0;
+		} else {
+			size_t count = media->resampler->process(media->player_frame.data(), media->player_frame.size(), (pj_int16_t *)frame->buf);
+			frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+			frame->size = count * sizeof(pj_int16_t);
+		}
+	} else if (media->playing && media->player) {
+		status = pjmedia_port_get_frame(media->player, frame);
+	} else {
+		frame->type = PJMEDIA_FRAME_TYPE_NONE;
+		frame->size = 0;
+	}
+	if (!media->sources.empty() && media->channel_count == 1) {
+		if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO) {
+			memset(frame->buf, 0, media->samples_per_frame * sizeof(pj_int16_t));
+			frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+			frame->size = media->samples_per_frame * sizeof(pj_int16_t);
+		}
+		for (AudioSource *source : media->sources)
+			source->mix((pj_int16_t *)frame->buf, frame->size / sizeof(pj_int16_t));
+		status = PJ_SUCCESS;
+	}
+	return status;
+}
+
+pj_status_t DirectMedia::tap_put_frame(pjmedia_port *port, pjmedia_frame *frame) {
+	DirectMedia *media = (DirectMedia *)port->port_data.pdata;
+	std::lock_guard<std::mutex> guard(media->lock);
+	if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO && media->channel_count == 1) {
+		for (AudioSink *sink : media->sinks)
+			sink->put((const pj_int16_t *)frame->buf, frame->size / sizeof(pj_int16_t));
+	}
+	if (media->recorder && frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+		return pjmedia_port_put_frame(media->recorder, frame);
+	}
+	return PJ_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_DIRECT_MEDIA_H
+#define VOIP_PATROL_DIRECT_MEDIA_H
+
+#include "audio_kernels.hh"
+#include <pjmedia.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class MediaEngine;
+class AudioSink;
+class AudioSource;
+
+/*
+ * Direct media path of a call, bypassing the conference bridge.
+ * A master port clocks the stream port of the call against a tap port, the tap
+ * feeds the stream from the player and gives the decoded audio to the recorder,
+ * there is no mixing, a mono player at another rate (8, 16, 48kHz) is resampled.
+ * The bridge only gets a null port for the call.
+ * The player and the recorder outlive a stream recreated by a re-INVITE.
+ * With a pre-encoded payload (G.711) the tap gives the payload to the codec instead of samples.
+ * A worker thread of the media engine exchanges the frames, the master port is only used without it.
+ */
+class DirectMedia {
+	public:
+		DirectMedia();
+		~DirectMedia();
+		pj_status_t start(pjmedia_port *stream_port, const std::string& play_file, int pre_encoded_pt = -1,
+		                  MediaEngine *engine = nullptr);
+		pjmedia_port* bridge_port() { return null_port; }
+		void play();
+		pj_status_t record(const std::string& file_name);
+		bool recording();
+		void add_sink(AudioSink *sink); // the received audio, also given to the recorder
+		void remove_sink(AudioSink *sink);
+		bool add_source(AudioSource *source); // mixed in the sent audio, not with a pre-encoded payload
+		void remove_source(AudioSource *source);
+		unsigned rate() { return clock_rate; }
+		void stop();
+		void close();
+		void tick(); // one frame each way, called by the media engine
+	private:
+		static pj_status_t tap_get_frame(pjmedia_port *port, pjmedia_frame *frame);
+		static pj_status_t tap_put_frame(pjmedia_port *port, pjmedia_frame *frame);
+		pj_pool_t *pool {nullptr};
+		pjmedia_port tap;
+		pjmedia_port *null_port {nullptr};
+		pjmedia_port *player {nullptr};
+		std::unique_ptr<Resampler> resampler; // player rate to stream rate
+		std::vector<pj_int16_t> player_frame;
+		const std::vector<uint8_t> *payload {nullptr}; // shared by the calls playing the file
+		size_t payload_pos {0};
+		pjmedia_port *recorder {nullptr};
+		std::vector<AudioSink*> sinks;
+		std::vector<AudioSource*> sources;
+		pjmedia_master_port *master {nullptr};
+		pjmedia_port *stream {nullptr};
+		MediaEngine *engine {nullptr};
+		int worker {-1};
+		std::vector<pj_int16_t> frame_buf;
+		pj_uint64_t timestamp {0};
+		unsigned clock_rate {0};
+		unsigned channel_count {0};
+		unsigned samples_per_frame {0};
+		std::mutex lock; // the tap runs in the master port clock thread
+		bool playing {false};
+};
+
+#endif
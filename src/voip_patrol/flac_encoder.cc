@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "flac_encoder.hh"
+#include <stdlib.h>
+
+#define FLAC_MAX_ORDER 4
+#define FLAC_MAX_PARTITION_ORDER 8
+#define FLAC_MAX_RICE 14
+
+class FlacBits {
+	public:
+		FlacBits(std::vector<uint8_t> &out) : out(out) {}
+		void put(uint32_t value, unsigned n) {
+			while (n) {
+				unsigned take = n < 24 ? n : 24;
+				n -= take;
+				acc = (acc << take) | ((value >> n) & ((1u << take) - 1));
+				used += take;
+				while (used >= 8) {
+					used -= 8;
+					out.push_back((uint8_t)(acc >> used));
+				}
+			}
+		}
+		void put_signed(int32_t value, unsigned n) {
+			put((uint32_t)value & (n == 32 ? 0xffffffff : ((1u << n) - 1)), n);
+		}
+		void put_unary(uint32_t q) {
+			while (q >= 24) {
+				put(0, 24);
+				q -= 24;
+			}
+			put(1, q + 1);
+		}
+		void align() {
+			if (used)
+				put(0, 8 - used);
+		}
+	private:
+		std::vector<uint8_t> &out;
+		uint64_t acc {0};
+		unsigned used {0};
+};
+
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+
+static bool crc_tables() {
+	for (unsigned i = 0; i < 256; i++) {
+		uint8_t c8 = i;
+		uint16_t c16 = i << 8;
+		for (int b = 0; b < 8; b++) {
+			c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+			c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+		}
+		crc8_table[i] = c8;
+		crc16_table[i] = c16;
+	}
+	return true;
+}
+static bool crc_ready = crc_tables();
+
+static uint8_t crc8(const uint8_t *p, size_t n) {
+	uint8_t crc = 0;
+	while (n--)
+		crc = crc8_table[crc ^ *p++];
+	return crc;
+}
+
+static uint16_t crc16(const uint8_t *p, size_t n) {
+	uint16_t crc = 0;
+	while (n--)
+		crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *p++];
+	return crc;
+}
+
+static unsigned sample_rate_code(unsigned rate) {
+	switch (rate) {
+		case 8000: return 4;
+		case 16000: return 5;
+		case 22050: return 6;
+		case 24000: return 7;
+		case 32000: return 8;
+		case 44100: return 9;
+		case 48000: return 10;
+		case 96000: return 11;
+	}
+	return 0; // from the stream header
+}
+
+static inline uint32_t zigzag(int32_t r) {
+	return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+FlacEncoder::FlacEncoder(unsigned clock_rate, unsigned channels) : clock_rate(clock_rate), channels(channels) {
+	channel.resize(FLAC_BLOCK_SIZE);
+	residual.resize(FLAC_BLOCK_SIZE);
+}
+
+void FlacEncoder::header(std::vector<uint8_t> &out) const {
+	FlacBits bits(out);
+	bits.put('f', 8);
+	bits.put('L', 8);
+	bits.put('a', 8);
+	bits.put('C', 8);
+	bits.put(1, 1);  // last metadata block
+	bits.put(0, 7);  // STREAMINFO
+	bits.put(34, 24);
+	bits.put(FLAC_BLOCK_SIZE, 16);
+	bits.put(FLAC_BLOCK_SIZE, 16);
+	bits.put(min_frame, 24);
+	bits.put(max_frame, 24);
+	bits.put(clock_rate, 20);
+	bits.put(channels - 1, 3);
+	bits.put(15, 5); // 16 bits per sample
+	bits.put((uint32_t)(total_samples >> 32), 4);
+	bits.put((uint32_t)total_samples, 32);
+	for (int i = 0; i < 4; i++)
+		bits.put(0, 32); // MD5 not computed
+}
+
+void FlacEncoder::encode(const int16_t *samples, unsigned count, std::vector<uint8_t> &out) {
+	if (!count)
+		return;
+	size_t start = out.size();
+	FlacBits bits(out);
+	bits.put(0x3ffe, 14);
+	bits.put(0, 1);
+	bits.put(0, 1);  // fixed block size
+	bits.put(count == FLAC_BLOCK_SIZE ? 12 : 7, 4);
+	bits.put(sample_rate_code(clock_rate), 4);
+	bits.put(channels - 1, 4); // independent channels
+	bits.put(4, 3);  // 16 bits per sample
+	bits.put(0, 1);
+	// frame number, UTF-8 like coding
+	uint32_t n = frame_number++;
+	if (n < 0x80) {
+		bits.put(n, 8);
+	} else {
+		int extra = n < 0x800 ? 1 : n < 0x10000 ? 2 : n < 0x200000 ? 3 : n < 0x4000000 ? 4 : 5;
+		bits.put(((1u << (extra + 1)) - 1) << 1, extra + 2);
+		bits.put(n >> (6 * extra), 6 - extra);
+		for (int i = extra - 1; i >= 0; i--) {
+			bits.put(2, 2);
+			bits.put(n >> (6 * i), 6);
+		}
+	}
+	if (count != FLAC_BLOCK_SIZE)
+		bits.put(count - 1, 16);
+	bits.put(crc8(&out[start], out.size() - start), 8);
+
+	for (unsigned c = 0; c < channels; c++) {
+		for (unsigned i = 0; i < count; i++)
+			channel[i] = samples[i * channels + c];
+		subframe(&channel[0], count, bits);
+	}
+	bits.align();
+	uint16_t crc = crc16(&out[start], out.size() - start);
+	bits.put(crc, 16);
+
+	uint32_t size = out.size() - start;
+	if (!min_frame || size < min_frame)
+		min_frame = size;
+	if (size > max_frame)
+		max_frame = size;
+	total_samples += count;
+}
+
+void FlacEncoder::subframe(const int32_t *x, unsigned n, FlacBits &bits) {
+	bool constant = true;
+	for (unsigned i = 1; i < n && constant; i++)
+		constant = x[i] == x[0];
+	if (constant) {
+		bits.put(0, 8);
+		bits.put_signed(x[0], 16);
+		return;
+	}
+
+	// the fixed predictor with the smallest residual
+	uint64_t error[FLAC_MAX_ORDER + 1] = {0};
+	for (unsigned i = FLAC_MAX_ORDER; i < n; i++) {
+		int32_t e0 = x[i];
+		int32_t e1 = e0 - x[i - 1];
+		int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+		int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+		int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+		error[0] += abs(e0);
+		error[1] += abs(e1);
+		error[2] += abs(e2);
+		error[3] += abs(e3);
+		error[4] += abs(e4);
+	}
+	unsigned order = 0;
+	unsigned max_order = n > FLAC_MAX_ORDER ? FLAC_MAX_ORDER : 0;
+	for (unsigned o = 1; o <= max_order; o++) {
+		if (error[o] < error[order])
+			order = o;
+	}
+	for (unsigned i = order; i < n; i++) {
+		switch (order) {
+			case 0: residual[i] = x[i]; break;
+			case 1: residual[i] = x[i] - x[i - 1]; break;
+			case 2: residual[i] = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+			case 3: residual[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+			case 4: residual[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+		}
+	}
+
+	// the partition order and Rice parameters with the smallest estimated size
+	unsigned best_order = 0;
+	uint64_t best_bits = UINT64_MAX;
+	unsigned params[1 << FLAC_MAX_PARTITION_ORDER];
+	unsigned best_params[1 << FLAC_MAX_PARTITION_ORDER];
+	for (unsigned p = 0; p <= FLAC_MAX_PARTITION_ORDER; p++) {
+		unsigned parts = 1 << p;
+		if (n % parts || (n >> p) <= order)
+			break;
+		uint64_t total = 0;
+		for (unsigned k = 0; k < parts; k++) {
+			unsigned first = k ? k * (n >> p) : order;
+			unsigned last = (k + 1) * (n >> p);
+			uint64_t sum = 0;
+			for (unsigned i = first; i < last; i++)
+				sum += zigzag(residual[i]);
+			unsigned count = last - first;
+			uint64_t best = UINT64_MAX;
+			for (unsigned r = 0; r <= FLAC_MAX_RICE; r++) {
+				uint64_t size = (uint64_t)count * (r + 1) + (sum >> r);
+				if (size < best) {
+					best = size;
+					params[k] = r;
+				}
+			}
+			total += best + 4;
+		}
+		if (total < best_bits) {
+			best_bits = total;
+			best_order = p;
+			for (unsigned k = 0; k < parts; k++)
+				best_params[k] = params[k];
+		}
+	}
+
+	if (best_bits + order * 16 >= (uint64_t)n * 16) {
+		bits.put(2, 8); // verbatim
+		for (unsigned i = 0; i < n; i++)
+			bits.put_signed(x[i], 16);
+		return;
+	}
+	bits.put((8 | order) << 1, 8);
+	for (unsigned i = 0; i < order; i++)
+		bits.put_signed(x[i], 16);
+	bits.put(0, 2);  // Rice, 4 bits parameters
+	bits.put(best_order, 4);
+	unsigned parts = 1 << best_order;
+	for (unsigned k = 0; k < parts; k++) {
+		unsigned first = k ? k * (n >> best_order) : order;
+		unsigned last = (k + 1) * (n >> best_order);
+		unsigned r = best_params[k];
+		bits.put(r, 4);
+		for (unsigned i = first; i < last; i++) {
+			uint32_t u = zigzag(residual[i]);
+			bits.put_unary(u >> r);
+			if (r)
+				bits.put(u & ((1u << r) - 1), r);
+		}
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_FLAC_ENCODER_H
+#define VOIP_PATROL_FLAC_ENCODER_H
+
+#include <stdint.h>
+#include <vector>
+
+#define FLAC_BLOCK_SIZE 4096
+
+/*
+ * Lossless FLAC encoder of 16 bits samples, independent channels, fixed
+ * predictors (order 0 to 4) and partitioned Rice residuals: about a third
+ * of the size of the PCM for speech (0.31 on the 8kHz reference files). The stream header is rewritten once the total
+ * is known, the MD5 signature is left unset (allowed by the format).
+ */
+class FlacEncoder {
+	public:
+		FlacEncoder(unsigned clock_rate, unsigned channels);
+		void header(std::vector<uint8_t> &out) const;
+		// interleaved samples, count per channel, at most FLAC_BLOCK_SIZE, a shorter block ends the stream
+		void encode(const int16_t *samples, unsigned count, std::vector<uint8_t> &out);
+		uint64_t total_samples {0};
+	private:
+		void subframe(const int32_t *x, unsigned n, class FlacBits &bits);
+		unsigned clock_rate;
+		unsigned channels;
+		uint32_t frame_number {0};
+		uint32_t min_frame {0};
+		uint32_t max_frame {0};
+		std::vector<int32_t> channel;
+		std::vector<int32_t> residual;
+};
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "injection.hh"
+#include "log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+injection_mode_t get_injection_mode_from_string(const std::string& mode) {
+	if (mode.compare("random") == 0) return INJECTION_RANDOM;
+	if (mode.compare("worker") == 0) return INJECTION_WORKER;
+	return INJECTION_SEQUENTIAL;
+}
+
+/*
+ * InjectionFile implementation
+ */
+
+InjectionFile::InjectionFile(const std::string& file_name, char separator)
+	: name(file_name), separator(separator), random(std::random_device()()) {
+}
+
+InjectionFile::~InjectionFile() {
+	close();
+}
+
+bool InjectionFile::open() {
+	struct stat st;
+
+	fd = ::open(name.c_str(), O_RDONLY);
+	if (fd < 0) {
+		LOG(logERROR) << __FUNCTION__ << ": can not open injection file: " << name;
+		return false;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		LOG(logERROR) << __FUNCTION__ << ": empty injection file: " << name;
+		close();
+		return false;
+	}
+	data_len = st.st_size;
+	void *map = mmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		LOG(logERROR) << __FUNCTION__ << ": can not mmap injection file: " << name;
+		data_len = 0;
+		close();
+		return false;
+	}
+	data = (const char *)map;
+	madvise(map, data_len, MADV_WILLNEED);
+
+	// index every row and field once, lookups are then only offsets
+	size_t pos = 0;
+	while (pos < data_len) {
+		const char *nl = (const char *)memchr(data + pos, '\n', data_len - pos);
+		size_t end = nl ? (size_t)(nl - data) : data_len;
+		size_t line_end = end;
+		if (line_end > pos && data[line_end - 1] == '\r') {
+			line_end--;
+		}
+		if (line_end > pos && data[pos] != '#') {
+			injection_line line;
+			line.offset = pos;
+			line.first_field = line_fields.size();
+			line.field_count = 0;
+			size_t field_start = pos;
+			while (true) {
+				const char *sep = (const char *)memchr(data + field_start, separator, line_end - field_start);
+				size_t field_end = sep ? (size_t)(sep - data) : line_end;
+				injection_field field;
+				field.offset = field_start - pos;
+				field.len = field_end - field_start;
+				line_fields.push_back(field);
+				line.field_count++;
+				if (!sep) {
+					break;
+				}
+				field_start = field_end + 1;
+			}
+			lines.push_back(line);
+		}
+		pos = end + 1;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": injection file: " << name << " rows: " << lines.size() << " fields: " << line_fields.size();
+
+	return lines.size() > 0;
+}
+
+void InjectionFile::close() {
+	if (data) {
+		munmap((void *)data, data_len);
+		data = nullptr;
+		data_len = 0;
+	}
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+}
+
+size_t InjectionFile::fields(size_t row) const {
+	if (row >= lines.size()) {
+		return 0;
+	}
+	return lines[row].field_count;
+}
+
+bool InjectionFile::get_field(size_t row, size_t field, const char **val, size_t *len) const {
+	if (row >= lines.size() || field >= lines[row].field_count) {
+		return false;
+	}
+	const injection_line &line = lines[row];
+	const injection_field &f = line_fields[line.first_field + field];
+	*val = data + line.offset + f.offset;
+	*len = f.len;
+	return true;
+}
+
+size_t InjectionFile::next_row(injection_mode_t mode, size_t *cursor, int workers) {
+	size_t row = 0;
+	if (mode == INJECTION_RANDOM) {
+		std::lock_guard<std::mutex> lock(random_lock);
+		row = random() % lines.size();
+	} else if (mode == INJECTION_WORKER) {
+		// the cursor is owned by the caller, starting at the worker index
+		row = *cursor % lines.size();
+		*cursor += (workers > 0 ? workers : 1);
+	} else {
+		row = sequential_cursor.fetch_add(1) % lines.size();
+	}
+	return row;
+}
+
+/*
+ * InjectionTemplate implementation
+ */
+
+bool InjectionTemplate::has_fields(const std::string& value) {
+	return value.find("[field") != std::string::npos || value.find("[row]") != std::string::npos;
+}
+
+InjectionTemplate::InjectionTemplate(const std::string& value) {
+	size_t pos = 0;
+	while (pos < value.size()) {
+		size_t open = value.find('[', pos);
+		size_t close = (open == std::string::npos) ? std::string::npos : value.find(']', open);
+		int field = -1;
+
+		if (close != std::string::npos) {
+			std::string name = value.substr(open + 1, close - open - 1);
+			if (name.compare("row") == 0) {
+				field = -2;
+			} else if (name.compare(0, 5, "field") == 0 && name.size() > 5 &&
+					name.find_first_not_of("0123456789", 5) == std::string::npos) {
+				field = atoi(name.c_str() + 5);
+			}
+		}
+		if (field == -1) {
+			// not a field reference, keep everything up to the next candidate as literal
+			size_t end = (open == std::string::npos) ? value.size() : open + 1;
+			if (!segments.empty() && segments.back().field == -1) {
+				segments.back().literal.append(value, pos, end - pos);
+			} else {
+				segment s;
+				s.field = -1;
+				s.literal = value.substr(pos, end - pos);
+				segments.push_back(s);
+			}
+			pos = end;
+			continue;
+		}
+		if (open > pos) {
+			segment s;
+			s.field = -1;
+			s.literal = value.substr(pos, open - pos);
+			if (!segments.empty() && segments.back().field == -1) {
+				segments.back().literal.append(s.literal);
+			} else {
+				segments.push_back(s);
+			}
+		}
+		segment s;
+		s.field = field;
+		segments.push_back(s);
+		pos = close + 1;
+	}
+}
+
+std::string InjectionTemplate::render(const InjectionFile *file, size_t row) const {
+	std::string res;
+	res.reserve(64);
+	for (const auto &s : segments) {
+		if (s.field == -1) {
+			res.append(s.literal);
+		} else if (s.field == -2) {
+			res.append(std::to_string(row));
+		} else {
+			const char *val;
+			size_t len;
+			if (file->get_field(row, s.field, &val, &len)) {
+				res.append(val, len);
+			} else {
+				LOG(logWARNING) << __FUNCTION__ << ": missing field" << s.field << " in row " << row << " of " << file->name;
+			}
+		}
+	}
+	return res;
+}
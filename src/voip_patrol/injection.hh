@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_INJECTION_H
+#define VOIP_PATROL_INJECTION_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <stdint.h>
+
+typedef enum injection_mode {
+	INJECTION_SEQUENTIAL,  // rows are consumed in order, shared by every action using the file
+	INJECTION_RANDOM,      // a random row is picked for every call
+	INJECTION_WORKER       // rows worker, worker+workers, worker+2*workers ... private to the action
+} injection_mode_t;
+
+injection_mode_t get_injection_mode_from_string(const std::string& mode);
+
+/*
+ * CSV injection file, the file is memory mapped and indexed once when opened,
+ * every row and field is then available by offset without copy or parsing.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+class InjectionFile {
+	public:
+		InjectionFile(const std::string& file_name, char separator=',');
+		~InjectionFile();
+		bool open();
+		void close();
+		size_t rows() const { return lines.size(); }
+		size_t fields(size_t row) const;
+		bool get_field(size_t row, size_t field, const char **val, size_t *len) const;
+		size_t next_row(injection_mode_t mode, size_t *cursor, int workers=1);
+		std::string name;
+	private:
+		struct injection_line {
+			size_t offset;
+			uint32_t first_field;
+			uint32_t field_count;
+		};
+		struct injection_field {
+			uint32_t offset; // relative to the line offset
+			uint32_t len;
+		};
+		char separator;
+		int fd {-1};
+		const char *data {nullptr};
+		size_t data_len {0};
+		std::vector<injection_line> lines;
+		std::vector<injection_field> line_fields;
+		std::atomic<size_t> sequential_cursor {0};
+		std::mutex random_lock;
+		std::minstd_rand random;
+};
+
+/*
+ * A parameter value referencing injection fields, ex: "[field0]@[field2]",
+ * "[row]" is the index of the selected row.
+ * The value is split once in literal and field segments, rendering a row is
+ * then a few appends.
+ */
+class InjectionTemplate {
+	public:
+		InjectionTemplate(const std::string& value);
+		static bool has_fields(const std::string& value);
+		std::string render(const InjectionFile *file, size_t row) const;
+	private:
+		struct segment {
+			std::string literal;
+			int field; // -1: literal, -2: row index
+		};
+		std::vector<segment> segments;
+};
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "latency.hh"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <unistd.h>
+
+#define LATENCY_RATE 8000               // of the detection
+#define LATENCY_CHIRP_MS 20
+#define LATENCY_CHIRP_LOW_HZ 400.0
+#define LATENCY_CHIRP_HIGH_HZ 3000.0
+#define LATENCY_CHIRP_AMPLITUDE 8000.0  // -12dBFS
+#define LATENCY_INTERVAL_MS 2000        // between two markers, the longest round trip measured
+#define LATENCY_FIRST_MS 1000
+#define LATENCY_QUIET_MS 200            // after a detection
+#define LATENCY_MIN_LEVEL 100.0         // window RMS, about -50dBFS
+#define LATENCY_THRESHOLD 0.6           // normalized cross-correlation
+#define LATENCY_MAX_VALUES 4096
+#define LATENCY_MAX_MARKS 8
+
+static double clock_now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<float> chirp(unsigned clock_rate) {
+	unsigned len = clock_rate * LATENCY_CHIRP_MS / 1000;
+	double duration = (double)len / clock_rate;
+	double slope = (LATENCY_CHIRP_HIGH_HZ - LATENCY_CHIRP_LOW_HZ) / duration;
+	std::vector<float> c(len);
+	for (unsigned i = 0; i < len; i++) {
+		double t = (double)i / clock_rate;
+		double window = 0.5 - 0.5 * cos(2.0 * M_PI * i / (len - 1));
+		c[i] = LATENCY_CHIRP_AMPLITUDE * window * sin(2.0 * M_PI * (LATENCY_CHIRP_LOW_HZ * t + slope * t * t / 2.0));
+	}
+	return c;
+}
+
+void LatencyStats::add(double ms) {
+	if (!count || ms < min)
+		min = ms;
+	if (!count || ms > max)
+		max = ms;
+	count++;
+	sum += ms;
+	if (values.size() < LATENCY_MAX_VALUES)
+		values.push_back(ms);
+}
+
+std::string LatencyStats::json() const {
+	std::vector<float> sorted = values;
+	std::sort(sorted.begin(), sorted.end());
+	float p50 = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+	float p95 = sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+	return "{\"count\": " + std::to_string(count) +
+	       ", \"min\": " + std::to_string(min) +
+	       ", \"avg\": " + std::to_string(count ? sum / count : 0.0) +
+	       ", \"p50\": " + std::to_string(p50) +
+	       ", \"p95\": " + std::to_string(p95) +
+	       ", \"max\": " + std::to_string(max) + "}";
+}
+
+static void add_mark(std::deque<double> &marks, double t) {
+	marks.push_back(t);
+	if (marks.size() > LATENCY_MAX_MARKS)
+		marks.pop_front();
+}
+
+// the last mark before t, within an interval
+static double mark_before(const std::deque<double> &marks, double t) {
+	for (auto it = marks.rbegin(); it != marks.rend(); ++it) {
+		if (*it <= t)
+			return t - *it < LATENCY_INTERVAL_MS / 1000.0 ? *it : 0.0;
+	}
+	return 0.0;
+}
+
+void LatencyMarks::add_sent(double t) {
+	std::lock_guard<std::mutex> guard(lock);
+	add_mark(sent, t);
+}
+
+void LatencyMarks::add_reflected(double t, double turnaround_ms) {
+	std::lock_guard<std::mutex> guard(lock);
+	add_mark(reflected, t);
+	add_mark(turnarounds, turnaround_ms);
+}
+
+double LatencyMarks::sent_before(double t) {
+	std::lock_guard<std::mutex> guard(lock);
+	return mark_before(sent, t);
+}
+
+double LatencyMarks::reflected_before(double t, double *turnaround_ms) {
+	std::lock_guard<std::mutex> guard(lock);
+	double r = mark_before(reflected, t);
+	for (size_t i = reflected.size(); r > 0.0 && i-- > 0;) {
+		if (reflected[i] == r) {
+			*turnaround_ms = turnarounds[i];
+			break;
+		}
+	}
+	return r;
+}
+
+std::string LatencyRegistry::new_key() {
+	return std::to_string(getpid()) + "-" + std::to_string(next++);
+}
+
+std::shared_ptr<LatencyMarks> LatencyRegistry::create(const std::string &key) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::shared_ptr<LatencyMarks> &m = marks[key];
+	m = std::make_shared<LatencyMarks>();
+	return m;
+}
+
+std::shared_ptr<LatencyMarks> LatencyRegistry::find(const std::string &key) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = marks.find(key);
+	return it == marks.end() ? nullptr : it->second;
+}
+
+void LatencyRegistry::remove(const std::string &key) {
+	std::lock_guard<std::mutex> guard(lock);
+	marks.erase(key);
+}
+
+LatencyProbe::LatencyProbe(unsigned in_rate, unsigned out_rate, bool reflect, std::shared_ptr<LatencyMarks> marks)
+	: AudioSink(in_rate), reflect(reflect), marks(marks), emitter(*this, out_rate) {
+	if (in_rate != LATENCY_RATE && Resampler::supported(in_rate, LATENCY_RATE))
+		resampler.reset(new Resampler(in_rate, LATENCY_RATE));
+	chirp_in = chirp(LATENCY_RATE);
+	chirp_energy = 0.0;
+	for (float c : chirp_in)
+		chirp_energy += (double)c * c;
+	history.assign(chirp_in.size() - 1, 0.0);
+	for (float c : chirp(out_rate))
+		chirp_out.push_back(lrint(c));
+	next_marker = (uint64_t)out_rate * LATENCY_FIRST_MS / 1000;
+	stats.valid = true;
+	stats.reflect = reflect;
+}
+
+void LatencyProbe::put(const pj_int16_t *samples, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (resampler) {
+		// the cost of the correlation grows with the square of the rate
+		resampled.resize((size_t)count * LATENCY_RATE / clock_rate + 16);
+		count = resampler->process(samples, count, &resampled[0]);
+		samples = &resampled[0];
+	} else if (clock_rate != LATENCY_RATE) {
+		return;
+	}
+	double now = clock_now();
+	size_t len = chirp_in.size();
+	for (unsigned i = 0; i < count; i++)
+		history.push_back(samples[i]);
+	for (unsigned i = 0; i < count; i++) {
+		// the window of the chirp length ending on the sample i, history_energy is the one of its len - 1 first samples
+		const float *window = &history[i];
+		double energy = history_energy + (double)window[len - 1] * window[len - 1];
+		history_energy = energy - (double)window[0] * window[0];
+		if (received + i + 1 < len)
+			continue;
+		uint64_t start = received + i + 1 - len;
+		if (peak > 0.0 && start > peak_at + len / 2) {
+			detected(peak_time);
+			quiet_until = peak_at + LATENCY_RATE * LATENCY_QUIET_MS / 1000;
+			peak = 0.0;
+		}
+		if (start < quiet_until || energy < LATENCY_MIN_LEVEL * LATENCY_MIN_LEVEL * len)
+			continue;
+		float ncc = audio_dot(window, &chirp_in[0], len) / sqrt(energy * chirp_energy);
+		if (ncc > LATENCY_THRESHOLD && ncc > peak) {
+			peak = ncc;
+			peak_at = start;
+			// the frame started now, the chirp can start in a previous one
+			peak_time = now + ((double)start - (double)received) / LATENCY_RATE;
+		}
+	}
+	history.erase(history.begin(), history.begin() + count);
+	received += count;
+	// updated sample by sample, computed again once per frame against the drift
+	history_energy = 0.0;
+	for (float x : history)
+		history_energy += (double)x * x;
+}
+
+void LatencyProbe::detected(double t) {
+	stats.detected++;
+	if (reflect) {
+		reflect_detected = t;
+		reflect_pending = true;
+		double s = marks ? marks->sent_before(t) : 0.0;
+		if (s > 0.0)
+			stats.forward.add((t - s) * 1000.0);
+		return;
+	}
+	// the turnaround of an accept of this process is the one measured, the one announced otherwise, 0 for an echo
+	double turnaround = peer_turnaround_ms;
+	double r = marks ? marks->reflected_before(t, &turnaround) : 0.0;
+	if (r > 0.0)
+		stats.backward.add((t - r) * 1000.0);
+	double s = mark_before(markers_sent, t);
+	if (s > 0.0)
+		stats.rtt.add((t - s) * 1000.0 - turnaround);
+}
+
+void LatencyProbe::emit(pj_int16_t *samples, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+	double now = clock_now();
+	unsigned rate = emitter.clock_rate;
+	for (unsigned i = 0; i < count; i++, sent++) {
+		if (chirp_pos < 0) {
+			bool start = false;
+			double t = now + (double)i / rate;
+			if (reflect && reflect_pending && t >= reflect_detected + LATENCY_REFLECT_MS / 1000.0) {
+				// a fixed turnaround, the detection delay depends on the frame the marker ends in
+				reflect_pending = false;
+				start = true;
+			} else if (!reflect && sent >= next_marker) {
+				next_marker += (uint64_t)rate * LATENCY_INTERVAL_MS / 1000;
+				start = true;
+			}
+			if (start) {
+				chirp_pos = 0;
+				stats.markers++;
+				if (reflect) {
+					double turnaround = (t - reflect_detected) * 1000.0;
+					stats.turnaround.add(turnaround);
+					if (marks)
+						marks->add_reflected(t, turnaround);
+				} else {
+					add_mark(markers_sent, t);
+					if (marks)
+						marks->add_sent(t);
+				}
+			}
+		}
+		if (chirp_pos >= 0) {
+			int v = samples[i] + chirp_out[chirp_pos];
+			samples[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+			if (++chirp_pos == (int)chirp_out.size())
+				chirp_pos = -1;
+		}
+	}
+}
+
+void LatencyProbe::peer_turnaround(double ms) {
+	std::lock_guard<std::mutex> guard(lock);
+	peer_turnaround_ms = ms;
+}
+
+LatencyResult LatencyProbe::result() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
+
+std::string LatencyResult::json() const {
+	std::string res = "{\"mode\": \"" + std::string(reflect ? "reflect" : "send") + "\"" +
+	                  ", \"markers\": " + std::to_string(markers) +
+	                  ", \"detected\": " + std::to_string(detected);
+	if (!rtt.empty())
+		res += ", \"rtt_ms\": " + rtt.json();
+	if (!forward.empty())
+		res += ", \"forward_ms\": " + forward.json();
+	if (!backward.empty())
+		res += ", \"backward_ms\": " + backward.json();
+	if (!turnaround.empty())
+		res += ", \"turnaround_ms\": " + turnaround.json();
+	return res + "}";
+}
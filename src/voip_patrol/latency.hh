@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_LATENCY_H
+#define VOIP_PATROL_LATENCY_H
+
+#include "audio_sink.hh"
+#include "audio_kernels.hh"
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define LATENCY_HEADER "X-VP-Latency"
+#define LATENCY_REFLECT_HEADER "X-VP-Latency-Reflect" // in the answer of an accept reflecting the markers, its delay in ms
+#define LATENCY_REFLECT_MS 100          // marker received to its reflection, longer than its detection
+
+/* distribution of the measures of a call, in ms */
+class LatencyStats {
+	public:
+		void add(double ms);
+		bool empty() const { return count == 0; }
+		std::string json() const;
+	private:
+		std::vector<float> values; // the first ones, for the percentiles
+		unsigned long count {0};
+		double sum {0.0};
+		double min {0.0};
+		double max {0.0};
+};
+
+/*
+ * Times of the markers of a call shared by its two legs when both run in this
+ * process, found by the key of the X-VP-Latency header: the one-way latencies
+ * need the same clock on both sides.
+ */
+struct LatencyMarks {
+	void add_sent(double t);
+	void add_reflected(double t, double turnaround_ms);
+	double sent_before(double t);      // 0 none
+	double reflected_before(double t, double *turnaround_ms);
+	private:
+		std::mutex lock;
+		std::deque<double> sent;
+		std::deque<double> reflected;
+		std::deque<double> turnarounds; // of the reflected ones
+};
+
+class LatencyRegistry {
+	public:
+		std::string new_key();
+		std::shared_ptr<LatencyMarks> create(const std::string &key);
+		std::shared_ptr<LatencyMarks> find(const std::string &key);
+		void remove(const std::string &key);
+	private:
+		std::atomic<unsigned> next {0};
+		std::mutex lock;
+		std::map<std::string, std::shared_ptr<LatencyMarks>> marks;
+};
+
+struct LatencyResult {
+	bool valid {false};
+	bool reflect {false};
+	unsigned long markers {0};     // sent, or reflected
+	unsigned long detected {0};
+	LatencyStats rtt;              // marker sent to its reflection received, less the turnaround of the peer
+	LatencyStats forward;          // one-way to the peer
+	LatencyStats backward;         // one-way from the peer
+	LatencyStats turnaround;       // marker received to its reflection sent
+	std::string json() const;
+};
+
+/*
+ * Mouth to ear latency of a call from chirp markers mixed in the sent audio,
+ * found in the received audio (at 8kHz) with a normalized cross-correlation.
+ * The caller sends a marker every 2 seconds and times its return, reflected by
+ * an accept in reflect mode or by an echo; the reflecting side sends a marker
+ * LATENCY_REFLECT_MS after the start of the one it received, the caller takes
+ * off the turnaround shared by the marks or announced in the answer. Both
+ * parts run in the same media clock thread.
+ */
+class LatencyProbe : public AudioSink {
+	public:
+		LatencyProbe(unsigned in_rate, unsigned out_rate, bool reflect, std::shared_ptr<LatencyMarks> marks);
+		void put(const pj_int16_t *samples, unsigned count) override;
+		AudioSource& source() { return emitter; }
+		LatencyResult result() const;
+		void peer_turnaround(double ms); // of a reflecting peer not sharing its marks
+	private:
+		class Emitter : public AudioSource {
+			public:
+				Emitter(LatencyProbe &probe, unsigned clock_rate) : AudioSource(clock_rate), probe(probe) {}
+				void mix(pj_int16_t *samples, unsigned count) override { probe.emit(samples, count); }
+			private:
+				LatencyProbe &probe;
+		};
+		void emit(pj_int16_t *samples, unsigned count);
+		void detected(double t);
+		bool reflect;
+		std::shared_ptr<LatencyMarks> marks;
+		Emitter emitter;
+		// receiving, at 8kHz
+		std::unique_ptr<Resampler> resampler;
+		std::vector<int16_t> resampled;
+		std::vector<float> chirp_in;
+		double chirp_energy;
+		std::vector<float> history;    // the last samples of the correlation window, then the frame
+		double history_energy {0.0};
+		uint64_t received {0};         // samples before the frame
+		uint64_t quiet_until {0};
+		float peak {0.0};
+		uint64_t peak_at {0};
+		double peak_time {0.0};
+		// sending, at the source rate
+		std::vector<int16_t> chirp_out;
+		uint64_t sent {0};
+		uint64_t next_marker;
+		int chirp_pos {-1};
+		std::atomic<bool> reflect_pending {false};
+		double reflect_detected {0.0};
+		std::deque<double> markers_sent;
+		double peer_turnaround_ms {0.0};
+		LatencyResult stats;
+		mutable std::mutex lock; // put() and emit() run in the media clock thread, result() in a SIP thread
+};
+
+#endif
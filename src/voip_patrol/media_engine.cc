@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "media_engine.hh"
+#include "direct_media.hh"
+#include "log.h"
+#include <pjsua-lib/pjsua.h>
+#include <algorithm>
+
+MediaEngine::~MediaEngine() {
+	stop();
+}
+
+bool MediaEngine::start(int threads) {
+	if (threads < 1 || running()) {
+		return false;
+	}
+	pool = pjsua_pool_create("media_engine", 1024, 1024);
+	pjmedia_clock_param param;
+	param.usec_interval = MEDIA_ENGINE_TICK_MS * 1000;
+	param.clock_rate = 1000 / MEDIA_ENGINE_TICK_MS;
+	for (int i = 0; i < threads; i++) {
+		std::unique_ptr<MediaWorker> worker(new MediaWorker());
+		worker->index = i;
+		pj_status_t status = pjmedia_clock_create2(pool, &param, 0, &on_tick, worker.get(), &worker->clock);
+		if (status != PJ_SUCCESS) {
+			LOG(logERROR) << __FUNCTION__ << ": can not create media worker " << i << ": " << status;
+			stop();
+			return false;
+		}
+		worker->started = std::chrono::steady_clock::now();
+		pjmedia_clock_start(worker->clock);
+		workers.push_back(std::move(worker));
+	}
+	LOG(logINFO) << __FUNCTION__ << ": media worker threads:" << threads << " tick:" << MEDIA_ENGINE_TICK_MS << "ms";
+	return true;
+}
+
+void MediaEngine::stop() {
+	for (auto &worker : workers) {
+		if (worker->clock) {
+			pjmedia_clock_stop(worker->clock);
+			pjmedia_clock_destroy(worker->clock);
+			worker->clock = nullptr;
+		}
+	}
+	workers.clear();
+	if (pool) {
+		pj_pool_release(pool);
+		pool = nullptr;
+	}
+}
+
+int MediaEngine::add(DirectMedia *media, unsigned ptime_ms) {
+	if (!running()) {
+		return -1;
+	}
+	MediaWorker *worker = workers[next++ % workers.size()].get();
+	MediaSlot slot;
+	slot.media = media;
+	slot.period = std::max(1u, (ptime_ms + MEDIA_ENGINE_TICK_MS / 2) / MEDIA_ENGINE_TICK_MS);
+	slot.countdown = 1;
+	std::lock_guard<std::mutex> guard(worker->lock);
+	worker->slots.push_back(slot);
+	worker->calls_total++;
+	return worker->index;
+}
+
+void MediaEngine::remove(DirectMedia *media, int index) {
+	if (index < 0 || index >= (int)workers.size()) {
+		return;
+	}
+	MediaWorker *worker = workers[index].get();
+	std::lock_guard<std::mutex> guard(worker->lock);
+	for (auto it = worker->slots.begin(); it != worker->slots.end(); ++it) {
+		if (it->media == media) {
+			worker->slots.erase(it);
+			return;
+		}
+	}
+}
+
+void MediaEngine::on_tick(const pj_timestamp *ts, void *user_data) {
+	PJ_UNUSED_ARG(ts);
+	MediaWorker *worker = (MediaWorker *)user_data;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> guard(worker->lock);
+
+	// the clock calls back several times in a row when it is behind
+	std::chrono::steady_clock::time_point expected = worker->started + std::chrono::milliseconds(worker->ticks * MEDIA_ENGINE_TICK_MS);
+	worker->ticks++;
+	if (now > expected) {
+		uint64_t late_us = std::chrono::duration_cast<std::chrono::microseconds>(now - expected).count();
+		worker->max_late_us = std::max(worker->max_late_us, late_us);
+		if (late_us > MEDIA_ENGINE_TICK_MS * 1000) {
+			worker->late_ticks++;
+		}
+	}
+	for (auto &slot : worker->slots) {
+		if (--slot.countdown > 0) {
+			continue;
+		}
+		slot.countdown = slot.period;
+		slot.media->tick();
+		worker->frames++;
+	}
+	worker->busy_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+}
+
+std::string MediaEngine::stats_json() {
+	std::string res = "{\"threads\": " + std::to_string(workers.size()) + ", \"tick_ms\": " + std::to_string(MEDIA_ENGINE_TICK_MS);
+	res += ", \"workers\": [";
+	for (size_t i = 0; i < workers.size(); i++) {
+		MediaWorker *w = workers[i].get();
+		std::lock_guard<std::mutex> guard(w->lock);
+		if (i > 0) {
+			res += ", ";
+		}
+		// share of the elapsed time spent exchanging frames
+		double load = w->ticks ? (double)w->busy_us / (w->ticks * MEDIA_ENGINE_TICK_MS * 1000) : 0.0;
+		res += "{\"thread\": " + std::to_string(w->index) +
+			", \"calls\": " + std::to_string(w->slots.size()) +
+			", \"calls_total\": " + std::to_string(w->calls_total) +
+			", \"frames\": " + std::to_string(w->frames) +
+			", \"ticks\": " + std::to_string(w->ticks) +
+			", \"late_ticks\": " + std::to_string(w->late_ticks) +
+			", \"max_late_ms\": " + std::to_string(w->max_late_us / 1000.0) +
+			", \"load\": " + std::to_string(load) + "}";
+	}
+	res += "]}";
+	return res;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_MEDIA_ENGINE_H
+#define VOIP_PATROL_MEDIA_ENGINE_H
+
+#include <pjmedia.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define MEDIA_ENGINE_TICK_MS 5
+
+class DirectMedia;
+
+struct MediaSlot {
+	DirectMedia *media;
+	unsigned period;     // ticks between two frames, the ptime of the stream
+	unsigned countdown;
+};
+
+struct MediaWorker {
+	int index {0};
+	pjmedia_clock *clock {nullptr};
+	std::mutex lock;     // held during a tick, a removed call is not served anymore once remove() returns
+	std::vector<MediaSlot> slots;
+	std::chrono::steady_clock::time_point started;
+	uint64_t ticks {0};
+	uint64_t frames {0};
+	uint64_t calls_total {0};
+	uint64_t busy_us {0};
+	uint64_t late_ticks {0}; // started more than a tick after their time
+	uint64_t max_late_us {0};
+};
+
+/*
+ * Media worker threads of the direct media path. Every worker is a pjmedia clock
+ * ticking every MEDIA_ENGINE_TICK_MS and exchanging the frames of its own set of
+ * call streams, a call is given to the next worker (round-robin) when its stream is created.
+ * Without it every direct media call has its own master port clock thread.
+ */
+class MediaEngine {
+	public:
+		~MediaEngine();
+		bool start(int threads);
+		void stop();
+		bool running() const { return !workers.empty(); }
+		int add(DirectMedia *media, unsigned ptime_ms);
+		void remove(DirectMedia *media, int worker);
+		std::string stats_json();
+	private:
+		static void on_tick(const pj_timestamp *ts, void *user_data);
+		std::vector<std::unique_ptr<MediaWorker>> workers;
+		std::atomic<unsigned> next {0};
+		pj_pool_t *pool {nullptr};
+};
+
+#endif
@@ -17,66 +17,297 @@
  */
 
 #include "voip_patrol.hh"
+#include "mod_voip_patrol.hh"
+#include <atomic>
 
 #define THIS_FILE "mod_voip_patrol.cc"
 
+static const char *mod_name = "mod_voip_patrol";
+
+pjsip_module mod_voip_patrol = {
+	NULL, NULL,                     /* prev, next.              */
+	{ (char *)mod_name, 15 },      /* Name.                    */
+	-1,                             /* Id                       */
+	//PJSIP_MOD_PRIORITY_APPLICATION, /* Priority                 */
+	1,
+	NULL,                           /* load()                   */
+	NULL,                           /* start()                  */
+	NULL,                           /* stop()                   */
+	NULL,                           /* unload()                 */
+	NULL,                           /* on_rx_request()          */
+	NULL,                           /* on_rx_response()         */
+	vp_on_tx_msg,                   /* on_tx_request()          */
+	vp_on_tx_msg,                   /* on_tx_response()         */
+	NULL,                           /* on_tsx_state()           */
+};
+
+/*
+ * Rules are indexed by message type (request/response) and method id, a message
+ * with no rule for its method is never looked at.
+ * The table is immutable once published, adding a rule publishes a new table,
+ * the transmit path only does an atomic load.
+ * A message printed again is invalidated by pjsip, its info is cleared: the info of
+ * the rewritten print is kept in the module data, retransmissions of the same print
+ * are not rewritten twice.
+ */
+struct rewrite_table {
+	std::vector<RewriteRule> rules;
+	std::vector<const RewriteRule *> buckets[2][PJSIP_OTHER_METHOD + 1];
+};
+
+static std::atomic<rewrite_table *> rewrite_rules {nullptr};
+static std::vector<rewrite_table *> rewrite_retired_tables;
+static std::mutex rewrite_rules_lock;
+
+static const char *rewrite_find(const char *start, const char *end, const char *s, size_t len) {
+	if ((size_t)(end - start) < len) {
+		return NULL;
+	}
+	for (const char *p = start; p <= end - len; p++) {
+		if (p[0] == s[0] && memcmp(p, s, len) == 0) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static char *rewrite_search(const RewriteRule *rule, char *start, char *end) {
+	size_t len = rule->match.size();
+	const char *m = rule->match.data();
+	if (len == 0 || (size_t)(end - start) < len) {
+		return NULL;
+	}
+	char *p = start;
+	while (p <= end - len) {
+		unsigned char last = (unsigned char)p[len - 1];
+		if (last == (unsigned char)m[len - 1] && memcmp(p, m, len - 1) == 0) {
+			return p;
+		}
+		p += rule->skip[last];
+	}
+	return NULL;
+}
+
+static bool rewrite_replace(pjsip_tx_data *tdata, char *pos, size_t len, const std::string& replace) {
+	pj_ssize_t delta = (pj_ssize_t)replace.size() - (pj_ssize_t)len;
+	if (delta > 0 && tdata->buf.cur + delta > tdata->buf.end) {
+		LOG(logWARNING) << __FUNCTION__ << ": no room in tx buffer for the replacement of " << len << " bytes";
+		return false;
+	}
+	if (delta != 0) {
+		memmove(pos + replace.size(), pos + len, tdata->buf.cur - (pos + len));
+	}
+	memcpy(pos, replace.data(), replace.size());
+	tdata->buf.cur += delta;
+	return true;
+}
+
+// Apply a rule on [start, *end), *end is moved with the replacements.
+static int rewrite_region(pjsip_tx_data *tdata, const RewriteRule *rule, char *start, char **end) {
+	int count = 0;
+	char *pos = start;
+	while (pos < *end) {
+		char *found = rewrite_search(rule, pos, *end);
+		if (!found) {
+			break;
+		}
+		size_t len = rule->match.size();
+		if (rule->wildcard) {
+			while (found + len < *end && !strchr(" ;>,\r\n", found[len])) {
+				len++;
+			}
+		}
+		if (!rewrite_replace(tdata, found, len, rule->replace)) {
+			break;
+		}
+		*end += (pj_ssize_t)rule->replace.size() - (pj_ssize_t)len;
+		pos = found + rule->replace.size();
+		count++;
+	}
+	return count;
+}
+
+static int rewrite_apply(pjsip_tx_data *tdata, const RewriteRule *rule) {
+	char *start = tdata->buf.start;
+	const char *hdr_end_c = rewrite_find(start, tdata->buf.cur, "\r\n\r\n", 4);
+	// rules never touch the body, its length is in Content-Length
+	char *hdr_end = hdr_end_c ? (char *)hdr_end_c + 2 : tdata->buf.cur;
+	char *eol = (char *)rewrite_find(start, hdr_end, "\r\n", 2);
+	if (!eol) {
+		return 0;
+	}
+	if (rule->request_line) {
+		return rewrite_region(tdata, rule, start, &eol);
+	}
+	if (rule->header.empty()) {
+		return rewrite_region(tdata, rule, start, &hdr_end);
+	}
+
+	int count = 0;
+	size_t hlen = rule->header.size();
+	char *line = eol + 2;
+	while (line < hdr_end) {
+		eol = (char *)rewrite_find(line, hdr_end, "\r\n", 2);
+		if (!eol) {
+			eol = hdr_end;
+		}
+		if ((size_t)(eol - line) > hlen && pj_ansi_strnicmp(line, rule->header.c_str(), hlen) == 0) {
+			char *value = line + hlen;
+			while (value < eol && (*value == ' ' || *value == '\t')) {
+				value++;
+			}
+			if (value < eol && *value == ':') {
+				char *line_end = eol;
+				int n = rewrite_region(tdata, rule, value + 1, &line_end);
+				hdr_end += line_end - eol;
+				eol = line_end;
+				count += n;
+			}
+		}
+		line = eol + 2;
+	}
+	return count;
+}
+
+// index once the vector is final, buckets point into it, called with rewrite_rules_lock
+static void rewrite_publish(rewrite_table *table) {
+	for (const auto &r : table->rules) {
+		int type = r.code ? 1 : 0;
+		if (r.method.empty()) {
+			for (int id = 0; id <= PJSIP_OTHER_METHOD; id++) {
+				table->buckets[type][id].push_back(&r);
+			}
+			continue;
+		}
+		pjsip_method m;
+		pj_str_t name = pj_str((char *)r.method.c_str());
+		pjsip_method_init_np(&m, &name);
+		table->buckets[type][m.id].push_back(&r);
+	}
+	rewrite_table *current = rewrite_rules.exchange(table);
+	if (current) {
+		// a transmitting thread may still be using it
+		rewrite_retired_tables.push_back(current);
+	}
+}
+
+bool vp_rewrite_add_rule(const std::string& method, int code, const std::string& header, const std::string& match, const std::string& replace,
+                         bool global) {
+	if (match.empty() || match == "*") {
+		LOG(logERROR) << __FUNCTION__ << ": empty match";
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(rewrite_rules_lock);
+	rewrite_table *current = rewrite_rules.load();
+	rewrite_table *table = new rewrite_table();
+	if (current) {
+		table->rules = current->rules;
+	}
+
+	RewriteRule rule;
+	rule.method = method;
+	rule.code = code;
+	rule.header = header;
+	rule.replace = replace;
+	rule.global = global;
+	rule.match = match;
+	if (rule.match.back() == '*') {
+		rule.wildcard = true;
+		rule.match.pop_back();
+	}
+	if (pj_ansi_stricmp(header.c_str(), "Request-Line") == 0 || pj_ansi_stricmp(header.c_str(), "Status-Line") == 0) {
+		rule.request_line = true;
+	}
+	size_t len = rule.match.size();
+	for (int i = 0; i < 256; i++) {
+		rule.skip[i] = len;
+	}
+	for (size_t i = 0; i + 1 < len; i++) {
+		rule.skip[(unsigned char)rule.match[i]] = len - 1 - i;
+	}
+	table->rules.push_back(rule);
+	rewrite_publish(table);
+	LOG(logINFO) << __FUNCTION__ << ": method[" << method << "] code[" << code << "] header[" << header << "] match[" << match << "] replace[" << replace << "]";
+	return true;
+}
+
+// the rules of the previous scenario are dropped, the global ones are kept
+void vp_rewrite_clear() {
+	std::lock_guard<std::mutex> lock(rewrite_rules_lock);
+	// the calls of the previous scenario are over, only the last table can still be in use
+	for (auto retired : rewrite_retired_tables) {
+		delete retired;
+	}
+	rewrite_retired_tables.clear();
+	rewrite_table *current = rewrite_rules.load();
+	if (!current) {
+		return;
+	}
+	rewrite_table *table = new rewrite_table();
+	for (const auto &r : current->rules) {
+		if (r.global) {
+			table->rules.push_back(r);
+		}
+	}
+	LOG(logINFO) << __FUNCTION__ << ": rules dropped:" << current->rules.size() - table->rules.size() << " kept:" << table->rules.size();
+	rewrite_publish(table);
+}
+
+pj_status_t vp_rewrite_register(pjsip_endpoint *endpt) {
+	if (mod_voip_patrol.id != -1) {
+		return PJ_SUCCESS;
+	}
+	/* Register stateless server module */
+	return pjsip_endpt_register_module(endpt, &mod_voip_patrol);
+}
+
 pj_status_t vp_on_tx_msg(pjsip_tx_data *tdata) {
 	/* Important note:
 	 *  tp_info field is only valid after outgoing messages has passed
 	 *  transport layer. So don't try to access tp_info when the module
 	 *  has lower priority than transport layer.
 	 */
+	const rewrite_table *table = rewrite_rules.load(std::memory_order_acquire);
+	pjsip_msg *msg = tdata->msg;
+	if (!table || !msg || !tdata->buf.start) {
+		return PJ_SUCCESS;
+	}
+	// retransmissions are sent from the same print, it is already rewritten
+	if (tdata->info && tdata->mod_data[mod_voip_patrol.id] == (void *)tdata->info) {
+		return PJ_SUCCESS;
+	}
 
-
-	// Curently the logic is simply to strip the transport to reproduce some broken carrier, this should evolve to be controled using PCRE
-	pjsip_sip_uri *sip_uri = (pjsip_sip_uri*)tdata->msg->line.req.uri;
-	LOG(logINFO) <<__FUNCTION__<<":"<< sip_uri->host.ptr <<" " << sip_uri->transport_param.ptr << "\n" ;
-
-	sip_uri->transport_param.ptr = NULL;
-	sip_uri->transport_param.slen = 0;
-	pj_str_t buff;
-	buff.ptr = tdata->buf.start;
-	buff.slen = tdata->buf.cur - tdata->buf.start;
-
-	LOG(logINFO) <<__FUNCTION__<<">>>> :"<<buff.slen <<" "<< sip_uri->host.ptr <<" " << sip_uri->transport_param.ptr << "\n" ;
-	char packet[PJSIP_MAX_PKT_LEN];
-	packet[0] = '\0';
-	char *packet_ptr = packet;
-
-	char *m = tdata->buf.start;
-	const char t[12] = ";transport=";
-	if (m[0] == 'A') {
-		char *ret = strstr(m, t);
-		if (ret) {
-			memcpy(packet_ptr, tdata->buf.start, ret - tdata->buf.start);
-			packet_ptr += ret - tdata->buf.start;
-			*packet_ptr = ' ';
-			packet_ptr++;
-			while (ret && ret[0] != 'S' && ret[1] != 'I') {
-				ret[0] = ' ';
-				ret++;
-			}
-			memcpy(packet_ptr, ret, tdata->buf.cur - ret);
-			packet_ptr +=  tdata->buf.cur - ret;
-			tdata->buf.cur = tdata->buf.start;
-			memcpy(tdata->buf.cur, packet, packet_ptr - packet);
-			tdata->buf.cur += (packet_ptr - packet);
-//			LOG(logINFO) <<__FUNCTION__<<">>OUT>> :\n" << tdata->buf.start << "\n" ;
+	const pjsip_method *method;
+	int type = 0;
+	int code = 0;
+	if (msg->type == PJSIP_REQUEST_MSG) {
+		method = &msg->line.req.method;
+	} else {
+		const pjsip_cseq_hdr *cseq = (const pjsip_cseq_hdr *)pjsip_msg_find_hdr(msg, PJSIP_H_CSEQ, NULL);
+		if (!cseq) {
+			return PJ_SUCCESS;
 		}
+		method = &cseq->method;
+		code = msg->line.status.code;
+		type = 1;
 	}
 
-//    PJ_LOG(3,(THIS_FILE, ">>> TX %d bytes %s to %s %s:%d:\n"
-//                         "%.*s\n"
-//                         "--end msg--",
-//                         (tdata->buf.cur - tdata->buf.start),
-//                         pjsip_tx_data_get_info(tdata),
-//                         tdata->tp_info.transport->type_name,
-//                         tdata->tp_info.dst_name,
-//                         tdata->tp_info.dst_port,
-//                         (int)(tdata->buf.cur - tdata->buf.start),
-//                         tdata->buf.start));
+	int count = 0;
+	for (const RewriteRule *rule : table->buckets[type][method->id]) {
+		if (rule->code && rule->code != code) {
+			continue;
+		}
+		if (method->id == PJSIP_OTHER_METHOD && !rule->method.empty() && pj_stricmp2(&method->name, rule->method.c_str()) != 0) {
+			continue;
+		}
+		count += rewrite_apply(tdata, rule);
+	}
+	if (count > 0) {
+		// the info is allocated once per print, from the pool of the message
+		tdata->mod_data[mod_voip_patrol.id] = (void *)pjsip_tx_data_get_info(tdata);
+		LOG(logDEBUG) << __FUNCTION__ << ": " << tdata->info << " rewrites:" << count;
+	}
 
 	/* Always return success, otherwise message will not get sent! */
 	return PJ_SUCCESS;
 }
-
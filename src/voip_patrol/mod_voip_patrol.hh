@@ -22,25 +22,32 @@
 // #include "mod_voip_patrol.h"
 #include "voip_patrol.hh"
 
-pj_status_t vp_on_tx_msg(pjsip_tx_data *tdata);
+/*
+ * Outbound message rewrite rule, applied in place on the printed tdata buffer.
+ * - method: request method or CSeq method of a response, empty for all
+ * - code: only for responses with this status code, 0 for requests
+ * - header: "Request-Line", a header name or empty for the whole message
+ * - match: literal, a trailing '*' extends the match up to the next ' ', ';', '>', ',' or end of line
+ * - global: set from the command line, kept when the rules of a scenario are cleared
+ */
+struct RewriteRule {
+	std::string method;
+	int code {0};
+	std::string header;
+	std::string match;
+	std::string replace;
+	bool request_line {false};
+	bool wildcard {false};
+	bool global {false};
+	size_t skip[256]; // Boyer-Moore-Horspool shift table of match
+};
 
-const char *mod_name = "mod_voip_patrol";
+bool vp_rewrite_add_rule(const std::string& method, int code, const std::string& header, const std::string& match, const std::string& replace,
+                         bool global=false);
+void vp_rewrite_clear();
+pj_status_t vp_rewrite_register(pjsip_endpoint *endpt);
+pj_status_t vp_on_tx_msg(pjsip_tx_data *tdata);
 
-pjsip_module mod_voip_patrol = {
-	NULL, NULL,                     /* prev, next.              */
-	{ (char *)mod_name, 15 },      /* Name.                    */
-	-1,                             /* Id                       */
-	//PJSIP_MOD_PRIORITY_APPLICATION, /* Priority                 */
-	1,
-	NULL,                           /* load()                   */
-	NULL,                           /* start()                  */
-	NULL,                           /* stop()                   */
-	NULL,                           /* unload()                 */
-	NULL,                           /* on_rx_request()          */
-	NULL,                           /* on_rx_response()         */
-	vp_on_tx_msg,                   /* on_tx_request()          */
-	NULL,                           /* on_tx_response()         */
-	NULL,                           /* on_tsx_state()           */
-};
+extern pjsip_module mod_voip_patrol;
 
 #endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "quality.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+/* Convenient function to convert transmission factor to MOS */
+float rfactor_to_mos(float rfactor) {
+	float mos;
+	if (rfactor <= 0) {
+		mos = 0.0;
+	} else if (rfactor > 100) {
+		mos = 4.5;
+	} else {
+		mos = rfactor*4.5/100;
+	}
+	return mos;
+}
+
+float emodel_rfactor(float loss_percent) {
+	const int Bpl = 25; // packet-loss robustness factor
+	const int Ie = 0;
+	float Ie_eff = Ie + (95 - Ie) * loss_percent / (loss_percent + Bpl);
+	return 100 - Ie_eff;
+}
+
+// G.107 7.4 Delay impairment factor, Id
+float emodel_delay_impairment(float delay_ms) {
+	const int mT = 100; // minimum perceivable delay
+	const int sT = 1;   // delay sensitivity
+	if (delay_ms < mT) {
+		return 0.0;
+	}
+	float X = log10(delay_ms / mT) / log10(2.0);
+	return 25.0 * (pow(1 + pow(X, 6.0 * sT), 1.0 / (6.0 * sT)) - 3.0 * pow(1.0 + pow(X / 3.0, 6.0 * sT), 1.0 / (6.0 * sT)) + 2);
+}
+
+static float loss_percent(uint64_t lost, uint64_t expected) {
+	return expected ? std::min(100.0f, lost * 100.0f / expected) : 0.0f;
+}
+
+void QualitySeries::sample(int t, const pj::StreamStat &stat) {
+	const pj::RtcpStreamStat &rx = stat.rtcp.rxStat;
+	const pj::RtcpStreamStat &tx = stat.rtcp.txStat;
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (rx.pkt < previous.rx_pkt || tx.pkt < previous.tx_pkt) {
+		previous = {0, 0, 0, 0, 0, 0};
+	}
+	uint64_t rx_pkt = rx.pkt - previous.rx_pkt;
+	uint64_t rx_lost = (rx.loss - std::min<uint64_t>(rx.loss, previous.rx_loss)) + (rx.discard - std::min<uint64_t>(rx.discard, previous.rx_discard));
+	uint64_t tx_pkt = tx.pkt - previous.tx_pkt;
+	uint64_t tx_lost = (tx.loss - std::min<uint64_t>(tx.loss, previous.tx_loss)) + (tx.discard - std::min<uint64_t>(tx.discard, previous.tx_discard));
+	previous = {rx.pkt, rx.loss, rx.discard, tx.pkt, tx.loss, tx.discard};
+
+	QualitySample s;
+	s.t = t;
+	s.rtt = stat.rtcp.rttUsec.last / 1000.0;
+	s.jitter_rx = rx.jitterUsec.last / 1000.0;
+	s.jitter_tx = tx.jitterUsec.last / 1000.0;
+	// no packet received during the interval is a media outage, there is no VAD
+	s.loss_rx = rx_pkt ? loss_percent(rx_lost, rx_pkt + rx_lost) : 100.0;
+	float rfactor_rx = emodel_rfactor(s.loss_rx);
+	s.mos_lq_rx = rfactor_to_mos(rfactor_rx);
+	s.mos_cq_rx = rfactor_to_mos(rfactor_rx - emodel_delay_impairment(s.rtt / 2 + stat.jbuf.avgDelayMsec));
+	if (tx_pkt || samples.empty()) {
+		s.loss_tx = loss_percent(tx_lost, tx_pkt + tx_lost);
+		float rfactor_tx = emodel_rfactor(s.loss_tx);
+		s.mos_lq_tx = rfactor_to_mos(rfactor_tx);
+		// the jitter buffer of the peer is extrapolated to twice the jitter
+		s.mos_cq_tx = rfactor_to_mos(rfactor_tx - emodel_delay_impairment(s.rtt / 2 + s.jitter_tx * 2));
+	} else {
+		// no RTCP report of the peer during the interval
+		s.loss_tx = samples.back().loss_tx;
+		s.mos_lq_tx = samples.back().mos_lq_tx;
+		s.mos_cq_tx = samples.back().mos_cq_tx;
+	}
+	samples.push_back(s);
+}
+
+bool QualitySeries::empty() {
+	std::lock_guard<std::mutex> guard(lock);
+	return samples.empty();
+}
+
+int QualitySeries::last_t() {
+	std::lock_guard<std::mutex> guard(lock);
+	return samples.empty() ? 0 : samples.back().t;
+}
+
+static std::string json_series(const std::vector<QualitySample> &samples, float QualitySample::*field) {
+	std::string res = "[";
+	char value[16];
+	for (size_t i = 0; i < samples.size(); i++) {
+		snprintf(value, sizeof(value), "%s%.2f", i ? ", " : "", samples[i].*field);
+		res += value;
+	}
+	return res + "]";
+}
+
+std::string QualitySeries::json(int interval) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::string t = "[";
+	const QualitySample *worst = nullptr;
+	float loss_max = 0, jitter_max = 0, rtt_max = 0;
+	for (size_t i = 0; i < samples.size(); i++) {
+		const QualitySample &s = samples[i];
+		t += (i ? ", " : "") + std::to_string(s.t);
+		if (!worst || s.mos_cq_rx < worst->mos_cq_rx) {
+			worst = &s;
+		}
+		loss_max = std::max(loss_max, s.loss_rx);
+		jitter_max = std::max(jitter_max, s.jitter_rx);
+		rtt_max = std::max(rtt_max, s.rtt);
+	}
+	t += "]";
+	std::string res = "{\"interval\": " + std::to_string(interval) + ", \"t\": " + t;
+	res += ", \"mos_lq_rx\": " + json_series(samples, &QualitySample::mos_lq_rx);
+	res += ", \"mos_cq_rx\": " + json_series(samples, &QualitySample::mos_cq_rx);
+	res += ", \"mos_lq_tx\": " + json_series(samples, &QualitySample::mos_lq_tx);
+	res += ", \"mos_cq_tx\": " + json_series(samples, &QualitySample::mos_cq_tx);
+	res += ", \"loss_rx\": " + json_series(samples, &QualitySample::loss_rx);
+	res += ", \"loss_tx\": " + json_series(samples, &QualitySample::loss_tx);
+	res += ", \"jitter_rx\": " + json_series(samples, &QualitySample::jitter_rx);
+	res += ", \"rtt\": " + json_series(samples, &QualitySample::rtt);
+	if (worst) {
+		// the interval with the lowest received conversational quality and the extremes of the call
+		res += ", \"worst\": {\"t\": " + std::to_string(worst->t) +
+			", \"mos_lq_rx\": " + std::to_string(worst->mos_lq_rx) +
+			", \"mos_cq_rx\": " + std::to_string(worst->mos_cq_rx) +
+			", \"loss_rx\": " + std::to_string(worst->loss_rx) +
+			", \"loss_rx_max\": " + std::to_string(loss_max) +
+			", \"jitter_rx_max\": " + std::to_string(jitter_max) +
+			", \"rtt_max\": " + std::to_string(rtt_max) + "}";
+	}
+	return res + "}";
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_QUALITY_H
+#define VOIP_PATROL_QUALITY_H
+
+#include <pjsua2.hpp>
+#include <mutex>
+#include <string>
+#include <vector>
+
+float rfactor_to_mos(float rfactor);
+// G.107 with the codec independent values used for the end of call figures, Ie 0 and Bpl 25
+float emodel_rfactor(float loss_percent);
+float emodel_delay_impairment(float delay_ms);
+
+struct QualitySample {
+	int t;               // seconds since the call was answered
+	float loss_rx;       // percent, lost and discarded packets of the interval
+	float loss_tx;       // as reported by the RTCP of the peer
+	float jitter_rx;     // ms
+	float jitter_tx;
+	float rtt;
+	float mos_lq_rx;
+	float mos_cq_rx;
+	float mos_lq_tx;
+	float mos_cq_tx;
+};
+
+/*
+ * Quality of a call interval by interval, from the difference between two
+ * readings of the stream statistics. The counters restart with a stream
+ * recreated by a re-INVITE.
+ */
+class QualitySeries {
+	public:
+		void sample(int t, const pj::StreamStat &stat);
+		bool empty();
+		int last_t();
+		std::string json(int interval);
+	private:
+		struct {
+			uint64_t rx_pkt, rx_loss, rx_discard;
+			uint64_t tx_pkt, tx_loss, tx_discard;
+		} previous {0, 0, 0, 0, 0, 0};
+		std::vector<QualitySample> samples;
+		std::mutex lock; // sampled by the wait action and when the stream is destroyed
+};
+
+#endif
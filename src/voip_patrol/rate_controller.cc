@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "rate_controller.hh"
+#include "log.h"
+#include <algorithm>
+#include <stdio.h>
+
+#define RATE_MAX_PAUSE_S 60
+
+RateController::RateController(float rate, float min, float max, float increase, float decrease)
+	: current(rate), min(min), max(max), increase(increase), decrease(decrease), lowest(rate) {
+}
+
+void RateController::overload(int retry_after_s, clock::time_point now) {
+	std::lock_guard<std::mutex> guard(lock);
+	overloads++;
+	if (retry_after_s > 0) {
+		pause_until = std::max(pause_until, now + std::chrono::seconds(std::min(retry_after_s, RATE_MAX_PAUSE_S)));
+		pauses++;
+	}
+	// the calls already in flight report the same overload
+	if (now - last_decrease < std::chrono::seconds(1)) {
+		return;
+	}
+	last_decrease = now;
+	current = std::max(min, current * decrease);
+	lowest = std::min(lowest, current);
+	decreases++;
+	LOG(logINFO) << __FUNCTION__ << ": rate decreased to " << current << " cps retry_after:" << retry_after_s;
+}
+
+void RateController::success() {
+	std::lock_guard<std::mutex> guard(lock);
+	successes++;
+	// at the current rate there are "current" answers per second
+	current = std::min(max, current + increase / std::max(current, 1.0f));
+}
+
+float RateController::rate() {
+	std::lock_guard<std::mutex> guard(lock);
+	return current;
+}
+
+int RateController::pause_ms(clock::time_point now) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (pause_until <= now) {
+		return 0;
+	}
+	return std::chrono::duration_cast<std::chrono::milliseconds>(pause_until - now).count();
+}
+
+std::string RateController::json() {
+	std::lock_guard<std::mutex> guard(lock);
+	char buf[256];
+	snprintf(buf, sizeof(buf), "{\"rate\": %.2f, \"lowest\": %.2f, \"overloads\": %d, \"decreases\": %d, \"pauses\": %d, \"successes\": %d}",
+		current, lowest, overloads, decreases, pauses, successes);
+	return buf;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_RATE_CONTROLLER_H
+#define VOIP_PATROL_RATE_CONTROLLER_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+/*
+ * AIMD call rate, every answered call raises the rate so that it grows by
+ * "increase" calls per second every second, an overload signal (503, 408,
+ * transaction timeout) multiplies it by "decrease" at most once per second.
+ * A Retry-After pauses the new calls.
+ */
+class RateController {
+	public:
+		typedef std::chrono::steady_clock clock;
+		RateController(float rate, float min, float max, float increase, float decrease);
+		void overload(int retry_after_s) { overload(retry_after_s, clock::now()); }
+		void overload(int retry_after_s, clock::time_point now); // the time given by the tests
+		void success();
+		float rate();
+		int pause_ms() { return pause_ms(clock::now()); }
+		int pause_ms(clock::time_point now);
+		std::string json();
+	private:
+		std::mutex lock;
+		float current;
+		float min;
+		float max;
+		float increase;
+		float decrease;
+		clock::time_point last_decrease;
+		clock::time_point pause_until;
+		int decreases {0};
+		int pauses {0};
+		int overloads {0};
+		int successes {0};
+		float lowest;
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "recording_writer.hh"
+#include "log.h"
+#include <pjlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+#define RECORDING_RING_SECONDS 4
+#define RECORDING_PERIOD_MS 50
+#define RECORDING_BATCH 65536          // bytes written at once
+#define RECORDING_MAX_BACKLOG 1048576  // encoded bytes waiting for the disk, then the ring fills up
+#define WAV_HEADER_SIZE 44
+
+static bool ends_with(const std::string &s, const std::string &suffix) {
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void put_le(std::vector<uint8_t> &out, uint32_t v, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void wav_header(std::vector<uint8_t> &out, unsigned clock_rate, uint64_t data_bytes) {
+	uint32_t data = data_bytes > 0xffffffd0 ? 0xffffffd0 : (uint32_t)data_bytes;
+	out.insert(out.end(), {'R', 'I', 'F', 'F'});
+	put_le(out, 36 + data, 4);
+	out.insert(out.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+	put_le(out, 16, 4);
+	put_le(out, 1, 2); // PCM
+	put_le(out, 1, 2); // mono
+	put_le(out, clock_rate, 4);
+	put_le(out, clock_rate * 2, 4);
+	put_le(out, 2, 2);
+	put_le(out, 16, 2);
+	out.insert(out.end(), {'d', 'a', 't', 'a'});
+	put_le(out, data, 4);
+}
+
+AsyncRecorder::AsyncRecorder(const std::string &file_name, RecordingFormat format, unsigned clock_rate)
+	: AudioSink(clock_rate), file_name(file_name), format(format) {
+	size_t size = 1;
+	while (size < (size_t)clock_rate * RECORDING_RING_SECONDS)
+		size <<= 1;
+	ring.resize(size);
+	mask = size - 1;
+	pending.resize(FLAC_BLOCK_SIZE);
+}
+
+AsyncRecorder::~AsyncRecorder() {
+	if (fp)
+		fclose(fp);
+}
+
+// media clock thread, never waits
+void AsyncRecorder::put(const pj_int16_t *samples, unsigned count) {
+	size_t h = head.load(std::memory_order_relaxed);
+	size_t t = tail.load(std::memory_order_acquire);
+	if (count > ring.size() - (h - t)) {
+		dropped += count;
+		return;
+	}
+	size_t pos = h & mask;
+	size_t first = std::min((size_t)count, ring.size() - pos);
+	memcpy(&ring[pos], samples, first * sizeof(int16_t));
+	memcpy(&ring[0], samples + first, (count - first) * sizeof(int16_t));
+	head.store(h + count, std::memory_order_release);
+}
+
+size_t AsyncRecorder::available() {
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+size_t AsyncRecorder::read(int16_t *out, size_t max) {
+	size_t t = tail.load(std::memory_order_relaxed);
+	size_t n = std::min(max, head.load(std::memory_order_acquire) - t);
+	size_t pos = t & mask;
+	size_t first = std::min(n, ring.size() - pos);
+	memcpy(out, &ring[pos], first * sizeof(int16_t));
+	memcpy(out + first, &ring[0], (n - first) * sizeof(int16_t));
+	tail.store(t + n, std::memory_order_release);
+	return n;
+}
+
+RecordingWriter::~RecordingWriter() {
+	stop();
+}
+
+bool RecordingWriter::handles(const std::string &file_name) {
+	return async || ends_with(file_name, ".flac");
+}
+
+std::shared_ptr<AsyncRecorder> RecordingWriter::open(const std::string &file_name, unsigned clock_rate) {
+	RecordingFormat fmt = ends_with(file_name, ".flac") ? RecordingFormat::flac : RecordingFormat::wav;
+	std::shared_ptr<AsyncRecorder> rec = std::make_shared<AsyncRecorder>(file_name, fmt, clock_rate);
+	// created here, the call that can not record is told, the writer thread only writes
+	rec->fp = fopen(file_name.c_str(), "wb");
+	if (!rec->fp) {
+		LOG(logERROR) << __FUNCTION__ << ": [error] can not open recording " << file_name;
+		failures++;
+		return nullptr;
+	}
+	if (fmt == RecordingFormat::flac) {
+		rec->flac.reset(new FlacEncoder(clock_rate, 1));
+		rec->flac->header(rec->out);
+	} else {
+		wav_header(rec->out, clock_rate, 0);
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	if (stopping) {
+		return nullptr;
+	}
+	if (!thread.joinable()) {
+		thread = std::thread(&RecordingWriter::run, this);
+		LOG(logINFO) << __FUNCTION__ << ": recording writer started, bandwidth:" << bandwidth;
+	}
+	recorders.push_back(rec);
+	recordings++;
+	return rec;
+}
+
+// the recordings still open are closed and written without the bandwidth cap
+void RecordingWriter::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		for (auto &rec : recorders)
+			rec->close();
+	}
+	cv.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void RecordingWriter::run() {
+	// the recorders, and their pool, can be released here
+	pj_thread_desc desc;
+	pj_thread_t *pj_thread;
+	if (!pj_thread_is_registered())
+		pj_thread_register("vp_recording", desc, &pj_thread);
+
+	auto last = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		cv.wait_for(guard, std::chrono::milliseconds(RECORDING_PERIOD_MS), [this] { return stopping; });
+		bool force = stopping;
+		std::vector<std::shared_ptr<AsyncRecorder>> list = recorders;
+		guard.unlock();
+
+		if (bandwidth) {
+			auto now = std::chrono::steady_clock::now();
+			tokens += bandwidth * std::chrono::duration<double>(now - last).count();
+			tokens = std::min(tokens, (double)bandwidth);
+			last = now;
+		}
+		std::vector<AsyncRecorder *> done;
+		for (auto &rec : list) {
+			if (drain(*rec, force))
+				done.push_back(rec.get());
+		}
+		list.clear();
+
+		guard.lock();
+		recorders.erase(std::remove_if(recorders.begin(), recorders.end(), [&done](const std::shared_ptr<AsyncRecorder> &rec) {
+			return std::find(done.begin(), done.end(), rec.get()) != done.end();
+		}), recorders.end());
+		if (force && recorders.empty())
+			break;
+	}
+}
+
+// true once the recording is complete on disk
+bool RecordingWriter::drain(AsyncRecorder &rec, bool force) {
+	// closed after the last frame was put
+	bool closing = rec.closing;
+
+	while (force || rec.out.size() < RECORDING_MAX_BACKLOG) {
+		size_t n = rec.read(&rec.pending[rec.pending_count], FLAC_BLOCK_SIZE - rec.pending_count);
+		if (!n)
+			break;
+		samples += n;
+		rec.pending_count += n;
+		if (rec.failed) {
+			rec.pending_count = 0;
+		} else if (rec.flac) {
+			if (rec.pending_count == FLAC_BLOCK_SIZE) {
+				rec.flac->encode(&rec.pending[0], FLAC_BLOCK_SIZE, rec.out);
+				rec.pending_count = 0;
+			}
+		} else {
+			const uint8_t *bytes = (const uint8_t *)&rec.pending[0];
+			rec.out.insert(rec.out.end(), bytes, bytes + rec.pending_count * sizeof(int16_t));
+			rec.data_bytes += rec.pending_count * sizeof(int16_t);
+			rec.pending_count = 0;
+		}
+	}
+	bool last = closing && rec.available() == 0;
+	if (last && rec.flac && rec.pending_count) {
+		// a shorter block ends the stream
+		rec.flac->encode(&rec.pending[0], rec.pending_count, rec.out);
+		rec.pending_count = 0;
+	}
+	if (rec.out.size() > max_backlog)
+		max_backlog = rec.out.size();
+
+	if (rec.failed) {
+		rec.out.clear();
+	} else if (last || force || rec.out.size() >= RECORDING_BATCH) {
+		size_t max = rec.out.size();
+		if (bandwidth && !force) {
+			max = std::min(max, (size_t)std::max(tokens, 0.0));
+			tokens -= max;
+		}
+		write(rec, max);
+	}
+	if (last && rec.out.empty()) {
+		finish(rec);
+		return true;
+	}
+	return false;
+}
+
+void RecordingWriter::write(AsyncRecorder &rec, size_t max) {
+	if (!max)
+		return;
+	size_t n = fwrite(&rec.out[0], 1, max, rec.fp);
+	if (n != max) {
+		LOG(logERROR) << __FUNCTION__ << ": [error] writing recording " << rec.file_name;
+		rec.failed = true;
+		failures++;
+	}
+	rec.out.erase(rec.out.begin(), rec.out.begin() + max);
+	bytes_written += n;
+	writes++;
+}
+
+// the header gets the final sizes
+void RecordingWriter::finish(AsyncRecorder &rec) {
+	samples_dropped += rec.dropped;
+	if (!rec.fp)
+		return;
+	if (!rec.failed) {
+		std::vector<uint8_t> header;
+		if (rec.flac)
+			rec.flac->header(header);
+		else
+			wav_header(header, rec.clock_rate, rec.data_bytes);
+		if (fseek(rec.fp, 0, SEEK_SET) == 0)
+			fwrite(&header[0], 1, header.size(), rec.fp);
+		completed++;
+	}
+	fclose(rec.fp);
+	rec.fp = nullptr;
+	LOG(logINFO) << __FUNCTION__ << ": recording " << rec.file_name << " dropped samples:" << rec.dropped;
+}
+
+std::string RecordingWriter::stats_json() {
+	return "{\"recordings\": " + std::to_string(recordings) +
+	       ", \"completed\": " + std::to_string(completed) +
+	       ", \"failures\": " + std::to_string(failures) +
+	       ", \"bytes_written\": " + std::to_string(bytes_written) +
+	       ", \"samples\": " + std::to_string(samples) +
+	       ", \"samples_dropped\": " + std::to_string(samples_dropped) +
+	       ", \"writes\": " + std::to_string(writes) +
+	       ", \"max_backlog\": " + std::to_string(max_backlog) + "}";
+}
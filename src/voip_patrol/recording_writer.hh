@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_RECORDING_WRITER_H
+#define VOIP_PATROL_RECORDING_WRITER_H
+
+#include "audio_sink.hh"
+#include "flac_encoder.hh"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class RecordingFormat { wav, flac };
+
+/*
+ * A call recording: the media clock thread only copies the frames in a lock
+ * free ring (one writer, one reader), the writer thread empties it, encodes
+ * and writes the file. A full ring drops the frames, the media is never held.
+ */
+class AsyncRecorder : public AudioSink {
+	public:
+		AsyncRecorder(const std::string &file_name, RecordingFormat format, unsigned clock_rate);
+		~AsyncRecorder();
+		void put(const pj_int16_t *samples, unsigned count) override;
+		void close() { closing = true; }
+		std::string file_name;
+		RecordingFormat format;
+	private:
+		friend class RecordingWriter;
+		size_t read(int16_t *out, size_t max);
+		size_t available();
+		std::vector<int16_t> ring;
+		size_t mask;
+		std::atomic<size_t> head {0}; // written by the media clock thread
+		std::atomic<size_t> tail {0}; // read by the writer thread
+		std::atomic<bool> closing {false};
+		std::atomic<unsigned long> dropped {0};
+		// writer thread only, once opened
+		FILE *fp {nullptr};
+		bool failed {false};
+		std::unique_ptr<FlacEncoder> flac;
+		std::vector<int16_t> pending;   // the FLAC block being filled
+		size_t pending_count {0};
+		std::vector<uint8_t> out;
+		uint64_t data_bytes {0};
+};
+
+/*
+ * Background writer of the recordings, WAV or FLAC by the file extension,
+ * the writes are batched and the disk bandwidth can be capped.
+ */
+class RecordingWriter {
+	public:
+		~RecordingWriter();
+		void stop();
+		bool running() { return recordings > 0; }
+		bool handles(const std::string &file_name);
+		std::shared_ptr<AsyncRecorder> open(const std::string &file_name, unsigned clock_rate);
+		std::string stats_json();
+		RecordingFormat format {RecordingFormat::wav}; // of the "auto" recordings
+		bool async {false};                             // every recording, not only FLAC
+		unsigned long bandwidth {0};                    // bytes per second, 0 unlimited
+	private:
+		void run();
+		bool drain(AsyncRecorder &rec, bool force);
+		void write(AsyncRecorder &rec, size_t max);
+		void finish(AsyncRecorder &rec);
+		std::thread thread;
+		bool stopping {false};
+		std::mutex lock;
+		std::condition_variable cv;
+		std::vector<std::shared_ptr<AsyncRecorder>> recorders;
+		double tokens {0.0};
+		// stats, read by the main thread
+		std::atomic<unsigned long> recordings {0};
+		std::atomic<unsigned long> completed {0};
+		std::atomic<unsigned long> failures {0};
+		std::atomic<unsigned long long> bytes_written {0};
+		std::atomic<unsigned long long> samples {0};
+		std::atomic<unsigned long long> samples_dropped {0};
+		std::atomic<unsigned long> writes {0};
+		std::atomic<size_t> max_backlog {0};
+};
+
+#endif
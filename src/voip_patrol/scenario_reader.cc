@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "scenario_reader.hh"
+#include "log.h"
+#include <ctype.h>
+#include <string.h>
+
+#define SCENARIO_READ_CHUNK 65536
+
+ScenarioReader::ScenarioReader(const std::string& file_name) : name(file_name) {
+}
+
+ScenarioReader::~ScenarioReader() {
+	release();
+	if (file) {
+		fclose(file);
+	}
+}
+
+bool ScenarioReader::open() {
+	file = fopen(name.c_str(), "r");
+	if (!file) {
+		LOG(logERROR) << __FUNCTION__ << ": can not open scenario file: " << name;
+		return false;
+	}
+	return true;
+}
+
+bool ScenarioReader::rewind() {
+	release();
+	buffer.clear();
+	pos = 0;
+	eof = false;
+	action_count = 0;
+	return file && fseek(file, 0, SEEK_SET) == 0;
+}
+
+void ScenarioReader::release() {
+	if (xml) {
+		ezxml_free(xml);
+		xml = nullptr;
+	}
+}
+
+// drop what was consumed and append the next chunk of the file
+bool ScenarioReader::fill() {
+	if (eof || !file) {
+		return false;
+	}
+	buffer.erase(0, pos);
+	pos = 0;
+	size_t len = buffer.size();
+	buffer.resize(len + SCENARIO_READ_CHUNK);
+	size_t n = fread(&buffer[len], 1, SCENARIO_READ_CHUNK, file);
+	buffer.resize(len + n);
+	if (n < SCENARIO_READ_CHUNK) {
+		eof = true;
+	}
+	return n > 0;
+}
+
+// position of the '>' closing the tag starting at pos, quoted values can contain '>'
+size_t ScenarioReader::tag_end(size_t p) {
+	char quote = 0;
+	for (; p < buffer.size(); p++) {
+		char c = buffer[p];
+		if (quote) {
+			if (c == quote) quote = 0;
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (c == '>') {
+			return p;
+		}
+	}
+	return std::string::npos;
+}
+
+// end of a comment, CDATA section or declaration starting at pos
+size_t ScenarioReader::skip_markup(size_t p) {
+	size_t end;
+	if (buffer.compare(p, 4, "<!--") == 0) {
+		end = buffer.find("-->", p + 4);
+		return end == std::string::npos ? end : end + 3;
+	}
+	if (buffer.compare(p, 9, "<![CDATA[") == 0) {
+		end = buffer.find("]]>", p + 9);
+		return end == std::string::npos ? end : end + 3;
+	}
+	end = tag_end(p);
+	return end == std::string::npos ? end : end + 1;
+}
+
+ezxml_t ScenarioReader::next() {
+	release();
+	while (true) {
+		size_t lt = buffer.find('<', pos);
+		if (lt == std::string::npos) {
+			pos = buffer.size();
+			if (!fill()) {
+				return nullptr;
+			}
+			continue;
+		}
+		pos = lt;
+		// enough to tell an action from a comment or another element
+		if (buffer.size() - pos < 10 && !eof) {
+			fill();
+			continue;
+		}
+		// top level elements of <actions>, a <parallel> block comes with its streams
+		std::string element;
+		for (const char *tag : {"action", "parallel"}) {
+			size_t len = strlen(tag);
+			if (buffer.compare(pos + 1, len, tag) == 0 && pos + len + 1 < buffer.size()) {
+				char c = buffer[pos + len + 1];
+				if (isspace((unsigned char)c) || c == '/' || c == '>') {
+					element = tag;
+				}
+			}
+		}
+		if (element.empty()) {
+			size_t end = skip_markup(pos);
+			if (end == std::string::npos) {
+				if (!fill()) {
+					return nullptr;
+				}
+				continue;
+			}
+			pos = end;
+			continue;
+		}
+
+		size_t end = tag_end(pos);
+		size_t stop = std::string::npos;
+		if (end != std::string::npos && buffer[end - 1] == '/') {
+			stop = end + 1;
+		} else if (end != std::string::npos) {
+			size_t close = buffer.find("</" + element, end);
+			size_t gt = (close == std::string::npos) ? close : buffer.find('>', close);
+			if (gt != std::string::npos) {
+				stop = gt + 1;
+			}
+		}
+		if (stop == std::string::npos) {
+			if (!fill()) {
+				LOG(logERROR) << __FUNCTION__ << ": truncated " << element << " at the end of " << name;
+				return nullptr;
+			}
+			continue;
+		}
+
+		snippet.assign(buffer, pos, stop - pos);
+		pos = stop;
+		xml = ezxml_parse_str(&snippet[0], snippet.size());
+		if (!xml || *ezxml_error(xml)) {
+			LOG(logERROR) << __FUNCTION__ << ": invalid " << element << " " << (xml ? ezxml_error(xml) : "") << " in " << name;
+			release();
+			continue;
+		}
+		action_count++;
+		return xml;
+	}
+}
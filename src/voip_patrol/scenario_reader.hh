@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_SCENARIO_READER_H
+#define VOIP_PATROL_SCENARIO_READER_H
+
+#include "ezxml/ezxml.h"
+#include <stdio.h>
+#include <string>
+
+/*
+ * Streaming scenario reader, pulls one <action> (or <parallel>) element at a time from the
+ * file, memory is bounded by the read chunk and the largest action.
+ * Each action is parsed on its own with ezxml, the returned element is
+ * valid until the next call to next() or rewind().
+ */
+class ScenarioReader {
+	public:
+		ScenarioReader(const std::string& file_name);
+		~ScenarioReader();
+		bool open();
+		ezxml_t next();
+		bool rewind();
+		size_t actions() const { return action_count; }
+	private:
+		bool fill();
+		size_t skip_markup(size_t pos);
+		size_t tag_end(size_t pos);
+		void release();
+		std::string name;
+		FILE *file {nullptr};
+		bool eof {false};
+		std::string buffer;
+		size_t pos {0};
+		std::string snippet;
+		ezxml_t xml {nullptr};
+		size_t action_count {0};
+};
+
+#endif
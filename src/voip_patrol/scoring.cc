@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "scoring.hh"
+#include "voip_patrol.hh"
+#include "log.h"
+#include <pjsua-lib/pjsua.h>
+#include <algorithm>
+#include <string.h>
+
+#define REFERENCE_PTIME 20
+
+AudioCapture::AudioCapture(unsigned clock_rate, size_t max_samples) : AudioSink(clock_rate), max_samples(max_samples) {
+	if (clock_rate != AUDIO_SCORE_RATE && Resampler::supported(clock_rate, AUDIO_SCORE_RATE)) {
+		resampler.reset(new Resampler(clock_rate, AUDIO_SCORE_RATE));
+	}
+	samples.reserve(max_samples);
+}
+
+void AudioCapture::put(const pj_int16_t *in, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (samples.size() >= max_samples) {
+		return;
+	}
+	if (resampler) {
+		resampled.resize(count * AUDIO_SCORE_RATE / clock_rate + 1);
+		count = resampler->process(in, count, resampled.data());
+		in = resampled.data();
+	} else if (clock_rate != AUDIO_SCORE_RATE) {
+		return;
+	}
+	count = std::min((size_t)count, max_samples - samples.size());
+	samples.insert(samples.end(), in, in + count);
+}
+
+std::vector<float> AudioCapture::take() {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<float> res;
+	res.swap(samples);
+	return res;
+}
+
+ScoringPool::~ScoringPool() {
+	stop();
+}
+
+void ScoringPool::start(int count) {
+	std::lock_guard<std::mutex> guard(lock);
+	stopping = false;
+	while ((int)threads.size() < count) {
+		threads.push_back(std::thread(&ScoringPool::run, this));
+	}
+	LOG(logINFO) << __FUNCTION__ << ": scoring threads:" << threads.size();
+}
+
+void ScoringPool::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	cv.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+std::shared_ptr<const std::vector<float>> ScoringPool::reference(const std::string& file_name) {
+	std::lock_guard<std::mutex> guard(references_lock);
+	auto it = references.find(file_name);
+	if (it != references.end()) {
+		return it->second;
+	}
+	std::shared_ptr<const std::vector<float>> &ref = references[file_name];
+	pj_pool_t *pool = pjsua_pool_create("reference", 4000, 4000);
+	pjmedia_port *player, *port;
+	if (pjmedia_wav_player_port_create(pool, file_name.c_str(), REFERENCE_PTIME, PJMEDIA_FILE_NO_LOOP, 0, &player) != PJ_SUCCESS) {
+		LOG(logERROR) << __FUNCTION__ << ": can not read the reference " << file_name;
+		pj_pool_release(pool);
+		return ref;
+	}
+	if (PJMEDIA_PIA_CCNT(&player->info) != 1) {
+		LOG(logERROR) << __FUNCTION__ << ": the reference is not mono " << file_name;
+		pjmedia_port_destroy(player);
+		pj_pool_release(pool);
+		return ref;
+	}
+	port = player;
+	// any rate, 44.1kHz references included
+	if (PJMEDIA_PIA_SRATE(&player->info) != AUDIO_SCORE_RATE &&
+	    pjmedia_resample_port_create(pool, player, AUDIO_SCORE_RATE, 0, &port) != PJ_SUCCESS) {
+		pjmedia_port_destroy(player);
+		pj_pool_release(pool);
+		return ref;
+	}
+	std::shared_ptr<std::vector<float>> samples = std::make_shared<std::vector<float>>();
+	std::vector<pj_int16_t> frame(PJMEDIA_PIA_SPF(&port->info));
+	while (true) {
+		pjmedia_frame f;
+		f.buf = frame.data();
+		f.size = frame.size() * sizeof(pj_int16_t);
+		f.type = PJMEDIA_FRAME_TYPE_AUDIO;
+		if (pjmedia_port_get_frame(port, &f) != PJ_SUCCESS || f.type != PJMEDIA_FRAME_TYPE_AUDIO) {
+			break;
+		}
+		samples->insert(samples->end(), frame.begin(), frame.end());
+	}
+	// the resample port destroys the player
+	pjmedia_port_destroy(port);
+	pj_pool_release(pool);
+	LOG(logINFO) << __FUNCTION__ << ": " << file_name << " " << samples->size() * 1000 / AUDIO_SCORE_RATE << "ms";
+	ref = samples;
+	return ref;
+}
+
+void ScoringPool::submit(Test *test, std::shared_ptr<const std::vector<float>> reference, std::vector<float> degraded) {
+	if (threads.empty()) {
+		start(threads_count);
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	jobs.push_back(Job{test, reference, std::move(degraded)});
+	cv.notify_one();
+}
+
+void ScoringPool::run() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		cv.wait(guard, [this] { return stopping || !jobs.empty(); });
+		if (jobs.empty()) {
+			// stopping, the calls already submitted are scored first
+			return;
+		}
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		scoring++;
+		guard.unlock();
+		AudioScore score = audio_score(*job.reference, job.degraded);
+		guard.lock();
+		job.test->audio_score = score;
+		job.test->mos = score.mos;
+		job.test->mos_ready = true;
+		done.push_back(job.test);
+		scoring--;
+	}
+}
+
+std::vector<Test *> ScoringPool::completed() {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<Test *> res;
+	res.swap(done);
+	return res;
+}
+
+int ScoringPool::pending() {
+	std::lock_guard<std::mutex> guard(lock);
+	return jobs.size() + scoring + done.size();
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_SCORING_H
+#define VOIP_PATROL_SCORING_H
+
+#include "audio_kernels.hh"
+#include "audio_score.hh"
+#include "audio_sink.hh"
+#include <pjmedia.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Test;
+
+/* Received audio of a call kept in memory at 8kHz for the scoring */
+class AudioCapture : public AudioSink {
+	public:
+		AudioCapture(unsigned clock_rate, size_t max_samples);
+		void put(const pj_int16_t *samples, unsigned count) override;
+		std::vector<float> take();
+	private:
+		std::unique_ptr<Resampler> resampler;
+		std::vector<pj_int16_t> resampled;
+		std::vector<float> samples;
+		size_t max_samples;
+		std::mutex lock;
+};
+
+/*
+ * Worker threads scoring the captured audio against the reference once a call
+ * has ended, the wait action completes the scored tests.
+ */
+class ScoringPool {
+	public:
+		~ScoringPool();
+		void start(int threads);
+		void stop(); // once the pending jobs are scored
+		// 8kHz samples of a mono WAV file, loaded once, when the scenario is compiled
+		std::shared_ptr<const std::vector<float>> reference(const std::string& file_name);
+		void submit(Test *test, std::shared_ptr<const std::vector<float>> reference, std::vector<float> degraded);
+		std::vector<Test *> completed();
+		int pending();
+		int threads_count {2};
+	private:
+		struct Job {
+			Test *test;
+			std::shared_ptr<const std::vector<float>> reference;
+			std::vector<float> degraded;
+		};
+		void run();
+		std::vector<std::thread> threads;
+		std::deque<Job> jobs;
+		std::vector<Test *> done;
+		int scoring {0};
+		bool stopping {false};
+		std::mutex lock;
+		std::condition_variable cv;
+		std::mutex references_lock;
+		std::map<std::string, std::shared_ptr<const std::vector<float>>> references;
+};
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "source_pool.hh"
+#include "log.h"
+#include <functional>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace pj;
+
+source_select_t get_source_select_from_string(const std::string& mode) {
+	if (mode.compare("hash") == 0) return SOURCE_HASH;
+	return SOURCE_ROUND_ROBIN;
+}
+
+bool SourcePool::parse(const std::string& spec) {
+	std::stringstream ss(spec);
+	std::string entry;
+
+	while (std::getline(ss, entry, ',')) {
+		if (entry.empty()) {
+			continue;
+		}
+		std::string address = entry;
+		int port = 0;
+		int port_end = 0;
+		size_t pos = entry.rfind(':');
+		// an IPv6 address has more than one ':', it is not supported
+		if (pos != std::string::npos && entry.find(':') == pos) {
+			address = entry.substr(0, pos);
+			std::string ports = entry.substr(pos + 1);
+			size_t dash = ports.find('-');
+			port = atoi(ports.c_str());
+			port_end = (dash == std::string::npos) ? port : atoi(ports.c_str() + dash + 1);
+		} else if (pos != std::string::npos) {
+			LOG(logERROR) << __FUNCTION__ << ": IPv6 source address not supported: " << entry;
+			return false;
+		}
+		if (address.empty() || port < 0 || port_end < port || port_end > 65535) {
+			LOG(logERROR) << __FUNCTION__ << ": invalid source address: " << entry;
+			return false;
+		}
+		for (int p = port; p <= port_end; p++) {
+			std::unique_ptr<SourceAddress> source(new SourceAddress());
+			source->address = address;
+			source->port = p;
+			sources.push_back(std::move(source));
+		}
+	}
+	return !sources.empty();
+}
+
+bool SourcePool::create(Endpoint& ep, bool udp, bool tcp) {
+	for (auto &source : sources) {
+		TransportConfig tcfg;
+		tcfg.port = source->port;
+		tcfg.boundAddress = source->address;
+		tcfg.publicAddress = source->address;
+		try {
+			if (udp) {
+				source->udp_id = ep.transportCreate(PJSIP_TRANSPORT_UDP, tcfg);
+			}
+			// outgoing connections are bound to the address of the listener
+			if (tcp) {
+				source->tcp_id = ep.transportCreate(PJSIP_TRANSPORT_TCP, tcfg);
+			}
+		} catch (Error & err) {
+			LOG(logERROR) << __FUNCTION__ << ": source " << source->address << ":" << source->port << " " << err.info();
+			return false;
+		}
+		LOG(logINFO) << __FUNCTION__ << ": source " << source->address << ":" << source->port << " udp[" << source->udp_id << "] tcp[" << source->tcp_id << "]";
+	}
+	return true;
+}
+
+int SourcePool::select(const std::string& key) {
+	if (sources.empty()) {
+		return -1;
+	}
+	if (mode == SOURCE_HASH) {
+		return std::hash<std::string>()(key) % sources.size();
+	}
+	return next.fetch_add(1) % sources.size();
+}
+
+pjsua_transport_id SourcePool::transport_id(int index, const std::string& transport) const {
+	if (index < 0 || index >= (int)sources.size()) {
+		return -1;
+	}
+	if (transport == "tcp") {
+		return sources[index]->tcp_id;
+	}
+	if (transport.empty() || transport == "udp") {
+		return sources[index]->udp_id;
+	}
+	return -1;
+}
+
+std::string SourcePool::name(int index) const {
+	if (index < 0 || index >= (int)sources.size()) {
+		return "";
+	}
+	return sources[index]->address + ":" + std::to_string(sources[index]->port);
+}
+
+void SourcePool::count(int index, bool registration) {
+	if (index < 0 || index >= (int)sources.size()) {
+		return;
+	}
+	if (registration) {
+		sources[index]->registrations++;
+	} else {
+		sources[index]->calls++;
+	}
+}
+
+void SourcePool::result(int index, bool success) {
+	if (index < 0 || index >= (int)sources.size()) {
+		return;
+	}
+	if (success) {
+		sources[index]->passed++;
+	} else {
+		sources[index]->failed++;
+	}
+}
+
+// the transports are kept, every scenario counts its own calls
+void SourcePool::reset_stats() {
+	for (auto &s : sources) {
+		s->calls = 0;
+		s->registrations = 0;
+		s->passed = 0;
+		s->failed = 0;
+	}
+}
+
+std::string SourcePool::stats_json() const {
+	std::string res = "[";
+	for (size_t i = 0; i < sources.size(); i++) {
+		const SourceAddress *s = sources[i].get();
+		if (i > 0) {
+			res += ", ";
+		}
+		res += "{\"source\": \"" + name(i) + "\", "
+			"\"calls\": " + std::to_string(s->calls) + ", "
+			"\"registrations\": " + std::to_string(s->registrations) + ", "
+			"\"passed\": " + std::to_string(s->passed) + ", "
+			"\"failed\": " + std::to_string(s->failed) + "}";
+	}
+	res += "]";
+	return res;
+}
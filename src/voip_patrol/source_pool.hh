@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_SOURCE_POOL_H
+#define VOIP_PATROL_SOURCE_POOL_H
+
+#include <pjsua2.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef enum source_select {
+	SOURCE_ROUND_ROBIN,
+	SOURCE_HASH           // the same key always leaves from the same source
+} source_select_t;
+
+source_select_t get_source_select_from_string(const std::string& mode);
+
+struct SourceAddress {
+	std::string address;
+	int port {0};
+	pjsua_transport_id udp_id {-1};
+	pjsua_transport_id tcp_id {-1};
+	std::atomic<int> calls {0};
+	std::atomic<int> registrations {0};
+	std::atomic<int> passed {0};
+	std::atomic<int> failed {0};
+};
+
+/*
+ * Pool of local source addresses, every address and port gets its own UDP
+ * and TCP transport, calls and registrations are spread among them.
+ */
+class SourcePool {
+	public:
+		// "ip[:port[-port_end]],ip[:port[-port_end]],..."
+		bool parse(const std::string& spec);
+		bool create(pj::Endpoint& ep, bool udp, bool tcp);
+		bool empty() const { return sources.empty(); }
+		int select(const std::string& key);
+		pjsua_transport_id transport_id(int index, const std::string& transport) const;
+		std::string name(int index) const;
+		void count(int index, bool registration);
+		void result(int index, bool success);
+		std::string stats_json() const;
+		void reset_stats();
+		source_select_t mode {SOURCE_ROUND_ROBIN};
+	private:
+		std::vector<std::unique_ptr<SourceAddress>> sources;
+		std::atomic<unsigned int> next {0};
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "trace.hh"
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+#include <thread>
+
+#define TRACE_CHECK_INTERVAL_MS 100
+
+TraceReplay::TraceReplay(Config *config, const CallAction &call, const vector<ActionCheck> &checks,
+                         const pj::SipHeaderVector &x_headers, const vector<ActionParam> &params)
+	: config(config), call(call), checks(checks), x_headers(x_headers) {
+	for (auto &param : params) {
+		if (param.name.compare("file") == 0) file = param.s_val;
+		else if (param.name.compare("time_scale") == 0 && param.f_val > 0) time_scale = param.f_val;
+		else if (param.name.compare("volume") == 0 && param.f_val > 0) volume = param.f_val;
+	}
+	this->call.repeat = 0;
+	this->call.concurrency = 0;
+	this->call.rate = 0;
+	this->call.backpressure = false;
+	this->call.hold.type = DIST_FIXED;
+	// a single pass of the wait loop, disconnects the calls that reached their duration
+	check_params = config->action.get_params(ActionType::wait);
+	config->action.set_param_by_name(&check_params, "ms", "0");
+}
+
+void TraceReplay::wait_until(clock::time_point at) {
+	while (true) {
+		clock::time_point now = clock::now();
+		if (now - checked >= std::chrono::milliseconds(TRACE_CHECK_INTERVAL_MS)) {
+			config->action.do_wait(check_params);
+			checked = now;
+			continue;
+		}
+		if (now >= at) {
+			return;
+		}
+		std::this_thread::sleep_until(std::min(at, checked + std::chrono::milliseconds(TRACE_CHECK_INTERVAL_MS)));
+	}
+}
+
+void TraceReplay::run() {
+	TraceReader reader(file);
+	if (!reader.open()) {
+		config->total_tasks_count += 100;
+		return;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": " << file << " time_scale:" << time_scale << " volume:" << volume;
+
+	Distribution fraction;
+	fraction.type = DIST_UNIFORM;
+	fraction.max = 1.0;
+	std::string label = call.label.empty() ? "trace" : call.label;
+	TraceRecord record;
+	double first_offset = 0.0;
+	double last_offset = 0.0;
+	int records = 0;
+	int calls = 0;
+	int unordered = 0;
+	clock::time_point start = clock::now();
+	checked = start;
+	while (reader.next(record)) {
+		if (records == 0) {
+			// offsets can be relative or absolute (epoch of the CDR)
+			first_offset = record.offset;
+		}
+		if (record.offset < last_offset) {
+			unordered++;
+		}
+		last_offset = std::max(last_offset, record.offset);
+		records++;
+
+		clock::time_point at = start + std::chrono::microseconds((long long)((record.offset - first_offset) * time_scale * 1e6));
+		wait_until(at);
+		double lateness_ms = std::chrono::duration<double, std::milli>(clock::now() - at).count();
+		config->traffic_summary.add(label + "/lateness_ms", "trace", lateness_ms);
+
+		int copies = (int)volume;
+		if (TrafficRandom::current(config->random).sample(fraction) < volume - copies) {
+			copies++;
+		}
+		CallAction record_call = call;
+		if (!record.caller.empty()) record_call.caller = record.caller;
+		if (!record.callee.empty()) record_call.callee = record.callee;
+		if (record.duration > 0) {
+			// the hangup is checked every second
+			record_call.hangup_duration = std::max(1, (int)std::lround(record.duration * time_scale));
+		}
+		for (int i = 0; i < copies; i++) {
+			config->total_tasks_count += 1;
+			config->action.do_call(record_call, checks, x_headers);
+			calls++;
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	char buf[512];
+	snprintf(buf, sizeof(buf), "{\"trace\": {\"file\": \"%s\", \"time_scale\": %.3f, \"volume\": %.3f, \"records\": %d, \"invalid\": %d, "
+	         "\"unordered\": %d, \"calls\": %d, \"trace_duration\": %.3f, \"replay_duration\": %.3f}}",
+	         file.c_str(), time_scale, volume, records, reader.invalid, unordered, calls, last_offset - first_offset, elapsed);
+	std::string res = buf;
+	config->result_file.write(res);
+	config->result_file.flush();
+	LOG(logINFO) << __FUNCTION__ << ": " << res;
+}
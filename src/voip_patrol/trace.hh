@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_TRACE_H
+#define VOIP_PATROL_TRACE_H
+
+#include "voip_patrol.hh"
+#include "trace_reader.hh"
+#include <chrono>
+#include <string>
+
+/*
+ * Trace replay, every record is called at its offset from the first record,
+ * scaled by time_scale, volume replays each record that many times on average.
+ * Arrivals follow a steady clock, the calls are checked every 100ms in between.
+ */
+class TraceReplay {
+	public:
+		TraceReplay(Config *config, const CallAction &call, const vector<ActionCheck> &checks,
+		            const pj::SipHeaderVector &x_headers, const vector<ActionParam> &params);
+		void run();
+	private:
+		typedef std::chrono::steady_clock clock;
+		void wait_until(clock::time_point at);
+		Config *config;
+		CallAction call;
+		const vector<ActionCheck> &checks;
+		const pj::SipHeaderVector &x_headers;
+		std::string file;
+		double time_scale {1.0};
+		double volume {1.0};
+		clock::time_point checked;
+		vector<ActionParam> check_params;
+};
+
+#endif
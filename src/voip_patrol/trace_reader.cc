@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "trace_reader.hh"
+#include "log.h"
+#include <stdlib.h>
+#include <vector>
+
+TraceReader::TraceReader(const std::string& file_name) : name(file_name) {
+}
+
+TraceReader::~TraceReader() {
+	free(line);
+	if (file) {
+		fclose(file);
+	}
+}
+
+bool TraceReader::open() {
+	file = fopen(name.c_str(), "r");
+	if (!file) {
+		LOG(logERROR) << __FUNCTION__ << ": can not open trace file: " << name;
+		return false;
+	}
+	return true;
+}
+
+static std::string trim(const std::string& s) {
+	size_t start = s.find_first_not_of(" \t\r\n\"");
+	if (start == std::string::npos) {
+		return "";
+	}
+	size_t end = s.find_last_not_of(" \t\r\n\"");
+	return s.substr(start, end - start + 1);
+}
+
+bool TraceReader::next(TraceRecord &record) {
+	ssize_t len;
+	while (file && (len = getline(&line, &line_size, file)) != -1) {
+		line_count++;
+		std::string l = trim(std::string(line, len));
+		if (l.empty() || l[0] == '#') {
+			continue;
+		}
+		std::vector<std::string> fields;
+		size_t start = 0, comma;
+		while ((comma = l.find(',', start)) != std::string::npos && fields.size() < 3) {
+			fields.push_back(trim(l.substr(start, comma - start)));
+			start = comma + 1;
+		}
+		fields.push_back(trim(l.substr(start)));
+
+		char *end = nullptr;
+		record.offset = strtod(fields[0].c_str(), &end);
+		if (end == fields[0].c_str() || *end != '\0' || fields.size() < 4) {
+			if (record_count > 0 || fields.size() < 4) {
+				// the line before the first record can be the column names
+				LOG(logERROR) << __FUNCTION__ << ": " << name << ":" << line_count << " invalid record";
+				invalid++;
+			}
+			continue;
+		}
+		record.duration = strtod(fields[1].c_str(), nullptr);
+		record.caller = fields[2];
+		record.callee = fields[3];
+		record_count++;
+		return true;
+	}
+	return false;
+}
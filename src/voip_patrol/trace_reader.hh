@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_TRACE_READER_H
+#define VOIP_PATROL_TRACE_READER_H
+
+#include <stdio.h>
+#include <string>
+
+/* one call of the trace, offset and duration in seconds */
+struct TraceRecord {
+	double offset {0.0};
+	double duration {0.0};
+	std::string caller;
+	std::string callee;
+};
+
+/*
+ * Trace file reader, one "offset,duration,caller,callee" line at a time,
+ * blank lines, comments (#) and a header line are skipped.
+ */
+class TraceReader {
+	public:
+		TraceReader(const std::string& file_name);
+		~TraceReader();
+		bool open();
+		bool next(TraceRecord &record);
+		std::string name;
+		int invalid {0};
+	private:
+		FILE *file {nullptr};
+		char *line {nullptr};
+		size_t line_size {0};
+		size_t line_count {0};
+		size_t record_count {0};
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "traffic.hh"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+TrafficGroup::TrafficGroup(Config *config) : config(config) {
+}
+
+bool TrafficGroup::add_action(ezxml_t xml_action, TrafficStream &stream, bool *valid) {
+	ScenarioAction compiled;
+	if (!config->compile_action(xml_action, compiled, valid)) {
+		return false;
+	}
+	if (compiled.type == ActionType::call && (compiled.call.concurrency > 0 || compiled.call.rate > 0)) {
+		// the stream sets the pace
+		LOG(logERROR) << __FUNCTION__ << ": call with concurrency or rate not allowed in stream " << stream.name;
+		*valid = false;
+		return false;
+	}
+	switch (compiled.type) {
+		case ActionType::call:
+		case ActionType::accept:
+		case ActionType::reg:
+		case ActionType::message:
+		case ActionType::accept_message:
+			stream.actions.push_back(compiled);
+			return true;
+		default:
+			// waiting and global settings belong to the sequence around the block
+			LOG(logERROR) << __FUNCTION__ << ": action/" << compiled.name << " not allowed in stream " << stream.name;
+			*valid = false;
+			return false;
+	}
+}
+
+bool TrafficGroup::compile_stream(ezxml_t xml_stream, TrafficStream &stream, bool *valid) {
+	const char *val = ezxml_attr(xml_stream, "name");
+	stream.name = val ? val : "stream-" + std::to_string(streams.size());
+	if ((val = ezxml_attr(xml_stream, "rate"))) {
+		stream.rate = atof(val);
+	}
+	if ((val = ezxml_attr(xml_stream, "duration"))) {
+		stream.duration_ms = atof(val) * 1000;
+	}
+	if ((val = ezxml_attr(xml_stream, "count"))) {
+		stream.count = atoi(val);
+	}
+	if ((val = ezxml_attr(xml_stream, "arrival"))) {
+		stream.poisson = (strcmp(val, "poisson") == 0);
+	}
+	if (stream.rate <= 0 || (stream.duration_ms <= 0 && stream.count <= 0)) {
+		LOG(logERROR) << __FUNCTION__ << ": stream " << stream.name << " needs a rate and a duration or a count";
+		*valid = false;
+		return false;
+	}
+	for (ezxml_t xml_action = ezxml_child(xml_stream, "action"); xml_action; xml_action = xml_action->next) {
+		add_action(xml_action, stream, valid);
+	}
+	LOG(logINFO) << __FUNCTION__ << ": stream " << stream.name << " rate:" << stream.rate << "/s duration:" << stream.duration_ms
+		<< "ms count:" << stream.count << " actions:" << stream.actions.size();
+	return !stream.actions.empty();
+}
+
+bool TrafficGroup::compile(ezxml_t xml_parallel, bool *valid) {
+	for (ezxml_t xml = xml_parallel->child; xml; xml = xml->ordered) {
+		TrafficStream stream;
+		if (strcmp(xml->name, "stream") == 0) {
+			if (compile_stream(xml, stream, valid)) {
+				streams.push_back(stream);
+			}
+		} else if (strcmp(xml->name, "action") == 0) {
+			// an action on its own is a stream executed once
+			const char *type = ezxml_attr(xml, "type");
+			stream.name = std::string(type ? type : "action") + "-" + std::to_string(streams.size());
+			stream.count = 1;
+			if (add_action(xml, stream, valid)) {
+				streams.push_back(stream);
+			}
+		} else {
+			LOG(logERROR) << __FUNCTION__ << ": unexpected <" << xml->name << "> in <parallel>";
+			*valid = false;
+		}
+	}
+	return !streams.empty();
+}
+
+void TrafficGroup::run_stream(TrafficStream &stream, int index) {
+	config->ep->libRegisterThread(stream.name);
+	// the draws of a stream do not depend on the scheduling of the others
+	TrafficRandom random;
+	random.seed(TrafficRandom::derive(config->random.get_seed(), index));
+	TrafficRandom::use(&random);
+	auto start = std::chrono::steady_clock::now();
+	auto end = start + std::chrono::milliseconds(stream.duration_ms);
+	auto next = start;
+
+	stream.iterations = 0;
+	while (stream.count <= 0 || stream.iterations < stream.count) {
+		// the schedule does not drift when an iteration is slow
+		if (stream.iterations > 0) {
+			double interval = random.interval(stream.rate, stream.poisson);
+			config->traffic_summary.add(stream.name + "/interarrival", stream.poisson ? "poisson" : "fixed", interval);
+			next += std::chrono::microseconds((long long)(interval * 1000000));
+		}
+		if (stream.duration_ms > 0 && next >= end) {
+			break;
+		}
+		std::this_thread::sleep_until(next);
+		// the actions lock the accounts they configure, the streams run at the same time
+		for (auto &action : stream.actions) {
+			config->execute(action);
+		}
+		stream.iterations++;
+	}
+	LOG(logINFO) << __FUNCTION__ << ": stream " << stream.name << " completed iterations:" << stream.iterations;
+	TrafficRandom::use(nullptr);
+	running--;
+}
+
+void TrafficGroup::run() {
+	LOG(logINFO) << __FUNCTION__ << ": starting streams:" << streams.size();
+	std::vector<std::thread> threads;
+	running = streams.size();
+	for (size_t i = 0; i < streams.size(); i++) {
+		threads.push_back(std::thread(&TrafficGroup::run_stream, this, std::ref(streams[i]), (int)i));
+	}
+	// calls progress (answer, hangup, re-invite) while the streams are generating
+	vector<ActionParam> params = config->action.get_params(ActionType::wait);
+	config->action.set_param_by_name(&params, "ms", "100");
+	while (running > 0) {
+		config->action.do_wait(params);
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	LOG(logINFO) << __FUNCTION__ << ": all streams completed";
+}
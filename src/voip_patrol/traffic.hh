@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_TRAFFIC_H
+#define VOIP_PATROL_TRAFFIC_H
+
+#include "voip_patrol.hh"
+#include "ezxml/ezxml.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+/* one traffic generator of a <parallel> block, its actions are executed "rate" times per second */
+struct TrafficStream {
+	std::string name;
+	float rate {1.0};
+	int duration_ms {0};  // stop after this duration, 0 no limit
+	int count {0};        // stop after this many iterations, 0 no limit
+	bool poisson {false}; // exponential intervals averaging the rate
+	std::vector<ScenarioAction> actions;
+	int iterations {0};
+};
+
+/*
+ * <parallel> block, every stream runs in its own thread, the block returns
+ * when all of them reached their stop condition.
+ */
+class TrafficGroup {
+	public:
+		TrafficGroup(Config *config);
+		bool compile(ezxml_t xml_parallel, bool *valid);
+		void run();
+		std::vector<TrafficStream> streams;
+	private:
+		bool compile_stream(ezxml_t xml_stream, TrafficStream &stream, bool *valid);
+		bool add_action(ezxml_t xml_action, TrafficStream &stream, bool *valid);
+		void run_stream(TrafficStream &stream, int index);
+		Config *config;
+		std::atomic<int> running {0};
+};
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "traffic_model.hh"
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+#define SUMMARY_RESERVOIR_SIZE 10000
+
+distribution_t get_distribution_from_string(const std::string& name) {
+	distribution_t type {DIST_FIXED};
+	parse_distribution(name, &type);
+	return type;
+}
+
+bool parse_distribution(const std::string& name, distribution_t *type) {
+	if (name.compare("fixed") == 0) *type = DIST_FIXED;
+	else if (name.compare("exponential") == 0) *type = DIST_EXPONENTIAL;
+	else if (name.compare("lognormal") == 0) *type = DIST_LOGNORMAL;
+	else if (name.compare("uniform") == 0) *type = DIST_UNIFORM;
+	else return false;
+	return true;
+}
+
+std::string get_distribution_string(distribution_t type) {
+	switch (type) {
+		case DIST_EXPONENTIAL: return "exponential";
+		case DIST_LOGNORMAL: return "lognormal";
+		case DIST_UNIFORM: return "uniform";
+		default: return "fixed";
+	}
+}
+
+std::string check_distribution(const std::string& param, const std::string& name, const Distribution& dist) {
+	distribution_t type;
+	if (!parse_distribution(name, &type)) {
+		return param + "=\"" + name + "\" unknown, expected fixed, exponential, lognormal or uniform";
+	}
+	if ((type == DIST_EXPONENTIAL || type == DIST_LOGNORMAL) && dist.mean <= 0) {
+		return param + "=\"" + name + "\" needs " + param + "_mean > 0";
+	}
+	if (type == DIST_UNIFORM && dist.max <= dist.min) {
+		return param + "=\"" + name + "\" needs " + param + "_min < " + param + "_max";
+	}
+	return "";
+}
+
+static thread_local TrafficRandom *thread_random = nullptr;
+
+TrafficRandom::TrafficRandom() {
+	seed(std::random_device()());
+}
+
+void TrafficRandom::seed(uint64_t value) {
+	std::lock_guard<std::mutex> guard(lock);
+	seed_value = value;
+	engine.seed(value);
+}
+
+uint64_t TrafficRandom::derive(uint64_t seed, uint64_t index) {
+	// splitmix64, neighbouring indexes give unrelated seeds
+	uint64_t z = seed + (index + 1) * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+void TrafficRandom::use(TrafficRandom *random) {
+	thread_random = random;
+}
+
+TrafficRandom& TrafficRandom::current(TrafficRandom& shared) {
+	return thread_random ? *thread_random : shared;
+}
+
+double TrafficRandom::sample(const Distribution& dist) {
+	std::lock_guard<std::mutex> guard(lock);
+	switch (dist.type) {
+		case DIST_EXPONENTIAL:
+			if (dist.mean <= 0) return 0.0;
+			return std::exponential_distribution<double>(1.0 / dist.mean)(engine);
+		case DIST_LOGNORMAL: {
+			if (dist.mean <= 0) return 0.0;
+			// mean of the samples is exp(mu + sigma^2/2)
+			double mu = std::log(dist.mean) - dist.sigma * dist.sigma / 2;
+			return std::lognormal_distribution<double>(mu, dist.sigma)(engine);
+		}
+		case DIST_UNIFORM:
+			if (dist.max <= dist.min) return dist.min;
+			return std::uniform_real_distribution<double>(dist.min, dist.max)(engine);
+		default:
+			return dist.mean;
+	}
+}
+
+double TrafficRandom::interval(double rate, bool poisson) {
+	if (rate <= 0) {
+		return 0.0;
+	}
+	if (!poisson) {
+		return 1.0 / rate;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	return std::exponential_distribution<double>(rate)(engine);
+}
+
+void DistributionSummary::add(double value, std::mt19937_64& engine) {
+	if (count == 0 || value < min) min = value;
+	if (count == 0 || value > max) max = value;
+	count++;
+	sum += value;
+	sum_sq += value * value;
+	if (reservoir.size() < SUMMARY_RESERVOIR_SIZE) {
+		reservoir.push_back(value);
+		return;
+	}
+	uint64_t slot = std::uniform_int_distribution<uint64_t>(0, count - 1)(engine);
+	if (slot < SUMMARY_RESERVOIR_SIZE) {
+		reservoir[slot] = value;
+	}
+}
+
+std::string DistributionSummary::json() const {
+	double mean = count ? sum / count : 0.0;
+	double variance = count ? sum_sq / count - mean * mean : 0.0;
+	std::vector<double> sorted = reservoir;
+	std::sort(sorted.begin(), sorted.end());
+	auto percentile = [&sorted](double p) {
+		if (sorted.empty()) return 0.0;
+		return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+	};
+	char buf[512];
+	snprintf(buf, sizeof(buf), "\"model\": \"%s\", \"count\": %llu, \"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, "
+		"\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f",
+		model.c_str(), (unsigned long long)count, mean, std::sqrt(std::max(0.0, variance)), min,
+		percentile(0.50), percentile(0.95), percentile(0.99), max);
+	return buf;
+}
+
+void TrafficSummary::add(const std::string& name, const std::string& model, double value) {
+	std::lock_guard<std::mutex> guard(lock);
+	DistributionSummary &summary = summaries[name];
+	summary.model = model;
+	summary.add(value, engine);
+}
+
+bool TrafficSummary::empty() {
+	std::lock_guard<std::mutex> guard(lock);
+	return summaries.empty();
+}
+
+void TrafficSummary::clear() {
+	std::lock_guard<std::mutex> guard(lock);
+	summaries.clear();
+}
+
+std::string TrafficSummary::json(uint64_t seed) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::string res = "{\"seed\": " + std::to_string(seed) + ", \"distributions\": [";
+	bool first = true;
+	for (auto &it : summaries) {
+		if (!first) {
+			res += ", ";
+		}
+		first = false;
+		res += "{\"name\": \"" + it.first + "\", " + it.second.json() + "}";
+	}
+	res += "]}";
+	return res;
+}
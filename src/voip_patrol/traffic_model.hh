@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_TRAFFIC_MODEL_H
+#define VOIP_PATROL_TRAFFIC_MODEL_H
+
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+typedef enum distribution {
+	DIST_FIXED,
+	DIST_EXPONENTIAL,
+	DIST_LOGNORMAL,      // sigma of the logarithm, the mean is the mean of the samples
+	DIST_UNIFORM         // between min and max
+} distribution_t;
+
+distribution_t get_distribution_from_string(const std::string& name);
+bool parse_distribution(const std::string& name, distribution_t *type);
+std::string get_distribution_string(distribution_t type);
+
+struct Distribution {
+	distribution_t type {DIST_FIXED};
+	double mean {0.0};
+	double sigma {1.0};
+	double min {0.0};
+	double max {0.0};
+};
+
+// empty when the parameters describe a distribution, the error otherwise
+std::string check_distribution(const std::string& param, const std::string& name, const Distribution& dist);
+
+/*
+ * seedable random source shared by the actions, the same seed replays the same traffic,
+ * a <parallel> stream draws from a generator of its own derived from the seed
+ */
+class TrafficRandom {
+	public:
+		TrafficRandom();
+		void seed(uint64_t value);
+		static uint64_t derive(uint64_t seed, uint64_t index);
+		// the draws of the calling thread go to this generator, NULL restores the shared one
+		static void use(TrafficRandom *random);
+		static TrafficRandom& current(TrafficRandom& shared);
+		uint64_t get_seed() const { return seed_value; }
+		double sample(const Distribution& dist);
+		// seconds to the next arrival, exponential for Poisson arrivals
+		double interval(double rate, bool poisson);
+	private:
+		std::mutex lock;
+		std::mt19937_64 engine;
+		uint64_t seed_value {0};
+};
+
+/* realized distribution of one sampled value, percentiles are computed on a bounded reservoir */
+class DistributionSummary {
+	public:
+		void add(double value, std::mt19937_64& engine);
+		std::string json() const;
+		std::string model;
+	private:
+		uint64_t count {0};
+		double sum {0.0};
+		double sum_sq {0.0};
+		double min {0.0};
+		double max {0.0};
+		std::vector<double> reservoir;
+};
+
+class TrafficSummary {
+	public:
+		void add(const std::string& name, const std::string& model, double value);
+		bool empty();
+		void clear();
+		std::string json(uint64_t seed);
+	private:
+		std::mutex lock;
+		std::mt19937_64 engine; // reservoir sampling only, independent from the traffic
+		std::map<std::string, DistributionSummary> summaries;
+};
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "transport_udp_batch.hh"
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define THIS_FILE "transport_udp_batch.cc"
+
+/*
+ * Counters are kept after the transport is destroyed, the scenario end line
+ * is written once the library is shut down.
+ */
+struct udp_batch_stats {
+	std::string name;
+	bool destroyed {false};
+	std::atomic<uint64_t> rx_syscalls {0};
+	std::atomic<uint64_t> rx_packets {0};
+	std::atomic<uint64_t> rx_dropped {0};
+	std::atomic<uint64_t> tx_syscalls {0};
+	std::atomic<uint64_t> tx_packets {0};
+	std::atomic<uint64_t> tx_errors {0};
+	std::atomic<uint64_t> tx_max_batch {0};
+};
+
+static std::mutex udp_batch_stats_lock;
+static std::vector<udp_batch_stats *> udp_batch_stats_list;
+
+struct udp_batch_pending {
+	pjsip_tx_data *tdata;
+	pj_sockaddr addr;
+	int addr_len;
+	void *token;
+	pjsip_transport_callback callback;
+};
+
+struct udp_batch_transport {
+	pjsip_transport base; // must be first, pjsip only knows this part
+	int fd {-1};
+	int batch {32};
+	std::atomic<bool> closing {false};
+	udp_batch_stats *stats {nullptr};
+
+	pj_thread_t *rx_thread {nullptr};
+	std::vector<pjsip_rx_data *> rdata;
+	std::vector<struct mmsghdr> rx_msgs;
+	std::vector<struct iovec> rx_iov;
+
+	pj_thread_t *tx_thread {nullptr};
+	std::mutex tx_lock;
+	std::condition_variable tx_cond;
+	std::vector<udp_batch_pending> tx_queue;
+	std::vector<udp_batch_pending> tx_sending;
+	std::vector<struct mmsghdr> tx_msgs;
+	std::vector<struct iovec> tx_iov;
+};
+
+static pjsip_rx_data *udp_batch_init_rdata(udp_batch_transport *tp, pj_pool_t *pool) {
+	pjsip_rx_data *rdata = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+	rdata->tp_info.pool = pool;
+	rdata->tp_info.transport = &tp->base;
+	rdata->tp_info.tp_data = tp;
+	return rdata;
+}
+
+static void udp_batch_on_packet(udp_batch_transport *tp, int index, unsigned len, int flags) {
+	pjsip_rx_data *rdata = tp->rdata[index];
+	pj_pool_t *pool = rdata->tp_info.pool;
+
+	if (flags & MSG_TRUNC) {
+		tp->stats->rx_dropped++;
+	} else if (len > 0) {
+		rdata->pkt_info.len = len;
+		rdata->pkt_info.zero = 0;
+		rdata->pkt_info.src_addr_len = tp->rx_msgs[index].msg_hdr.msg_namelen;
+		pj_gettimeofday(&rdata->pkt_info.timestamp);
+		pj_sockaddr_print(&rdata->pkt_info.src_addr, rdata->pkt_info.src_name, sizeof(rdata->pkt_info.src_name), 0);
+		rdata->pkt_info.src_port = pj_sockaddr_get_port(&rdata->pkt_info.src_addr);
+		pjsip_tpmgr_receive_packet(tp->base.tpmgr, rdata);
+	}
+	// the rdata lives in its pool, it is allocated again after the reset
+	pj_pool_reset(pool);
+	tp->rdata[index] = udp_batch_init_rdata(tp, pool);
+}
+
+static int udp_batch_rx_thread(void *arg) {
+	udp_batch_transport *tp = (udp_batch_transport *)arg;
+	int n = tp->batch;
+
+	while (!tp->closing) {
+		for (int i = 0; i < n; i++) {
+			pjsip_rx_data *rdata = tp->rdata[i];
+			tp->rx_iov[i].iov_base = rdata->pkt_info.packet;
+			tp->rx_iov[i].iov_len = sizeof(rdata->pkt_info.packet) - 1;
+			struct msghdr *hdr = &tp->rx_msgs[i].msg_hdr;
+			memset(hdr, 0, sizeof(*hdr));
+			hdr->msg_name = &rdata->pkt_info.src_addr;
+			hdr->msg_namelen = sizeof(rdata->pkt_info.src_addr);
+			hdr->msg_iov = &tp->rx_iov[i];
+			hdr->msg_iovlen = 1;
+		}
+		// blocks for the first datagram then takes everything already queued, SO_RCVTIMEO bounds the wait
+		int count = recvmmsg(tp->fd, tp->rx_msgs.data(), n, MSG_WAITFORONE, NULL);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !tp->closing) {
+				LOG(logERROR) << __FUNCTION__ << ": recvmmsg error:" << strerror(errno);
+				pj_thread_sleep(10);
+			}
+			continue;
+		}
+		tp->stats->rx_syscalls++;
+		tp->stats->rx_packets += count;
+		for (int i = 0; i < count; i++) {
+			udp_batch_on_packet(tp, i, tp->rx_msgs[i].msg_len, tp->rx_msgs[i].msg_hdr.msg_flags);
+		}
+	}
+	return 0;
+}
+
+static void udp_batch_flush(udp_batch_transport *tp) {
+	std::vector<udp_batch_pending> &pending = tp->tx_sending;
+	size_t done = 0;
+
+	while (done < pending.size()) {
+		size_t n = pending.size() - done;
+		if (n > (size_t)tp->batch) {
+			n = tp->batch;
+		}
+		for (size_t i = 0; i < n; i++) {
+			udp_batch_pending *p = &pending[done + i];
+			tp->tx_iov[i].iov_base = p->tdata->buf.start;
+			tp->tx_iov[i].iov_len = p->tdata->buf.cur - p->tdata->buf.start;
+			struct msghdr *hdr = &tp->tx_msgs[i].msg_hdr;
+			memset(hdr, 0, sizeof(*hdr));
+			hdr->msg_name = &p->addr;
+			hdr->msg_namelen = p->addr_len;
+			hdr->msg_iov = &tp->tx_iov[i];
+			hdr->msg_iovlen = 1;
+		}
+		int sent = sendmmsg(tp->fd, tp->tx_msgs.data(), n, 0);
+		tp->stats->tx_syscalls++;
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				struct pollfd pfd = {tp->fd, POLLOUT, 0};
+				poll(&pfd, 1, 10);
+				continue;
+			}
+			// the first message of the batch is the one failing, report it and keep going
+			pj_status_t status = PJ_RETURN_OS_ERROR(errno);
+			udp_batch_pending *p = &pending[done];
+			tp->stats->tx_errors++;
+			(*p->callback)(&tp->base, p->token, -status);
+			done++;
+			continue;
+		}
+		tp->stats->tx_packets += sent;
+		for (int i = 0; i < sent; i++) {
+			udp_batch_pending *p = &pending[done + i];
+			(*p->callback)(&tp->base, p->token, tp->tx_msgs[i].msg_len);
+		}
+		done += sent;
+	}
+	if (pending.size() > tp->stats->tx_max_batch) {
+		tp->stats->tx_max_batch = pending.size();
+	}
+	pending.clear();
+}
+
+static int udp_batch_tx_thread(void *arg) {
+	udp_batch_transport *tp = (udp_batch_transport *)arg;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(tp->tx_lock);
+			tp->tx_cond.wait(lock, [tp] { return !tp->tx_queue.empty() || tp->closing; });
+			if (tp->tx_queue.empty() && tp->closing) {
+				break;
+			}
+			// everything queued while the previous batch was sent goes in the next one
+			tp->tx_sending.swap(tp->tx_queue);
+		}
+		udp_batch_flush(tp);
+	}
+	return 0;
+}
+
+static pj_status_t udp_batch_send_msg(pjsip_transport *transport, pjsip_tx_data *tdata,
+		const pj_sockaddr_t *rem_addr, int addr_len, void *token, pjsip_transport_callback callback) {
+	udp_batch_transport *tp = (udp_batch_transport *)transport;
+
+	PJ_ASSERT_RETURN(transport && tdata && rem_addr, PJ_EINVAL);
+	PJ_ASSERT_RETURN(addr_len <= (int)sizeof(pj_sockaddr), PJ_EINVAL);
+	if (tp->closing) {
+		return PJ_EINVALIDOP;
+	}
+
+	// the transport manager holds a reference on tdata until the callback
+	udp_batch_pending p;
+	p.tdata = tdata;
+	pj_memcpy(&p.addr, rem_addr, addr_len);
+	p.addr_len = addr_len;
+	p.token = token;
+	p.callback = callback;
+	{
+		std::lock_guard<std::mutex> lock(tp->tx_lock);
+		tp->tx_queue.push_back(p);
+	}
+	tp->tx_cond.notify_one();
+	return PJ_EPENDING;
+}
+
+static pj_status_t udp_batch_shutdown(pjsip_transport *transport) {
+	PJ_UNUSED_ARG(transport);
+	return PJ_SUCCESS;
+}
+
+static pj_status_t udp_batch_destroy(pjsip_transport *transport) {
+	udp_batch_transport *tp = (udp_batch_transport *)transport;
+
+	tp->closing = true;
+	tp->tx_cond.notify_one();
+	if (tp->tx_thread) {
+		pj_thread_join(tp->tx_thread);
+		pj_thread_destroy(tp->tx_thread);
+	}
+	if (tp->rx_thread) {
+		pj_thread_join(tp->rx_thread);
+		pj_thread_destroy(tp->rx_thread);
+	}
+	if (tp->fd >= 0) {
+		close(tp->fd);
+	}
+	for (auto rdata : tp->rdata) {
+		pj_pool_release(rdata->tp_info.pool);
+	}
+	LOG(logINFO) << __FUNCTION__ << ": " << tp->base.obj_name << " rx_syscalls:" << tp->stats->rx_syscalls
+		<< " rx_packets:" << tp->stats->rx_packets << " tx_syscalls:" << tp->stats->tx_syscalls
+		<< " tx_packets:" << tp->stats->tx_packets;
+	{
+		std::lock_guard<std::mutex> lock(udp_batch_stats_lock);
+		if (tp->stats->name.empty()) {
+			// never published
+			delete tp->stats;
+		} else {
+			tp->stats->destroyed = true;
+		}
+	}
+
+	pj_pool_t *pool = tp->base.pool;
+	if (tp->base.lock) {
+		pj_lock_destroy(tp->base.lock);
+	}
+	if (tp->base.ref_cnt) {
+		pj_atomic_destroy(tp->base.ref_cnt);
+	}
+	delete tp;
+	pj_pool_release(pool);
+	return PJ_SUCCESS;
+}
+
+static int udp_batch_socket(const udp_batch_config_t &cfg, int af, pj_sockaddr *addr) {
+	pj_str_t bound = pj_str((char *)cfg.bound_address.c_str());
+	if (pj_sockaddr_init(af, addr, cfg.bound_address.empty() ? NULL : &bound, (pj_uint16_t)cfg.port) != PJ_SUCCESS) {
+		LOG(logERROR) << __FUNCTION__ << ": invalid bound address:" << cfg.bound_address;
+		errno = EINVAL;
+		return -1;
+	}
+	int fd = socket(af, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	int on = 1;
+	if (af == pj_AF_INET6()) {
+		// the IPv4 transport can use the same port
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+	}
+	if (cfg.reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+		LOG(logERROR) << __FUNCTION__ << ": SO_REUSEPORT:" << strerror(errno);
+	}
+	// bursts of thousands of messages are expected
+	int size = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	struct timeval tv = {0, 100000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	// pj_sockaddr has the layout of the system sockaddr_in and sockaddr_in6 on Linux
+	if (bind(fd, (struct sockaddr *)addr, pj_sockaddr_get_len(addr)) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	socklen_t len = sizeof(*addr);
+	getsockname(fd, (struct sockaddr *)addr, &len);
+	return fd;
+}
+
+pj_status_t udp_batch_transport_create(pjsip_endpoint *endpt, const udp_batch_config_t &cfg, pjsip_transport **p_transport) {
+	pj_status_t status;
+	pj_sockaddr bound_addr;
+
+	PJ_ASSERT_RETURN(endpt && p_transport && cfg.batch > 0, PJ_EINVAL);
+
+	// an IPv6 address has more than one ':'
+	bool ipv6 = std::count(cfg.bound_address.begin(), cfg.bound_address.end(), ':') > 1;
+	int af = ipv6 ? pj_AF_INET6() : pj_AF_INET();
+	pjsip_transport_type_e type = ipv6 ? PJSIP_TRANSPORT_UDP6 : PJSIP_TRANSPORT_UDP;
+	int fd = udp_batch_socket(cfg, af, &bound_addr);
+	if (fd < 0) {
+		status = PJ_RETURN_OS_ERROR(errno);
+		LOG(logERROR) << __FUNCTION__ << ": can not bind UDP port " << cfg.port << ":" << strerror(errno);
+		return status;
+	}
+
+	pj_pool_t *pool = pjsip_endpt_create_pool(endpt, "udpbatch%p", PJSIP_POOL_LEN_TRANSPORT, PJSIP_POOL_INC_TRANSPORT);
+	if (!pool) {
+		close(fd);
+		return PJ_ENOMEM;
+	}
+	udp_batch_transport *tp = new udp_batch_transport();
+	memset(&tp->base, 0, sizeof(tp->base));
+	tp->fd = fd;
+	tp->batch = cfg.batch;
+	tp->base.pool = pool;
+	pj_memcpy(tp->base.obj_name, pool->obj_name, PJ_MAX_OBJ_NAME);
+	tp->stats = new udp_batch_stats();
+
+	status = pj_atomic_create(pool, 0, &tp->base.ref_cnt);
+	if (status == PJ_SUCCESS) {
+		status = pj_lock_create_recursive_mutex(pool, pool->obj_name, &tp->base.lock);
+	}
+	if (status != PJ_SUCCESS) {
+		udp_batch_destroy(&tp->base);
+		return status;
+	}
+
+	tp->base.key.type = type;
+	tp->base.type_name = (char *)pjsip_transport_get_type_name(type);
+	tp->base.flag = pjsip_transport_get_flag_from_type(type);
+	tp->base.dir = PJSIP_TP_DIR_NONE;
+	tp->base.addr_len = pj_sockaddr_get_len(&bound_addr);
+	pj_memcpy(&tp->base.local_addr, &bound_addr, tp->base.addr_len);
+
+	// published address: public address, bound address or the default interface
+	char host[PJ_INET6_ADDRSTRLEN];
+	if (!cfg.public_address.empty()) {
+		pj_ansi_strncpy(host, cfg.public_address.c_str(), sizeof(host));
+		host[sizeof(host) - 1] = '\0';
+	} else if (pj_sockaddr_has_addr(&bound_addr)) {
+		pj_sockaddr_print(&bound_addr, host, sizeof(host), 0);
+	} else {
+		pj_sockaddr hostip;
+		status = pj_gethostip(af, &hostip);
+		if (status != PJ_SUCCESS) {
+			udp_batch_destroy(&tp->base);
+			return status;
+		}
+		pj_sockaddr_print(&hostip, host, sizeof(host), 0);
+	}
+	pj_strdup2(pool, &tp->base.local_name.host, host);
+	tp->base.local_name.port = pj_sockaddr_get_port(&bound_addr);
+	tp->base.remote_name.host = pj_str((char *)(ipv6 ? "::0" : "0.0.0.0"));
+	tp->base.remote_name.port = 0;
+	tp->base.info = (char *)pj_pool_alloc(pool, PJSIP_TRANSPORT_INFO_LEN);
+	pj_ansi_snprintf(tp->base.info, PJSIP_TRANSPORT_INFO_LEN, ipv6 ? "udp6 batch [%.*s]:%d" : "udp batch %.*s:%d",
+		(int)tp->base.local_name.host.slen, tp->base.local_name.host.ptr, tp->base.local_name.port);
+
+	tp->base.endpt = endpt;
+	tp->base.tpmgr = pjsip_endpt_get_tpmgr(endpt);
+	tp->base.send_msg = &udp_batch_send_msg;
+	tp->base.do_shutdown = &udp_batch_shutdown;
+	tp->base.destroy = &udp_batch_destroy;
+
+	tp->stats->name = tp->base.info;
+	{
+		std::lock_guard<std::mutex> lock(udp_batch_stats_lock);
+		udp_batch_stats_list.push_back(tp->stats);
+	}
+
+	// one rdata per slot of the receive batch, each with its own pool as in the pjsip UDP transport
+	tp->rx_msgs.resize(tp->batch);
+	tp->rx_iov.resize(tp->batch);
+	tp->tx_msgs.resize(tp->batch);
+	tp->tx_iov.resize(tp->batch);
+	for (int i = 0; i < tp->batch; i++) {
+		pj_pool_t *rdata_pool = pjsip_endpt_create_pool(endpt, "rtd%p", PJSIP_POOL_RDATA_LEN, PJSIP_POOL_RDATA_INC);
+		if (!rdata_pool) {
+			udp_batch_destroy(&tp->base);
+			return PJ_ENOMEM;
+		}
+		tp->rdata.push_back(udp_batch_init_rdata(tp, rdata_pool));
+	}
+
+	status = pjsip_transport_register(tp->base.tpmgr, &tp->base);
+	if (status != PJ_SUCCESS) {
+		udp_batch_destroy(&tp->base);
+		return status;
+	}
+
+	status = pj_thread_create(pool, "udpbatch_rx", &udp_batch_rx_thread, tp, 0, 0, &tp->rx_thread);
+	if (status == PJ_SUCCESS) {
+		status = pj_thread_create(pool, "udpbatch_tx", &udp_batch_tx_thread, tp, 0, 0, &tp->tx_thread);
+	}
+	if (status != PJ_SUCCESS) {
+		pjsip_transport_destroy(&tp->base);
+		return status;
+	}
+
+	LOG(logINFO) << __FUNCTION__ << ": " << tp->base.info << " batch:" << tp->batch << " reuse_port:" << cfg.reuse_port;
+	*p_transport = &tp->base;
+	return PJ_SUCCESS;
+}
+
+std::string udp_batch_stats_json() {
+	uint64_t rx_syscalls = 0, rx_packets = 0, tx_syscalls = 0, tx_packets = 0;
+	std::string sockets;
+	std::lock_guard<std::mutex> lock(udp_batch_stats_lock);
+
+	for (auto s : udp_batch_stats_list) {
+		rx_syscalls += s->rx_syscalls;
+		rx_packets += s->rx_packets;
+		tx_syscalls += s->tx_syscalls;
+		tx_packets += s->tx_packets;
+		if (!sockets.empty()) {
+			sockets += ", ";
+		}
+		sockets += "{\"socket\": \"" + s->name + "\"";
+		sockets += ", \"rx_syscalls\": " + std::to_string(s->rx_syscalls);
+		sockets += ", \"rx_packets\": " + std::to_string(s->rx_packets);
+		sockets += ", \"rx_dropped\": " + std::to_string(s->rx_dropped);
+		sockets += ", \"tx_syscalls\": " + std::to_string(s->tx_syscalls);
+		sockets += ", \"tx_packets\": " + std::to_string(s->tx_packets);
+		sockets += ", \"tx_errors\": " + std::to_string(s->tx_errors);
+		sockets += ", \"tx_max_batch\": " + std::to_string(s->tx_max_batch) + "}";
+	}
+	std::string res = "{\"rx_syscalls\": " + std::to_string(rx_syscalls);
+	res += ", \"rx_packets\": " + std::to_string(rx_packets);
+	res += ", \"tx_syscalls\": " + std::to_string(tx_syscalls);
+	res += ", \"tx_packets\": " + std::to_string(tx_packets);
+	res += ", \"sockets\": [" + sockets + "]}";
+	return res;
+}
+
+void udp_batch_stats_reset() {
+	std::lock_guard<std::mutex> lock(udp_batch_stats_lock);
+	std::vector<udp_batch_stats *> live;
+
+	for (auto s : udp_batch_stats_list) {
+		if (s->destroyed) {
+			delete s;
+			continue;
+		}
+		s->rx_syscalls = 0;
+		s->rx_packets = 0;
+		s->rx_dropped = 0;
+		s->tx_syscalls = 0;
+		s->tx_packets = 0;
+		s->tx_errors = 0;
+		s->tx_max_batch = 0;
+		live.push_back(s);
+	}
+	udp_batch_stats_list.swap(live);
+}
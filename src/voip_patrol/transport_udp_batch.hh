@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_TRANSPORT_UDP_BATCH_H
+#define VOIP_PATROL_TRANSPORT_UDP_BATCH_H
+
+#include <pjsip.h>
+#include <string>
+
+/*
+ * SIP UDP transport receiving with recvmmsg() and sending with sendmmsg().
+ * Each transport has its own receive thread, pulling up to "batch" datagrams
+ * per system call, and its own send thread, sending every message queued
+ * while the previous batch was on its way in one system call.
+ * An IPv6 bound address creates a UDP6 transport.
+ */
+typedef struct udp_batch_config {
+	std::string bound_address;
+	std::string public_address;
+	int port {5060};
+	int batch {32};
+	bool reuse_port {false};
+} udp_batch_config_t;
+
+pj_status_t udp_batch_transport_create(pjsip_endpoint *endpt, const udp_batch_config_t &cfg, pjsip_transport **p_transport);
+
+/* Syscall and packet counters of every batched UDP transport, JSON object */
+std::string udp_batch_stats_json();
+/* Counters zeroed for the next scenario, the ones of the destroyed transports are dropped */
+void udp_batch_stats_reset();
+
+#endif
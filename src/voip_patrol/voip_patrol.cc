@@ -21,7 +21,15 @@
 #include "mod_voip_patrol.hh"
 #include "action.hh"
 #include "check.hh"
+#include "transport_udp_batch.hh"
+#include "scenario_reader.hh"
+#include "daemon.hh"
+#include "traffic.hh"
+#include "capacity.hh"
+#include "trace.hh"
+#include "codec_preencoded.hh"
 #define THIS_FILE "voip_patrol.cc"
+#define BRIDGE_RELEASE_DELAY_MS 1000
 #include <pjsua2/account.hpp>
 #include <pjsua2/call.hpp>
 #include <pjsua2/endpoint.hpp>
@@ -29,6 +37,8 @@
 #include "pj_util.hpp"
 #include <pjsua-lib/pjsua_internal.h>
 #include <algorithm>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 using namespace pj;
 
@@ -81,6 +91,11 @@ bool stob(std::string s) {
 
 static pj_status_t stream_to_call(TestCall* call, pjsua_call_id call_id, const char *caller_contact ) {
 	pj_status_t status = PJ_SUCCESS;
+	if (call->direct_media) {
+		// the player was opened with the stream
+		call->direct_media->play();
+		return status;
+	}
 	// Create a player if none.
 	if (call->player_id < 0) {
 		LOG(logINFO) <<__FUNCTION__<< ": [stream_to_call] streaming file: " << call->test->play;
@@ -108,13 +123,18 @@ static pj_status_t record_call(TestCall* call, pjsua_call_id call_id, const char
 	// Create a recorder if none.
 	LOG(logINFO) <<__FUNCTION__<<": [record_call] starting recording call:" << call_id;
 
-	if (call->recorder_id < 0) {
+	if (call->async_recorder) {
+		return PJ_SUCCESS;
+	}
+	if (call->recorder_id < 0 && !(call->direct_media && call->direct_media->recording())) {
 		char rec_fn[1024] = "";
+		RecordingWriter &writer = call->test->config->recording;
 
 		// Set recording filename
 		if (strcmp(recording, "auto") == 0) {
 			CallInfo ci = call->getInfo();
-			sprintf(rec_fn, "/srv/%s_%s_rec.wav", ci.callIdString.c_str(), caller_contact);
+			sprintf(rec_fn, "/srv/%s_%s_rec.%s", ci.callIdString.c_str(), caller_contact,
+			        writer.format == RecordingFormat::flac ? "flac" : "wav");
 		} else {
 			sprintf(rec_fn, "%s", recording);
 		}
@@ -124,6 +144,32 @@ static pj_status_t record_call(TestCall* call, pjsua_call_id call_id, const char
 
 		LOG(logINFO) <<__FUNCTION__<<": [record_call] recording to file:" << rec_fn;
 
+		if (writer.handles(rec_fn)) {
+			// the media thread only copies the frames, encoding and disk writes are done by the writer thread
+			if (call->direct_media) {
+				call->async_recorder = writer.open(rec_fn, call->direct_media->rate());
+				if (!call->async_recorder)
+					return PJ_EINVALIDOP;
+				call->direct_media->add_sink(call->async_recorder.get());
+				return PJ_SUCCESS;
+			}
+			pjsua_conf_port_info info;
+			status = pjsua_conf_get_port_info(0, &info);
+			if (status != PJ_SUCCESS)
+				return status;
+			call->async_recorder = writer.open(rec_fn, info.clock_rate);
+			if (!call->async_recorder)
+				return PJ_EINVALIDOP;
+			status = pjsua_conf_add_port(call->async_recorder->get_pool(), call->async_recorder->port(), &call->async_recorder_slot);
+			if (status == PJ_SUCCESS)
+				status = pjsua_conf_connect(pjsua_call_get_conf_port(call_id), call->async_recorder_slot);
+			if (status != PJ_SUCCESS)
+				LOG(logINFO) << __FUNCTION__ << ": [error] record_call:" << status << "\n";
+			return status;
+		}
+		if (call->direct_media) {
+			return call->direct_media->record(rec_fn);
+		}
 		status = pjsua_recorder_create(&rec_file_name, 0, NULL, -1, 0, &call->recorder_id);
 
 		if (status != PJ_SUCCESS) {
@@ -241,6 +287,123 @@ void TestCall::hangup(const CallOpParam &prm) {
 }
 
 
+// a signaling only call answers with the audio disabled, the default setting would restore it
+void TestCall::media_setting(CallSetting &opt) {
+	if (test && test->no_media) {
+		opt = CallSetting(true);
+		opt.audioCount = 0;
+		opt.videoCount = 0;
+	}
+}
+
+// one interval of the quality time series, from the statistics of the audio stream
+void TestCall::sample_quality(const CallInfo &ci) {
+	for (unsigned i = 0; i < ci.media.size(); i++) {
+		if (ci.media[i].type != PJMEDIA_TYPE_AUDIO || ci.media[i].status == PJSUA_CALL_MEDIA_NONE) {
+			continue;
+		}
+		try {
+			test->quality.sample(ci.connectDuration.sec, getStreamStat(i));
+		} catch (pj::Error& e) {
+			LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): " << e.reason;
+		}
+		return;
+	}
+}
+
+// the taps of the received and sent audio, attached when the call is answered
+void TestCall::start_taps(pjsua_call_id call_id) {
+	if (!taps.empty()) {
+		return;
+	}
+	int call_port = pjsua_call_get_conf_port(call_id);
+	// the direct media gives the audio at the stream rate, the bridge at its own rate
+	unsigned in_rate = direct_media ? direct_media->rate() : AUDIO_ANALYSIS_RATE;
+	unsigned out_rate = in_rate;
+	pjsua_conf_port_info info;
+	if (!direct_media && pjsua_conf_get_port_info(0, &info) == PJ_SUCCESS) {
+		out_rate = info.clock_rate;
+	}
+	if (test->min_mos > 0) {
+		// the received audio is kept in memory for the scoring, no recording is needed
+		reference = test->config->scoring.reference(test->reference.empty() ? test->play : test->reference);
+		if (reference && !reference->empty()) {
+			// the alignment searches the reference up to 2 seconds late
+			capture = std::make_shared<AudioCapture>(direct_media ? in_rate : AUDIO_SCORE_RATE, reference->size() + 3 * AUDIO_SCORE_RATE);
+			if (!taps.add_sink(capture, direct_media.get(), call_port)) {
+				LOG(logERROR) << __FUNCTION__ << ": can not capture the audio of call " << call_id;
+			}
+		}
+	}
+	if (!test->analyze.empty()) {
+		// analysed as it arrives, with a constant memory per call
+		analyzer = std::make_shared<AudioAnalyzer>(in_rate);
+		if (!taps.add_sink(analyzer, direct_media.get(), call_port)) {
+			LOG(logERROR) << __FUNCTION__ << ": can not analyse the audio of call " << call_id;
+		}
+	}
+	if (test->watermark) {
+		// the id of the call is mixed in the sent audio, the received audio is searched for the ids of the calls
+		wm_detector = std::make_shared<WatermarkDetector>(in_rate, test->watermark_id);
+		if (!taps.add_sink(wm_detector, direct_media.get(), call_port)) {
+			LOG(logERROR) << __FUNCTION__ << ": can not search the watermark of call " << call_id;
+		}
+		if (test->watermark_id > 0 &&
+		    !taps.add_source(std::make_shared<WatermarkSender>(test->watermark_id, out_rate), direct_media.get(), call_port)) {
+			LOG(logERROR) << __FUNCTION__ << ": can not send the watermark of call " << call_id << ", a pre-encoded payload has no samples";
+		}
+	}
+	if (test->latency) {
+		// markers in the sent audio timed when they come back, or reflected as soon as they are received
+		latency_probe = std::make_shared<LatencyProbe>(in_rate, out_rate, test->type == "accept", test->latency_marks);
+		latency_probe->peer_turnaround(test->latency_reflect_ms);
+		if (!taps.add_sink(latency_probe, direct_media.get(), call_port) ||
+		    !taps.add_source(std::shared_ptr<AudioSource>(latency_probe, &latency_probe->source()), direct_media.get(), call_port)) {
+			LOG(logERROR) << __FUNCTION__ << ": can not measure the latency of call " << call_id << ", a pre-encoded payload has no samples";
+		}
+	}
+}
+
+// the results are read once the taps are detached, a call that was not answered has none
+void TestCall::end_taps() {
+	if (test->taps_done) {
+		return;
+	}
+	std::vector<std::shared_ptr<void>> owners;
+	taps.detach(owners);
+	if (test->min_mos > 0) {
+		if (capture) {
+			test->config->scoring.submit(test, reference, capture->take());
+		} else {
+			// nothing to score, the MOS stays 0
+			test->mos_ready = true;
+		}
+	}
+	if (analyzer) {
+		test->analysis = analyzer->result();
+		LOG(logINFO) << __FUNCTION__ << ": [call] audio analysis " << test->analysis.verdict;
+	}
+	if (wm_detector) {
+		test->watermark_result = wm_detector->result();
+		LOG(logINFO) << __FUNCTION__ << ": [call] watermark " << test->watermark_result.verdict << " " << test->watermark_result.json();
+	}
+	if (!test->latency_key.empty()) {
+		test->config->latency_marks.remove(test->latency_key);
+	}
+	if (latency_probe) {
+		test->latency_result = latency_probe->result();
+		LOG(logINFO) << __FUNCTION__ << ": [call] latency " << test->latency_result.json();
+	}
+	capture.reset();
+	analyzer.reset();
+	wm_detector.reset();
+	latency_probe.reset();
+	for (auto &owner : owners) {
+		test->config->release_later(owner);
+	}
+	test->taps_done = true;
+}
+
 void TestCall::makeCall(const string &dst_uri, const CallOpParam &prm, const string &to_uri) {
 	pj_str_t pj_to_uri = str2Pj(dst_uri);
 	vp_call_param param(prm.txOption, prm.opt, prm.reason);
@@ -297,10 +460,11 @@ TestCall::TestCall(TestAccount *p_acc, int call_id) : Call(*p_acc, call_id) {
 
 TestCall::~TestCall() {
 	if (test) {
-		test->config->checking_calls.lock();
-		test->config->removeCall(this);
+		Config *config = test->config;
+		config->checking_calls.lock();
+		config->removeCall(this);
+		config->checking_calls.unlock();
 		delete test;
-		test->config->checking_calls.unlock();
 	}
 }
 
@@ -319,6 +483,32 @@ void TestCall::onCallTsxState(OnCallTsxStateParam &prm) {
 	PJ_UNUSED_ARG(prm);
 	CallInfo ci = getInfo();
 
+	if (test && prm.e.type == PJSIP_EVENT_TSX_STATE) {
+		pjsip_transaction *tsx = (pjsip_transaction *) prm.e.body.tsxState.tsx.pjTransaction;
+		if (tsx && tsx->role == PJSIP_ROLE_UAC && tsx->method.id == PJSIP_INVITE_METHOD && tsx->retransmit_count > test->retransmissions) {
+			test->retransmissions = tsx->retransmit_count;
+		}
+		// backpressure, a timeout is reported as 408 by the transaction
+		if (tsx && tsx->role == PJSIP_ROLE_UAC && tsx->method.id == PJSIP_INVITE_METHOD && tsx->status_code >= 200
+		    && test->group && test->group->controller && !test->rate_reported) {
+			int retry_after = 0;
+			if (prm.e.body.tsxState.type == PJSIP_EVENT_RX_MSG) {
+				pjsip_rx_data *rdata = (pjsip_rx_data *) prm.e.body.tsxState.src.rdata.pjRxData;
+				pjsip_retry_after_hdr *hdr = rdata ? (pjsip_retry_after_hdr *) pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_RETRY_AFTER, NULL) : NULL;
+				if (hdr) {
+					retry_after = hdr->ivalue;
+				}
+			}
+			if (tsx->status_code == PJSIP_SC_SERVICE_UNAVAILABLE || tsx->status_code == PJSIP_SC_REQUEST_TIMEOUT || retry_after > 0) {
+				test->group->controller->overload(retry_after);
+				test->rate_reported = true;
+			} else if (tsx->status_code / 100 == 2) {
+				test->group->controller->success();
+				test->rate_reported = true;
+			}
+		}
+	}
+
 	if (prm.e.type == PJSIP_EVENT_TSX_STATE && prm.e.body.tsxState.type == PJSIP_EVENT_RX_MSG) {
 		pjsip_rx_data *pjsip_rxdata = (pjsip_rx_data *) prm.e.body.tsxState.src.rdata.pjRxData;
 		if (pjsip_rxdata) {
@@ -339,6 +529,16 @@ void TestCall::onCallTsxState(OnCallTsxStateParam &prm) {
 					}
 				} else if (ci.state == PJSIP_INV_STATE_CONFIRMED && test->sip_latency.invite200Ms == 0) {
 					test->sip_latency.invite200Ms = s.sec*1000 + s.msec;
+					if (test->latency) {
+						// the delay of a reflecting accept, taken off the round trips
+						pj_str_t reflect_name = pj_str((char *)LATENCY_REFLECT_HEADER);
+						pjsip_generic_string_hdr *reflect_hdr = (pjsip_generic_string_hdr *) pjsip_msg_find_hdr_by_name(pjsip_rxdata->msg_info.msg, &reflect_name, NULL);
+						if (reflect_hdr) {
+							test->latency_reflect_ms = atoi(std::string(reflect_hdr->hvalue.ptr, reflect_hdr->hvalue.slen).c_str());
+							if (latency_probe)
+								latency_probe->peer_turnaround(test->latency_reflect_ms);
+						}
+					}
 					if (test->early_cancel == 1) {
 						CallOpParam prm(true);
 						this->hangup(prm);
@@ -363,19 +563,6 @@ void TestCall::onCallTsxState(OnCallTsxStateParam &prm) {
 	}
 }
 
-/* Convenient function to convert transmission factor to MOS */
-static float rfactor_to_mos(float rfactor) {
-	float mos;
-	if (rfactor <= 0) {
-		mos = 0.0;
-	} else if (rfactor > 100) {
-		mos = 4.5;
-	} else {
-		mos = rfactor*4.5/100;
-	}
-	return mos;
-}
-
 void TestCall::onDtmfDigit(OnDtmfDigitParam &prm) {
 	LOG(logINFO) << __FUNCTION__ << ":"<<prm.digit;
 	test->dtmf_recv.append(prm.digit);
@@ -386,11 +573,14 @@ void TestCall::onCallMediaState(OnCallMediaStateParam &prm) {
 
 	LOG(logINFO) <<__FUNCTION__<< " id:" << ci.id;
 
-	if (test && ci.state == PJSIP_INV_STATE_EARLY && test->record_early && test->recording.length() > 0 && !test->is_recording_running) {
+	if (test && !test->no_media && ci.state == PJSIP_INV_STATE_EARLY && test->record_early && test->recording.length() > 0 && !test->is_recording_running) {
 		LOG(logINFO) <<__FUNCTION__<< " Start call recording in early state";
 
 		if (record_call(this, ci.id, test->remote_user.c_str(), test->recording.c_str()) == PJ_SUCCESS) {
 			test->is_recording_running = true;
+			test->recording_error.clear();
+		} else {
+			test->recording_error = "can not record to " + test->record_fn;
 		}
 	}
 }
@@ -406,6 +596,11 @@ void TestCall::onStreamDestroyed(OnStreamDestroyedParam &prm) {
 	pjmedia_stream const *pj_stream = (pjmedia_stream *)&prm.stream;
 	//pjmedia_stream_info *pj_stream_info;
 
+	if (direct_media) {
+		// the stream port is destroyed after this callback
+		direct_media->stop();
+	}
+
 	if (ci.state == PJSIP_INV_STATE_EARLY) {
 		LOG(logINFO) << __FUNCTION__ << "State is PJSIP_INV_STATE_EARLY";
 		return;
@@ -418,6 +613,10 @@ void TestCall::onStreamDestroyed(OnStreamDestroyedParam &prm) {
 		StreamInfo const &infos = getStreamInfo(prm.streamIdx);
 		LOG(logINFO) << __FUNCTION__ << " codec name:"<< infos.codecName <<" clock rate:"<< infos.codecClockRate <<" RTP IP:"<< infos.remoteRtpAddress;
 		StreamStat const &stats = getStreamStat(prm.streamIdx);
+		if (test && test->quality_interval && ci.connectDuration.sec > test->quality.last_t()) {
+			// the last, shorter, interval
+			test->quality.sample(ci.connectDuration.sec, stats);
+		}
 		RtcpStat rtcp = stats.rtcp;
 		JbufState jbuf = stats.jbuf;
 		RtcpStreamStat rxStat = rtcp.rxStat;
@@ -520,6 +719,34 @@ void TestCall::onStreamDestroyed(OnStreamDestroyedParam &prm) {
 void TestCall::onStreamCreated(OnStreamCreatedParam &prm) {
 	CallInfo ci = getInfo();
 	LOG(logINFO) <<__FUNCTION__<<" id:"<<ci.id<<" idx["<<prm.streamIdx<<"]";
+
+	if (!test || !test->config->direct_media || test->no_media) {
+		return;
+	}
+	pjmedia_port *stream_port;
+	if (pjmedia_stream_get_port((pjmedia_stream *)prm.stream, &stream_port) != PJ_SUCCESS) {
+		return;
+	}
+	bool restart = (bool)direct_media;
+	if (!direct_media) {
+		direct_media.reset(new DirectMedia());
+	}
+	int pre_encoded_pt = -1;
+	pjmedia_stream_info stream_info;
+	if (test->config->pre_encode && pjmedia_stream_get_info((pjmedia_stream *)prm.stream, &stream_info) == PJ_SUCCESS) {
+		pre_encoded_pt = stream_info.fmt.pt;
+	}
+	if (direct_media->start(stream_port, test->play, pre_encoded_pt, &test->config->media_engine) != PJ_SUCCESS) {
+		LOG(logINFO) << __FUNCTION__ << ": id:" << ci.id << " using the conference bridge";
+		if (!restart) {
+			direct_media.reset();
+		}
+		// after a re-INVITE the player and the recorder are kept for the next stream
+		return;
+	}
+	// the bridge gets a silent port instead of the stream
+	prm.pPort = direct_media->bridge_port();
+	prm.destroyPort = false;
 }
 
 void TestCall::onCallState(OnCallStateParam &prm) {
@@ -613,24 +840,34 @@ void TestCall::onCallState(OnCallStateParam &prm) {
 		}
 	}
 	// Create player and recorder
-	if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
+	if (ci.state == PJSIP_INV_STATE_CONFIRMED && !test->no_media) {
 		if (test->play_dtmf.length() > 0) {
 			dialDtmf(test->play_dtmf);
 			LOG(logINFO) <<__FUNCTION__<<": [dtmf]" << test->play_dtmf;
 		}
 
 		stream_to_call(this, ci.id, test->remote_user.c_str());
+		start_taps(ci.id);
 
 		if (test->recording.length() > 0 && !test->is_recording_running) {
 			if (record_call(this, ci.id, test->remote_user.c_str(), test->recording.c_str()) == PJ_SUCCESS) {
 				test->is_recording_running = true;
+				test->recording_error.clear();
+			} else {
+				test->recording_error = "can not record to " + test->record_fn;
 			}
 		}
 	}
 	if (ci.state == PJSIP_INV_STATE_DISCONNECTED) {
 		std::string res = " code [" + std::to_string(ci.lastStatusCode) + "] reason ["+ ci.lastReason +"] remote user [" + remote_user + "]";
 		test->rtp_stats_ready = true;
+		end_taps();
 		test->update_result();
+		if (test->group && !test->group_ended) {
+			// a new call can be started in its place
+			test->group->ended();
+			test->group_ended = true;
+		}
 
 		LOG(logINFO) <<__FUNCTION__<<": [Call disconnected]:"<< res;
 
@@ -643,6 +880,26 @@ void TestCall::onCallState(OnCallStateParam &prm) {
 			pjsua_recorder_destroy(recorder_id);
 			recorder_id = -1;
 		}
+
+		if (async_recorder) {
+			if (direct_media) {
+				direct_media->remove_sink(async_recorder.get());
+			}
+			if (async_recorder_slot != PJSUA_INVALID_ID) {
+				pjsua_conf_remove_port(async_recorder_slot);
+				async_recorder_slot = PJSUA_INVALID_ID;
+			}
+			// the writer flushes the end of the recording and releases it, the bridge can still hold its port
+			async_recorder->close();
+			test->config->release_later(async_recorder);
+			async_recorder.reset();
+		}
+
+		if (direct_media) {
+			direct_media->close();
+			// the bridge can still hold the silent port of the call
+			test->config->release_later(std::shared_ptr<void>(std::move(direct_media)));
+		}
 	}
 }
 
@@ -657,6 +914,7 @@ void TestAccount::setTest(Test *ptest) {
 
 TestAccount::TestAccount() {
 	test = NULL;
+	testAccept = NULL;
 	config = NULL;
 	hangup_duration = 0;
 	max_duration = 0;
@@ -669,6 +927,9 @@ TestAccount::TestAccount() {
 
 TestAccount::~TestAccount() {
 	LOG(logINFO) << "[Account] is being deleted: No of calls=" << calls.size() ;
+	// the calls are deleted by Config::reset
+	delete test;
+	delete testAccept;
 }
 
 void TestAccount::onRegState(OnRegStateParam &prm) {
@@ -742,7 +1003,31 @@ void TestAccount::onIncomingCall(OnIncomingCallParam &iprm) {
 
 		LOG(logINFO) <<__FUNCTION__<<": rtp_stats:" << rtp_stats;
 
+		call->test->quality_interval = quality_interval;
+		call->test->quality_next = quality_interval;
+		call->test->analyze = analyze;
+		if (watermark) {
+			// the caller sends its id, without it the ids received are only reported
+			call->test->watermark = true;
+			pj_str_t wm_name = pj_str((char *)WATERMARK_HEADER);
+			pjsip_generic_string_hdr *wm_hdr = (pjsip_generic_string_hdr *) pjsip_msg_find_hdr_by_name(pjsip_data->msg_info.msg, &wm_name, NULL);
+			if (wm_hdr) {
+				call->test->watermark_id = atoi(std::string(wm_hdr->hvalue.ptr, wm_hdr->hvalue.slen).c_str());
+			}
+		}
+		if (latency) {
+			// reflect mode, the one-way latencies when the caller runs in this process
+			call->test->latency = true;
+			pj_str_t lat_name = pj_str((char *)LATENCY_HEADER);
+			pjsip_generic_string_hdr *lat_hdr = (pjsip_generic_string_hdr *) pjsip_msg_find_hdr_by_name(pjsip_data->msg_info.msg, &lat_name, NULL);
+			if (lat_hdr) {
+				call->test->latency_marks = config->latency_marks.find(std::string(lat_hdr->hvalue.ptr, lat_hdr->hvalue.slen));
+			}
+		}
 		call->test->late_start = late_start;
+		if (no_media) {
+			call->test->disable_media();
+		}
 		call->test->force_contact = force_contact;
 		call->test->code = (pjsip_status_code) code;
 		call->test->reason = reason;
@@ -765,11 +1050,12 @@ void TestAccount::onIncomingCall(OnIncomingCallParam &iprm) {
 	// 	call->test->call_count = call_count;
 	// }
 
-	config->calls.push_back(call);
+	// config->calls is owned by the thread running the scenario, the call reaches it through new_calls
 
 	for (auto x_hdr : x_headers) {
 		prm.txOption.headers.push_back(x_hdr);
 	}
+	call->test->add_latency_reflect(prm);
 
 	if (response_delay > 0) {
 		LOG(logINFO) << __FUNCTION__ << ": Not answering to the call due to response delay: " << response_delay << " ms";
@@ -777,11 +1063,11 @@ void TestAccount::onIncomingCall(OnIncomingCallParam &iprm) {
 		//CallOpParam prm_100;
 		//prm_100.statusCode = PJSIP_SC_TRYING;
 		//call->answer(prm_100);
+		config->new_calls_lock.lock();
 		calls.push_back(call);
 		if (call_count > 0) {
 			call_count -= 1;
 		}
-		config->new_calls_lock.lock();
 		config->new_calls.push_back(call);
 		config->new_calls_lock.unlock();
 
@@ -810,14 +1096,15 @@ void TestAccount::onIncomingCall(OnIncomingCallParam &iprm) {
 	} else if (reason.size() > 0) {
 		prm.reason = reason;
 	}
+	call->media_setting(prm.opt);
 	call->answer(prm);
 
+	// incoming calls can be received on several SIP worker threads at once
+	config->new_calls_lock.lock();
 	calls.push_back(call);
-
 	if (call_count > 0) {
 		call_count -= 1;
 	}
-	config->new_calls_lock.lock();
 	config->new_calls.push_back(call);
 	config->new_calls_lock.unlock();
 }
@@ -867,10 +1154,29 @@ Test::Test(Config *config, const string& type) : config(config), type(type) {
 	LOG(logINFO)<<__FUNCTION__<<LOG_COLOR_INFO<<": New test created:"<<type<<LOG_COLOR_END;
 }
 
+// signaling only, no RTP socket, media transport, conference port or player
+void Test::disable_media() {
+	no_media = true;
+	rtp_stats = false;
+	quality_interval = 0;
+	analyze.clear();
+	watermark = false;
+	latency = false;
+}
+
+// the delay of an accept reflecting the latency markers, in its answer: the caller takes it off its round trips
+void Test::add_latency_reflect(CallOpParam &prm) {
+	if (!latency)
+		return;
+	SipHeader reflect_hdr;
+	reflect_hdr.hName = LATENCY_REFLECT_HEADER;
+	reflect_hdr.hValue = std::to_string(LATENCY_REFLECT_MS);
+	prm.txOption.headers.push_back(reflect_hdr);
+}
+
 void Test::get_mos() {
-	std::string reference = "voice_ref_files/reference_8000_12s.wav";
-	//std::string degraded = "voice_files/" + remote_user + "_rec.wav";
-	LOG(logINFO)<<__FUNCTION__<<": [call] mos["<<mos<<"] min-mos["<<min_mos<<"] "<< reference <<" vs "<< record_fn;
+	LOG(logINFO)<<__FUNCTION__<<": [call] mos["<<mos<<"] min-mos["<<min_mos<<"] "<< (reference.empty() ? play : reference)
+	            <<" delay["<<audio_score.delay_ms<<"ms] gain["<<audio_score.gain_db<<"dB] frames["<<audio_score.frames<<"]";
 }
 
 void jsonify(std::string *str) {
@@ -913,7 +1219,10 @@ void Test::update_result() {
 		}
 	}
 
-	if (min_mos > 0 && mos == 0) {
+	if (!taps_done && (min_mos > 0 || !analyze.empty() || watermark || latency)) {
+			return;
+	}
+	if (min_mos > 0 && !mos_ready) {
 			return;
 	}
 	if (rtp_stats && !rtp_stats_ready && result_cause_code < 300) {
@@ -922,6 +1231,7 @@ void Test::update_result() {
 			return;
 		}
 		queued = true;
+		std::lock_guard<std::mutex> lock(config->rtp_stats_lock);
 		config->tests_with_rtp_stats.push_back(this);
 		return;
 	}
@@ -932,6 +1242,13 @@ void Test::update_result() {
 	}
 	LOG(logINFO) <<__FUNCTION__<< "[" << this << "]" << " completing...\n";
 	completed = true;
+	if (min_mos > 0) {
+		get_mos();
+	}
+	if (group) {
+		int pdd_ms = sip_latency.invite18xMs ? sip_latency.invite18xMs : sip_latency.invite200Ms;
+		group->completed(result_cause_code, pdd_ms, mos, retransmissions);
+	}
 
 	if (fail_on_accept && type == "accept") {
 		res_text = "This call should not happen";
@@ -951,6 +1268,10 @@ void Test::update_result() {
 		success = true;
 	} else if (mos < min_mos) {
 		res_text = "MOS is too low";
+	} else if (analyze == "check" && analysis.valid && analysis.verdict != "ok") {
+		res_text = "Audio analysis " + analysis.verdict;
+	} else if (watermark_result.valid && watermark_result.verdict == "mismatch") {
+		res_text = "Watermark mismatch, audio of another call received";
 	} else if (expected_cause_code == result_cause_code) {
 		res_text = "Main test passed";
 		res = "PASS";
@@ -1023,6 +1344,7 @@ void Test::update_result() {
 		result_checks_json += "\"result\": \"" + result + "\"}";
 		x++;
 	}
+	config->source_pool.result(source, res == "PASS");
 
 
 	std::string result_line_json = "{\""+std::to_string(config->json_result_count)+ "/" + std::to_string(config->total_tasks_count) + "\": {"
@@ -1050,6 +1372,8 @@ void Test::update_result() {
 						"\"hangup_duration\": " + std::to_string(hangup_duration);
 	if (dtmf_recv.length() > 0)
 		result_line_json += ", \"dtmf_recv\": \""+dtmf_recv+"\"";
+	if (source >= 0)
+		result_line_json += ", \"source\": \""+config->source_pool.name(source)+"\"";
 
 
 	result_line_json += ", \"call_info\":{"
@@ -1071,6 +1395,26 @@ void Test::update_result() {
 
 	if (rtp_stats && rtp_stats_ready)
 		result_line_json += ", \"rtp_stats\":[" + rtp_stats_json + "]";
+	if (audio_score.valid)
+		result_line_json += ", \"audio_score\": {\"mos\": " + to_string(audio_score.mos) +
+		                    ", \"delay_ms\": " + to_string(audio_score.delay_ms) +
+		                    ", \"gain_db\": " + to_string(audio_score.gain_db) +
+		                    ", \"disturbance\": " + to_string(audio_score.disturbance) +
+		                    ", \"asymmetric\": " + to_string(audio_score.asymmetric) +
+		                    ", \"frames\": " + to_string(audio_score.frames) + "}";
+	if (!quality.empty())
+		result_line_json += ", \"quality\": " + quality.json(quality_interval);
+	if (analysis.valid)
+		result_line_json += ", \"audio_analysis\": " + analysis.json();
+	if (!recording_error.empty()) {
+		string jsonRecordingError = recording_error;
+		jsonify(&jsonRecordingError);
+		result_line_json += ", \"recording_error\": \"" + jsonRecordingError + "\"";
+	}
+	if (watermark_result.valid)
+		result_line_json += ", \"watermark\": " + watermark_result.json();
+	if (latency_result.valid)
+		result_line_json += ", \"latency\": " + latency_result.json();
 	result_line_json += "}}";
 
 	config->result_file.write(result_line_json);
@@ -1140,9 +1484,66 @@ bool ResultFile::write(const std::string& res) {
 		LOG(logINFO) <<__FUNCTION__<< "Exception: " << err.info() ;
 		return false;
 	}
+	// called from the SIP callbacks, the writer thread sends the line
+	std::lock_guard<std::mutex> lock(mirror_lock);
+	if (mirror_fd >= 0) {
+		mirror_queue.push_back(res + "\n");
+		mirror_cond.notify_all();
+	}
 	return true;
 }
 
+// the lines of the previous submitter are sent before the next one gets the results
+void ResultFile::mirror(int fd) {
+	std::unique_lock<std::mutex> lock(mirror_lock);
+	if (fd >= 0 && !mirror_thread.joinable()) {
+		mirror_thread = std::thread(&ResultFile::mirror_run, this);
+	}
+	mirror_cond.wait(lock, [this] { return mirror_queue.empty() && !mirror_sending; });
+	if (fd >= 0) {
+		// a client not reading its results does not hold the daemon forever
+		struct timeval tv = {5, 0};
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+	mirror_fd = fd;
+}
+
+void ResultFile::mirror_run() {
+	std::unique_lock<std::mutex> lock(mirror_lock);
+	while (true) {
+		mirror_cond.wait(lock, [this] { return !mirror_queue.empty() || mirror_stop; });
+		if (mirror_queue.empty()) {
+			break;
+		}
+		std::string line = mirror_queue.front();
+		mirror_queue.pop_front();
+		int fd = mirror_fd;
+		mirror_sending = true;
+		lock.unlock();
+		bool sent = send(fd, line.c_str(), line.size(), MSG_NOSIGNAL) == (ssize_t)line.size();
+		lock.lock();
+		mirror_sending = false;
+		if (!sent && fd == mirror_fd) {
+			// the client may be gone, the results are still in the file
+			LOG(logERROR) <<__FUNCTION__<< ": can not send result to the submitter, fd:" << fd;
+			mirror_fd = -1;
+			mirror_queue.clear();
+		}
+		mirror_cond.notify_all();
+	}
+}
+
+ResultFile::~ResultFile() {
+	{
+		std::lock_guard<std::mutex> lock(mirror_lock);
+		mirror_stop = true;
+		mirror_cond.notify_all();
+	}
+	if (mirror_thread.joinable()) {
+		mirror_thread.join();
+	}
+}
+
 void ResultFile::flush() {
 	file.flush();
 }
@@ -1193,6 +1594,9 @@ void Config::log(const std::string& message) {
 
 Config::~Config() {
 	result_file.close();
+	for (auto &injection : injection_files) {
+		delete injection.second;
+	}
 }
 
 bool Config::removeCall(TestCall *call) {
@@ -1201,6 +1605,7 @@ bool Config::removeCall(TestCall *call) {
 		if (*it == call) {
 			found = true;
 			calls.erase(it);
+			removed_calls.push_back(call);
 			break;
 		}
 	}
@@ -1210,6 +1615,96 @@ bool Config::removeCall(TestCall *call) {
 	return found;
 }
 
+void Config::hangup_all() {
+	// incoming calls not yet collected by a wait action
+	new_calls_lock.lock();
+	calls.insert(calls.end(), new_calls.begin(), new_calls.end());
+	new_calls.clear();
+	new_calls_lock.unlock();
+
+	bool disconnecting = true;
+	while (disconnecting) {
+		disconnecting = false;
+		for (auto & call : calls) {
+			pjsua_call_info pj_ci;
+			CallInfo ci;
+			if (call->is_disconnecting()) { // wait for call disconnections
+					if (call->test && call->test->completed) {
+						removeCall(call);
+					}
+					disconnecting = true;
+					continue;
+			}
+			pj_status_t status = pjsua_call_get_info(call->getId(), &pj_ci);
+
+			LOG(logINFO) << __FUNCTION__ << " disconnecting >>> call[" << call->getId() << "][" << call << "] ";
+
+			if (status != PJ_SUCCESS) {
+				LOG(logINFO) << __FUNCTION__ << " can not get call info, removing call["<< call->getId() <<"]["<< call <<"] "<< removeCall(call);
+				continue;
+			}
+			ci.fromPj(pj_ci);
+
+			CallOpParam prm(true);
+			if (ci.state != PJSIP_INV_STATE_DISCONNECTED) {
+				disconnecting = true;
+				try {
+					call->hangup(prm);
+				} catch (pj::Error& e)  {
+					LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): [" << e.srcFile << "] " << e.reason << std::endl;
+				}
+			} else {
+				LOG(logINFO) << __FUNCTION__ << " disconnected call["<< call->getId() <<"]["<< call <<"]";
+
+				pj_thread_sleep(500);
+			}
+		}
+		pj_thread_sleep(50);
+	}
+}
+
+std::string Config::scenario_start_json(const std::string& name) {
+	char now[20] = {'\0'};
+	get_time_string(now);
+	std::string res = "{\"scenario\": {\"state\":\"start";
+	res += "\", \"name\":\"" + name;
+	res += "\", \"time\":\"" + std::string(now) + "\"}}";
+	return res;
+}
+
+std::string Config::scenario_end_json(const std::string& name) {
+	char now[20] = {'\0'};
+	get_time_string(now);
+	std::string res = "{\"scenario\": {\"state\":\"end\" ,\"result\":\"";
+
+	if (total_tasks_count != json_result_count) {
+		res += "FAIL";
+	} else {
+		res += "PASS";
+	}
+	res += "\", \"name\":\"" + name;
+	res += "\", \"time\":\"" + std::string(now);
+	res += "\", \"total tasks\":\"" + std::to_string(total_tasks_count);
+	res += "\", \"completed tasks\":\"" + std::to_string(json_result_count) + "\"";
+	if (!source_pool.empty()) {
+		res += ", \"sources\": " + source_pool.stats_json();
+	}
+	if (udp_batch_stats) {
+		res += ", \"udp_batch\": " + udp_batch_stats_json();
+	}
+	if (media_engine.running()) {
+		res += ", \"media_engine\": " + media_engine.stats_json();
+	}
+	if (recording.running()) {
+		res += ", \"recording\": " + recording.stats_json();
+	}
+	if (!traffic_summary.empty()) {
+		res += ", \"traffic\": " + traffic_summary.json(random.get_seed());
+	}
+	res += "}}";
+	return res;
+}
+
 void Config::createDefaultAccount() {
 	AccountConfig acc_cfg;
 	acc_cfg.idUri = "sip:default";
@@ -1222,7 +1717,9 @@ void Config::createDefaultAccount() {
 
 TestAccount* Config::createAccount(AccountConfig acc_cfg) {
 	TestAccount *account = new TestAccount();
+	accounts_lock.lock();
 	accounts.push_back(account);
+	accounts_lock.unlock();
 	account->config = this;
 	acc_cfg.mediaConfig.transportConfig.port = rtp_cfg.port;
 
@@ -1244,16 +1741,73 @@ TestAccount* Config::createAccount(AccountConfig acc_cfg) {
 	return account;
 }
 
+InjectionFile* Config::getInjectionFile(const std::string& file_name) {
+	std::lock_guard<std::mutex> setup(setup_lock);
+	auto it = injection_files.find(file_name);
+	if (it != injection_files.end()) {
+		return it->second;
+	}
+	InjectionFile *injection = new InjectionFile(file_name);
+	if (!injection->open()) {
+		delete injection;
+		return nullptr;
+	}
+	injection_files[file_name] = injection;
+	return injection;
+}
+
+// the bridge removes a port on its next clock tick, the owner of the port is freed well after
+void Config::release_later(std::shared_ptr<void> owner) {
+	std::lock_guard<std::mutex> guard(release_lock);
+	released.push_back(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(BRIDGE_RELEASE_DELAY_MS), owner));
+}
+
+void Config::release_expired(bool all) {
+	std::vector<std::shared_ptr<void>> expired;
+	auto now = std::chrono::steady_clock::now();
+	release_lock.lock();
+	while (!released.empty() && (all || released.front().first <= now)) {
+		expired.push_back(released.front().second);
+		released.pop_front();
+	}
+	release_lock.unlock();
+	// freed outside the lock, a destructor can take the media locks
+	expired.clear();
+}
+
+// every call of an injection file looks up its caller, the accounts are only scanned once per caller
+TestAccount* Config::findCallerAccount(const std::string& account_uri) {
+	accounts_lock.lock();
+	auto it = caller_accounts.find(account_uri);
+	TestAccount *account = it != caller_accounts.end() ? it->second : nullptr;
+	accounts_lock.unlock();
+	if (account) {
+		return account;
+	}
+	account = findAccount(account_uri);
+	if (account) {
+		accounts_lock.lock();
+		caller_accounts[account_uri] = account;
+		accounts_lock.unlock();
+	}
+	return account;
+}
+
 TestAccount* Config::findAccount(std::string account_name) {
+	// called from the SIP worker threads, pjsua is not called with the lock held
+	accounts_lock.lock();
+	std::vector<TestAccount *> accounts = this->accounts;
+	accounts_lock.unlock();
+
 	for (auto account : accounts) {
-		LOG(logINFO) << __FUNCTION__ << ": name [" << account->account_name << "]<>[" << account_name << "]";
+		LOG(logDEBUG) << __FUNCTION__ << ": name [" << account->account_name << "]<>[" << account_name << "]";
 		if (account_name == account->account_name) {
-			LOG(logINFO) << __FUNCTION__ << ": found account based on name: " << account_name;
+			LOG(logDEBUG) << __FUNCTION__ << ": found account based on name: " << account_name;
 
 			return account;
 		}
 	}
-	LOG(logINFO) << __FUNCTION__ << ": falling back to URI search";
+	LOG(logDEBUG) << __FUNCTION__ << ": falling back to URI search";
 	if (account_name.compare(0, 1, "+") == 0) {
 		account_name.erase(0,1);
 	}
@@ -1263,26 +1817,19 @@ TestAccount* Config::findAccount(std::string account_name) {
 		if (acc_inf.uri.compare(0, 4, "sips") == 0) {
 			proto_length = 5;
 		}
-		LOG(logINFO) << __FUNCTION__ << ": [searching account]["<< acc_inf.id << "]["<<acc_inf.uri<<"]["<<acc_inf.uri.substr(proto_length)<<"]<>["<<account_name<<"]";
+		LOG(logDEBUG) << __FUNCTION__ << ": [searching account]["<< acc_inf.id << "]["<<acc_inf.uri<<"]["<<acc_inf.uri.substr(proto_length)<<"]<>["<<account_name<<"]";
 		if (acc_inf.uri.compare(proto_length, account_name.length(), account_name) == 0) {
-			LOG(logINFO) << __FUNCTION__ << ": found account id["<< acc_inf.id <<"] uri[" << acc_inf.uri <<"]";
+			LOG(logDEBUG) << __FUNCTION__ << ": found account id["<< acc_inf.id <<"] uri[" << acc_inf.uri <<"]";
 			return account;
 		}
 	}
 	return nullptr;
 }
 
-bool Config::process(const std::string& p_configFileName, const std::string& p_jsonResultFileName) {
-	ezxml_t xml_actions, xml_action, xml_xhdr, xml_check, xml_param;
-	configFileName = p_configFileName;
-	ezxml_t xml_conf = ezxml_parse_file(configFileName.c_str());
-	xml_conf_head = xml_conf; // saving the head if the linked list
+bool Config::compile(ezxml_t xml_conf, std::vector<ScenarioAction> &plan) {
+	ezxml_t xml_actions, xml_action, xml_param;
+	bool valid = true;
 
-	if(!xml_conf){
-		LOG(logINFO) <<__FUNCTION__<< "[error] test can not load file :" << configFileName ;
-		return false;
-	}
-replay:
 	for (xml_param = ezxml_child(xml_conf, "param"); xml_param; xml_param=xml_param->next) {
 		const char * n = ezxml_attr(xml_param, "name");
 		const char * v = ezxml_attr(xml_param, "value");
@@ -1295,134 +1842,355 @@ replay:
 
 	for (xml_actions = ezxml_child(xml_conf, "actions"); xml_actions; xml_actions=xml_actions->next) {
 		LOG(logINFO) <<__FUNCTION__<< " ===> " << xml_actions->name;
-		for (xml_action = ezxml_child(xml_actions, "action"); xml_action; xml_action=xml_action->next) {
-			const char * val = ezxml_attr(xml_action,"type");
-			if (!val) {
-				LOG(logERROR) <<__FUNCTION__<<" invalid action !";
+		// <action> and <parallel> in document order
+		for (xml_action = xml_actions->child; xml_action; xml_action=xml_action->ordered) {
+			ScenarioAction compiled;
+			if (!compile_action(xml_action, compiled, &valid)) {
 				continue;
 			}
+			plan.push_back(compiled);
+		}
+	}
+	return valid;
+}
+
+bool Config::compile_action(ezxml_t xml_action, ScenarioAction &compiled, bool *valid) {
+	ezxml_t xml_xhdr, xml_check;
+	if (strcmp(xml_action->name, "parallel") == 0) {
+		compiled.name = "parallel";
+		compiled.type = ActionType::parallel;
+		compiled.group = std::make_shared<TrafficGroup>(this);
+		if (!compiled.group->compile(xml_action, valid)) {
+			LOG(logERROR) <<__FUNCTION__<<" empty <parallel> block !";
+			return false;
+		}
+		return true;
+	}
+	if (strcmp(xml_action->name, "action") != 0) {
+		LOG(logERROR) <<__FUNCTION__<<" unexpected <" << xml_action->name << "> in actions !";
+		return false;
+	}
+	const char * val = ezxml_attr(xml_action,"type");
+	if (!val) {
+		LOG(logERROR) <<__FUNCTION__<<" invalid action !";
+		return false;
+	}
+	compiled.name = val;
+	compiled.type = get_action_type_from_string(compiled.name);
 
-			SipHeaderVector x_hdrs = SipHeaderVector();
-			for (xml_xhdr = ezxml_child(xml_action, "x-header"); xml_xhdr; xml_xhdr=xml_xhdr->next) {
+	for (xml_xhdr = ezxml_child(xml_action, "x-header"); xml_xhdr; xml_xhdr=xml_xhdr->next) {
 
-				SipHeader sh = SipHeader();
-				sh.hName = ezxml_attr(xml_xhdr, "name");
-				sh.hValue = ezxml_attr(xml_xhdr, "value");
+		SipHeader sh = SipHeader();
+		sh.hName = ezxml_attr(xml_xhdr, "name");
+		sh.hValue = ezxml_attr(xml_xhdr, "value");
 
-				if (sh.hValue.compare(0, 7, "VP_ENV_") == 0){
-					if (const char* h_val = std::getenv(sh.hValue.c_str())) {
-						LOG(logINFO) << __FUNCTION__ << ":" << sh.hValue << " substitution x-header:" << sh.hName << " " << h_val;
+		if (sh.hValue.compare(0, 7, "VP_ENV_") == 0){
+			if (const char* h_val = std::getenv(sh.hValue.c_str())) {
+				LOG(logINFO) << __FUNCTION__ << ":" << sh.hValue << " substitution x-header:" << sh.hName << " " << h_val;
 
-						sh.hValue = h_val;
-					}
-				}
-				x_hdrs.push_back(sh);
+				sh.hValue = h_val;
 			}
-			vector<ActionCheck> checks;
-			// TO DO: these checks sould use get/set params like we do with action params
-			// <check-message>
-			for (xml_check = ezxml_child(xml_action, "check-message"); xml_check; xml_check=xml_check->next) {
-				ActionCheck check;
-				check.type = "message";
-				const char * val_inner = ezxml_attr(xml_check, "method");
-				if (val_inner) {
-					check.method = string(val_inner);
-				} else {
-					LOG(logERROR) <<__FUNCTION__<<"<check-message> missing [method] param !";
-					continue;
-				}
-				val_inner = ezxml_attr(xml_check, "regex");
-				if (val_inner) {
-					check.regex = string(val_inner);
-				} else {
-					LOG(logERROR) <<__FUNCTION__<<"<check-message> missing [regex] param !";
-					continue;
-				}
-				val_inner = ezxml_attr(xml_check, "code");
-				if (val_inner) {
-					check.code = atoi(val_inner);
-				}
-				val_inner = ezxml_attr(xml_check, "fail_on_match");
-				if (val_inner) {
-					check.fail_on_match = stob(val_inner);
-				}
-				LOG(logINFO) << __FUNCTION__ << " check-message: method[" << check.method << "] regex[" << check.regex<<"] fail_on_match[" << check.fail_on_match << "]";
+		}
+		compiled.x_headers.push_back(sh);
+	}
+	// TO DO: these checks sould use get/set params like we do with action params
+	// <check-message>
+	for (xml_check = ezxml_child(xml_action, "check-message"); xml_check; xml_check=xml_check->next) {
+		ActionCheck check;
+		check.type = "message";
+		const char * val_inner = ezxml_attr(xml_check, "method");
+		if (val_inner) {
+			check.method = string(val_inner);
+		} else {
+			LOG(logERROR) <<__FUNCTION__<<"<check-message> missing [method] param !";
+			continue;
+		}
+		val_inner = ezxml_attr(xml_check, "regex");
+		if (val_inner) {
+			check.regex = string(val_inner);
+		} else {
+			LOG(logERROR) <<__FUNCTION__<<"<check-message> missing [regex] param !";
+			continue;
+		}
+		val_inner = ezxml_attr(xml_check, "code");
+		if (val_inner) {
+			check.code = atoi(val_inner);
+		}
+		val_inner = ezxml_attr(xml_check, "fail_on_match");
+		if (val_inner) {
+			check.fail_on_match = stob(val_inner);
+		}
+		LOG(logINFO) << __FUNCTION__ << " check-message: method[" << check.method << "] regex[" << check.regex<<"] fail_on_match[" << check.fail_on_match << "]";
 
-				checks.push_back(check);
+		compiled.checks.push_back(check);
+	}
+	// <checks-header>
+	for (xml_check = ezxml_child(xml_action, "check-header"); xml_check; xml_check=xml_check->next) {
+		ActionCheck check;
+		check.type = "header";
+		const char * val_inner = ezxml_attr(xml_check, "name");
+		if (!val_inner) {
+			LOG(logERROR) <<__FUNCTION__<<" missing action check header name !";
+			continue;
+		}
+		check.hdr.hName = val_inner;
+		val_inner = ezxml_attr(xml_check, "value");
+		if (val_inner) {
+			check.hdr.hValue = val_inner;
+		} else {
+			val_inner = ezxml_attr(xml_check, "regex");
+			if (val_inner) {
+				std::string tmp_val;
+				tmp_val.assign(val_inner);
+				check.hdr.hValue = "regex/" + tmp_val;
 			}
-			// <checks-header>
-			for (xml_check = ezxml_child(xml_action, "check-header"); xml_check; xml_check=xml_check->next) {
-				ActionCheck check;
-				check.type = "header";
-				const char * val_inner = ezxml_attr(xml_check, "name");
-				if (!val_inner) {
-					LOG(logERROR) <<__FUNCTION__<<" missing action check header name !";
-					continue;
-				}
-				check.hdr.hName = val_inner;
-				val_inner = ezxml_attr(xml_check, "value");
-				if (val_inner) {
-					check.hdr.hValue = val_inner;
-				} else {
-					val_inner = ezxml_attr(xml_check, "regex");
-					if (val_inner) {
-						std::string tmp_val;
-						tmp_val.assign(val_inner);
-						check.hdr.hValue = "regex/" + tmp_val;
-					}
-				}
-				val_inner = ezxml_attr(xml_check, "fail_on_match");
-				if (val_inner) {
-					check.fail_on_match = stob(val_inner);
-				}
-				LOG(logINFO) <<__FUNCTION__<< " check-header:" << check.hdr.hName << " " << check.hdr.hValue << " fail_on_match: " << check.fail_on_match;
+		}
+		val_inner = ezxml_attr(xml_check, "fail_on_match");
+		if (val_inner) {
+			check.fail_on_match = stob(val_inner);
+		}
+		LOG(logINFO) <<__FUNCTION__<< " check-header:" << check.hdr.hName << " " << check.hdr.hValue << " fail_on_match: " << check.fail_on_match;
 
-				checks.push_back(check);
-			}
-			string action_type = ezxml_attr(xml_action,"type");;
-			LOG(logINFO) <<__FUNCTION__<< " ===> action/" << action_type;
-			if (action_type == "replay") {
-				goto replay;
-			}
-			vector<ActionParam> params = action.get_params(action_type);
-			if (params.size() == 0) {
-				LOG(logERROR) <<__FUNCTION__<< ": params not found for action:" << action_type << std::endl;
-				continue;
+		compiled.checks.push_back(check);
+	}
+	LOG(logINFO) <<__FUNCTION__<< " ===> action/" << compiled.name;
+	if (compiled.type == ActionType::none) {
+		LOG(logERROR) <<__FUNCTION__<< ": params not found for action:" << compiled.name << std::endl;
+		return false;
+	}
+	if (compiled.type != ActionType::replay) {
+		compiled.params = action.get_params(compiled.type);
+		for (auto &param : compiled.params) {
+			if (!action.set_param(param, ezxml_attr(xml_action, param.name.c_str())) && param.required) {
+				LOG(logERROR) <<__FUNCTION__<< ": action/" << compiled.name << " missing required parameter <" << param.name << ">";
+				*valid = false;
 			}
+		}
+	}
+	if (pre_encode && compiled.type == ActionType::accept) {
+		const char *play = ezxml_attr(xml_action, "play");
+		preencode_play_file(play && *play ? play : default_playback_file);
+	}
+	if (compiled.type == ActionType::call || compiled.type == ActionType::capacity || compiled.type == ActionType::trace) {
+		compiled.call = action.get_call_action(compiled.params);
+		if (pre_encode) {
+			preencode_play_file(compiled.call.play);
+		}
+		if (compiled.call.min_mos > 0) {
+			// not read from a call state callback
+			scoring.reference(compiled.call.reference.empty() ? compiled.call.play : compiled.call.reference);
+		}
+		const char *hold = ezxml_attr(xml_action, "hold");
+		std::string error = check_distribution("hold", hold ? hold : "fixed", compiled.call.hold);
+		if (!error.empty()) {
+			LOG(logERROR) <<__FUNCTION__<< ": action/" << compiled.name << " " << error;
+			*valid = false;
+		}
+	}
+	return true;
+}
 
-			for (auto &param : params) {
-				action.set_param(param, ezxml_attr(xml_action, param.name.c_str()));
+void Config::execute(const ScenarioAction &compiled) {
+	switch (compiled.type) {
+		case ActionType::wait:
+			action.do_wait(compiled.params);
+			break;
+		case ActionType::call:
+			if (compiled.call.concurrency > 0) {
+				action.do_call_concurrency(compiled.call, compiled.checks, compiled.x_headers);
+				break;
 			}
+			total_tasks_count += 1;
+			action.do_call(compiled.call, compiled.checks, compiled.x_headers);
+			break;
+		case ActionType::accept:
+			total_tasks_count += 1;
+			action.do_accept(compiled.params, compiled.checks, compiled.x_headers);
+			break;
+		case ActionType::reg:
+			total_tasks_count += 1;
+			action.do_register(compiled.params, compiled.checks, compiled.x_headers);
+			break;
+		case ActionType::alert:
+			action.do_alert(compiled.params);
+			break;
+		case ActionType::codec:
+			action.do_codec(compiled.params);
+			break;
+		case ActionType::turn:
+			action.do_turn(compiled.params);
+			break;
+		case ActionType::message:
+			total_tasks_count += 1;
+			action.do_message(compiled.params, compiled.checks, compiled.x_headers);
+			break;
+		case ActionType::accept_message:
+			total_tasks_count += 1;
+			action.do_accept_message(compiled.params, compiled.checks, compiled.x_headers);
+			break;
+		case ActionType::rewrite:
+			action.do_rewrite(compiled.params);
+			break;
+		case ActionType::parallel:
+			compiled.group->run();
+			break;
+		case ActionType::capacity: {
+			CapacitySearch search(this, compiled.call, compiled.checks, compiled.x_headers, compiled.params);
+			search.run();
+			break;
+		}
+		case ActionType::trace: {
+			TraceReplay replay(this, compiled.call, compiled.checks, compiled.x_headers, compiled.params);
+			replay.run();
+			break;
+		}
+		default:
+			break;
+	}
+}
 
-			if (action_type.compare("wait") == 0) {
-				action.do_wait(params);
-			} else if (action_type.compare("call") == 0) {
-				total_tasks_count += 1;
-				action.do_call(params, checks, x_hdrs);
-			} else if (action_type.compare("accept") == 0) {
-				total_tasks_count += 1;
-				action.do_accept(params, checks, x_hdrs);
-			} else if (action_type.compare("register") == 0) {
-				total_tasks_count += 1;
-				action.do_register(params, checks, x_hdrs);
-			} else if ( action_type.compare("alert") == 0) {
-				action.do_alert(params);
-			} else if (action_type.compare("codec") == 0) {
-				action.do_codec(params);
-			} else if (action_type.compare("turn") == 0) {
-				action.do_turn(params);
-			} else if (action_type.compare("message") == 0) {
-				total_tasks_count += 1;
-				action.do_message(params, checks, x_hdrs);
-			} else if (action_type.compare("accept_message") == 0) {
-				total_tasks_count += 1;
-				action.do_accept_message(params, checks, x_hdrs);
-			}
+bool Config::process(const std::string& p_configFileName, const std::string& p_jsonResultFileName) {
+	configFileName = p_configFileName;
+	ezxml_t xml_conf = ezxml_parse_file(configFileName.c_str());
+	xml_conf_head = xml_conf; // saving the head if the linked list
+
+	if(!xml_conf){
+		LOG(logINFO) <<__FUNCTION__<< "[error] test can not load file :" << configFileName ;
+		total_tasks_count += 100;
+		return false;
+	}
+
+	// the scenario is compiled once, replay and repeat run from the plan
+	std::vector<ScenarioAction> plan;
+	bool valid = compile(xml_conf, plan);
+	// the plan holds copies, the document is not needed anymore (the daemon parses a scenario per submission)
+	ezxml_free(xml_conf);
+	xml_conf_head = nullptr;
+	if (!valid) {
+		LOG(logERROR) <<__FUNCTION__<< "[error] invalid scenario :" << configFileName ;
+		total_tasks_count += 100;
+		return false;
+	}
+	LOG(logINFO) <<__FUNCTION__<< " compiled actions:" << plan.size();
+
+	size_t i = 0;
+	while (i < plan.size()) {
+		if (plan[i].type == ActionType::replay) {
+			i = 0;
+			continue;
 		}
+		execute(plan[i]);
+		i++;
 	}
 	return true;
 }
 
+bool Config::run_scenario(const std::string& file_name, bool stream) {
+	total_tasks_count = 0;
+	bool res;
+	if (stream) {
+		res = process_stream(file_name);
+	} else {
+		res = process(file_name, result_file.name);
+	}
+
+	LOG(logINFO) <<__FUNCTION__<<": checking alerts...";
+
+	// send email reporting
+	Alert alert(this);
+	alert.send();
+	return res;
+}
+
+void Config::reset() {
+	// the previous scenario is over, hangup_all waited for every call to be disconnected
+	checking_calls.lock();
+	new_calls_lock.lock();
+	std::vector<TestCall *> ended = calls;
+	ended.insert(ended.end(), removed_calls.begin(), removed_calls.end());
+	ended.insert(ended.end(), new_calls.begin(), new_calls.end());
+	calls.clear();
+	removed_calls.clear();
+	new_calls.clear();
+	new_calls_lock.unlock();
+	checking_calls.unlock();
+	for (auto call : ended) {
+		delete call;
+	}
+	release_expired(true);
+	// accounts created or configured by the previous scenario are dropped, deleting a pjsua2 account unregisters it
+	accounts_lock.lock();
+	std::vector<TestAccount *> previous = accounts;
+	accounts.clear();
+	caller_accounts.clear();
+	accounts_lock.unlock();
+	for (auto account : previous) {
+		delete account;
+	}
+	for (auto &injection : injection_files) {
+		// the file can change between two submissions
+		delete injection.second;
+	}
+	injection_files.clear();
+	source_pool.reset_stats();
+	vp_rewrite_clear();
+	udp_batch_stats_reset();
+	rtp_stats_lock.lock();
+	tests_with_rtp_stats.clear();
+	rtp_stats_lock.unlock();
+	testResults.clear();
+	alert_email_to.clear();
+	alert_email_from.clear();
+	alert_server_url.clear();
+	total_tasks_count = 0;
+	json_result_count = 0;
+	// every scenario replays the same random traffic
+	traffic_summary.clear();
+	random.seed(random.get_seed());
+	createDefaultAccount();
+}
+
+bool Config::process_stream(const std::string& p_configFileName) {
+	configFileName = p_configFileName;
+	ScenarioReader reader(configFileName);
+	if (!reader.open()) {
+		total_tasks_count += 100;
+		return false;
+	}
+
+	// actions are compiled and executed one at a time, only the current one is in memory
+	bool valid = true;
+	bool executed = false;
+	ezxml_t xml_action;
+	while ((xml_action = reader.next())) {
+		ScenarioAction compiled;
+		bool action_valid = true;
+		if (!compile_action(xml_action, compiled, &action_valid)) {
+			continue;
+		}
+		if (!action_valid) {
+			// the rest of the scenario may already be running, only this action is dropped
+			LOG(logERROR) <<__FUNCTION__<< "[error] invalid action:" << compiled.name << " in " << configFileName;
+			valid = false;
+			continue;
+		}
+		if (compiled.type == ActionType::replay) {
+			if (!executed || !reader.rewind()) {
+				break;
+			}
+			executed = false;
+			continue;
+		}
+		execute(compiled);
+		executed = true;
+	}
+	LOG(logINFO) <<__FUNCTION__<< " streamed actions:" << reader.actions();
+	if (!valid) {
+		total_tasks_count += 100;
+	}
+	return valid;
+}
+
 
 /*
  * Alert implementation
@@ -1598,14 +2366,18 @@ int main(int argc, char **argv){
 	Config config(log_test_fn);
 	bool tcp_only = false;
 	bool udp_only = false;
+	int udp_batch = 0;
+	int sip_workers = 1;
+	int media_threads = 0;
+	std::string source_addr;
+	bool stream_scenario = false;
+	std::string daemon_socket;
 	int timer_ms = 0;
 	config.rtp_cfg.port = 4000;
 	ep.config = &config;
 	config.ep = &ep;
 
 	std::string scenario_status_string = "";
-	char now[20] = {'\0'};
-	std::string current_time = "";
 
 	// command line argument
 	for (int i = 1; i < argc; ++i) {
@@ -1617,6 +2389,9 @@ int main(int argc, char **argv){
             " --log-level-console <0-10>        console log level         \n"\
             " -p --port <5060>                  local port                \n"\
             " -c,--conf <conf.xml>              XML scenario file         \n"\
+            " --daemon <socket path>            keep running and execute the scenario files submitted on this UNIX socket\n"\
+            " --seed <n>                        seed of the random arrivals and holding times, to reproduce a run\n"\
+            " --stream-scenario                 execute each action as it is read, for very large scenario files\n"\
             " -l,--log <logfilename>            voip_patrol log file name \n"\
             " -t, timer_ms <ms>                 pjsua timer_d for transaction default to 32s\n"\
             " -o,--output <result.json>         json result file name, another file suffixed with \".pjsua\" will also be created with all the logs from PJ-SIP \n"\
@@ -1625,9 +2400,19 @@ int main(int argc, char **argv){
             " --tls-cert <path/file_name>       TLS certificate (pem format) \n"\
             " --tls-verify-server               TLS verify server certificate \n"\
             " --tls-verify-client               TLS verify client certificate \n"\
-            " --rewrite-ack-transport           WIP first use case of rewriting messages before they are sent \n"\
+            " --rewrite-ack-transport           strip the transport parameter from the ACK request URI, see action rewrite \n"\
             " --graceful-shutdown               Wait a few seconds when shuting down\n"\
             " --tcp / --udp                     Only listen to TCP/UDP    \n"\
+            " --udp-batch <n>                   UDP transport sending and receiving up to n datagrams per system call\n"\
+            " --direct-media                    play and record on the call streams without the conference bridge\n"\
+            " --pre-encode                      G.711 play files are encoded once and sent as is by every call, implies --direct-media\n"\
+            " --media-threads <n>               n media worker threads sharing the direct media calls, implies --direct-media, default one per CPU\n"\
+            " --scoring-threads <n>             n threads scoring the audio of the calls with min_mos, default 2\n"\
+            " --recording-writer <wav|flac>     recordings written by a background thread, format of the \"auto\" recordings\n"\
+            " --recording-bandwidth <kB/s>      disk bandwidth of the background recording writer, default unlimited\n"\
+            " --sip-workers <n>                 n SIP worker threads, n SO_REUSEPORT UDP sockets and TCP listeners\n"\
+            " --source-addr <IP[:port[-port]],...> spread calls and registrations over UDP/TCP transports on these addresses\n"\
+            " --source-select <round-robin|hash> source address selection, hash keeps a caller on the same source\n"\
             " --ip-addr <IP>                    Use the specifed address as SIP and RTP addresses\n"\
             " --bound-addr <IP>                 Bind transports to this IP interface\n"\
  			" --rtp-port <1-65535>              Starting port of the range used for RTP\n"\
@@ -1645,12 +2430,66 @@ int main(int argc, char **argv){
 			if (i + 1 < argc) {
 				timer_ms = atoi(argv[++i]);
 			}
+		} else if ( (arg == "--daemon") ) {
+			if (i + 1 < argc) {
+				daemon_socket = argv[++i];
+			}
+		} else if ( (arg == "--seed") ) {
+			if (i + 1 < argc) {
+				config.random.seed(strtoull(argv[++i], NULL, 10));
+			}
+		} else if ( (arg == "--stream-scenario") ) {
+			stream_scenario = true;
+		} else if ( (arg == "--direct-media") ) {
+			config.direct_media = true;
+		} else if ( (arg == "--pre-encode") ) {
+			config.direct_media = true;
+			config.pre_encode = true;
+		} else if ( (arg == "--scoring-threads") ) {
+			if (i + 1 < argc) {
+				config.scoring.threads_count = std::max(1, atoi(argv[++i]));
+			}
+		} else if ( (arg == "--recording-writer") ) {
+			if (i + 1 < argc) {
+				std::string format = argv[++i];
+				if (format != "wav" && format != "flac") {
+					std::cerr << "--recording-writer: unknown format " << format << ", expected wav or flac\n";
+					return 1;
+				}
+				config.recording.async = true;
+				config.recording.format = format == "flac" ? RecordingFormat::flac : RecordingFormat::wav;
+			}
+		} else if ( (arg == "--recording-bandwidth") ) {
+			if (i + 1 < argc) {
+				config.recording.bandwidth = strtoul(argv[++i], NULL, 10) * 1000;
+			}
+		} else if ( (arg == "--media-threads") ) {
+			if (i + 1 < argc) {
+				media_threads = atoi(argv[++i]);
+				config.direct_media = media_threads > 0 || config.direct_media;
+			}
 		} else if ( (arg == "--graceful-shutdown") ) {
 			config.graceful_shutdown = true;
 		} else if ( (arg == "--tcp") ) {
 			tcp_only = true;
 		} else if ( (arg == "--udp") ) {
 			udp_only = true;
+		} else if ( (arg == "--udp-batch") ) {
+			if (i + 1 < argc) {
+				udp_batch = atoi(argv[++i]);
+			}
+		} else if ( (arg == "--sip-workers") ) {
+			if (i + 1 < argc) {
+				sip_workers = atoi(argv[++i]);
+			}
+		} else if (arg == "--source-addr") {
+			if (i + 1 < argc) {
+				source_addr = argv[++i];
+			}
+		} else if (arg == "--source-select") {
+			if (i + 1 < argc) {
+				config.source_pool.mode = get_source_select_from_string(argv[++i]);
+			}
 		} else if ( (arg == "--rewrite-ack-transport") ) {
 			config.rewrite_ack_transport = true;
 		} else if ( (arg == "--log-level-file") ) {
@@ -1713,12 +2552,19 @@ int main(int argc, char **argv){
 		"output file: "<<log_test_fn<<"\n"
 		"public_address: "<<config.ip_cfg.public_address<<"\n"
 		"bound_address: "<<config.ip_cfg.bound_address<<"\n"
+		"random seed: "<<config.random.get_seed()<<"\n"
 		"* * * * * * *\n";
 
 	if (udp_only && tcp_only) {
 		udp_only = false;
 		tcp_only = false;
 	}
+	if (sip_workers < 1) {
+		sip_workers = 1;
+	}
+	if (udp_batch > 0 || sip_workers > 1) {
+		config.udp_batch_stats = true;
+	}
 
 	//pjsip_cfg()->tsx.t1 = 100;
 	//pjsip_cfg()->tsx.t2 = 100;
@@ -1732,10 +2578,9 @@ int main(int argc, char **argv){
 	try {
 		ep.libCreate();
 		if (config.rewrite_ack_transport) {
-			/* Register stateless server module */
-			pj_status_t status = -1;
-			struct pjsua_data* pjsua_var = pjsua_get_var();
-			status = pjsip_endpt_register_module(pjsua_var->endpt, &mod_voip_patrol);
+			// strip the transport parameter from the ACK request URI to reproduce some broken carrier
+			vp_rewrite_add_rule("ACK", 0, "Request-Line", ";transport=*", "", true);
+			pj_status_t status = vp_rewrite_register(pjsua_get_pjsip_endpt());
 			PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
 		}
 		EpConfig ep_cfg;
@@ -1746,9 +2591,23 @@ int main(int argc, char **argv){
 		ep_cfg.logConfig.filename = pj_log_fn.c_str();
 		ep_cfg.medConfig.ecTailLen = 0; // disable echo canceller
 		ep_cfg.medConfig.noVad = 1;
+		if (sip_workers > 1) {
+			ep_cfg.uaConfig.threadCnt = sip_workers;
+		}
 		// ep_cfg.uaConfig.nameserver.push_back("8.8.8.8");
 
 		ep.libInit(ep_cfg);
+		if (config.pre_encode) {
+			preencoded_g711_register(pjsua_get_pjmedia_endpt());
+		}
+		if (config.direct_media && media_threads <= 0) {
+			// a master port clock thread per call would cost more than the bridge it replaces
+			media_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if (media_threads > 0 && !config.media_engine.start(media_threads)) {
+			LOG(logERROR) <<__FUNCTION__<<": can not start the media worker threads";
+			return 1;
+		}
 		// pjsua_set_null_snd_dev() before calling pjsua_start().
 
 		tcfg.port = port;
@@ -1756,12 +2615,68 @@ int main(int argc, char **argv){
 		tcfg.boundAddress = config.ip_cfg.bound_address;
 
 		// TCP and UDP transports
-		if (!tcp_only) {
+		if (!tcp_only && (udp_batch > 0 || sip_workers > 1)) {
+			// every socket has its own receive thread, the kernel spreads the datagrams with SO_REUSEPORT
+			udp_batch_config_t batch_cfg;
+			batch_cfg.port = port;
+			batch_cfg.batch = udp_batch > 0 ? udp_batch : batch_cfg.batch;
+			batch_cfg.reuse_port = sip_workers > 1;
+			batch_cfg.public_address = config.ip_cfg.public_address;
+			batch_cfg.bound_address = config.ip_cfg.bound_address;
+			for (int i = 0; i < sip_workers; i++) {
+				pjsip_transport *tp;
+				pjsua_transport_id id;
+				pj_status_t status = udp_batch_transport_create(pjsua_get_pjsip_endpt(), batch_cfg, &tp);
+				if (status == PJ_SUCCESS) {
+					status = pjsua_transport_register(tp, &id);
+				}
+				if (status != PJ_SUCCESS) {
+					LOG(logERROR) <<__FUNCTION__<<": can not create the batched UDP transport";
+					return 1;
+				}
+				// outgoing requests use the first one, responses leave from the socket the request came in
+				if (i == 0) {
+					config.transport_id_udp = id;
+				}
+			}
+		} else if (!tcp_only) {
 			config.transport_id_udp = ep.transportCreate(PJSIP_TRANSPORT_UDP, tcfg);
 		}
-		if (!udp_only) {
+		if (!udp_only && sip_workers > 1) {
+			// the listening sockets share the port, the accepted connections are spread among the worker threads
+			static int reuse_port = 1;
+			pjsua_transport_config tcp_cfg;
+			pjsua_transport_config_default(&tcp_cfg);
+			tcp_cfg.port = port;
+			tcp_cfg.public_addr = pj_str((char *)config.ip_cfg.public_address.c_str());
+			tcp_cfg.bound_addr = pj_str((char *)config.ip_cfg.bound_address.c_str());
+			tcp_cfg.sockopt_params.cnt = 1;
+			tcp_cfg.sockopt_params.options[0].level = pj_SOL_SOCKET();
+			tcp_cfg.sockopt_params.options[0].optname = SO_REUSEPORT;
+			tcp_cfg.sockopt_params.options[0].optval = &reuse_port;
+			tcp_cfg.sockopt_params.options[0].optlen = sizeof(reuse_port);
+			for (int i = 0; i < sip_workers; i++) {
+				pjsua_transport_id id;
+				pj_status_t status = pjsua_transport_create(PJSIP_TRANSPORT_TCP, &tcp_cfg, &id);
+				if (status != PJ_SUCCESS) {
+					LOG(logERROR) <<__FUNCTION__<<": can not create TCP listener " << i;
+					return 1;
+				}
+				if (i == 0) {
+					config.transport_id_tcp = id;
+				}
+			}
+		} else if (!udp_only) {
 			config.transport_id_tcp = ep.transportCreate(PJSIP_TRANSPORT_TCP, tcfg);
 		}
+		LOG(logINFO) <<__FUNCTION__<<": SIP worker threads:" << sip_workers;
+
+		if (!source_addr.empty()) {
+			if (!config.source_pool.parse(source_addr) || !config.source_pool.create(ep, !tcp_only, !udp_only)) {
+				LOG(logERROR) <<__FUNCTION__<<": invalid source addresses: " << source_addr;
+				return 1;
+			}
+		}
 	} catch (Error & err) {
 		LOG(logINFO) <<__FUNCTION__<<": Exception: " << err.info() ;
 		return 1;
@@ -1795,38 +2710,30 @@ int main(int argc, char **argv){
 	try {
 		// load config and execute test
 
-		get_time_string(now);
-		current_time = now;
-
-		scenario_status_string = "{\"scenario\": {\"state\":\"start";
-		scenario_status_string += "\", \"name\":\"" + conf_fn;
-		scenario_status_string += "\", \"time\":\"" + current_time + "\"}}";
+		if (daemon_socket.empty()) {
+			scenario_status_string = config.scenario_start_json(conf_fn);
 
-		config.result_file.write(scenario_status_string);
+			config.result_file.write(scenario_status_string);
 
-		LOG(logINFO) << __FUNCTION__ << scenario_status_string;
+			LOG(logINFO) << __FUNCTION__ << scenario_status_string;
 
-		config.result_file.flush();
+			config.result_file.flush();
+		}
 
 		pjsua_set_null_snd_dev();
 		ep.libStart();
 
 		config.createDefaultAccount();
-		config.total_tasks_count = 0;
-		config.process(conf_fn, log_test_fn);
-
-		// LOG(logINFO) <<__FUNCTION__<<": final wait complete all...";
-
-		// vector<ActionParam> params = config.action.get_params("wait");
-
-		// config.action.set_param_by_name(&params, "complete");
-		// config.action.do_wait(params);
-
-		LOG(logINFO) <<__FUNCTION__<<": checking alerts...";
-
-		// send email reporting
-		Alert alert(&config);
-		alert.send();
+		if (!daemon_socket.empty()) {
+			// the endpoint and the transports stay up, scenarios are submitted on the socket
+			ScenarioDaemon daemon(&config, daemon_socket, stream_scenario);
+			if (!daemon.start()) {
+				throw Error(PJ_EINVAL, "daemon", "can not listen on " + daemon_socket, __FILE__, __LINE__);
+			}
+			daemon.run();
+		} else {
+			config.run_scenario(conf_fn, stream_scenario);
+		}
 
 		LOG(logINFO) <<__FUNCTION__<<": hangup all calls..." ;
 		if (config.graceful_shutdown) { // make sure we terminate transactions, not sure why this was necessary
@@ -1839,45 +2746,10 @@ int main(int argc, char **argv){
 		ret = 1;
 	}
 
-	bool disconnecting = true;
-	while (disconnecting) {
-		disconnecting = false;
-		for (auto & call : config.calls) {
-			pjsua_call_info pj_ci;
-			CallInfo ci;
-			if (call->is_disconnecting()) { // wait for call disconnections
-					if (call->test && call->test->completed) {
-						config.removeCall(call);
-					}
-					disconnecting = true;
-					continue;
-			}
-			pj_status_t status = pjsua_call_get_info(call->getId(), &pj_ci);
-
-			LOG(logINFO) << __FUNCTION__ << " disconnecting >>> call[" << call->getId() << "][" << call << "] ";
-
-			if (status != PJ_SUCCESS) {
-				LOG(logINFO) << __FUNCTION__ << " can not get call info, removing call["<< call->getId() <<"]["<< call <<"] "<< config.removeCall(call);
-				continue;
-			}
-			ci.fromPj(pj_ci);
-
-			CallOpParam prm(true);
-			if (ci.state != PJSIP_INV_STATE_DISCONNECTED) {
-				disconnecting = true;
-				try {
-					call->hangup(prm);
-				} catch (pj::Error& e)  {
-					LOG(logERROR) << __FUNCTION__ << " error (" << e.status << "): [" << e.srcFile << "] " << e.reason << std::endl;
-				}
-			} else {
-				LOG(logINFO) << __FUNCTION__ << " disconnected call["<< call->getId() <<"]["<< call <<"]";
-
-				pj_thread_sleep(500);
-			}
-		}
-		pj_thread_sleep(50);
-	}
+	config.hangup_all();
+	config.media_engine.stop();
+	config.scoring.stop();
+	config.recording.stop();
 
 	try {
 		ep.libDestroy();
@@ -1893,24 +2765,13 @@ int main(int argc, char **argv){
 	}
 
 
-	get_time_string(now);
-	current_time = now;
-
-	scenario_status_string = "{\"scenario\": {\"state\":\"end\" ,\"result\":\"";
+	if (daemon_socket.empty()) {
+		scenario_status_string = config.scenario_end_json(conf_fn);
 
-	if (config.total_tasks_count != config.json_result_count) {
-		scenario_status_string += "FAIL";
-	} else {
-		scenario_status_string += "PASS";
+		config.result_file.write(scenario_status_string);
+		LOG(logINFO)<<__FUNCTION__ << scenario_status_string;
+		config.result_file.flush();
 	}
-	scenario_status_string += "\", \"name\":\"" + conf_fn;
-	scenario_status_string += "\", \"time\":\"" + current_time;
-	scenario_status_string += "\", \"total tasks\":\"" + std::to_string(config.total_tasks_count);
-	scenario_status_string += "\", \"completed tasks\":\"" + std::to_string(config.json_result_count) + "\"}}";
-
-	config.result_file.write(scenario_status_string);
-	LOG(logINFO)<<__FUNCTION__ << scenario_status_string;
-	config.result_file.flush();
 
 	LOG(logINFO) <<__FUNCTION__<<": Watch completed, exiting" ;
 	return ret;
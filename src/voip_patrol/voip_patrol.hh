@@ -19,12 +19,30 @@
 #ifndef VOIP_PATROL_H
 #define VOIP_PATROL_H
 #include "action.hh"
+#include "injection.hh"
+#include "source_pool.hh"
+#include "traffic_model.hh"
+#include "call_group.hh"
+#include "direct_media.hh"
+#include "media_engine.hh"
+#include "quality.hh"
+#include "scoring.hh"
+#include "audio_analysis.hh"
+#include "recording_writer.hh"
+#include "watermark.hh"
+#include "latency.hh"
 #include <pjsua2.hpp>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <vector>
+#include <map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include <pj/file_access.h>
 #include "ezxml/ezxml.h"
 #include "curl/email.h"
@@ -80,9 +98,20 @@ class ResultFile {
 		bool open();
 		void close();
 		bool write(const std::string& res);
+		void mirror(int fd);
 		std::string name;
+		~ResultFile();
 	private:
+		void mirror_run();
 		std::fstream file;
+		// results are also sent to the submitter of the running scenario in daemon mode, by a writer thread
+		std::mutex mirror_lock;
+		std::condition_variable mirror_cond;
+		std::deque<std::string> mirror_queue;
+		std::thread mirror_thread;
+		bool mirror_sending {false};
+		bool mirror_stop {false};
+		int mirror_fd {-1};
 };
 
 class VoipPatrolEnpoint : public Endpoint {
@@ -112,14 +141,28 @@ class Config {
 		~Config();
 		void log(const std::string& message);
 		bool process(const std::string& ConfigFileName, const std::string& jsonResultFile);
+		bool process_stream(const std::string& ConfigFileName);
+		bool run_scenario(const std::string& file_name, bool stream);
+		void reset();
+		void hangup_all();
+		std::string scenario_start_json(const std::string& name);
+		std::string scenario_end_json(const std::string& name);
+		bool compile(ezxml_t xml_conf, std::vector<ScenarioAction> &plan);
+		bool compile_action(ezxml_t xml_action, ScenarioAction &compiled, bool *valid);
+		void execute(const ScenarioAction &compiled);
 		bool wait(bool complete_all);
 		TestAccount* findAccount(std::string);
+		TestAccount* findCallerAccount(const std::string& account_uri);
 		TestAccount* createAccount(AccountConfig acc_cfg);
 		void createDefaultAccount();
+		InjectionFile* getInjectionFile(const std::string& file_name);
+		void release_later(std::shared_ptr<void> owner); // of a conference bridge port, removed asynchronously
+		void release_expired(bool all = false);
 		turn_config_t turn_config;
 		std::vector<TestAccount *> accounts;
 		std::vector<TestCall *> calls;
 		std::vector<TestCall *> new_calls;
+		std::vector<TestCall *> removed_calls; // deleted by reset, between two scenarios
 		std::vector<Test *> tests;
 		std::vector<std::string> testResults;
 		ezxml_t xml_conf_head;
@@ -134,7 +177,9 @@ class Config {
 		TransportId transport_id_udp{-1};
 		TransportId transport_id_tcp{-1};
 		TransportId transport_id_tls{-1};
-		int total_tasks_count;
+		std::atomic<int> total_tasks_count; // incremented by the <parallel> streams
+		std::atomic<unsigned> watermark_next {0}; // in band ids of the calls
+		LatencyRegistry latency_marks;            // marker times of the calls with latency, by X-VP-Latency key
 		int json_result_count;
 		Action action;
 		ResultFile result_file;
@@ -156,6 +201,22 @@ class Config {
 			int port_range;
 		} rtp_cfg;
 		std::vector<Test *> tests_with_rtp_stats;
+		std::mutex rtp_stats_lock;
+		std::mutex accounts_lock;
+		std::mutex setup_lock; // account creation and configuration by the actions, <parallel> streams run them at the same time
+		std::map<std::string, TestAccount *> caller_accounts; // accounts of the call actions by caller and transport
+		std::map<std::string, InjectionFile *> injection_files;
+		SourcePool source_pool;
+		TrafficRandom random;
+		TrafficSummary traffic_summary;
+		bool udp_batch_stats {false};
+		bool direct_media {false}; // play and record without the conference bridge
+		bool pre_encode {false};   // G.711 play files encoded once, requires direct_media
+		MediaEngine media_engine;  // direct media worker threads, not running with one clock per call
+		ScoringPool scoring;       // min_mos of the calls, scored in memory once they end
+		RecordingWriter recording; // FLAC and async recordings, written by a background thread
+		std::mutex release_lock;
+		std::deque<std::pair<std::chrono::steady_clock::time_point, std::shared_ptr<void>>> released; // by release_later
 		VoipPatrolEnpoint *ep;
 		std::mutex process_result;
 	private:
@@ -198,14 +259,34 @@ class Test {
 		std::string end_time;
 		float min_mos{0.0};
 		float mos{0.0};
+		std::atomic<bool> mos_ready {false}; // set by the scoring pool
+		AudioScore audio_score;
+		std::string reference;            // played by the peer, scored against the received audio
+		std::string analyze;              // "report" or "check" the received audio, empty none
+		AudioAnalysis analysis;
+		bool watermark {false};
+		int watermark_id {-1};            // sent and expected back, -1 unknown
+		WatermarkResult watermark_result;
+		bool latency {false};             // a call sends markers, an accept reflects them
+		std::string latency_key;          // of the call, in the X-VP-Latency header
+		std::shared_ptr<LatencyMarks> latency_marks;
+		int latency_reflect_ms {0};       // announced by the accept reflecting the markers of the call
+		LatencyResult latency_result;
+		void add_latency_reflect(CallOpParam &prm);
+		bool taps_done {false};           // the capture, analysis, watermark and latency results are in
 		bool rtp_stats {false};
 		bool late_start {false};
+		bool no_media {false};            // signaling only, the offer and the answer disable the audio
+		void disable_media();
 		std::string force_contact {""};
 		std::string reason {""};
 		int connect_duration {0};
 		int hangup_duration {0};
 		int re_invite_next {0};
 		int re_invite_interval {0};
+		int quality_interval {0};         // seconds between two samples of the quality time series, 0 none
+		int quality_next {0};
+		QualitySeries quality;
 		int setup_duration {0};
 		int expected_setup_duration {0};
 		int expected_duration {0};
@@ -229,6 +310,11 @@ class Test {
 		std::string accept_label {"accept_default"};
 		std::string transport;
 		std::string peer_socket;
+		int source {-1};
+		std::shared_ptr<CallGroup> group; // concurrency target or capacity probe of the call action
+		bool group_ended {false};
+		int retransmissions {0};          // of the INVITE
+		bool rate_reported {false};       // INVITE outcome given to the group controller
 		std::string dtmf_recv;
 		std::string cancel_behavoir {""};
 		call_state_t wait_state {INV_STATE_NULL};
@@ -238,6 +324,7 @@ class Test {
 		bool record_early {false};
 		bool is_recording_running {false};
 		std::string record_fn;
+		std::string recording_error;      // the recording could not be started, in the result
 		std::string reference_fn;
 		std::string rtp_stats_json;
 		std::string play;
@@ -270,6 +357,10 @@ class TestAccount : public Account {
 		virtual void onInstantMessageStatus(OnInstantMessageStatusParam &prm);
 		int hangup_duration {0};
 		int re_invite_interval {0};
+		int quality_interval {0};
+		std::string analyze;
+		bool watermark {false};
+		bool latency {false};
 		int max_duration {0};
 		int ring_duration {0};
 		int response_delay {0};
@@ -277,6 +368,7 @@ class TestAccount : public Account {
 		int expected_setup_duration {0};
 		bool rtp_stats {false};
 		bool late_start {false};
+		bool no_media {false};
 		bool unregistering {false};
 		std::string force_contact;
 		bool early_media {false};
@@ -317,8 +409,21 @@ class TestCall : public Call {
 		virtual void onDtmfDigit(OnDtmfDigitParam &prm);
 		void makeCall(const string &dst_uri, const CallOpParam &prm, const string &to_uri);
 		void hangup(const CallOpParam &prm);
+		void media_setting(CallSetting &opt);
+		void sample_quality(const CallInfo &ci);
+		void start_taps(pjsua_call_id call_id);
+		void end_taps();
 		pjsua_recorder_id recorder_id{-1};
 		pjsua_player_id player_id{-1};
+		std::unique_ptr<DirectMedia> direct_media; // instead of the player and recorder ids
+		MediaTaps taps;                            // the sinks and sources below, attached together
+		std::shared_ptr<AudioCapture> capture;     // received audio of a call with min_mos
+		std::shared_ptr<const std::vector<float>> reference;
+		std::shared_ptr<AudioAnalyzer> analyzer;   // received audio of a call with analyze
+		std::shared_ptr<WatermarkDetector> wm_detector;
+		std::shared_ptr<LatencyProbe> latency_probe;
+		std::shared_ptr<AsyncRecorder> async_recorder; // instead of recorder_id, shared with the writer
+		pjsua_conf_port_id async_recorder_slot {PJSUA_INVALID_ID};
 		int role;
 		int rtt;
 		bool is_disconnecting(){return disconnecting;};
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "watermark.hh"
+#include "audio_kernels.hh"
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <string.h>
+
+#define WATERMARK_BASE_HZ 700
+#define WATERMARK_STEP_HZ 150
+#define WATERMARK_SYNC 16
+#define WATERMARK_TONE_MS 40
+#define WATERMARK_SYMBOL_MS 80
+#define WATERMARK_PERIOD_MS 2000
+#define WATERMARK_RAMP_MS 4
+#define WATERMARK_AMPLITUDE 3277.0  // -20dBFS
+#define WATERMARK_BLOCK_MS 20
+#define WATERMARK_MIN_LEVEL 100.0   // block RMS, about -50dBFS
+#define WATERMARK_PURITY 0.4        // share of the block energy in the tone
+#define WATERMARK_MAX_IDS 4
+#define WATERMARK_CONFIRM 2         // detections of another id for a mismatch, the 4 bits checksum passes 1 noise in 16
+
+static unsigned tone_hz(unsigned k) {
+	return WATERMARK_BASE_HZ + WATERMARK_STEP_HZ * k;
+}
+
+static uint16_t checksum(const unsigned *digits) {
+	return ((digits[0] + digits[1] + digits[2] + digits[3]) ^ 0xa) & 0xf;
+}
+
+// the bursts of every tone at a clock rate, with short ramps against the clicks
+static const std::vector<int16_t>* tone_bursts(unsigned clock_rate) {
+	static std::mutex lock;
+	static std::map<unsigned, std::vector<int16_t>> bursts;
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<int16_t> &b = bursts[clock_rate];
+	if (b.empty()) {
+		unsigned len = clock_rate * WATERMARK_TONE_MS / 1000;
+		unsigned ramp = clock_rate * WATERMARK_RAMP_MS / 1000;
+		b.resize(WATERMARK_TONES * len);
+		for (unsigned k = 0; k < WATERMARK_TONES; k++) {
+			for (unsigned i = 0; i < len; i++) {
+				double gain = 1.0;
+				if (i < ramp)
+					gain = 0.5 - 0.5 * cos(M_PI * i / ramp);
+				else if (len - 1 - i < ramp)
+					gain = 0.5 - 0.5 * cos(M_PI * (len - 1 - i) / ramp);
+				b[k * len + i] = lrint(WATERMARK_AMPLITUDE * gain * sin(2.0 * M_PI * tone_hz(k) * i / clock_rate));
+			}
+		}
+	}
+	return &b;
+}
+
+WatermarkSender::WatermarkSender(uint16_t id, unsigned clock_rate) : AudioSource(clock_rate), id(id) {
+	tones = tone_bursts(clock_rate);
+	symbols[0] = WATERMARK_SYNC;
+	for (int i = 0; i < 4; i++)
+		symbols[1 + i] = (id >> (12 - 4 * i)) & 0xf;
+	symbols[5] = checksum(&symbols[1]);
+}
+
+void WatermarkSender::mix(pj_int16_t *samples, unsigned count) {
+	unsigned len = clock_rate * WATERMARK_TONE_MS / 1000;
+	unsigned symbol_len = clock_rate * WATERMARK_SYMBOL_MS / 1000;
+	unsigned period = clock_rate * WATERMARK_PERIOD_MS / 1000;
+	for (unsigned i = 0; i < count; i++) {
+		unsigned s = position / symbol_len;
+		unsigned pos = position % symbol_len;
+		if (s < WATERMARK_SYMBOLS && pos < len) {
+			int v = samples[i] + (*tones)[symbols[s] * len + pos];
+			samples[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+		}
+		if (++position == period)
+			position = 0;
+	}
+}
+
+WatermarkDetector::WatermarkDetector(unsigned clock_rate, int expected) : AudioSink(clock_rate), expected(expected) {
+	block_samples = clock_rate * WATERMARK_BLOCK_MS / 1000;
+	block.resize(block_samples);
+	for (unsigned k = 0; k < WATERMARK_TONES; k++)
+		coefs[k] = 2.0 * cos(2.0 * M_PI * tone_hz(k) / clock_rate);
+}
+
+void WatermarkDetector::put(const pj_int16_t *samples, unsigned count) {
+	std::lock_guard<std::mutex> guard(lock);
+	while (count) {
+		unsigned n = std::min(count, block_samples - block_pos);
+		memcpy(&block[block_pos], samples, n * sizeof(pj_int16_t));
+		block_pos += n;
+		samples += n;
+		count -= n;
+		if (block_pos == block_samples) {
+			end_block();
+			block_pos = 0;
+		}
+	}
+}
+
+void WatermarkDetector::end_block() {
+	double energy = 0.0;
+	for (unsigned i = 0; i < block_samples; i++)
+		energy += (double)block[i] * block[i];
+	if (energy < WATERMARK_MIN_LEVEL * WATERMARK_MIN_LEVEL * block_samples) {
+		symbol(-1);
+		return;
+	}
+	float power[WATERMARK_TONES];
+	goertzel_power(&block[0], block_samples, coefs, WATERMARK_TONES, power);
+	int best = 0;
+	float second = 0.0;
+	for (int k = 1; k < WATERMARK_TONES; k++) {
+		if (power[k] > power[best]) {
+			second = power[best];
+			best = k;
+		} else if (power[k] > second) {
+			second = power[k];
+		}
+	}
+	// a pure tone on its bin has a power of its energy * n / 2
+	if (power[best] > WATERMARK_PURITY * energy * block_samples / 2 && second < power[best] / 4)
+		symbol(best);
+	else
+		symbol(-1);
+}
+
+void WatermarkDetector::symbol(int s) {
+	if (s == last_symbol)
+		return; // the same tone over several blocks
+	last_symbol = s;
+	if (s < 0)
+		return;
+	if (s == WATERMARK_SYNC) {
+		received_count = 0;
+		return;
+	}
+	if (received_count < 0)
+		return;
+	received[received_count++] = s;
+	if (received_count < WATERMARK_SYMBOLS - 1)
+		return;
+	received_count = -1;
+	unsigned digits[4] = {(unsigned)received[0], (unsigned)received[1], (unsigned)received[2], (unsigned)received[3]};
+	if (checksum(digits) != (unsigned)received[4])
+		return;
+	uint16_t id = (digits[0] << 12) | (digits[1] << 8) | (digits[2] << 4) | digits[3];
+	for (auto &d : detected) {
+		if (d.first == id) {
+			d.second++;
+			return;
+		}
+	}
+	if (detected.size() >= WATERMARK_MAX_IDS) {
+		// the oldest id seen once makes room, noise must not hide an id received again
+		auto it = detected.begin();
+		while (it != detected.end() && (it->second > 1 || it->first == expected))
+			++it;
+		if (it == detected.end()) {
+			others++;
+			return;
+		}
+		detected.erase(it);
+		others++;
+	}
+	detected.push_back(std::make_pair(id, 1u));
+}
+
+WatermarkResult WatermarkDetector::result() const {
+	std::lock_guard<std::mutex> guard(lock);
+	WatermarkResult r;
+	r.valid = true;
+	r.expected = expected;
+	r.detected = detected;
+	r.others = others;
+	bool found = false;
+	bool foreign = false;
+	for (auto &d : detected) {
+		if (d.first == expected)
+			found = true;
+		else if (d.second >= WATERMARK_CONFIRM)
+			foreign = true;
+		else
+			r.unconfirmed++;
+	}
+	if (expected < 0)
+		r.verdict = detected.empty() ? "none" : "detected";
+	else if (foreign)
+		r.verdict = "mismatch";
+	else if (found)
+		r.verdict = "ok";
+	else
+		r.verdict = "missing";
+	return r;
+}
+
+std::string WatermarkResult::json() const {
+	std::string ids;
+	for (auto &d : detected) {
+		if (!ids.empty())
+			ids += ", ";
+		ids += "{\"id\": " + std::to_string(d.first) + ", \"count\": " + std::to_string(d.second) + "}";
+	}
+	return "{\"verdict\": \"" + verdict + "\", \"expected\": " + std::to_string(expected) +
+	       ", \"detected\": [" + ids + "], \"unconfirmed\": " + std::to_string(unconfirmed) +
+	       ", \"others\": " + std::to_string(others) + "}";
+}
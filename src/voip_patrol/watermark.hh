@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_WATERMARK_H
+#define VOIP_PATROL_WATERMARK_H
+
+#include "audio_sink.hh"
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define WATERMARK_HEADER "X-VP-Watermark"
+#define WATERMARK_TONES 17       // 16 symbols and the sync
+#define WATERMARK_SYMBOLS 6      // sync, 4 hexadecimal digits of the id, checksum
+
+/*
+ * In-band signature of a call: its 16 bits id sent as a sequence of tones,
+ * 40ms tone and 40ms gap per symbol, repeated every 2 seconds.
+ * The tones are 700Hz to 3100Hz by 150Hz, on the 50Hz bins of a 20ms block.
+ */
+class WatermarkSender : public AudioSource {
+	public:
+		WatermarkSender(uint16_t id, unsigned clock_rate);
+		void mix(pj_int16_t *samples, unsigned count) override;
+		uint16_t id;
+	private:
+		const std::vector<int16_t> *tones; // one burst per tone, shared by the calls at this rate
+		unsigned symbols[WATERMARK_SYMBOLS];
+		unsigned position {0};
+};
+
+/* ids decoded from the received audio */
+struct WatermarkResult {
+	bool valid {false};
+	int expected {-1};               // the id of the call, -1 unknown
+	std::vector<std::pair<uint16_t, unsigned>> detected; // id and count, the first ones
+	unsigned unconfirmed {0};        // other ids detected once, reported without a mismatch
+	unsigned others {0};             // detections of the ids not in the list, or dropped from it
+	std::string verdict;             // ok, mismatch, missing, detected, none
+	std::string json() const;
+};
+
+/*
+ * Goertzel filters of the tones over blocks of 20ms, a block is a symbol when
+ * one tone holds most of its energy, the symbols between two syncs are an id.
+ */
+class WatermarkDetector : public AudioSink {
+	public:
+		WatermarkDetector(unsigned clock_rate, int expected);
+		void put(const pj_int16_t *samples, unsigned count) override;
+		WatermarkResult result() const;
+	private:
+		void end_block();
+		void symbol(int s);
+		int expected;
+		unsigned block_samples;
+		std::vector<pj_int16_t> block;
+		unsigned block_pos {0};
+		float coefs[WATERMARK_TONES];
+		int last_symbol {-1};
+		int received[WATERMARK_SYMBOLS];
+		int received_count {-1}; // -1 waiting for a sync
+		std::vector<std::pair<uint16_t, unsigned>> detected;
+		unsigned others {0};
+		mutable std::mutex lock; // put() runs in the media clock thread, result() in a SIP thread
+};
+
+#endif
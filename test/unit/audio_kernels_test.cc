@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/audio_kernels.hh"
+#include <algorithm>
+#include <stdlib.h>
+
+static const audio_isa_t isas[] = {AUDIO_ISA_SCALAR, AUDIO_ISA_SSE41, AUDIO_ISA_AVX2};
+
+static void test_g711() {
+	// every 16 bits value, with a tail shorter than a vector
+	std::vector<int16_t> pcm(65536 + 5);
+	for (size_t i = 0; i < pcm.size(); i++)
+		pcm[i] = (int16_t)(i - 32768);
+	std::vector<uint8_t> codes(256 + 7);
+	for (size_t i = 0; i < codes.size(); i++)
+		codes[i] = i & 0xff;
+
+	std::vector<uint8_t> ulaw[3], alaw[3];
+	std::vector<int16_t> ulaw_pcm[3], alaw_pcm[3];
+	for (int k = 0; k < 3; k++) {
+		audio_kernels_set_isa(isas[k]);
+		ulaw[k].resize(pcm.size());
+		alaw[k].resize(pcm.size());
+		ulaw_pcm[k].resize(codes.size());
+		alaw_pcm[k].resize(codes.size());
+		g711_ulaw_encode(&pcm[0], &ulaw[k][0], pcm.size());
+		g711_alaw_encode(&pcm[0], &alaw[k][0], pcm.size());
+		g711_ulaw_decode(&codes[0], &ulaw_pcm[k][0], codes.size());
+		g711_alaw_decode(&codes[0], &alaw_pcm[k][0], codes.size());
+		// limited to the CPU, the same as the scalar one otherwise
+		CHECK(ulaw[k] == ulaw[0] && alaw[k] == alaw[0]);
+		CHECK(ulaw_pcm[k] == ulaw_pcm[0] && alaw_pcm[k] == alaw_pcm[0]);
+	}
+	audio_kernels_set_isa(AUDIO_ISA_AVX2);
+
+	CHECK(ulaw[0][32768] == 0xff);
+	CHECK(alaw[0][32768] == 0xd5);
+	CHECK(ulaw_pcm[0][0xff] == 0 && ulaw_pcm[0][0x7f] == 0);
+	CHECK(ulaw_pcm[0][0x80] == 32124 && ulaw_pcm[0][0x00] == -32124);
+	CHECK(alaw_pcm[0][0xd5] == 8 && alaw_pcm[0][0xaa] == 32256);
+	// a decoded code encodes to itself, the negative zero of u-law excepted
+	for (unsigned c = 0; c < 256; c++) {
+		if (c != 0x7f)
+			CHECK(ulaw[0][ulaw_pcm[0][c] + 32768] == c);
+		CHECK(alaw[0][alaw_pcm[0][c] + 32768] == c);
+	}
+	// monotonic decoding of the encoded values
+	for (size_t i = 1; i < 65536; i++) {
+		CHECK(ulaw_pcm[0][ulaw[0][i]] >= ulaw_pcm[0][ulaw[0][i - 1]]);
+		CHECK(alaw_pcm[0][alaw[0][i]] >= alaw_pcm[0][alaw[0][i - 1]]);
+	}
+}
+
+static void test_resampler() {
+	const unsigned rates[][2] = {{8000, 16000}, {8000, 48000}, {16000, 8000}, {16000, 48000}, {48000, 8000}, {48000, 16000}};
+	for (auto &r : rates) {
+		CHECK(Resampler::supported(r[0], r[1]));
+		// a 440Hz sine of one second in 20ms frames
+		unsigned frame = r[0] / 50;
+		std::vector<int16_t> in(r[0]);
+		for (size_t i = 0; i < in.size(); i++)
+			in[i] = (int16_t)lrint(10000.0 * sin(2.0 * M_PI * 440.0 * i / r[0]));
+		std::vector<int16_t> out[3];
+		for (int k = 0; k < 3; k++) {
+			audio_kernels_set_isa(isas[k]);
+			Resampler resampler(r[0], r[1]);
+			out[k].resize(r[1] + 64);
+			size_t n = 0;
+			for (size_t i = 0; i < in.size(); i += frame)
+				n += resampler.process(&in[i], frame, &out[k][n]);
+			out[k].resize(n);
+			CHECK(out[k] == out[0]);
+		}
+		audio_kernels_set_isa(AUDIO_ISA_AVX2);
+		CHECK(out[0].size() == r[1]);
+		// the sine passes, its amplitude kept once the filter is filled
+		int peak = 0;
+		for (size_t i = out[0].size() / 2; i < out[0].size(); i++)
+			peak = std::max(peak, abs(out[0][i]));
+		CHECK_NEAR(peak, 10000, 500);
+	}
+	CHECK(!Resampler::supported(8000, 11025));
+
+	// a tone above the lowest Nyquist frequency is removed when decimating
+	std::vector<int16_t> in(48000), out(8000 + 64);
+	for (size_t i = 0; i < in.size(); i++)
+		in[i] = (int16_t)lrint(10000.0 * sin(2.0 * M_PI * 6000.0 * i / 48000));
+	Resampler resampler(48000, 8000);
+	size_t n = 0;
+	for (size_t i = 0; i < in.size(); i += 960)
+		n += resampler.process(&in[i], 960, &out[n]);
+	int peak = 0;
+	for (size_t i = n / 2; i < n; i++)
+		peak = std::max(peak, abs(out[i]));
+	CHECK(peak < 500);
+}
+
+static void test_goertzel() {
+	// the power of the frequency of a tone is far above the others
+	std::vector<int16_t> tone(160);
+	for (size_t i = 0; i < tone.size(); i++)
+		tone[i] = (int16_t)lrint(8000.0 * sin(2.0 * M_PI * 1000.0 * i / 8000));
+	float coefs[9], power[3][9];
+	for (int f = 0; f < 9; f++)
+		coefs[f] = 2.0 * cos(2.0 * M_PI * (600 + 100 * f) / 8000);
+	for (int k = 0; k < 3; k++) {
+		audio_kernels_set_isa(isas[k]);
+		goertzel_power(&tone[0], tone.size(), coefs, 9, power[k]);
+		for (int f = 0; f < 9; f++)
+			CHECK_NEAR(power[k][f], power[0][f], power[0][f] * 1e-4 + 1.0);
+	}
+	audio_kernels_set_isa(AUDIO_ISA_AVX2);
+	for (int f = 0; f < 9; f++) {
+		if (f != 4)
+			CHECK(power[0][4] > 100 * power[0][f]);
+	}
+
+	std::vector<float> a(1000), b(1000);
+	double expected = 0.0;
+	for (size_t i = 0; i < a.size(); i++) {
+		a[i] = sin(i * 0.1);
+		b[i] = cos(i * 0.07);
+		expected += (double)a[i] * b[i];
+	}
+	CHECK_NEAR(audio_dot(&a[0], &b[0], a.size()), expected, 1e-2);
+}
+
+int main() {
+	test_g711();
+	test_resampler();
+	test_goertzel();
+	return unit_result();
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/flac_encoder.hh"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Decoder of the subset of FLAC written by the encoder: STREAMINFO, 16 bits,
+ * independent channels, constant, verbatim and fixed subframes, Rice residuals.
+ */
+class FlacReader {
+	public:
+		FlacReader(const std::vector<uint8_t> &data) : data(data) {}
+		bool decode(std::vector<int16_t> &samples);
+		unsigned rate {0};
+		unsigned channels {0};
+		uint64_t total {0};
+	private:
+		uint32_t get(unsigned n) {
+			uint32_t v = 0;
+			while (n--) {
+				if (pos >> 3 >= data.size()) {
+					error = true;
+					return 0;
+				}
+				v = (v << 1) | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+				pos++;
+			}
+			return v;
+		}
+		int32_t get_signed(unsigned n) {
+			uint32_t v = get(n);
+			return v >> (n - 1) ? (int32_t)v - (1 << n) : (int32_t)v;
+		}
+		bool subframe(unsigned n, std::vector<int32_t> &x);
+		const std::vector<uint8_t> &data;
+		size_t pos {0};
+		bool error {false};
+};
+
+static uint8_t crc8(const uint8_t *p, size_t n) {
+	uint8_t crc = 0;
+	while (n--) {
+		crc ^= *p++;
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static uint16_t crc16(const uint8_t *p, size_t n) {
+	uint16_t crc = 0;
+	while (n--) {
+		crc ^= *p++ << 8;
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+	}
+	return crc;
+}
+
+bool FlacReader::subframe(unsigned n, std::vector<int32_t> &x) {
+	get(1);
+	unsigned type = get(6);
+	if (get(1))
+		return false; // wasted bits
+	x.clear();
+	if (type == 0) {
+		x.assign(n, get_signed(16));
+		return true;
+	}
+	if (type == 1) {
+		for (unsigned i = 0; i < n; i++)
+			x.push_back(get_signed(16));
+		return true;
+	}
+	if (type < 8 || type > 12)
+		return false;
+	unsigned order = type - 8;
+	for (unsigned i = 0; i < order; i++)
+		x.push_back(get_signed(16));
+	if (get(2) != 0)
+		return false;
+	unsigned partition_order = get(4);
+	for (unsigned k = 0; k < 1u << partition_order; k++) {
+		unsigned r = get(4);
+		unsigned count = (n >> partition_order) - (k ? 0 : order);
+		for (unsigned j = 0; j < count && !error; j++) {
+			uint32_t q = 0;
+			while (!get(1) && !error)
+				q++;
+			uint32_t u = (q << r) | get(r);
+			int32_t residual = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+			size_t i = x.size();
+			int32_t p = 0;
+			switch (order) {
+				case 1: p = x[i - 1]; break;
+				case 2: p = 2 * x[i - 1] - x[i - 2]; break;
+				case 3: p = 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3]; break;
+				case 4: p = 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4]; break;
+			}
+			x.push_back(p + residual);
+		}
+	}
+	return !error;
+}
+
+bool FlacReader::decode(std::vector<int16_t> &samples) {
+	if (data.size() < 42 || memcmp(&data[0], "fLaC", 4))
+		return false;
+	pos = 8 * 8 + 16 + 16 + 24 + 24; // STREAMINFO header, block and frame sizes
+	rate = get(20);
+	channels = get(3) + 1;
+	if (get(5) != 15)
+		return false;
+	total = (uint64_t)get(4) << 32;
+	total |= get(32);
+	pos = 42 * 8;
+	uint32_t frame = 0;
+	std::vector<std::vector<int32_t>> x(channels);
+	while (pos >> 3 < data.size()) {
+		size_t start = pos >> 3;
+		if (get(14) != 0x3ffe)
+			return false;
+		get(2);
+		unsigned size_code = get(4);
+		get(4);
+		if (get(4) != channels - 1 || get(3) != 4)
+			return false;
+		get(1);
+		uint32_t number = get(8);
+		unsigned extra = 0;
+		while (extra < 7 && (number & (0x80 >> extra)))
+			extra++;
+		if (extra)
+			number &= 0xff >> (extra + 1);
+		for (unsigned i = 1; i < extra; i++)
+			number = (number << 6) | (get(8) & 0x3f);
+		if (number != frame++)
+			return false;
+		unsigned n = size_code == 12 ? FLAC_BLOCK_SIZE : size_code == 7 ? get(16) + 1 : 0;
+		if (!n || crc8(&data[start], (pos >> 3) - start) != get(8))
+			return false;
+		for (unsigned c = 0; c < channels; c++) {
+			if (!subframe(n, x[c]))
+				return false;
+		}
+		pos = (pos + 7) & ~(size_t)7;
+		size_t end = pos >> 3;
+		if (get(16) != crc16(&data[start], end - start))
+			return false;
+		for (unsigned i = 0; i < n; i++) {
+			for (unsigned c = 0; c < channels; c++)
+				samples.push_back(x[c][i]);
+		}
+	}
+	return !error && samples.size() == total * channels;
+}
+
+static std::vector<uint8_t> encode(const std::vector<int16_t> &samples, unsigned rate, unsigned channels) {
+	FlacEncoder encoder(rate, channels);
+	std::vector<uint8_t> out;
+	encoder.header(out);
+	size_t frames = samples.size() / channels;
+	for (size_t i = 0; i < frames; i += FLAC_BLOCK_SIZE) {
+		unsigned count = frames - i < FLAC_BLOCK_SIZE ? frames - i : FLAC_BLOCK_SIZE;
+		encoder.encode(&samples[i * channels], count, out);
+	}
+	// the header with the total, as the recording writer does on close
+	std::vector<uint8_t> header;
+	encoder.header(header);
+	std::copy(header.begin(), header.end(), out.begin());
+	return out;
+}
+
+int main(int argc, char **argv) {
+	std::vector<int16_t> speech = unit_read_wav(argc > 1 ? argv[1] : "voice_ref_files/reference_8000_12s.wav");
+	CHECK(speech.size() > 8000);
+
+	// speech, mono: lossless and about a third of the PCM size
+	{
+		std::vector<uint8_t> flac = encode(speech, 8000, 1);
+		FlacReader reader(flac);
+		std::vector<int16_t> decoded;
+		CHECK(reader.decode(decoded));
+		CHECK(reader.rate == 8000 && reader.channels == 1 && reader.total == speech.size());
+		CHECK(decoded == speech);
+		CHECK(flac.size() < speech.size() * 2 * 0.4);
+	}
+
+	// stereo with noise (verbatim), silence (constant), full scale and a last short block
+	{
+		std::vector<int16_t> samples;
+		srand(1);
+		for (unsigned i = 0; i < 3 * FLAC_BLOCK_SIZE + 777; i++) {
+			int16_t left = i < FLAC_BLOCK_SIZE ? (int16_t)(rand() % 65536 - 32768) : i < 2 * FLAC_BLOCK_SIZE ? 0 : (i & 1) ? 32767 : -32768;
+			int16_t right = speech.empty() ? 0 : speech[i % speech.size()];
+			samples.push_back(left);
+			samples.push_back(right);
+		}
+		std::vector<uint8_t> flac = encode(samples, 16000, 2);
+		FlacReader reader(flac);
+		std::vector<int16_t> decoded;
+		CHECK(reader.decode(decoded));
+		CHECK(reader.rate == 16000 && reader.channels == 2);
+		CHECK(decoded == samples);
+	}
+
+	// more than 127 frames, the frame numbers take two bytes
+	{
+		std::vector<int16_t> samples(200 * FLAC_BLOCK_SIZE);
+		for (size_t i = 0; i < samples.size(); i++)
+			samples[i] = speech.empty() ? 0 : speech[i % speech.size()];
+		std::vector<uint8_t> flac = encode(samples, 8000, 1);
+		FlacReader reader(flac);
+		std::vector<int16_t> decoded;
+		CHECK(reader.decode(decoded));
+		CHECK(decoded == samples);
+	}
+	return unit_result();
+}
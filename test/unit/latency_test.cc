@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/latency.hh"
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+
+/*
+ * A call and an accept reflecting its markers, each direction a delay line of
+ * frames, paced by the clock: the probes time the markers with it.
+ */
+static void simulate(LatencyProbe &call, LatencyProbe &accept, unsigned rate, const std::vector<int16_t> &speech,
+                     unsigned forward_frames, unsigned backward_frames, unsigned frames) {
+	unsigned count = rate / 50;
+	std::deque<std::vector<int16_t>> forward(forward_frames, std::vector<int16_t>(count, 0));
+	std::deque<std::vector<int16_t>> backward(backward_frames, std::vector<int16_t>(count, 0));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned f = 0; f < frames; f++) {
+		std::this_thread::sleep_until(start + std::chrono::milliseconds(20 * f));
+		std::vector<int16_t> a(count), b(count);
+		for (unsigned i = 0; i < count && !speech.empty(); i++) {
+			size_t at = (size_t)f * 160 + i * 8000 / rate;
+			a[i] = speech[at % speech.size()] / 2;
+			b[i] = speech[(at + speech.size() / 2) % speech.size()] / 2;
+		}
+		call.source().mix(&a[0], count);
+		accept.source().mix(&b[0], count);
+		forward.push_back(a);
+		backward.push_back(b);
+		call.put(&backward.front()[0], count);
+		accept.put(&forward.front()[0], count);
+		forward.pop_front();
+		backward.pop_front();
+	}
+}
+
+static double avg(const std::string &json, const std::string &name) {
+	size_t at = json.find("\"" + name + "\": {");
+	if (at == std::string::npos)
+		return -1.0;
+	at = json.find("\"avg\": ", at);
+	return atof(json.c_str() + at + 7);
+}
+
+int main(int argc, char **argv) {
+	std::vector<int16_t> speech = unit_read_wav(argc > 1 ? argv[1] : "voice_ref_files/reference_8000_12s.wav");
+	CHECK(!speech.empty());
+
+	// both legs in this process: 100ms forward, 160ms backward, the round trip without the turnaround
+	{
+		LatencyRegistry registry;
+		std::string key = registry.new_key();
+		LatencyProbe call(8000, 8000, false, registry.create(key));
+		LatencyProbe accept(8000, 8000, true, registry.find(key));
+		simulate(call, accept, 8000, speech, 5, 8, 200);
+		LatencyResult c = call.result(), a = accept.result();
+		CHECK(c.markers == 2 && c.detected == 2);
+		CHECK(a.markers == 2 && a.detected == 2);
+		CHECK_NEAR(avg(c.json(), "rtt_ms"), 260, 5);
+		CHECK_NEAR(avg(c.json(), "backward_ms"), 160, 5);
+		CHECK_NEAR(avg(a.json(), "forward_ms"), 100, 5);
+		CHECK_NEAR(avg(a.json(), "turnaround_ms"), LATENCY_REFLECT_MS, 1);
+		registry.remove(key);
+		CHECK(!registry.find(key));
+	}
+
+	// a reflecting peer announcing its turnaround, at 16kHz: the resampling adds about 1ms each way
+	{
+		LatencyProbe call(16000, 16000, false, nullptr);
+		LatencyProbe accept(16000, 16000, true, nullptr);
+		call.peer_turnaround(LATENCY_REFLECT_MS);
+		simulate(call, accept, 16000, speech, 3, 3, 200);
+		LatencyResult c = call.result();
+		CHECK(c.detected == 2);
+		CHECK_NEAR(avg(c.json(), "rtt_ms"), 122, 5);
+		CHECK(avg(c.json(), "backward_ms") < 0);
+	}
+
+	// nothing comes back
+	{
+		LatencyProbe call(8000, 8000, false, nullptr);
+		std::vector<int16_t> frame(160);
+		for (int f = 0; f < 100; f++) {
+			std::fill(frame.begin(), frame.end(), 0);
+			call.source().mix(&frame[0], 160);
+			std::fill(frame.begin(), frame.end(), 0);
+			call.put(&frame[0], 160);
+		}
+		CHECK(call.result().json() == "{\"mode\": \"send\", \"markers\": 1, \"detected\": 0}");
+	}
+	return unit_result();
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/rate_controller.hh"
+#include <chrono>
+#include <string>
+
+int main() {
+	// additive increase: "increase" calls per second every second, one answer at a time
+	{
+		RateController controller(10.0, 1.0, 20.0, 2.0, 0.5);
+		controller.success();
+		CHECK_NEAR(controller.rate(), 10.2, 1e-5);
+		// a second of answers at about 10 cps
+		for (int i = 1; i < 10; i++)
+			controller.success();
+		CHECK_NEAR(controller.rate(), 12.0, 0.2);
+		for (int i = 0; i < 1000; i++)
+			controller.success();
+		CHECK_NEAR(controller.rate(), 20.0, 1e-6);
+	}
+
+	// multiplicative decrease, once per second whatever the overloads in flight
+	{
+		RateController controller(10.0, 2.0, 20.0, 1.0, 0.5);
+		RateController::clock::time_point t = RateController::clock::now();
+		controller.overload(0, t);
+		CHECK_NEAR(controller.rate(), 5.0, 1e-6);
+		controller.overload(0, t + std::chrono::milliseconds(10));
+		controller.overload(0, t + std::chrono::milliseconds(999));
+		CHECK_NEAR(controller.rate(), 5.0, 1e-6);
+		CHECK(controller.pause_ms(t) == 0);
+		controller.overload(0, t + std::chrono::milliseconds(1000));
+		CHECK_NEAR(controller.rate(), 2.5, 1e-6);
+		// not below the minimum
+		controller.overload(0, t + std::chrono::milliseconds(2000));
+		CHECK_NEAR(controller.rate(), 2.0, 1e-6);
+		CHECK(controller.json() == "{\"rate\": 2.00, \"lowest\": 2.00, \"overloads\": 5, \"decreases\": 3, \"pauses\": 0, \"successes\": 0}");
+	}
+
+	// a Retry-After pauses the calls, at most 60 seconds
+	{
+		RateController controller(10.0, 1.0, 20.0, 1.0, 0.5);
+		RateController::clock::time_point t = RateController::clock::now();
+		controller.overload(3, t);
+		CHECK(controller.pause_ms(t) == 3000);
+		CHECK(controller.pause_ms(t + std::chrono::milliseconds(2500)) == 500);
+		CHECK(controller.pause_ms(t + std::chrono::milliseconds(3000)) == 0);
+		controller.overload(3600, t);
+		CHECK(controller.pause_ms(t) == 60000);
+		CHECK(controller.json().find("\"pauses\": 2") != std::string::npos);
+	}
+	return unit_result();
+}
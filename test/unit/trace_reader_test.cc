@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/trace_reader.hh"
+#include <string>
+#include <unistd.h>
+
+static std::string write_trace(const char *content) {
+	char name[] = "/tmp/vp_trace_XXXXXX";
+	int fd = mkstemp(name);
+	if (fd < 0)
+		return "";
+	FILE *file = fdopen(fd, "w");
+	fputs(content, file);
+	fclose(file);
+	return name;
+}
+
+int main() {
+	std::string file = write_trace(
+		"offset,duration,caller,callee\n"
+		"# comment\n"
+		"\n"
+		"0.5, 30 ,\"alice@example.com\",bob@example.com\r\n"
+		"1.25,0,carol,dave,with,commas\n"
+		"two,10,a,b\n"
+		"3,10,a\n"
+		"4,10.5,e,f");
+	CHECK(!file.empty());
+
+	TraceReader reader(file);
+	CHECK(reader.open());
+	TraceRecord record;
+	CHECK(reader.next(record));
+	CHECK(record.offset == 0.5 && record.duration == 30);
+	CHECK(record.caller == "alice@example.com" && record.callee == "bob@example.com");
+	// the callee is the rest of the line
+	CHECK(reader.next(record));
+	CHECK(record.offset == 1.25 && record.duration == 0);
+	CHECK(record.caller == "carol" && record.callee == "dave,with,commas");
+	// a record without a number or with missing fields is counted and skipped, the last line has no end of line
+	CHECK(reader.next(record));
+	CHECK(record.offset == 4 && record.duration == 10.5 && record.caller == "e" && record.callee == "f");
+	CHECK(!reader.next(record));
+	CHECK(reader.invalid == 2);
+	unlink(file.c_str());
+
+	// only the line before the first record can be the column names
+	file = write_trace("1,2,a,b\ncaller,callee,a,b\n");
+	TraceReader names(file);
+	CHECK(names.open());
+	CHECK(names.next(record));
+	CHECK(!names.next(record));
+	CHECK(names.invalid == 1);
+	unlink(file.c_str());
+
+	TraceReader missing("/nonexistent/trace.csv");
+	CHECK(!missing.open());
+	CHECK(!missing.next(record));
+	return unit_result();
+}
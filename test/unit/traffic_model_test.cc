@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/traffic_model.hh"
+#include <algorithm>
+#include <string>
+#include <thread>
+
+static double mean_of(TrafficRandom &random, const Distribution &dist, int n, double *low, double *high) {
+	double sum = 0.0;
+	*low = 1e300;
+	*high = -1e300;
+	for (int i = 0; i < n; i++) {
+		double v = random.sample(dist);
+		sum += v;
+		*low = std::min(*low, v);
+		*high = std::max(*high, v);
+	}
+	return sum / n;
+}
+
+static void test_parameters() {
+	distribution_t type;
+	CHECK(parse_distribution("lognormal", &type) && type == DIST_LOGNORMAL);
+	CHECK(parse_distribution("uniform", &type) && type == DIST_UNIFORM);
+	CHECK(!parse_distribution("normal", &type));
+	CHECK(get_distribution_from_string("normal") == DIST_FIXED);
+	CHECK(get_distribution_string(DIST_EXPONENTIAL) == "exponential");
+
+	Distribution dist;
+	CHECK(check_distribution("hold", "fixed", dist).empty());
+	CHECK(check_distribution("hold", "gaussian", dist) == "hold=\"gaussian\" unknown, expected fixed, exponential, lognormal or uniform");
+	CHECK(check_distribution("hold", "exponential", dist) == "hold=\"exponential\" needs hold_mean > 0");
+	CHECK(!check_distribution("hold", "lognormal", dist).empty());
+	dist.mean = 120;
+	CHECK(check_distribution("hold", "lognormal", dist).empty());
+	dist.min = 10;
+	dist.max = 10;
+	CHECK(check_distribution("hold", "uniform", dist) == "hold=\"uniform\" needs hold_min < hold_max");
+	dist.max = 20;
+	CHECK(check_distribution("hold", "uniform", dist).empty());
+}
+
+static void test_samples() {
+	TrafficRandom random;
+	random.seed(42);
+	double low, high;
+	Distribution dist;
+	dist.type = DIST_FIXED;
+	dist.mean = 30;
+	CHECK(mean_of(random, dist, 10, &low, &high) == 30 && low == 30 && high == 30);
+
+	dist.type = DIST_EXPONENTIAL;
+	dist.mean = 120;
+	CHECK_NEAR(mean_of(random, dist, 100000, &low, &high), 120, 2);
+	CHECK(low >= 0);
+
+	// the mean of the samples, not of the logarithm
+	dist.type = DIST_LOGNORMAL;
+	dist.sigma = 0.5;
+	CHECK_NEAR(mean_of(random, dist, 100000, &low, &high), 120, 2);
+	CHECK(low > 0);
+
+	dist.type = DIST_UNIFORM;
+	dist.min = 5;
+	dist.max = 10;
+	CHECK_NEAR(mean_of(random, dist, 100000, &low, &high), 7.5, 0.05);
+	CHECK(low >= 5 && high < 10);
+
+	// Poisson arrivals at 10 cps, fixed ones otherwise
+	double sum = 0.0;
+	for (int i = 0; i < 100000; i++)
+		sum += random.interval(10, true);
+	CHECK_NEAR(sum / 100000, 0.1, 0.002);
+	CHECK(random.interval(10, false) == 0.1);
+	CHECK(random.interval(0, true) == 0.0);
+}
+
+static void test_seeds() {
+	// the same seed replays the same draws
+	Distribution dist;
+	dist.type = DIST_EXPONENTIAL;
+	dist.mean = 60;
+	TrafficRandom a, b;
+	a.seed(1234);
+	b.seed(1234);
+	bool same = true;
+	for (int i = 0; i < 100; i++)
+		same = same && a.sample(dist) == b.sample(dist);
+	CHECK(same);
+	CHECK(a.get_seed() == 1234);
+
+	// the streams get seeds of their own, the same for the same index
+	CHECK(TrafficRandom::derive(1234, 0) == TrafficRandom::derive(1234, 0));
+	CHECK(TrafficRandom::derive(1234, 0) != TrafficRandom::derive(1234, 1));
+	CHECK(TrafficRandom::derive(1234, 0) != TrafficRandom::derive(1235, 0));
+
+	// a thread draws from the generator it uses, the others from the shared one
+	TrafficRandom shared, stream;
+	CHECK(&TrafficRandom::current(shared) == &shared);
+	TrafficRandom *seen = nullptr;
+	std::thread thread([&]() {
+		TrafficRandom::use(&stream);
+		seen = &TrafficRandom::current(shared);
+		TrafficRandom::use(nullptr);
+	});
+	thread.join();
+	CHECK(seen == &stream);
+	CHECK(&TrafficRandom::current(shared) == &shared);
+}
+
+static void test_summary() {
+	TrafficSummary summary;
+	CHECK(summary.empty());
+	for (int i = 1; i <= 100; i++)
+		summary.add("calls/hold", "uniform", i);
+	std::string json = summary.json(7);
+	CHECK(json.find("{\"seed\": 7, \"distributions\": [{\"name\": \"calls/hold\", \"model\": \"uniform\", \"count\": 100, \"mean\": 50.500") == 0);
+	CHECK(json.find("\"min\": 1.000, \"p50\": 51.000, \"p95\": 96.000, \"p99\": 100.000, \"max\": 100.000") != std::string::npos);
+	summary.clear();
+	CHECK(summary.empty());
+}
+
+int main() {
+	test_parameters();
+	test_samples();
+	test_seeds();
+	test_summary();
+	return unit_result();
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#ifndef VOIP_PATROL_UNIT_H
+#define VOIP_PATROL_UNIT_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/* checks of the unit tests, a test returns unit_result() from main */
+static int unit_failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+		unit_failures++; \
+	} \
+} while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) do { \
+	double v_ = (value), e_ = (expected); \
+	if (fabs(v_ - e_) > (tolerance)) { \
+		fprintf(stderr, "%s:%d: failed: %s = %f, expected %f\n", __FILE__, __LINE__, #value, v_, e_); \
+		unit_failures++; \
+	} \
+} while (0)
+
+static inline int unit_result() {
+	if (unit_failures)
+		fprintf(stderr, "%d check(s) failed\n", unit_failures);
+	return unit_failures ? 1 : 0;
+}
+
+// the samples of a 16 bits mono wav file with a 44 bytes header, empty when it can not be read
+static inline std::vector<int16_t> unit_read_wav(const char *file_name) {
+	std::vector<int16_t> samples;
+	FILE *file = fopen(file_name, "rb");
+	if (!file) {
+		fprintf(stderr, "can not open %s\n", file_name);
+		return samples;
+	}
+	int16_t buf[4096];
+	size_t n;
+	fseek(file, 44, SEEK_SET);
+	while ((n = fread(buf, 2, 4096, file)) > 0)
+		samples.insert(samples.end(), buf, buf + n);
+	fclose(file);
+	return samples;
+}
+
+#endif
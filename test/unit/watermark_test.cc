@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016-2024 Julien Chavanton <jchavanton@gmail.com>, Ihor Olkhovskyi <ihor@provoip.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA~
+ */
+
+#include "unit.hh"
+#include "voip_patrol/watermark.hh"
+#include "voip_patrol/audio_kernels.hh"
+#include <string>
+
+// the audio of a call tagged with an id, in 20ms frames as the media clock mixes it
+static std::vector<int16_t> tagged(const std::vector<int16_t> &audio, uint16_t id, unsigned rate) {
+	std::vector<int16_t> a = audio;
+	WatermarkSender sender(id, rate);
+	unsigned frame = rate / 50;
+	for (size_t i = 0; i + frame <= a.size(); i += frame)
+		sender.mix(&a[i], frame);
+	return a;
+}
+
+static WatermarkResult detect(const std::vector<int16_t> &audio, int expected, unsigned rate) {
+	WatermarkDetector detector(rate, expected);
+	unsigned frame = rate / 50;
+	for (size_t i = 0; i + frame <= audio.size(); i += frame)
+		detector.put(&audio[i], frame);
+	return detector.result();
+}
+
+static unsigned count_of(const WatermarkResult &r, uint16_t id) {
+	for (auto &d : r.detected) {
+		if (d.first == id)
+			return d.second;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	std::vector<int16_t> speech = unit_read_wav(argc > 1 ? argv[1] : "voice_ref_files/reference_8000_12s.wav");
+	CHECK(speech.size() >= 8000 * 10);
+	speech.resize(8000 * 10);
+
+	// the id sent under speech, a sequence every 2 seconds
+	WatermarkResult r = detect(tagged(speech, 0x1234, 8000), 0x1234, 8000);
+	CHECK(r.verdict == "ok");
+	CHECK(count_of(r, 0x1234) >= 4);
+	CHECK(r.unconfirmed == 0 && r.others == 0);
+
+	// through G.711
+	std::vector<int16_t> audio = tagged(speech, 0xbeef, 8000);
+	std::vector<uint8_t> ulaw(audio.size());
+	g711_ulaw_encode(&audio[0], &ulaw[0], audio.size());
+	g711_ulaw_decode(&ulaw[0], &audio[0], audio.size());
+	r = detect(audio, 0xbeef, 8000);
+	CHECK(r.verdict == "ok" && count_of(r, 0xbeef) >= 4);
+
+	// the audio of another call from the middle: crossed media
+	audio = tagged(speech, 0x1234, 8000);
+	std::vector<int16_t> other = tagged(speech, 0x4321, 8000);
+	std::copy(other.begin() + other.size() / 2, other.end(), audio.begin() + audio.size() / 2);
+	r = detect(audio, 0x1234, 8000);
+	CHECK(r.verdict == "mismatch");
+	CHECK(count_of(r, 0x4321) >= 2);
+
+	// a single sequence of another id is not enough for a mismatch
+	audio = tagged(speech, 0x1234, 8000);
+	std::copy(other.begin() + 8000 * 6, other.begin() + 8000 * 6 + 4800, audio.begin() + 8000 * 6);
+	r = detect(audio, 0x1234, 8000);
+	CHECK(r.verdict == "ok");
+	CHECK(count_of(r, 0x4321) == 1 && r.unconfirmed == 1);
+
+	// four ids received once fill the list before another id received again
+	std::vector<int16_t> longer;
+	while (longer.size() < 8000 * 20)
+		longer.insert(longer.end(), speech.begin(), speech.end());
+	longer.resize(8000 * 20);
+	const uint16_t ids[10] = {0x1234, 0x1111, 0x2222, 0x3333, 0x4444, 0x4321, 0x4321, 0x4321, 0x1234, 0x1234};
+	audio = longer;
+	for (int k = 0; k < 10; k++) {
+		// the sequence sent every 2 seconds, from the call of this id
+		std::vector<int16_t> call = tagged(longer, ids[k], 8000);
+		std::copy(call.begin() + 16000 * k, call.begin() + 16000 * k + 4800, audio.begin() + 16000 * k);
+	}
+	r = detect(audio, 0x1234, 8000);
+	CHECK(r.verdict == "mismatch");
+	CHECK(count_of(r, 0x1234) == 3 && count_of(r, 0x4321) == 3);
+	CHECK(r.detected.size() == 4 && r.unconfirmed == 2 && r.others == 2);
+
+	// no id in the audio of a call expecting one, or of a call without one
+	r = detect(speech, 0x1234, 8000);
+	CHECK(r.verdict == "missing" && r.detected.empty());
+	r = detect(speech, -1, 8000);
+	CHECK(r.verdict == "none");
+	r = detect(tagged(speech, 7, 8000), -1, 8000);
+	CHECK(r.verdict == "detected" && count_of(r, 7) >= 4);
+	CHECK(r.json().find("{\"verdict\": \"detected\", \"expected\": -1, \"detected\": [{\"id\": 7, \"count\": ") == 0);
+
+	// at 48kHz, on silence
+	std::vector<int16_t> silence(48000 * 6, 0);
+	r = detect(tagged(silence, 42, 48000), 42, 48000);
+	CHECK(r.verdict == "ok" && count_of(r, 42) >= 2);
+	return unit_result();
+}